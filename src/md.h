@@ -26,6 +26,7 @@ struct apr_array_header_t;
 struct apr_hash_t;
 struct md_json_t;
 struct md_cert_t;
+struct md_cert_info_t;
 struct md_job_t;
 struct md_pkey_t;
 struct md_result_t;
@@ -113,28 +114,36 @@ struct md_t {
 };
 
 #define MD_KEY_ACCOUNT          "account"
+#define MD_KEY_ACCOUNTS         "accounts"
 #define MD_KEY_ACME_TLS_1       "acme-tls/1"
 #define MD_KEY_ACTIVATION_DELAY "activation-delay"
 #define MD_KEY_ACTIVITY         "activity"
 #define MD_KEY_AGREEMENT        "agreement"
+#define MD_KEY_ARI_CERT_ID      "ari-cert-id"
 #define MD_KEY_AUTHORIZATIONS   "authorizations"
 #define MD_KEY_BITS             "bits"
+#define MD_KEY_BODY             "body"
 #define MD_KEY_CA               "ca"
 #define MD_KEY_CA_URL           "ca-url"
 #define MD_KEY_CERT             "cert"
 #define MD_KEY_CERT_FILES       "cert-files"
+#define MD_KEY_CERTID           "certid"
 #define MD_KEY_CERTIFICATE      "certificate"
+#define MD_KEY_CERTS            "certs"
 #define MD_KEY_CHALLENGE        "challenge"
 #define MD_KEY_CHALLENGES       "challenges"
 #define MD_KEY_CMD_DNS01        "cmd-dns-01"
 #define MD_KEY_DNS01_VERSION    "cmd-dns-01-version"
 #define MD_KEY_COMPLETE         "complete"
+#define MD_KEY_CONNECT          "connect"
 #define MD_KEY_CONTACT          "contact"
 #define MD_KEY_CONTACTS         "contacts"
 #define MD_KEY_CSR              "csr"
 #define MD_KEY_CURVE            "curve"
+#define MD_KEY_DEPTH            "depth"
 #define MD_KEY_DETAIL           "detail"
 #define MD_KEY_DISABLED         "disabled"
+#define MD_KEY_DNS              "dns"
 #define MD_KEY_DIR              "dir"
 #define MD_KEY_DOMAIN           "domain"
 #define MD_KEY_DOMAINS          "domains"
@@ -144,28 +153,42 @@ struct md_t {
 #define MD_KEY_ERRORED          "errored"
 #define MD_KEY_ERROR            "error"
 #define MD_KEY_ERRORS           "errors"
+#define MD_KEY_ETAG             "etag"
 #define MD_KEY_EXPIRES          "expires"
+#define MD_KEY_EXPLANATION      "explanation"
 #define MD_KEY_FINALIZE         "finalize"
 #define MD_KEY_FINISHED         "finished"
+#define MD_KEY_FIRST_BYTE       "first-byte"
 #define MD_KEY_FROM             "from"
 #define MD_KEY_GOOD             "good"
+#define MD_KEY_HEADERS          "headers"
 #define MD_KEY_HMAC             "hmac"
+#define MD_KEY_HOLD_UNTIL       "hold-until"
 #define MD_KEY_HTTP             "http"
 #define MD_KEY_HTTPS            "https"
+#define MD_KEY_HTTP_TIMINGS     "http-timings"
 #define MD_KEY_ID               "id"
 #define MD_KEY_IDENTIFIER       "identifier"
+#define MD_KEY_ISSUERS          "issuers"
 #define MD_KEY_KEY              "key"
+#define MD_KEY_KEY_POOL         "key-pool"
+#define MD_KEY_KEYS             "keys"
 #define MD_KEY_KID              "kid"
 #define MD_KEY_KEYAUTHZ         "keyAuthorization"
 #define MD_KEY_LAST             "last"
+#define MD_KEY_LAST_DURATION    "last-duration"
+#define MD_KEY_LAST_MODIFIED    "last-modified"
 #define MD_KEY_LAST_RUN         "last-run"
 #define MD_KEY_LOCATION         "location"
 #define MD_KEY_LOG              "log"
+#define MD_KEY_MAX              "max"
 #define MD_KEY_MDS              "managed-domains"
+#define MD_KEY_METHOD           "method"
 #define MD_KEY_MESSAGE          "message"
 #define MD_KEY_MUST_STAPLE      "must-staple"
 #define MD_KEY_NAME             "name"
 #define MD_KEY_NEXT_RUN         "next-run"
+#define MD_KEY_NEXT_UPDATE      "next-update"
 #define MD_KEY_NOTIFIED         "notified"
 #define MD_KEY_NOTIFIED_RENEWED "notified-renewed"
 #define MD_KEY_OCSP             "ocsp"
@@ -184,12 +207,14 @@ struct md_t {
 #define MD_KEY_RENEWAL          "renewal"
 #define MD_KEY_RENEWING         "renewing"
 #define MD_KEY_RENEW_WINDOW     "renew-window"
+#define MD_KEY_REQUESTS         "requests"
 #define MD_KEY_REQUIRE_HTTPS    "require-https"
 #define MD_KEY_RESOURCE         "resource"
 #define MD_KEY_RESPONSE         "response"
 #define MD_KEY_REVOKED          "revoked"
 #define MD_KEY_SERIAL           "serial"
 #define MD_KEY_SHA256_FINGERPRINT  "sha256-fingerprint"
+#define MD_KEY_STAMP            "stamp"
 #define MD_KEY_STAPLING         "stapling"
 #define MD_KEY_STATE            "state"
 #define MD_KEY_STATE_DESCR      "state-descr"
@@ -197,23 +222,29 @@ struct md_t {
 #define MD_KEY_STORE            "store"
 #define MD_KEY_SUBPROBLEMS      "subproblems"
 #define MD_KEY_TEMPORARY        "temporary"
+#define MD_KEY_TLS              "tls"
 #define MD_KEY_TOS              "termsOfService"
 #define MD_KEY_TOKEN            "token"
+#define MD_KEY_TOKENS           "tokens"
 #define MD_KEY_TOTAL            "total"
 #define MD_KEY_TRANSITIVE       "transitive"
 #define MD_KEY_TYPE             "type"
 #define MD_KEY_UNKNOWN          "unknown"
 #define MD_KEY_UNTIL            "until"
+#define MD_KEY_UP               "up"
+#define MD_KEY_UPDATED          "updated"
 #define MD_KEY_URL              "url"
 #define MD_KEY_URLS             "urls"
 #define MD_KEY_URI              "uri"
 #define MD_KEY_VALID            "valid"
 #define MD_KEY_VALID_FROM       "valid-from"
 #define MD_KEY_VALUE            "value"
+#define MD_KEY_VERIFIED         "verified"
 #define MD_KEY_VERSION          "version"
 #define MD_KEY_WATCHED          "watched"
 #define MD_KEY_WHEN             "when"
 #define MD_KEY_WARN_WINDOW      "warn-window"
+#define MD_KEY_WINDOW           "window"
 
 /* Check if a string member of a new MD (n) has 
  * a value and if it differs from the old MD o
@@ -267,6 +298,66 @@ md_t *md_get_by_domain(struct apr_array_header_t *mds, const char *domain);
  */
 md_t *md_get_by_dns_overlap(struct apr_array_header_t *mds, const md_t *md);
 
+/**
+ * An index over the DNS names of a list of managed domains, answering the
+ * same questions as md_get_by_domain() and md_get_by_dns_overlap() without
+ * looking at every managed domain. Names are matched case-insensitively,
+ * exact ones through a hash and wildcards through a hash of the names they
+ * apply to. When several managed domains match, the one added first is found,
+ * as in the list versions.
+ * The index needs to be rebuilt when the names of a managed domain change.
+ */
+typedef struct md_domain_idx_t md_domain_idx_t;
+
+md_domain_idx_t *md_domain_idx_create(apr_pool_t *p);
+
+/**
+ * Create an index for all md_t* in the array, in array order.
+ */
+md_domain_idx_t *md_domain_idx_make(apr_pool_t *p, struct apr_array_header_t *mds);
+
+/**
+ * Add the names of a managed domain to the index.
+ */
+void md_domain_idx_add(md_domain_idx_t *idx, md_t *md);
+
+/**
+ * Look up a managed domain by a DNS name it contains.
+ */
+md_t *md_domain_idx_get(const md_domain_idx_t *idx, const char *domain);
+
+/**
+ * Find a managed domain, different from the given one, that has overlaps
+ * in the domain list.
+ */
+md_t *md_domain_idx_get_overlap(const md_domain_idx_t *idx, const md_t *md);
+
+/**
+ * Callback for md_domain_idx_do(), pos is the number of managed domains
+ * added to the index before md. Return 0 to stop.
+ */
+typedef int md_domain_idx_cb(void *baton, md_t *md, int pos);
+
+/**
+ * Call cb once for every managed domain that contains the DNS name, exactly
+ * or through a wildcard, in the order they were added.
+ * Returns 0 when the callback stopped the iteration.
+ */
+int md_domain_idx_do(const md_domain_idx_t *idx, const char *domain, 
+                     md_domain_idx_cb *cb, void *baton);
+
+/**
+ * Remove the managed domain from the index.
+ */
+void md_domain_idx_remove(md_domain_idx_t *idx, const md_t *md);
+
+/**
+ * Find the managed domain that contains all names of the given one or,
+ * when there is none, the one having most names in common with it. This
+ * is how a renamed managed domain is recognized in the store.
+ */
+md_t *md_domain_idx_get_closest(const md_domain_idx_t *idx, const md_t *md, apr_pool_t *p);
+
 /**
  * Create and empty md record, structures initialized.
  */
@@ -319,7 +410,9 @@ typedef apr_status_t md_job_notify_cb(struct md_job_t *job, const char *reason,
 
 typedef struct md_pubcert_t md_pubcert_t;
 struct md_pubcert_t {
-    struct apr_array_header_t *certs;     /* chain of const md_cert*, leaf cert first */
+    struct apr_array_header_t *certs;     /* chain of const md_cert*, leaf cert first,
+                                             NULL when info came from the snapshot */
+    struct md_cert_info_t *info;          /* information about the leaf cert */
     struct apr_array_header_t *alt_names; /* alt-names of leaf cert */
     const char *cert_file;                /* file path of chain */
     const char *key_file;                 /* file path of key for leaf cert */
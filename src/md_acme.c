@@ -49,6 +49,7 @@ struct acme_problem_status_t {
 };
 
 static acme_problem_status_t Problems[] = {
+    { "acme:error:accountDoesNotExist",          APR_ENOENT,   0 },
     { "acme:error:badCSR",                       APR_EINVAL,   1 },
     { "acme:error:badNonce",                     APR_EAGAIN,   0 },
     { "acme:error:badSignatureAlgorithm",        APR_EINVAL,   1 },
@@ -107,22 +108,65 @@ int md_acme_problem_is_input_related(const char *problem) {
     return 0;
 }
 
+int md_acme_problem_is_rate_limited(const char *problem) {
+    if (!problem) return 0;
+    if (!strcmp(MD_ACME_PROBLEM_CA_LIMIT, problem)) return 1;
+    if (strstr(problem, "urn:ietf:params:") == problem) {
+        problem += strlen("urn:ietf:params:");
+    }
+    else if (strstr(problem, "urn:") == problem) {
+        problem += strlen("urn:");
+    }
+    return !apr_strnatcasecmp(problem, "acme:error:rateLimited");
+}
+
+int md_acme_problem_is_acct_gone(const char *problem) {
+    if (!problem) return 0;
+    if (strstr(problem, "urn:ietf:params:") == problem) {
+        problem += strlen("urn:ietf:params:");
+    }
+    else if (strstr(problem, "urn:") == problem) {
+        problem += strlen("urn:");
+    }
+    return !apr_strnatcasecmp(problem, "acme:error:accountDoesNotExist")
+        || !apr_strnatcasecmp(problem, "acme:error:unauthorized");
+}
+
 /**************************************************************************************************/
 /* acme requests */
 
+/* Nonces are single use. We keep the unused ones we got, so that requests
+ * sent in parallel do not each need a round trip to the server for one. */
+#define MD_ACME_MAX_NONCES      64
+
 static void req_update_nonce(md_acme_t *acme, apr_table_t *hdrs)
 {
     if (hdrs) {
         const char *nonce = apr_table_get(hdrs, "Replay-Nonce");
         if (nonce) {
-            acme->nonce = apr_pstrdup(acme->p, nonce);
+            if (acme->nonces->nelts >= MD_ACME_MAX_NONCES) {
+                /* forget the oldest one, it is the most likely to have expired */
+                memmove(acme->nonces->elts, acme->nonces->elts + sizeof(const char*),
+                        (size_t)(acme->nonces->nelts - 1) * sizeof(const char*));
+                --acme->nonces->nelts;
+            }
+            APR_ARRAY_PUSH(acme->nonces, const char*) = apr_pstrdup(acme->p, nonce);
         }
     }
 }
 
+static const char *nonce_take(md_acme_t *acme)
+{
+    const char **pnonce = apr_array_pop(acme->nonces);
+    return pnonce? *pnonce : NULL;
+}
+
 static apr_status_t http_update_nonce(const md_http_response_t *res, void *data)
 {
-    req_update_nonce(data, res->headers);
+    md_acme_t *acme = data;
+
+    md_result_http_timings_add(acme->totals, res->req->url, &res->req->timings);
+    req_update_nonce(acme, res->headers);
     return APR_SUCCESS;
 }
 
@@ -156,6 +200,7 @@ static md_acme_req_t *md_acme_req_create(md_acme_t *acme, const char *method, co
  
 static apr_status_t acmev2_new_nonce(md_acme_t *acme)
 {
+    md_counter_inc(MD_CNT_ACME_REQUESTS);
     return md_http_HEAD_perform(acme->http, acme->api.v2.new_nonce, NULL, http_update_nonce, acme);
 }
 
@@ -172,6 +217,10 @@ static apr_status_t inspect_problem(md_acme_req_t *req, const md_http_response_t
     md_json_t *problem = NULL;
     apr_status_t rv;
 
+    if (res->status == 429) {
+        /* Too Many Requests, the CA may tell us for how long */
+        req->acme->rate_limited_until = md_util_retry_after(res->headers, apr_time_now());
+    }
     ctype = apr_table_get(req->resp_hdrs, "content-type");
     ctype = md_util_parse_ct(res->req->pool, ctype);
     if (ctype && !strcmp(ctype, "application/problem+json")) {
@@ -264,6 +313,7 @@ static apr_status_t md_acme_req_done(md_acme_req_t *req, apr_status_t rv)
     rv = req->result->status;
     /* transfer results into the acme's central result for longer life and later inspection */
     md_result_dup(req->acme->last, req->result);
+    md_result_http_stats_add(req->acme->totals, req->result);
     if (req->p) {
         apr_pool_destroy(req->p);
     }
@@ -277,6 +327,7 @@ static apr_status_t on_response(const md_http_response_t *res, void *data)
     
     req->resp_hdrs = apr_table_clone(req->p, res->headers);
     req_update_nonce(req->acme, res->headers);
+    md_result_http_timings_add(req->result, res->req->url, &res->req->timings);
     
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, req->p, "response: %d", res->status);
     if (res->status >= 200 && res->status < 300) {
@@ -326,6 +377,18 @@ static apr_status_t on_response(const md_http_response_t *res, void *data)
     return rv;
 }
 
+static apr_status_t on_body(const md_http_response_t *res, const char *data, 
+                            apr_size_t len, void *baton)
+{
+    md_acme_req_t *req = baton;
+    
+    if (res->status >= 200 && res->status < 300) {
+        return req->on_body(res, data, len, req->body_baton);
+    }
+    /* keep problem reports for inspect_problem() */
+    return apr_brigade_write(res->body, NULL, NULL, data, len);
+}
+
 static apr_status_t acmev2_GET_as_POST_init(md_acme_req_t *req, void *baton)
 {
     (void)baton;
@@ -337,6 +400,7 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
     apr_status_t rv;
     md_acme_t *acme = req->acme;
     md_data_t *body = NULL;
+    md_http_request_t *hreq = NULL;
     md_result_t *result;
 
     assert(acme->url);
@@ -370,15 +434,14 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
             rv = md_acme_setup(acme, result);
             if (APR_SUCCESS != rv) goto leave;
         }
-        if (!acme->nonce && (APR_SUCCESS != (rv = acme->new_nonce_fn(acme)))) {
+        if (!acme->nonces->nelts && (APR_SUCCESS != (rv = acme->new_nonce_fn(acme)))) {
             md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, req->p, 
                           "error retrieving new nonce from ACME server");
             goto leave;
         }
 
-        md_json_sets(acme->nonce, req->prot_fields, "nonce", NULL);
+        md_json_sets(nonce_take(acme), req->prot_fields, "nonce", NULL);
         md_json_sets(req->url, req->prot_fields, "url", NULL);
-        acme->nonce = NULL;
     }
     
     rv = req->on_init? req->on_init(req, req->baton) : APR_SUCCESS;
@@ -401,21 +464,27 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
                       "req: %s %s", req->method, req->url);
     }
     
+    md_counter_inc(MD_CNT_ACME_REQUESTS);
     if (!strcmp("GET", req->method)) {
-        rv = md_http_GET_perform(req->acme->http, req->url, NULL, on_response, req);
+        rv = md_http_GET_create(&hreq, req->acme->http, req->url, NULL);
     }
     else if (!strcmp("POST", req->method)) {
-        rv = md_http_POSTd_perform(req->acme->http, req->url, NULL, "application/jose+json",  
-                                   body, on_response, req);
+        rv = md_http_POSTd_create(&hreq, req->acme->http, req->url, NULL, 
+                                  "application/jose+json", body);
     }
     else if (!strcmp("HEAD", req->method)) {
-        rv = md_http_HEAD_perform(req->acme->http, req->url, NULL, on_response, req);
+        rv = md_http_HEAD_create(&hreq, req->acme->http, req->url, NULL);
     }
     else {
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, req->p, 
                       "HTTP method %s against: %s", req->method, req->url);
         rv = APR_ENOTIMPL;
     }
+    if (APR_SUCCESS == rv) {
+        md_http_set_on_response_cb(hreq, on_response, req);
+        if (req->on_body) md_http_set_on_body_cb(hreq, on_body, req);
+        rv = md_http_perform(hreq);
+    }
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, req->p, "req sent");
     
     if (APR_EAGAIN == rv && req->max_retries > 0) {
@@ -475,6 +544,260 @@ apr_status_t md_acme_GET(md_acme_t *acme, const char *url,
     return md_acme_req_send(req);
 }
 
+apr_status_t md_acme_GET_streamed(md_acme_t *acme, const char *url,
+                                  md_acme_req_body_cb *on_body, void *body_baton,
+                                  md_acme_req_res_cb *on_res,
+                                  md_acme_req_err_cb *on_err,
+                                  void *baton)
+{
+    md_acme_req_t *req;
+    
+    assert(url);
+    assert(on_body && on_res);
+
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, acme->p, "add acme GET (streamed): %s", url);
+    req = md_acme_req_create(acme, "GET", url);
+    req->on_body = on_body;
+    req->body_baton = body_baton;
+    req->on_res = on_res;
+    req->on_err = on_err;
+    req->baton = baton;
+    
+    return md_acme_req_send(req);
+}
+
+/**************************************************************************************************/
+/* ACME GET requests in parallel */
+
+#define MD_ACME_MAX_PARALLEL    8
+
+typedef enum {
+    MULTI_REQ_PENDING,              /* waiting to be sent */
+    MULTI_REQ_SENT,                 /* in flight */
+    MULTI_REQ_DONE,                 /* response processed or failed */
+} multi_req_state_t;
+
+typedef struct multi_ctx_t multi_ctx_t;
+
+typedef struct {
+    multi_ctx_t *ctx;
+    md_acme_req_t *req;
+    multi_req_state_t state;
+    apr_status_t rv;
+} multi_req_t;
+
+struct multi_ctx_t {
+    md_acme_t *acme;
+    apr_array_header_t *queue;      /* multi_req_t* in order of sending, retries appended */
+    int next;                       /* index of next request in queue to send */
+    int nonce_reqs;                 /* new-nonce requests in flight */
+    int sent_reqs;                  /* signed requests in flight */
+    apr_status_t rv;                /* error that stops sending further requests */
+    md_result_t *failed;            /* result of the first failed request */
+};
+
+static void multi_req_finished(multi_req_t *mreq, apr_status_t rv)
+{
+    mreq->state = MULTI_REQ_DONE;
+    mreq->rv = rv;
+    /* the acme's last result is the one of this request now */
+    if (APR_SUCCESS != rv && APR_SUCCESS == mreq->ctx->failed->status) {
+        md_result_dup(mreq->ctx->failed, mreq->ctx->acme->last);
+    }
+}
+
+static apr_status_t multi_on_response(const md_http_response_t *res, void *data)
+{
+    multi_req_t *mreq = data;
+    apr_status_t rv;
+    
+    rv = on_response(res, mreq->req);
+    if (APR_EAGAIN == rv) {
+        if (mreq->req->max_retries > 0) {
+            /* e.g. a bad nonce, send again with another one */
+            --mreq->req->max_retries;
+            mreq->state = MULTI_REQ_PENDING;
+            APR_ARRAY_PUSH(mreq->ctx->queue, multi_req_t*) = mreq;
+            return rv;
+        }
+        rv = md_acme_req_done(mreq->req, rv);
+    }
+    multi_req_finished(mreq, rv);
+    return rv;
+}
+
+static apr_status_t multi_on_status(const md_http_request_t *req, apr_status_t status, void *data)
+{
+    multi_req_t *mreq = data;
+    
+    (void)req;
+    --mreq->ctx->sent_reqs;
+    if (MULTI_REQ_SENT == mreq->state) {
+        /* no response was processed, e.g. the connection failed */
+        multi_req_finished(mreq, md_acme_req_done(mreq->req, 
+                                                  status? status : APR_EGENERAL));
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t multi_on_nonce(const md_http_response_t *res, void *data)
+{
+    multi_ctx_t *ctx = data;
+    
+    if (!apr_table_get(res->headers, "Replay-Nonce")) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, APR_EINVAL, res->req->pool, 
+                      "no nonce in response from ACME server (http status %d)", res->status);
+        return APR_EINVAL;
+    }
+    return http_update_nonce(res, ctx->acme);
+}
+
+static apr_status_t multi_on_nonce_status(const md_http_request_t *req, 
+                                          apr_status_t status, void *data)
+{
+    multi_ctx_t *ctx = data;
+    
+    --ctx->nonce_reqs;
+    if (APR_SUCCESS != status && APR_SUCCESS == ctx->rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, status, req->pool, 
+                      "error retrieving new nonce from ACME server");
+        ctx->rv = status;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t multi_next_req(md_http_request_t **preq, void *baton, 
+                                   md_http_t *http, int in_flight)
+{
+    multi_ctx_t *ctx = baton;
+    md_acme_t *acme = ctx->acme;
+    multi_req_t *mreq;
+    md_acme_req_t *req;
+    md_data_t *body;
+    int waiting;
+    apr_status_t rv;
+    
+    while (1) {
+        waiting = ctx->queue->nelts - ctx->next;
+        if (APR_SUCCESS != ctx->rv || waiting <= 0 || in_flight >= MD_ACME_MAX_PARALLEL) {
+            return APR_ENOENT;
+        }
+        
+        if (!acme->nonces->nelts) {
+            /* Every response brings a fresh nonce. Only ask for the ones that
+             * are missing for the requests still waiting. */
+            if (ctx->nonce_reqs + ctx->sent_reqs >= waiting) return APR_ENOENT;
+            rv = md_http_HEAD_create(preq, http, acme->api.v2.new_nonce, NULL);
+            if (APR_SUCCESS != rv) return rv;
+            md_http_set_on_response_cb(*preq, multi_on_nonce, ctx);
+            md_http_set_on_status_cb(*preq, multi_on_nonce_status, ctx);
+            ++ctx->nonce_reqs;
+            return APR_SUCCESS;
+        }
+        
+        mreq = APR_ARRAY_IDX(ctx->queue, ctx->next++, multi_req_t*);
+        req = mreq->req;
+        md_json_sets(nonce_take(acme), req->prot_fields, "nonce", NULL);
+        md_json_sets(req->url, req->prot_fields, "url", NULL);
+        rv = req->on_init(req, req->baton);
+        if (APR_SUCCESS == rv) {
+            body = apr_pcalloc(req->p, sizeof(*body));
+            body->data = md_json_writep(req->req_json, req->p, MD_JSON_FMT_INDENT);
+            body->len = strlen(body->data);
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, req->p, 
+                          "req: %s %s (parallel)", req->method, req->url);
+            rv = md_http_POSTd_create(preq, http, req->url, NULL, 
+                                      "application/jose+json", body);
+        }
+        if (APR_SUCCESS != rv) {
+            multi_req_finished(mreq, md_acme_req_done(req, rv));
+            continue;
+        }
+        md_http_set_on_response_cb(*preq, multi_on_response, mreq);
+        md_http_set_on_status_cb(*preq, multi_on_status, mreq);
+        md_counter_inc(MD_CNT_ACME_REQUESTS);
+        mreq->state = MULTI_REQ_SENT;
+        ++ctx->sent_reqs;
+        return APR_SUCCESS;
+    }
+}
+
+apr_status_t md_acme_GET_all(md_acme_t *acme, apr_array_header_t *urls,
+                             md_acme_req_json_cb *on_json, apr_array_header_t *batons)
+{
+    multi_ctx_t ctx;
+    multi_req_t *mreq;
+    apr_array_header_t *mreqs;
+    apr_pool_t *ptemp = NULL;
+    const char *url;
+    void *baton;
+    apr_status_t rv = APR_SUCCESS, rv2;
+    int i;
+    
+    assert(on_json);
+    assert(urls->nelts == batons->nelts);
+    
+    md_result_reset(acme->last);
+    if (acme->version == MD_ACME_VERSION_UNKNOWN) {
+        rv = md_acme_setup(acme, acme->last);
+        if (APR_SUCCESS != rv) goto leave;
+    }
+    
+    if (urls->nelts < 2 || MD_ACME_VERSION_MAJOR(acme->version) < 2) {
+        /* nothing to gain from doing these in parallel */
+        for (i = 0; i < urls->nelts; ++i) {
+            url = APR_ARRAY_IDX(urls, i, const char*);
+            baton = APR_ARRAY_IDX(batons, i, void*);
+            rv2 = md_acme_GET(acme, url, NULL, on_json, NULL, NULL, baton);
+            if (APR_SUCCESS == rv) rv = rv2;
+        }
+        goto leave;
+    }
+    
+    rv = apr_pool_create(&ptemp, acme->p);
+    if (APR_SUCCESS != rv) goto leave;
+    apr_pool_tag(ptemp, "md_acme_multi");
+    
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.acme = acme;
+    ctx.queue = apr_array_make(ptemp, urls->nelts, sizeof(multi_req_t*));
+    ctx.failed = md_result_make(ptemp, APR_SUCCESS);
+    mreqs = apr_array_make(ptemp, urls->nelts, sizeof(multi_req_t*));
+    for (i = 0; i < urls->nelts; ++i) {
+        url = APR_ARRAY_IDX(urls, i, const char*);
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, acme->p, "add acme GET: %s", url);
+        mreq = apr_pcalloc(ptemp, sizeof(*mreq));
+        mreq->ctx = &ctx;
+        mreq->state = MULTI_REQ_PENDING;
+        /* POST-as-GET, as in md_acme_req_send() */
+        mreq->req = md_acme_req_create(acme, "POST", url);
+        mreq->req->on_init = acmev2_GET_as_POST_init;
+        mreq->req->on_json = on_json;
+        mreq->req->baton = APR_ARRAY_IDX(batons, i, void*);
+        APR_ARRAY_PUSH(mreqs, multi_req_t*) = mreq;
+        APR_ARRAY_PUSH(ctx.queue, multi_req_t*) = mreq;
+    }
+    
+    rv = md_http_multi_perform(acme->http, multi_next_req, &ctx);
+    if (APR_STATUS_IS_ENOENT(rv)) rv = ctx.rv;
+    
+    for (i = 0; i < mreqs->nelts; ++i) {
+        mreq = APR_ARRAY_IDX(mreqs, i, multi_req_t*);
+        if (MULTI_REQ_DONE != mreq->state) {
+            /* never sent, because of an error elsewhere */
+            multi_req_finished(mreq, md_acme_req_done(mreq->req, rv? rv : APR_EGENERAL));
+        }
+        if (APR_SUCCESS == rv) rv = mreq->rv;
+    }
+    if (APR_SUCCESS != ctx.failed->status) {
+        md_result_dup(acme->last, ctx.failed);
+    }
+    
+leave:
+    if (ptemp) apr_pool_destroy(ptemp);
+    return rv;
+}
+
 void md_acme_report_result(md_acme_t *acme, apr_status_t rv, struct md_result_t *result)
 {
     if (acme->last->status == APR_SUCCESS) {
@@ -578,7 +901,7 @@ apr_status_t md_acme_use_acct_for_md(md_acme_t *acme, struct md_store_t *store,
             acme->acct_id = apr_pstrdup(p, acct_id);
             acme->acct = acct;
             acme->acct_key = pkey;
-            rv = md_acme_acct_validate(acme, store, p);
+            rv = md_acme_acct_verify(acme, store, p);
         }
         else {
             /* account is from another server or, more likely, from another
@@ -654,6 +977,8 @@ apr_status_t md_acme_create(md_acme_t **pacme, apr_pool_t *p, const char *url,
     acme->sname = (len <= 16)? uri_parsed.hostname : apr_pstrdup(p, uri_parsed.hostname + len - 16);
     acme->version = MD_ACME_VERSION_UNKNOWN;
     acme->last = md_result_make(acme->p, APR_SUCCESS);
+    acme->totals = md_result_make(acme->p, APR_SUCCESS);
+    acme->nonces = apr_array_make(acme->p, 5, sizeof(const char*));
     
     *pacme = acme;
     return rv;
@@ -674,6 +999,7 @@ static apr_status_t update_directory(const md_http_response_t *res, void *data)
     const char *s;
     
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, req->pool, "directory lookup response: %d", res->status);
+    md_result_http_timings_add(acme->totals, req->url, &req->timings);
     if (res->status == 503) {
         md_result_printf(result, APR_EAGAIN,
             "The ACME server at <%s> reports that Service is Unavailable (503). This "
@@ -711,6 +1037,7 @@ static apr_status_t update_directory(const md_http_response_t *res, void *data)
         acme->api.v2.revoke_cert = md_json_dups(acme->p, json, "revokeCert", NULL);
         acme->api.v2.key_change = md_json_dups(acme->p, json, "keyChange", NULL);
         acme->api.v2.new_nonce = md_json_dups(acme->p, json, "newNonce", NULL);
+        acme->api.v2.renewal_info = md_json_dups(acme->p, json, "renewalInfo", NULL);
         /* RFC 8555 only requires "directory" and "newNonce" resources.
          * mod_md uses "newAccount" and "newOrder" so check for them.
          * But mod_md does not use the "revokeCert" or "keyChange"
@@ -753,13 +1080,9 @@ leave:
     return rv;
 }
 
-apr_status_t md_acme_setup(md_acme_t *acme, md_result_t *result)
+apr_status_t md_acme_http_init(md_acme_t *acme)
 {
     apr_status_t rv;
-    update_dir_ctx ctx;
-   
-    assert(acme->url);
-    acme->version = MD_ACME_VERSION_UNKNOWN;
     
     if (!acme->http && APR_SUCCESS != (rv = md_http_create(&acme->http, acme->p,
                                                            acme->user_agent, acme->proxy_url))) {
@@ -772,11 +1095,26 @@ apr_status_t md_acme_setup(md_acme_t *acme, md_result_t *result)
     md_http_set_connect_timeout_default(acme->http, apr_time_from_sec(30));
     md_http_set_stalling_default(acme->http, 10, apr_time_from_sec(30));
     md_http_set_ca_file(acme->http, acme->ca_file);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_setup(md_acme_t *acme, md_result_t *result)
+{
+    apr_status_t rv;
+    update_dir_ctx ctx;
+   
+    assert(acme->url);
+    acme->version = MD_ACME_VERSION_UNKNOWN;
+    
+    if (APR_SUCCESS != (rv = md_acme_http_init(acme))) {
+        return rv;
+    }
     
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, acme->p, "get directory from %s", acme->url);
     
     ctx.acme = acme;
     ctx.result = result;
+    md_counter_inc(MD_CNT_ACME_REQUESTS);
     rv = md_http_GET_perform(acme->http, acme->url, NULL, update_directory, &ctx);
     
     if (APR_SUCCESS != rv && APR_SUCCESS == result->status) {
@@ -80,6 +80,14 @@ typedef apr_status_t md_acme_req_json_cb(md_acme_t *acme, apr_pool_t *p,
 typedef apr_status_t md_acme_req_err_cb(md_acme_req_t *req, 
                                         const struct md_result_t *result, void *baton);
 
+/**
+ * Request callback on the body data of a successful response, as it arrives
+ * (see md_http_body_cb). Data the callback does not consume itself it may
+ * add to res->body for the on_res callback.
+ */
+typedef apr_status_t md_acme_req_body_cb(const struct md_http_response_t *res, 
+                                         const char *data, apr_size_t len, void *baton);
+
 
 typedef apr_status_t md_acme_new_nonce_fn(md_acme_t *acme);
 typedef apr_status_t md_acme_req_init_fn(md_acme_req_t *req, struct md_json_t *jpayload);
@@ -118,6 +126,7 @@ struct md_acme_t {
             const char *key_change;
             const char *revoke_cert;
             const char *new_nonce;
+            const char *renewal_info;   /* ARI (RFC 9773), if offered */
         } v2;
     } api;
     const char *ca_agreement;
@@ -130,9 +139,11 @@ struct md_acme_t {
     
     struct md_http_t *http;
     
-    const char *nonce;
+    struct apr_array_header_t *nonces; /* unused nonces from the server, freshest last */
     int max_retries;
     struct md_result_t *last;      /* result of last request */
+    apr_time_t rate_limited_until; /* Retry-After of a rate limited request or 0 */
+    struct md_result_t *totals;    /* statistics accumulated over all requests */
 };
 
 /**
@@ -160,6 +171,12 @@ apr_status_t md_acme_create(md_acme_t **pacme, apr_pool_t *p, const char *url,
  */
 apr_status_t md_acme_setup(md_acme_t *acme, struct md_result_t *result);
 
+/**
+ * Prepare the http client of the ACME instance, without contacting the server.
+ * Done by md_acme_setup(), for requests to urls known from an earlier setup.
+ */
+apr_status_t md_acme_http_init(md_acme_t *acme);
+
 void md_acme_report_result(md_acme_t *acme, apr_status_t rv, struct md_result_t *result);
 
 /**************************************************************************************************/
@@ -262,6 +279,8 @@ struct md_acme_req_t {
     md_acme_req_json_cb *on_json;  /* callback on successful JSON response */
     md_acme_req_res_cb *on_res;    /* callback on generic HTTP response */
     md_acme_req_err_cb *on_err;    /* callback on encountered error */
+    md_acme_req_body_cb *on_body;  /* callback on body data of successful response */
+    void *body_baton;              /* userdata for the on_body callback */
     int max_retries;               /* how often this might be retried */
     void *baton;                   /* userdata for callbacks */
     struct md_result_t *result;    /* result of this request */
@@ -275,6 +294,35 @@ apr_status_t md_acme_GET(md_acme_t *acme, const char *url,
                          md_acme_req_res_cb *on_res,
                          md_acme_req_err_cb *on_err,
                          void *baton);
+
+/**
+ * Perform a GET against the ACME url whose successful response body is handed
+ * to `on_body` while it arrives, e.g. a certificate chain, instead of being
+ * collected. The `on_res` callback is invoked at the end of the response.
+ * Bodies of unsuccessful responses are collected to inspect the problem.
+ */
+apr_status_t md_acme_GET_streamed(md_acme_t *acme, const char *url,
+                                  md_acme_req_body_cb *on_body, void *body_baton,
+                                  md_acme_req_res_cb *on_res,
+                                  md_acme_req_err_cb *on_err,
+                                  void *baton);
+
+/**
+ * Perform GET requests against several ACME urls in parallel. For each url, 
+ * `on_json` is invoked on a successful JSON response with the baton at the same
+ * index in `batons`. Each request is signed with its own nonce, which are
+ * taken from earlier responses or retrieved in parallel, if needed.
+ * 
+ * @param acme        the ACME server to talk to
+ * @param urls        the urls (const char*) to GET
+ * @param on_json     callback on successful JSON response
+ * @param batons      userdata (void*) for the callback, one per url
+ * @return APR_SUCCESS if all requests succeeded, else the status of the first failure
+ */
+apr_status_t md_acme_GET_all(md_acme_t *acme, struct apr_array_header_t *urls,
+                             md_acme_req_json_cb *on_json, 
+                             struct apr_array_header_t *batons);
+
 /**
  * Perform a POST against the ACME url. If a on_json callback is given and
  * the HTTP response is JSON, only this callback is invoked. Otherwise, on HTTP status
@@ -314,4 +362,19 @@ apr_status_t md_acme_protos_add(struct apr_hash_t *protos, apr_pool_t *p);
  */
 int md_acme_problem_is_input_related(const char *problem);
 
+/* Problem reported when our own admission control holds back a request to the CA */
+#define MD_ACME_PROBLEM_CA_LIMIT    "urn:org:apache:httpd:md:ca-limit"
+
+/**
+ * Return != 0 iff the given problem identifier says that a request was
+ * not made or refused due to rate limits, by the CA or by ourself.
+ */
+int md_acme_problem_is_rate_limited(const char *problem);
+
+/**
+ * Return != 0 iff the given problem identifier says that the CA no longer
+ * accepts the account a request was signed with.
+ */
+int md_acme_problem_is_acct_gone(const char *problem);
+
 #endif /* md_acme_h */
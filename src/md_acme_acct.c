@@ -24,6 +24,7 @@
 #include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_tables.h>
+#include <apr_thread_mutex.h>
 
 #include "md.h"
 #include "md_crypt.h"
@@ -37,6 +38,7 @@
 
 #include "md_acme.h"
 #include "md_acme_acct.h"
+#include "md_acme_limit.h"
 
 static apr_status_t acct_make(md_acme_acct_t **pacct, apr_pool_t *p, 
                               const char *ca_url, apr_array_header_t *contacts)
@@ -173,6 +175,110 @@ leave:
     return rv;
 }
 
+/**************************************************************************************************/
+/* account index */
+
+/* Updates of the index read, modify and write it back. They are serialized in the
+ * process by this mutex, which lives as long as the registry that set it up.
+ * The store replaces the file atomically, so readers always see a complete index. */
+static apr_thread_mutex_t *index_mutex;
+
+static apr_status_t index_mutex_clear(void *data)
+{
+    (void)data;
+    index_mutex = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_acct_index_init(apr_pool_t *p)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    if (!index_mutex) {
+        rv = apr_thread_mutex_create(&index_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+        if (APR_SUCCESS == rv) {
+            apr_pool_cleanup_register(p, NULL, index_mutex_clear, apr_pool_cleanup_null);
+        }
+    }
+    return rv;
+}
+
+static void index_lock(void)
+{
+    if (index_mutex) apr_thread_mutex_lock(index_mutex);
+}
+
+static void index_unlock(void)
+{
+    if (index_mutex) apr_thread_mutex_unlock(index_mutex);
+}
+
+static md_json_t *index_load(md_store_t *store, apr_pool_t *p)
+{
+    md_json_t *json = NULL;
+    
+    if (APR_SUCCESS != md_store_load_json(store, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                                          MD_FN_ACCT_INDEX, &json, p)) {
+        json = NULL;
+    }
+    return json;
+}
+
+static void index_save(md_store_t *store, md_json_t *json, apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    rv = md_store_save_json(store, p, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                            MD_FN_ACCT_INDEX, json, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "saving account index");
+    }
+}
+
+/* What the index keeps of an account: what is needed to match it to an MD. */
+static md_json_t *index_entry(md_acme_acct_t *acct, apr_pool_t *p)
+{
+    md_json_t *jentry;
+    
+    jentry = md_acme_acct_to_json(acct, p);
+    md_json_del(jentry, MD_KEY_REGISTRATION, NULL);
+    return jentry;
+}
+
+/* Record the account in an existing index. Without an index, the next lookup
+ * builds one from all accounts in the store. */
+static void index_update(md_store_t *store, const char *id, md_acme_acct_t *acct, 
+                         apr_time_t verified, apr_pool_t *p)
+{
+    md_json_t *json, *jentry;
+    
+    index_lock();
+    if (!(json = index_load(store, p))) goto leave;
+    jentry = index_entry(acct, p);
+    if (!verified && MD_ACME_ACCT_ST_VALID == acct->status) {
+        verified = md_json_get_time(json, MD_KEY_ACCOUNTS, id, MD_KEY_VERIFIED, NULL);
+    }
+    if (verified && MD_ACME_ACCT_ST_VALID == acct->status) {
+        md_json_set_time(verified, jentry, MD_KEY_VERIFIED, NULL);
+    }
+    md_json_setj(jentry, json, MD_KEY_ACCOUNTS, id, NULL);
+    index_save(store, json, p);
+leave:
+    index_unlock();
+}
+
+void md_acme_acct_index_remove(md_store_t *store, const char *id, apr_pool_t *p)
+{
+    md_json_t *json;
+    
+    index_lock();
+    if ((json = index_load(store, p)) && md_json_has_key(json, MD_KEY_ACCOUNTS, id, NULL)) {
+        md_json_del(json, MD_KEY_ACCOUNTS, id, NULL);
+        index_save(store, json, p);
+    }
+    index_unlock();
+}
+
 apr_status_t md_acme_acct_save(md_store_t *store, apr_pool_t *p, md_acme_t *acme, 
                                const char **pid, md_acme_acct_t *acct, md_pkey_t *acct_key)
 {
@@ -196,6 +302,9 @@ apr_status_t md_acme_acct_save(md_store_t *store, apr_pool_t *p, md_acme_t *acme
         if (pid) *pid = id;
         rv = md_store_save(store, p, MD_SG_ACCOUNTS, id, MD_FN_ACCT_KEY, MD_SV_PKEY, acct_key, 0);
     }
+    if (APR_SUCCESS == rv) {
+        index_update(store, id, acct, 0, p);
+    }
     return rv;
 }
 
@@ -265,6 +374,9 @@ typedef struct {
     apr_pool_t *p;
     const md_t *md;
     const char *id;
+    const char *pattern;
+    md_json_t *index;               /* when not NULL, collect all accounts into it */
+    md_json_t *old_index;           /* the index being rebuilt, if there was one */
 } find_ctx;
 
 static int find_acct(void *baton, const char *name, const char *aspect,
@@ -281,36 +393,101 @@ static int find_acct(void *baton, const char *name, const char *aspect,
         rv = md_acme_acct_from_json(&acct, (md_json_t*)value, ptemp);
         if (APR_SUCCESS != rv) goto cleanup;
 
-        if (MD_ACME_ACCT_ST_VALID == acct->status
+        if (ctx->index) {
+            md_json_t *jentry = index_entry(acct, ptemp);
+            apr_time_t verified = 0;
+            
+            if (ctx->old_index && MD_ACME_ACCT_ST_VALID == acct->status) {
+                verified = md_json_get_time(ctx->old_index, MD_KEY_ACCOUNTS, name, 
+                                            MD_KEY_VERIFIED, NULL);
+            }
+            if (verified) md_json_set_time(verified, jentry, MD_KEY_VERIFIED, NULL);
+            md_json_setj(jentry, ctx->index, MD_KEY_ACCOUNTS, name, NULL);
+        }
+        if (!ctx->id && MD_ACME_ACCT_ST_VALID == acct->status
+            && (!ctx->pattern || APR_SUCCESS == apr_fnmatch(ctx->pattern, name, 0))
             && (!ctx->md || md_acme_acct_matches_md(acct, ctx->md))) {
             md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ctx->p, 
                           "found account %s for %s: %s, status=%d",
                           acct->id, ctx->md->ca_effective, aspect, acct->status);
             ctx->id = apr_pstrdup(ctx->p, name);
-            return 0;
+            if (!ctx->index) return 0;
         }
     }
 cleanup:
     return 1;
 }
 
+static int find_indexed_acct(void *baton, const char *key, md_json_t *json)
+{
+    find_ctx *ctx = baton;
+    md_acme_acct_t *acct;
+    
+    if (APR_SUCCESS == apr_fnmatch(ctx->pattern, key, 0)
+        && APR_SUCCESS == md_acme_acct_from_json(&acct, json, ctx->p)
+        && MD_ACME_ACCT_ST_VALID == acct->status
+        && (!ctx->md || md_acme_acct_matches_md(acct, ctx->md))) {
+        ctx->id = apr_pstrdup(ctx->p, key);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Find the id of a valid account matching the md. In MD_SG_ACCOUNTS, this
+ * looks at the index. When the index has no match or a match that no longer
+ * exists, the accounts in the store are scanned and the index is rebuilt.
+ */
+static const char *acct_find_id(md_store_t *store, md_store_group_t group, 
+                                const char *name_pattern, const md_t *md, apr_pool_t *p)
+{
+    find_ctx ctx;
+    md_json_t *index;
+    
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.p = p;
+    ctx.md = md;
+    ctx.pattern = name_pattern;
+    if (MD_SG_ACCOUNTS != group) goto scan;
+    
+    if ((index = index_load(store, p))) {
+        md_json_iterkey(find_indexed_acct, &ctx, index, MD_KEY_ACCOUNTS, NULL);
+        if (ctx.id && md_store_get_modified(store, group, ctx.id, MD_FN_ACCOUNT, p)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, p, "account %s from index", ctx.id);
+            return ctx.id;
+        }
+        ctx.id = NULL;
+    }
+    /* rebuild the index from all accounts, looking for a match on the way */
+    index_lock();
+    ctx.old_index = index_load(store, p);
+    ctx.index = md_json_create(p);
+    md_json_setj(md_json_create(p), ctx.index, MD_KEY_ACCOUNTS, NULL);
+    md_store_iter(find_acct, &ctx, store, p, group, "*", MD_FN_ACCOUNT, MD_SV_JSON);
+    if (!ctx.old_index || !md_json_equal(ctx.old_index, ctx.index)) {
+        index_save(store, ctx.index, p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "rebuilt account index");
+    }
+    index_unlock();
+    return ctx.id;
+scan:
+    md_store_iter(find_acct, &ctx, store, p, group, name_pattern, MD_FN_ACCOUNT, MD_SV_JSON);
+    return ctx.id;
+}
+
 static apr_status_t acct_find(const char **pid, md_acme_acct_t **pacct, md_pkey_t **ppkey, 
                               md_store_t *store, md_store_group_t group,
                               const char *name_pattern,
                               const md_t *md, apr_pool_t *p)
 {
     apr_status_t rv;
-    find_ctx ctx;
-
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.p = p;
-    ctx.md = md;
+    const char *id;
 
-    rv = md_store_iter(find_acct, &ctx, store, p, group, name_pattern, MD_FN_ACCOUNT, MD_SV_JSON);
-    if (ctx.id) {
-        *pid = ctx.id;
-        rv = md_acme_acct_load(pacct, ppkey, store, group, ctx.id, p);
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "acct_find: got account %s", ctx.id);
+    id = acct_find_id(store, group, name_pattern, md, p);
+    if (id) {
+        *pid = id;
+        rv = md_acme_acct_load(pacct, ppkey, store, group, id, p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "acct_find: got account %s", id);
     }
     else {
         *pacct = NULL;
@@ -337,7 +514,7 @@ static apr_status_t acct_find_and_verify(md_store_t *store, md_store_group_t gro
         acme->acct_id = (MD_SG_STAGING == group)? NULL : id;
         acme->acct = acct;
         acme->acct_key = pkey;
-        rv = md_acme_acct_validate(acme, (MD_SG_STAGING == group)? NULL : store, p);
+        rv = md_acme_acct_verify(acme, (MD_SG_STAGING == group)? NULL : store, p);
         md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, p, "acct_find_and_verify: verified %s",
                       id);
 
@@ -382,19 +559,15 @@ apr_status_t md_acme_acct_id_for_md(const char **pid, md_store_t *store,
                                     md_store_group_t group, const md_t *md,
                                     apr_pool_t *p)
 {
-    apr_status_t rv;
-    find_ctx ctx;
-
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.p = p;
-    ctx.md = md;
+    apr_status_t rv = APR_ENOENT;
+    const char *id;
 
-    rv = md_store_iter(find_acct, &ctx, store, p, group, "*", MD_FN_ACCOUNT, MD_SV_JSON);
-    if (ctx.id) {
-        *pid = ctx.id;
+    id = acct_find_id(store, group, "*", md, p);
+    if (id) {
+        *pid = id;
         rv = APR_SUCCESS;
     }
-    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "acct_id_for_md %s -> %s", md->name, *pid);
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "acct_id_for_md %s -> %s", md->name, id);
     return rv;
 }
 
@@ -502,6 +675,27 @@ apr_status_t md_acme_acct_validate(md_acme_t *acme, md_store_t *store, apr_pool_
     return rv;
 }
 
+apr_status_t md_acme_acct_verify(md_acme_t *acme, md_store_t *store, apr_pool_t *p)
+{
+    md_json_t *index;
+    apr_time_t verified;
+    apr_status_t rv;
+    
+    if (store && acme->acct_id && (index = index_load(store, p))) {
+        verified = md_json_get_time(index, MD_KEY_ACCOUNTS, acme->acct_id, MD_KEY_VERIFIED, NULL);
+        if (verified && apr_time_now() < verified + MD_ACME_ACCT_VERIFY_TTL) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, p, 
+                          "account %s validated recently", acme->acct_id);
+            return APR_SUCCESS;
+        }
+    }
+    rv = md_acme_acct_validate(acme, store, p);
+    if (APR_SUCCESS == rv && store && acme->acct_id) {
+        index_update(store, acme->acct_id, acme->acct, apr_time_now(), p);
+    }
+    return rv;
+}
+
 /**************************************************************************************************/
 /* Register a new account */
 
@@ -621,20 +815,15 @@ apr_status_t md_acme_acct_register(md_acme_t *acme, md_store_t *store,
      * of identifying information.
      */
     if (!acme->acct_key) {
-        find_ctx fctx;
-
-        memset(&fctx, 0, sizeof(fctx));
-        fctx.p = p;
-        fctx.md = md;
+        const char *id;
 
-        md_store_iter(find_acct, &fctx, store, p, MD_SG_ACCOUNTS, 
-                      mk_acct_pattern(p, acme), MD_FN_ACCOUNT, MD_SV_JSON);
-        if (fctx.id) {
-            rv = md_store_load(store, MD_SG_ACCOUNTS, fctx.id, MD_FN_ACCT_KEY, MD_SV_PKEY,
+        id = acct_find_id(store, MD_SG_ACCOUNTS, mk_acct_pattern(p, acme), md, p);
+        if (id) {
+            rv = md_store_load(store, MD_SG_ACCOUNTS, id, MD_FN_ACCT_KEY, MD_SV_PKEY,
                                (void**)&acme->acct_key, p);
             if (APR_SUCCESS == rv) {
                 md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p,
-                              "reusing key from account %s", fctx.id);
+                              "reusing key from account %s", id);
             }
             else {
                 acme->acct_key = NULL;
@@ -58,6 +58,16 @@ struct md_acme_acct_t {
 
 #define MD_ACME_ACCT_STAGED     "staged"
 
+/* An index of all accounts in MD_SG_ACCOUNTS, so that finding one for an MD
+ * does not need to read every account in the store. It records verifications
+ * made by the renewal watchdog, which may not write MD_SG_ACCOUNTS, and is
+ * therefore kept in MD_SG_STAGING beside the CA limits (MD_ACME_LIMITS_NAME). */
+#define MD_FN_ACCT_INDEX        "accounts-index.json"
+
+/* How long a successful validation of an account at its CA is trusted when
+ * looking for an account to use. */
+#define MD_ACME_ACCT_VERIFY_TTL apr_time_from_sec(MD_SECS_PER_DAY)
+
 /**
  * Convert an ACME account form/to JSON.
  */
@@ -76,6 +86,12 @@ apr_status_t md_acme_acct_update(md_acme_t *acme);
  */
 apr_status_t md_acme_acct_validate(md_acme_t *acme, md_store_t *store, apr_pool_t *p);
 
+/**
+ * Like md_acme_acct_validate(), but without asking the CA again when the
+ * account has been validated in the last MD_ACME_ACCT_VERIFY_TTL.
+ */
+apr_status_t md_acme_acct_verify(md_acme_t *acme, md_store_t *store, apr_pool_t *p);
+
 /**
  * Agree to the given Terms-of-Service url for the current account.
  */
@@ -134,6 +150,18 @@ apr_status_t md_acme_acct_load(struct md_acme_acct_t **pacct, struct md_pkey_t *
                                md_store_t *store, md_store_group_t group, 
                                const char *name, apr_pool_t *p);
 
+/**
+ * Serialize updates of the account index in this process, for as long as
+ * the pool lives. The registry does this when it is created.
+ */
+apr_status_t md_acme_acct_index_init(apr_pool_t *p);
+
+/**
+ * Remove an account from the index, after it was deleted from the store,
+ * or when the CA no longer accepts it.
+ */
+void md_acme_acct_index_remove(md_store_t *store, const char *id, apr_pool_t *p);
+
 /*
  * Return != 0 iff the account can be used for the ACME url.
  */
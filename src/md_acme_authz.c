@@ -25,6 +25,7 @@
 #include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_tables.h>
+#include <apr_thread_mutex.h>
 
 #include "md.h"
 #include "md_crypt.h"
@@ -34,10 +35,12 @@
 #include "md_jws.h"
 #include "md_result.h"
 #include "md_store.h"
+#include "md_time.h"
 #include "md_util.h"
 
 #include "md_acme.h"
 #include "md_acme_authz.h"
+#include "md_acme_limit.h"
 
 md_acme_authz_t *md_acme_authz_create(apr_pool_t *p)
 {
@@ -76,6 +79,170 @@ static void authz_req_ctx_init(authz_req_ctx *ctx, md_acme_t *acme,
     ctx->authz = authz;
 }
 
+/**************************************************************************************************/
+/* valid authorizations of an account */
+
+/* Renewals of several MDs of the same account update the file, in parallel */
+static apr_thread_mutex_t *known_mutex;
+
+static apr_status_t known_mutex_clear(void *data)
+{
+    (void)data;
+    known_mutex = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_authz_known_init(apr_pool_t *p)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    if (!known_mutex) {
+        rv = apr_thread_mutex_create(&known_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+        if (APR_SUCCESS == rv) {
+            apr_pool_cleanup_register(p, NULL, known_mutex_clear, apr_pool_cleanup_null);
+        }
+    }
+    return rv;
+}
+
+static void known_lock(void)
+{
+    if (known_mutex) apr_thread_mutex_lock(known_mutex);
+}
+
+static void known_unlock(void)
+{
+    if (known_mutex) apr_thread_mutex_unlock(known_mutex);
+}
+
+static const char *known_fname(md_acme_t *acme, apr_pool_t *p)
+{
+    return apr_pstrcat(p, MD_FN_AUTHZS_PREFIX, acme->acct_id, ".json", NULL);
+}
+
+static md_json_t *known_load(md_acme_t *acme, md_store_t *store, apr_pool_t *p)
+{
+    md_json_t *json = NULL;
+    
+    if (!store || !acme->acct_id
+        || APR_SUCCESS != md_store_load_json(store, MD_SG_STAGING, MD_ACME_LIMITS_NAME, 
+                                             known_fname(acme, p), &json, p)) {
+        json = NULL;
+    }
+    return json;
+}
+
+static void known_save(md_acme_t *acme, md_store_t *store, md_json_t *json, 
+                       const char *domain, apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    rv = md_store_save_json(store, p, MD_SG_STAGING, MD_ACME_LIMITS_NAME, 
+                            known_fname(acme, p), json, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                      "account %s: unable to save known authorizations (%s)", 
+                      acme->acct_id, domain);
+    }
+}
+
+static int drop_expired(void *baton, const char *key, md_json_t *json)
+{
+    apr_array_header_t *expired = baton;
+    
+    if (md_json_get_time(json, MD_KEY_EXPIRES, NULL) < apr_time_now() + MD_ACME_AUTHZ_REUSE_MIN) {
+        APR_ARRAY_PUSH(expired, const char*) = key;
+    }
+    return 1;
+}
+
+void md_acme_authz_remember(md_acme_authz_t *authz, md_acme_t *acme, 
+                            md_store_t *store, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_array_header_t *expired;
+    int i;
+    
+    if (!store || !acme->acct_id || !authz->domain 
+        || MD_ACME_AUTHZ_S_VALID != authz->state
+        || authz->expires < apr_time_now() + MD_ACME_AUTHZ_REUSE_MIN) return;
+    
+    known_lock();
+    if (!(json = known_load(acme, store, p))) json = md_json_create(p);
+    if (!md_json_has_key(json, authz->domain, NULL)
+        || strcmp(authz->url, md_json_gets(json, authz->domain, MD_KEY_URL, NULL))) {
+        md_json_sets(authz->url, json, authz->domain, MD_KEY_URL, NULL);
+        md_json_set_time(authz->expires, json, authz->domain, MD_KEY_EXPIRES, NULL);
+        expired = apr_array_make(p, 5, sizeof(const char*));
+        md_json_iterkey(drop_expired, expired, json, NULL);
+        for (i = 0; i < expired->nelts; ++i) {
+            md_json_del(json, APR_ARRAY_IDX(expired, i, const char*), NULL);
+        }
+        known_save(acme, store, json, authz->domain, p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "account %s: remember authz for %s",
+                      acme->acct_id, authz->domain);
+    }
+    known_unlock();
+}
+
+typedef struct {
+    const char *url;
+    const char *domain;
+} known_ctx;
+
+static int find_known(void *baton, const char *key, md_json_t *json)
+{
+    known_ctx *ctx = baton;
+    const char *url = md_json_gets(json, MD_KEY_URL, NULL);
+    
+    if (url && !strcmp(ctx->url, url)
+        && md_json_get_time(json, MD_KEY_EXPIRES, NULL) > apr_time_now() + MD_ACME_AUTHZ_REUSE_MIN) {
+        ctx->domain = key;
+        return 0;
+    }
+    return 1;
+}
+
+const char *md_acme_authz_known_valid(md_acme_t *acme, md_store_t *store, 
+                                      const char *url, apr_pool_t *p)
+{
+    md_json_t *json;
+    known_ctx ctx;
+    
+    ctx.url = url;
+    ctx.domain = NULL;
+    known_lock();
+    if ((json = known_load(acme, store, p))) {
+        md_json_iterkey(find_known, &ctx, json, NULL);
+    }
+    known_unlock();
+    return ctx.domain;
+}
+
+void md_acme_authz_forget(md_acme_t *acme, md_store_t *store, 
+                          const char *domain, apr_pool_t *p)
+{
+    md_json_t *json;
+    
+    known_lock();
+    if ((json = known_load(acme, store, p)) && md_json_has_key(json, domain, NULL)) {
+        md_json_del(json, domain, NULL);
+        known_save(acme, store, json, domain, p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "account %s: forget authz for %s",
+                      acme->acct_id, domain);
+    }
+    known_unlock();
+}
+
+void md_acme_authz_forget_all(md_acme_t *acme, md_store_t *store, apr_pool_t *p)
+{
+    if (store && acme->acct_id) {
+        known_lock();
+        md_store_remove(store, MD_SG_STAGING, MD_ACME_LIMITS_NAME, known_fname(acme, p), p, 1);
+        known_unlock();
+    }
+}
+
 /**************************************************************************************************/
 /* Update an existing authorization */
 
@@ -111,30 +278,23 @@ static int copy_challenge_error(void *baton, size_t index, md_json_t *json)
     return 1;
 }
 
-apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme, apr_pool_t *p)
+static apr_status_t authz_update_from_json(md_acme_authz_t *authz, md_json_t *json, 
+                                           apr_status_t rv, apr_pool_t *p)
 {
-    md_json_t *json;
     const char *s, *err;
     md_log_level_t log_level;
-    apr_status_t rv;
     error_ctx_t ctx;
     
-    assert(acme);
-    assert(acme->http);
-    assert(authz);
-    assert(authz->url);
-
     authz->state = MD_ACME_AUTHZ_S_UNKNOWN;
-    json = NULL;
     authz->error_type = authz->error_detail = NULL;
     authz->error_subproblems = NULL;
     err = "unable to parse response";
     log_level = MD_LOG_ERR;
     
-    if (APR_SUCCESS == (rv = md_acme_get_json(&json, acme, authz->url, p))
-        && (s = md_json_gets(json, MD_KEY_STATUS, NULL))) {
+    if (APR_SUCCESS == rv && json && (s = md_json_gets(json, MD_KEY_STATUS, NULL))) {
             
         authz->domain = md_json_gets(json, MD_KEY_IDENTIFIER, MD_KEY_VALUE, NULL); 
+        authz->expires = md_time_parse_rfc3339(md_json_gets(json, MD_KEY_EXPIRES, NULL));
         authz->resource = json;
         if (!strcmp(s, "pending")) {
             authz->state = MD_ACME_AUTHZ_S_PENDING;
@@ -169,6 +329,75 @@ apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme, apr_p
     return rv;
 }
 
+apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_status_t rv;
+    
+    assert(acme);
+    assert(acme->http);
+    assert(authz);
+    assert(authz->url);
+
+    json = NULL;
+    authz->retry_at = 0;
+    rv = md_acme_get_json(&json, acme, authz->url, p);
+    return authz_update_from_json(authz, json, rv, p);
+}
+
+typedef struct {
+    apr_pool_t *p;
+    md_acme_authz_t *authz;
+    md_json_t *json;
+} authz_update_ctx;
+
+static apr_status_t on_authz_json(md_acme_t *acme, apr_pool_t *p, const apr_table_t *headers, 
+                                  md_json_t *jbody, void *baton)
+{
+    authz_update_ctx *ctx = baton;
+
+    (void)acme;
+    (void)p;
+    ctx->json = md_json_clone(ctx->p, jbody);
+    ctx->authz->retry_at = md_util_retry_after(headers, apr_time_now());
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_authz_update_all(apr_array_header_t *authzs, md_acme_t *acme, 
+                                      apr_pool_t *p)
+{
+    apr_array_header_t *urls, *batons;
+    authz_update_ctx *ctx;
+    md_acme_authz_t *authz;
+    apr_status_t rv, rv2;
+    int i;
+    
+    assert(acme);
+    assert(acme->http);
+    
+    urls = apr_array_make(p, authzs->nelts, sizeof(const char*));
+    batons = apr_array_make(p, authzs->nelts, sizeof(void*));
+    for (i = 0; i < authzs->nelts; ++i) {
+        authz = APR_ARRAY_IDX(authzs, i, md_acme_authz_t*);
+        assert(authz->url);
+        authz->retry_at = 0;
+        ctx = apr_pcalloc(p, sizeof(*ctx));
+        ctx->p = p;
+        ctx->authz = authz;
+        APR_ARRAY_PUSH(urls, const char*) = authz->url;
+        APR_ARRAY_PUSH(batons, void*) = ctx;
+    }
+    
+    rv = md_acme_GET_all(acme, urls, on_authz_json, batons);
+    for (i = 0; i < batons->nelts; ++i) {
+        ctx = APR_ARRAY_IDX(batons, i, authz_update_ctx*);
+        rv2 = ctx->json? APR_SUCCESS : (rv? rv : APR_EINVAL);
+        rv2 = authz_update_from_json(ctx->authz, ctx->json, rv2, p);
+        if (APR_SUCCESS == rv) rv = rv2;
+    }
+    return rv;
+}
+
 /**************************************************************************************************/
 /* response to a challenge */
 
@@ -240,11 +469,21 @@ static apr_status_t setup_key_authz(md_acme_authz_cha_t *cha, md_acme_authz_t *a
     return rv;
 }
 
+static md_acme_http01_publish_cb *http01_publish;
+static void *http01_publish_baton;
+
+void md_acme_authz_set_http01_publish(md_acme_http01_publish_cb *cb, void *baton)
+{
+    http01_publish = cb;
+    http01_publish_baton = baton;
+}
+
 static apr_status_t cha_http_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t *authz,
                                       md_acme_t *acme, md_store_t *store, 
                                       md_pkeys_spec_t *key_specs,
                                       apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                       apr_table_t *env, md_result_t *result,
+                                      md_acme_dns01_batch_t *batch,
                                       const char **psetup_token, apr_pool_t *p)
 {
     const char *data;
@@ -252,6 +491,7 @@ static apr_status_t cha_http_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t
     int notify_server;
     
     (void)key_specs;
+    (void)batch;
     (void)env;
     (void)acme_tls_1_domains;
     (void)md;
@@ -263,12 +503,16 @@ static apr_status_t cha_http_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t
     rv = md_store_load(store, MD_SG_CHALLENGES, authz->domain, MD_FN_HTTP01,
                        MD_SV_TEXT, (void**)&data, p);
     if ((APR_SUCCESS == rv && strcmp(cha->key_authz, data)) || APR_STATUS_IS_ENOENT(rv)) {
-        const char *content = apr_psprintf(p, "%s\n", cha->key_authz);
+        /* served as it is, the same as from the shared challenge table */
         rv = md_store_save(store, p, MD_SG_CHALLENGES, authz->domain, MD_FN_HTTP01,
-                           MD_SV_TEXT, (void*)content, 0);
+                           MD_SV_TEXT, (void*)cha->key_authz, 0);
         notify_server = 1;
     }
     
+    if (APR_SUCCESS == rv && http01_publish) {
+        http01_publish(http01_publish_baton, authz->domain, cha->key_authz, p);
+    }
+
     if (APR_SUCCESS == rv && notify_server) {
         authz_req_ctx ctx;
         const char *event;
@@ -306,6 +550,7 @@ static apr_status_t cha_tls_alpn_01_setup(md_acme_authz_cha_t *cha, md_acme_auth
                                           md_pkeys_spec_t *key_specs,
                                           apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                           apr_table_t *env, md_result_t *result,
+                                          md_acme_dns01_batch_t *batch,
                                           const char **psetup_token, apr_pool_t *p)
 {
     const char *acme_id, *token;
@@ -314,6 +559,7 @@ static apr_status_t cha_tls_alpn_01_setup(md_acme_authz_cha_t *cha, md_acme_auth
     md_data_t data;
     int i;
 
+    (void)batch;
     (void)env;
     (void)md;
     if (md_array_str_index(acme_tls_1_domains, authz->domain, 0, 0) < 0) {
@@ -416,11 +662,128 @@ out:
     return rv;
 }
 
+static const char *dns01_cmd_get(const md_t *md, apr_table_t *env)
+{
+    return md->dns01_cmd? md->dns01_cmd : apr_table_get(env, MD_KEY_CMD_DNS01);
+}
+
+static int dns01_is_batched(apr_table_t *env)
+{
+    const char *dns01v = apr_table_get(env, MD_KEY_DNS01_VERSION);
+    return dns01v && !strcmp(dns01v, "3");
+}
+
+/* Invoke the dns-01 command once with `action` and all "domain token" pairs in `args` */
+static apr_status_t dns01_exec(const char *dns01_cmd, const char *action, 
+                               apr_array_header_t *args, const md_t *md, apr_pool_t *p)
+{
+    const char *cmdline;
+    const char * const *argv;
+    apr_status_t rv;
+    int exit_code = 0;
+
+    cmdline = apr_psprintf(p, "%s %s %s", dns01_cmd, action, apr_array_pstrcat(p, args, ' '));
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
+                  "%s: dns-01 %s command: %s", md->name, action, cmdline);
+    apr_tokenize_to_argv(cmdline, (char***)&argv, p);
+    if (APR_SUCCESS != (rv = md_util_exec(p, argv[0], argv, &exit_code))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                      "%s: dns-01 %s command failed to execute", md->name, action);
+    }
+    else if (exit_code) {
+        rv = APR_EGENERAL;
+        md_log_perror(MD_LOG_MARK, MD_LOG_INFO, rv, p, 
+                      "%s: dns-01 %s command returns %d", md->name, action, exit_code);
+    }
+    return rv;
+}
+
+typedef struct {
+    md_acme_authz_cha_t *cha;
+    md_acme_authz_t *authz;
+    const char *token;
+} dns01_pending_t;
+
+struct md_acme_dns01_batch_t {
+    const char *dns01_cmd;
+    apr_array_header_t *pending;    /* dns01_pending_t* */
+};
+
+md_acme_dns01_batch_t *md_acme_dns01_batch_make(const md_t *md, apr_table_t *env, 
+                                                apr_pool_t *p)
+{
+    md_acme_dns01_batch_t *batch;
+    const char *dns01_cmd;
+
+    if (!dns01_is_batched(env) || !(dns01_cmd = dns01_cmd_get(md, env))) {
+        return NULL;
+    }
+    batch = apr_pcalloc(p, sizeof(*batch));
+    batch->dns01_cmd = dns01_cmd;
+    batch->pending = apr_array_make(p, 5, sizeof(dns01_pending_t*));
+    return batch;
+}
+
+apr_status_t md_acme_dns01_batch_run(md_acme_dns01_batch_t *batch, md_acme_t *acme, 
+                                     const md_t *md, md_result_t *result, apr_pool_t *p)
+{
+    dns01_pending_t *pending;
+    apr_array_header_t *args;
+    authz_req_ctx ctx;
+    const char *event;
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    if (!batch || apr_is_empty_array(batch->pending)) goto out;
+
+    args = apr_array_make(p, batch->pending->nelts * 2, sizeof(const char*));
+    for (i = 0; i < batch->pending->nelts; ++i) {
+        pending = APR_ARRAY_IDX(batch->pending, i, dns01_pending_t*);
+        APR_ARRAY_PUSH(args, const char*) = pending->authz->domain;
+        APR_ARRAY_PUSH(args, const char*) = pending->token;
+    }
+    /* the command gets all records of the order at once and waits
+     * for their propagation only once */
+    md_result_activity_printf(result, "Setting up %d dns-01 challenges", batch->pending->nelts);
+    if (APR_SUCCESS != (rv = dns01_exec(batch->dns01_cmd, "setup", args, md, p))) {
+        md_result_printf(result, rv, "dns-01 setup command failed for %d domains of %s", 
+                         batch->pending->nelts, md->name);
+        md_result_log(result, MD_LOG_WARNING);
+        goto out;
+    }
+
+    for (i = 0; i < batch->pending->nelts; ++i) {
+        pending = APR_ARRAY_IDX(batch->pending, i, dns01_pending_t*);
+        event = apr_psprintf(p, "challenge-setup:%s:%s", MD_AUTHZ_TYPE_DNS01, 
+                             pending->authz->domain);
+        if (APR_SUCCESS != (rv = md_result_raise(result, event, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p,
+                          "%s: event '%s' failed. aborting challenge setup",
+                          pending->authz->domain, event);
+            goto out;
+        }
+    }
+    /* all challenges are setup, tell ACME server so it may (re)try verification */
+    for (i = 0; i < batch->pending->nelts; ++i) {
+        pending = APR_ARRAY_IDX(batch->pending, i, dns01_pending_t*);
+        authz_req_ctx_init(&ctx, acme, NULL, pending->authz, p);
+        ctx.challenge = pending->cha;
+        rv = md_acme_POST(acme, pending->cha->uri, on_init_authz_resp, authz_http_set, 
+                          NULL, NULL, &ctx);
+        if (APR_SUCCESS != rv) goto out;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: dns-01 setup succeeded for %d domains",
+                  md->name, batch->pending->nelts);
+out:
+    return rv;
+}
+
 static apr_status_t cha_dns_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t *authz, 
                                      md_acme_t *acme, md_store_t *store, 
                                      md_pkeys_spec_t *key_specs,
                                      apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                      apr_table_t *env, md_result_t *result,
+                                     md_acme_dns01_batch_t *batch,
                                      const char **psetup_token, apr_pool_t *p)
 {
     const char *token;
@@ -436,9 +799,7 @@ static apr_status_t cha_dns_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t *
     (void)key_specs;
     (void)acme_tls_1_domains;
 
-    dns01_cmd = md->dns01_cmd;
-    if (!dns01_cmd)
-      dns01_cmd = apr_table_get(env, MD_KEY_CMD_DNS01);
+    dns01_cmd = dns01_cmd_get(md, env);
     if (!dns01_cmd) {
         rv = APR_ENOTIMPL;
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: dns-01 command not set", 
@@ -458,6 +819,20 @@ static apr_status_t cha_dns_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t *
         goto out;
     }
 
+    if (batch) {
+        dns01_pending_t *pending;
+
+        /* setup is done for all domains of the order in md_acme_dns01_batch_run() */
+        pending = apr_pcalloc(p, sizeof(*pending));
+        pending->cha = cha;
+        pending->authz = authz;
+        pending->token = token;
+        APR_ARRAY_PUSH(batch->pending, dns01_pending_t*) = pending;
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "%s: dns-01 setup queued for %s",
+                      md->name, authz->domain);
+        goto out;
+    }
+
     cmdline = apr_psprintf(p, "%s setup %s %s", dns01_cmd, authz->domain, token); 
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
                   "%s: dns-01 setup command: %s", authz->domain, cmdline);
@@ -509,9 +884,7 @@ static apr_status_t cha_dns_01_teardown(md_store_t *store, const char *domain, c
     
     (void)store;
 
-    dns01_cmd = md->dns01_cmd;
-    if (!dns01_cmd)
-      dns01_cmd = apr_table_get(env, MD_KEY_CMD_DNS01);
+    dns01_cmd = dns01_cmd_get(md, env);
     if (!dns01_cmd) {
         rv = APR_ENOTIMPL;
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "%s: dns-01 command not set for %s",
@@ -519,7 +892,7 @@ static apr_status_t cha_dns_01_teardown(md_store_t *store, const char *domain, c
         goto out;
     }
     dns01v = apr_table_get(env, MD_KEY_DNS01_VERSION);
-    if (!dns01v || strcmp(dns01v, "2")) {
+    if (!dns01v || (strcmp(dns01v, "2") && strcmp(dns01v, "3"))) {
         /* use older version of teardown args with only domain, remove token */
         tmp = apr_pstrdup(p, domain);
         s = strchr(tmp, ' ');
@@ -548,11 +921,21 @@ static apr_status_t cha_teardown_dir(md_store_t *store, const char *domain, cons
     return md_store_purge(store, p, MD_SG_CHALLENGES, domain);
 }
 
+static apr_status_t cha_http_01_teardown(md_store_t *store, const char *domain, const md_t *md,
+                                         apr_table_t *env, apr_pool_t *p)
+{
+    if (http01_publish) {
+        http01_publish(http01_publish_baton, domain, NULL, p);
+    }
+    return cha_teardown_dir(store, domain, md, env, p);
+}
+
 typedef apr_status_t cha_setup(md_acme_authz_cha_t *cha, md_acme_authz_t *authz, 
                                md_acme_t *acme, md_store_t *store, 
                                md_pkeys_spec_t *key_specs,
                                apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                apr_table_t *env, md_result_t *result,
+                               md_acme_dns01_batch_t *batch,
                                const char **psetup_token, apr_pool_t *p);
                                
 typedef apr_status_t cha_teardown(md_store_t *store, const char *domain, const md_t *md,
@@ -565,7 +948,7 @@ typedef struct {
 } cha_type;
 
 static const cha_type CHA_TYPES[] = {
-    { MD_AUTHZ_TYPE_HTTP01,     cha_http_01_setup,      cha_teardown_dir },
+    { MD_AUTHZ_TYPE_HTTP01,     cha_http_01_setup,      cha_http_01_teardown },
     { MD_AUTHZ_TYPE_TLSALPN01,  cha_tls_alpn_01_setup,  cha_teardown_dir },
     { MD_AUTHZ_TYPE_DNS01,      cha_dns_01_setup,       cha_dns_01_teardown },
 };
@@ -606,7 +989,7 @@ apr_status_t md_acme_authz_respond(md_acme_authz_t *authz, md_acme_t *acme, md_s
                                    apr_array_header_t *challenges, md_pkeys_spec_t *key_specs,
                                    apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                    apr_table_t *env, apr_pool_t *p, const char **psetup_token,
-                                   md_result_t *result)
+                                   md_result_t *result, md_acme_dns01_batch_t *batch)
 {
     apr_status_t rv;
     int i, j;
@@ -650,7 +1033,7 @@ apr_status_t md_acme_authz_respond(md_acme_authz_t *authz, md_acme_t *acme, md_s
                                               fctx.accepted->type, authz->domain);
                     rv = CHA_TYPES[j].setup(fctx.accepted, authz, acme, store, key_specs,
                                             acme_tls_1_domains, md, env, result,
-                                            psetup_token, p);
+                                            batch, psetup_token, p);
                     if (APR_SUCCESS == rv) {
                         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
                                       "%s: set up challenge '%s' for %s", 
@@ -714,3 +1097,31 @@ apr_status_t md_acme_authz_teardown(struct md_store_t *store, const char *token,
     return APR_SUCCESS;
 }
 
+
+apr_status_t md_acme_authz_teardown_all(struct md_store_t *store, apr_array_header_t *setup_tokens,
+                                        const md_t *md, apr_table_t *env, apr_pool_t *p)
+{
+    apr_array_header_t *args;
+    const char *token, *dns01_cmd = NULL, *prefix = MD_AUTHZ_TYPE_DNS01 ":";
+    apr_size_t prefix_len = strlen(prefix);
+    apr_status_t rv = APR_SUCCESS;
+    int i, batched;
+
+    batched = dns01_is_batched(env) && (dns01_cmd = dns01_cmd_get(md, env));
+    args = apr_array_make(p, setup_tokens->nelts, sizeof(const char*));
+    for (i = 0; i < setup_tokens->nelts; ++i) {
+        token = APR_ARRAY_IDX(setup_tokens, i, const char*);
+        if (!token) continue;
+        if (batched && !strncmp(prefix, token, prefix_len)) {
+            APR_ARRAY_PUSH(args, const char*) = token + prefix_len;
+        }
+        else {
+            md_acme_authz_teardown(store, token, md, env, p);
+        }
+    }
+    if (!apr_is_empty_array(args)) {
+        /* one invocation for all dns-01 records of the order */
+        rv = dns01_exec(dns01_cmd, "teardown", args, md, p);
+    }
+    return rv;
+}
@@ -27,6 +27,7 @@ struct md_pkey_spec_t;
 struct md_result_t;
 
 typedef struct md_acme_challenge_t md_acme_challenge_t;
+typedef struct md_acme_dns01_batch_t md_acme_dns01_batch_t;
 
 /**************************************************************************************************/
 /* authorization request for a specific domain name */
@@ -53,10 +54,24 @@ struct md_acme_authz_t {
     const char *error_detail;
     const struct md_json_t *error_subproblems;
     struct md_json_t *resource;
+    apr_time_t retry_at;            /* when the server wants us to ask again or 0 */
 };
 
 #define MD_FN_HTTP01            "acme-http-01.txt"
 
+/**
+ * Called when the content of a http-01 challenge for a domain has been set up
+ * in the store, or with key_authz == NULL when it is torn down. Allows to answer
+ * challenge requests without reading the store.
+ */
+typedef void md_acme_http01_publish_cb(void *baton, const char *domain,
+                                       const char *key_authz, apr_pool_t *p);
+
+/**
+ * Set the callback for http-01 challenges set up in this process, NULL to disable.
+ */
+void md_acme_authz_set_http01_publish(md_acme_http01_publish_cb *cb, void *baton);
+
 void tls_alpn01_fnames(apr_pool_t *p, struct md_pkey_spec_t *kspec, char **keyfn, char **certfn );
 
 md_acme_authz_t *md_acme_authz_create(apr_pool_t *p);
@@ -65,15 +80,91 @@ apr_status_t md_acme_authz_retrieve(md_acme_t *acme, apr_pool_t *p, const char *
                                     md_acme_authz_t **pauthz);
 apr_status_t md_acme_authz_update(md_acme_authz_t *authz, struct md_acme_t *acme, apr_pool_t *p);
 
+/**
+ * Update all authorizations in the array (md_acme_authz_t*) with parallel requests.
+ * @return APR_SUCCESS if all were updated, else the status of the first failure
+ */
+apr_status_t md_acme_authz_update_all(struct apr_array_header_t *authzs, 
+                                      struct md_acme_t *acme, apr_pool_t *p);
+
 apr_status_t md_acme_authz_respond(md_acme_authz_t *authz, struct md_acme_t *acme, 
                                    struct md_store_t *store, apr_array_header_t *challenges, 
                                    struct md_pkeys_spec_t *key_spec,
                                    apr_array_header_t *acme_tls_1_domains, const md_t *md,
                                    struct apr_table_t *env,
                                    apr_pool_t *p, const char **setup_token,
-                                   struct md_result_t *result);
+                                   struct md_result_t *result, md_acme_dns01_batch_t *batch);
+
+/**
+ * Get a batch for setting up the dns-01 challenges of all authorizations of an
+ * order with a single invocation of the dns-01 command, when configured with
+ * `MDChallengeDns01Version 3`. Returns NULL otherwise.
+ * Passed to md_acme_authz_respond(), dns-01 challenges are only collected and
+ * performed by md_acme_dns01_batch_run().
+ */
+md_acme_dns01_batch_t *md_acme_dns01_batch_make(const md_t *md, struct apr_table_t *env,
+                                                apr_pool_t *p);
+
+/**
+ * Run the dns-01 command once to set up all collected challenges and then
+ * tell the ACME server about them. Does nothing for a NULL or empty batch.
+ */
+apr_status_t md_acme_dns01_batch_run(md_acme_dns01_batch_t *batch, struct md_acme_t *acme,
+                                     const md_t *md, struct md_result_t *result, apr_pool_t *p);
+
+/**************************************************************************************************/
+/* valid authorizations of an account */
+
+/* Kept by identifier in MD_SG_STAGING beside the CA limits (MD_ACME_LIMITS_NAME),
+ * where the renewal watchdog may write, one file per account: "authzs-<id>.json" */
+#define MD_FN_AUTHZS_PREFIX         "authzs-"
+/* Authorizations that expire sooner are not reused */
+#define MD_ACME_AUTHZ_REUSE_MIN     apr_time_from_sec(MD_SECS_PER_HOUR)
+
+/**
+ * Serialize updates of the remembered authorizations in this process, for
+ * as long as the pool lives. The registry does this when it is created.
+ */
+apr_status_t md_acme_authz_known_init(apr_pool_t *p);
+
+/**
+ * Remember a valid authorization of the current account. When an order for
+ * another MD of the same account is given the same authorization by the CA,
+ * it does not need to be looked at again.
+ */
+void md_acme_authz_remember(md_acme_authz_t *authz, struct md_acme_t *acme, 
+                            struct md_store_t *store, apr_pool_t *p);
+
+/**
+ * Get the identifier if url is a valid authorization of the current account,
+ * remembered before and not about to expire, NULL otherwise.
+ */
+const char *md_acme_authz_known_valid(struct md_acme_t *acme, struct md_store_t *store, 
+                                      const char *url, apr_pool_t *p);
+
+/**
+ * Forget the remembered authorization for the identifier, e.g. when the CA
+ * no longer reports it as valid.
+ */
+void md_acme_authz_forget(struct md_acme_t *acme, struct md_store_t *store, 
+                          const char *domain, apr_pool_t *p);
+
+/**
+ * Forget all authorizations of the current account, e.g. when an order did
+ * not become ready after all.
+ */
+void md_acme_authz_forget_all(struct md_acme_t *acme, struct md_store_t *store, apr_pool_t *p);
 
 apr_status_t md_acme_authz_teardown(struct md_store_t *store, const char *setup_token, 
                                     const md_t *md, struct apr_table_t *env, apr_pool_t *p);
 
+/**
+ * Tear down all setup tokens (const char*, NULL entries are skipped) of an order.
+ * With `MDChallengeDns01Version 3`, all dns-01 challenges are removed with a
+ * single invocation of the dns-01 command.
+ */
+apr_status_t md_acme_authz_teardown_all(struct md_store_t *store, 
+                                        apr_array_header_t *setup_tokens, const md_t *md, 
+                                        struct apr_table_t *env, apr_pool_t *p);
+
 #endif /* md_acme_authz_h */
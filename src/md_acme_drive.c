@@ -21,6 +21,7 @@
 #include <apr_strings.h>
 #include <apr_buckets.h>
 #include <apr_hash.h>
+#include <apr_thread_proc.h>
 #include <apr_uri.h>
 
 #include "md.h"
@@ -28,6 +29,7 @@
 #include "md_json.h"
 #include "md_jws.h"
 #include "md_http.h"
+#include "md_keypool.h"
 #include "md_log.h"
 #include "md_result.h"
 #include "md_reg.h"
@@ -37,6 +39,8 @@
 #include "md_acme.h"
 #include "md_acme_acct.h"
 #include "md_acme_authz.h"
+#include "md_acme_issuers.h"
+#include "md_acme_limit.h"
 #include "md_acme_order.h"
 
 #include "md_acme_drive.h"
@@ -78,6 +82,26 @@ static apr_status_t save_acct_staged(md_acme_t *acme, md_store_t *store,
     return rv;
 }
 
+apr_status_t md_acme_drive_admit(md_proto_driver_t *d, md_acme_limit_kind_t kind,
+                                 md_result_t *result)
+{
+    md_acme_driver_t *ad = d->baton;
+    apr_time_t next;
+    apr_status_t rv;
+    
+    rv = md_acme_limits_admit(md_reg_ca_limits_get(d->reg), ad->acme->url, kind, &next, d->p);
+    if (APR_SUCCESS != rv) {
+        md_result_problem_printf(result, rv, MD_ACME_PROBLEM_CA_LIMIT, 
+                                 "Holding back request for new %s at %s to stay within "
+                                 "its rate limits, next possible in %s.", 
+                                 md_acme_limit_kind_name(kind), ad->acme->url,
+                                 md_duration_print(d->p, next - apr_time_now()));
+        md_result_delay_set(result, next);
+        md_result_log(result, MD_LOG_INFO);
+    }
+    return rv;
+}
+
 apr_status_t md_acme_drive_set_acct(md_proto_driver_t *d, md_result_t *result) 
 {
     md_acme_driver_t *ad = d->baton;
@@ -165,6 +189,9 @@ apr_status_t md_acme_drive_set_acct(md_proto_driver_t *d, md_result_t *result)
             md_result_log(result, MD_LOG_INFO);
         }
 
+        rv = md_acme_drive_admit(d, MD_ACME_LIMIT_ACCOUNTS, result);
+        if (APR_SUCCESS != rv) goto leave;
+        
         rv = md_acme_acct_register(ad->acme, d->store, md, d->p);
         if (APR_SUCCESS != rv) {
             if (APR_SUCCESS != ad->acme->last->status) {
@@ -205,14 +232,66 @@ static void get_up_link(md_proto_driver_t *d, apr_table_t *headers)
     }
 } 
 
-static apr_status_t add_http_certs(apr_array_header_t *chain, apr_pool_t *p,
-                                   const md_http_response_t *res)
+/* A certificate (chain) being retrieved */
+typedef struct {
+    md_proto_driver_t *d;
+    md_cert_chain_reader_t *reader; /* adds PEM certificates while they arrive */
+    int count;                      /* certificates in the chain before */
+    const md_http_response_t *res;  /* the response ct was parsed from */
+    const char *ct;                 /* its media type, without parameters */
+} cert_fetch_t;
+
+/* The media type of the response, parsed once when its body starts */
+static const char *fetch_ct(cert_fetch_t *fetch, const md_http_response_t *res)
+{
+    if (fetch->res != res) {
+        fetch->res = res;
+        fetch->ct = md_util_parse_ct(res->req->pool, apr_table_get(res->headers, "Content-Type"));
+    }
+    return fetch->ct;
+}
+
+static int is_pem_chain(cert_fetch_t *fetch, const md_http_response_t *res)
+{
+    const char *ct = fetch_ct(fetch, res);
+    
+    return ct && !strcmp("application/pem-certificate-chain", ct);
+}
+
+static apr_status_t on_cert_body(const md_http_response_t *res, const char *data, 
+                                 apr_size_t len, void *baton)
+{
+    cert_fetch_t *fetch = baton;
+    
+    if (is_pem_chain(fetch, res)) {
+        return md_cert_chain_reader_body_cb(res, data, len, fetch->reader);
+    }
+    /* DER certificates and other content types are parsed at the end */
+    return apr_brigade_write(res->body, NULL, NULL, data, len);
+}
+
+static apr_status_t cert_fetch_GET(md_proto_driver_t *d, const char *url, 
+                                   md_acme_req_res_cb *on_res)
+{
+    md_acme_driver_t *ad = d->baton;
+    cert_fetch_t *fetch;
+    apr_status_t rv;
+    
+    fetch = apr_pcalloc(d->p, sizeof(*fetch));
+    fetch->d = d;
+    fetch->count = ad->cred->chain->nelts;
+    rv = md_cert_chain_reader_create(&fetch->reader, ad->cred->chain, d->p);
+    if (APR_SUCCESS != rv) return rv;
+    return md_acme_GET_streamed(ad->acme, url, on_cert_body, fetch, on_res, NULL, fetch);
+}
+
+static apr_status_t add_http_certs(cert_fetch_t *fetch, apr_array_header_t *chain, 
+                                   apr_pool_t *p, const md_http_response_t *res)
 {
     apr_status_t rv = APR_SUCCESS;
     const char *ct;
     
-    ct = apr_table_get(res->headers, "Content-Type");
-    ct = md_util_parse_ct(res->req->pool, ct);
+    ct = fetch_ct(fetch, res);
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, p,
                   "parse certs from %s -> %d (%s)", res->req->url, res->status, ct);
     if (ct && !strcmp("application/x-pkcs7-mime", ct)) {
@@ -220,9 +299,11 @@ static apr_status_t add_http_certs(apr_array_header_t *chain, apr_pool_t *p,
         goto out; 
     }
 
-    /* Lets try to read one or more certificates */
-    if (APR_SUCCESS != (rv = md_cert_chain_read_http(chain, p, res))
-        && APR_STATUS_IS_ENOENT(rv)) {
+    /* Lets try to read one or more certificates, PEM ones have been parsed
+     * while the body arrived */
+    rv = is_pem_chain(fetch, res)? 
+         md_cert_chain_reader_finish(fetch->reader) : md_cert_chain_read_http(chain, p, res);
+    if (APR_SUCCESS != rv && APR_STATUS_IS_ENOENT(rv)) {
         rv = APR_EAGAIN;
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
                       "cert not in response from %s", res->req->url);
@@ -231,18 +312,32 @@ out:
     return rv;
 }
 
+/* Use the cached instances of intermediates that came with the certificate. */
+static void intern_issuers(md_proto_driver_t *d, int from)
+{
+    md_acme_driver_t *ad = d->baton;
+    md_acme_issuers_t *issuers = md_reg_issuers_get(d->reg);
+    md_cert_t **pcert;
+    int i;
+    
+    for (i = (from > 1)? from : 1; i < ad->cred->chain->nelts; ++i) {
+        pcert = &APR_ARRAY_IDX(ad->cred->chain, i, md_cert_t*);
+        *pcert = md_acme_issuers_add(issuers, NULL, *pcert, NULL, d->p);
+    }
+}
+
 static apr_status_t on_add_cert(md_acme_t *acme, const md_http_response_t *res, void *baton)
 {
-    md_proto_driver_t *d = baton;
+    cert_fetch_t *fetch = baton;
+    md_proto_driver_t *d = fetch->d;
     md_acme_driver_t *ad = d->baton;
     apr_status_t rv = APR_SUCCESS;
-    int count;
     
     (void)acme;
-    count = ad->cred->chain->nelts;
-    if (APR_SUCCESS == (rv = add_http_certs(ad->cred->chain, d->p, res))) {
+    if (APR_SUCCESS == (rv = add_http_certs(fetch, ad->cred->chain, d->p, res))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%d certs parsed", 
-                      ad->cred->chain->nelts - count);
+                      ad->cred->chain->nelts - fetch->count);
+        intern_issuers(d, fetch->count);
         get_up_link(d, res->headers);
     }
     return rv;
@@ -256,7 +351,7 @@ static apr_status_t get_cert(void *baton, int attempt)
     (void)attempt;
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, d->p, "retrieving cert from %s",
                   ad->order->certificate);
-    return md_acme_GET(ad->acme, ad->order->certificate, NULL, NULL, on_add_cert, NULL, d);
+    return cert_fetch_GET(d, ad->order->certificate, on_add_cert);
 }
 
 apr_status_t md_acme_drive_cert_poll(md_proto_driver_t *d, int only_once)
@@ -280,6 +375,115 @@ apr_status_t md_acme_drive_cert_poll(md_proto_driver_t *d, int only_once)
     return rv;
 }
 
+/**************************************************************************************************/
+/* private key generation */
+
+static apr_status_t stage_privkey(md_pkey_t **ppkey, md_proto_driver_t *d, 
+                                  md_pkey_spec_t *spec, apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    /* use a key generated ahead of time, if there is one */
+    rv = md_keypool_claim(ppkey, md_reg_keypool_get(d->reg), spec, p);
+    if (APR_SUCCESS != rv) rv = md_pkey_gen(ppkey, p, spec);
+    if (APR_SUCCESS == rv) {
+        rv = md_pkey_save(d->store, p, MD_SG_STAGING, d->md->name, spec, *ppkey, 1);
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                  "%s: generate %s privkey", d->md->name, md_pkey_spec_name(spec));
+    return rv;
+}
+
+#if APR_HAS_THREADS
+
+typedef struct {
+    md_proto_driver_t *d;
+    md_pkey_spec_t *spec;
+    apr_status_t rv;
+} key_gen_t;
+
+static void * APR_THREAD_FUNC key_gen_worker(apr_thread_t *thread, void *baton)
+{
+    key_gen_t *gen = baton;
+    apr_allocator_t *allocator;
+    apr_pool_t *ptemp;
+    md_pkey_t *privkey;
+    
+    /* generators run concurrently, each needs a pool with its own allocator */
+    apr_allocator_create(&allocator);
+    apr_allocator_max_free_set(allocator, 1);
+    gen->rv = apr_pool_create_ex(&ptemp, NULL, NULL, allocator);
+    if (APR_SUCCESS != gen->rv) {
+        apr_allocator_destroy(allocator);
+        goto leave;
+    }
+    apr_allocator_owner_set(allocator, ptemp);
+    apr_pool_tag(ptemp, "md_key_gen");
+    /* the key is picked up from staging again when its CSR is created */
+    gen->rv = stage_privkey(&privkey, gen->d, gen->spec, ptemp);
+    apr_pool_destroy(ptemp);
+leave:
+    apr_thread_exit(thread, gen->rv);
+    return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+/**
+ * Generate the private keys of all credentials still to be renewed at the same
+ * time, so that an MD with several key specs does not wait for one key after
+ * the other. Keys that cannot be generated here are tried again in
+ * md_acme_drive_setup_cred_chain() when their order is finalized.
+ */
+static void stage_missing_privkeys(md_proto_driver_t *d, md_result_t *result)
+{
+#if APR_HAS_THREADS
+    md_acme_driver_t *ad = d->baton;
+    md_credentials_t *cred;
+    md_pkey_t *privkey;
+    apr_array_header_t *gens;
+    apr_thread_t **threads;
+    key_gen_t *gen;
+    apr_status_t rv, trv;
+    int i, started = 0;
+    
+    gens = apr_array_make(d->p, ad->creds->nelts, sizeof(key_gen_t));
+    for (i = 0; i < ad->creds->nelts; ++i) {
+        cred = APR_ARRAY_IDX(ad->creds, i, md_credentials_t*);
+        if (cred->pkey && !md_array_is_empty(cred->chain)) continue;
+        rv = md_pkey_load(d->store, MD_SG_STAGING, d->md->name, cred->spec, &privkey, d->p);
+        if (!APR_STATUS_IS_ENOENT(rv)) continue;
+        gen = apr_array_push(gens);
+        gen->d = d;
+        gen->spec = cred->spec;
+        gen->rv = APR_EINCOMPLETE;
+    }
+    /* a single key is generated when its order is finalized */
+    if (gens->nelts < 2) return;
+    
+    md_result_activity_printf(result, "Generating %d private keys for %s", 
+                              gens->nelts, d->md->name);
+    threads = apr_pcalloc(d->p, (apr_size_t)gens->nelts * sizeof(apr_thread_t *));
+    for (i = 0; i < gens->nelts; ++i) {
+        gen = &APR_ARRAY_IDX(gens, i, key_gen_t);
+        if (APR_SUCCESS != (rv = apr_thread_create(&threads[i], NULL, key_gen_worker, gen, d->p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, 
+                          "%s: unable to start key generation thread", d->md->name);
+            break;
+        }
+        ++started;
+    }
+    for (i = 0; i < started; ++i) {
+        apr_thread_join(&trv, threads[i]);
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, d->p, 
+                  "%s: generated %d private keys in parallel", d->md->name, started);
+#else
+    (void)d;
+    (void)result;
+#endif
+}
+
 /**************************************************************************************************/
 /* order finalization */
 
@@ -365,11 +569,7 @@ apr_status_t md_acme_drive_setup_cred_chain(md_proto_driver_t *d, md_result_t *r
         
     rv = md_pkey_load(d->store, MD_SG_STAGING, d->md->name, spec, &privkey, d->p);
     if (APR_STATUS_IS_ENOENT(rv)) {
-        if (APR_SUCCESS == (rv = md_pkey_gen(&privkey, d->p, spec))) {
-            rv = md_pkey_save(d->store, d->p, MD_SG_STAGING, d->md->name, spec, privkey, 1);
-        }
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, 
-                      "%s: generate %s privkey", d->md->name, md_pkey_spec_name(spec));
+        rv = stage_privkey(&privkey, d, spec, d->p);
     }
     if (APR_SUCCESS != rv) goto leave;
     
@@ -394,7 +594,8 @@ leave:
 
 static apr_status_t on_add_chain(md_acme_t *acme, const md_http_response_t *res, void *baton)
 {
-    md_proto_driver_t *d = baton;
+    cert_fetch_t *fetch = baton;
+    md_proto_driver_t *d = fetch->d;
     md_acme_driver_t *ad = d->baton;
     apr_status_t rv = APR_SUCCESS;
     const char *ct;
@@ -407,7 +608,7 @@ static apr_status_t on_add_chain(md_acme_t *acme, const md_http_response_t *res,
         return APR_SUCCESS;
     }
     
-    if (APR_SUCCESS == (rv = add_http_certs(ad->cred->chain, d->p, res))) {
+    if (APR_SUCCESS == (rv = add_http_certs(fetch, ad->cred->chain, d->p, res))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "chain cert parsed");
         get_up_link(d, res->headers);
     }
@@ -418,7 +619,9 @@ static apr_status_t get_chain(void *baton, int attempt)
 {
     md_proto_driver_t *d = baton;
     md_acme_driver_t *ad = d->baton;
-    const char *prev_link = NULL;
+    md_acme_issuers_t *issuers = md_reg_issuers_get(d->reg);
+    const char *prev_link = NULL, *up;
+    md_cert_t *cert, **pcert;
     apr_status_t rv = APR_SUCCESS;
 
     while (APR_SUCCESS == rv && ad->cred->chain->nelts < 10) {
@@ -427,9 +630,16 @@ static apr_status_t get_chain(void *baton, int attempt)
         if (ad->chain_up_link && (!prev_link || strcmp(prev_link, ad->chain_up_link))) {
             prev_link = ad->chain_up_link;
 
+            if (APR_SUCCESS == md_acme_issuers_get(&cert, &up, issuers, prev_link, d->p)) {
+                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, 
+                              "next chain cert from cache for %s", prev_link);
+                APR_ARRAY_PUSH(ad->cred->chain, md_cert_t*) = cert;
+                ad->chain_up_link = up;
+                continue;
+            }
             md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, 
                           "next chain cert at  %s", ad->chain_up_link);
-            rv = md_acme_GET(ad->acme, ad->chain_up_link, NULL, NULL, on_add_chain, NULL, d);
+            rv = cert_fetch_GET(d, ad->chain_up_link, on_add_chain);
             
             if (APR_SUCCESS == rv && nelts == ad->cred->chain->nelts) {
                 break;
@@ -439,6 +649,13 @@ static apr_status_t get_chain(void *baton, int attempt)
                               "error retrieving certificate from %s", ad->chain_up_link);
                 return rv;
             }
+            else if (nelts + 1 == ad->cred->chain->nelts) {
+                /* the common case of one issuer per link, remember for all MDs */
+                up = (ad->chain_up_link && strcmp(prev_link, ad->chain_up_link))?
+                     ad->chain_up_link : NULL;
+                pcert = &APR_ARRAY_IDX(ad->cred->chain, nelts, md_cert_t*);
+                *pcert = md_acme_issuers_add(issuers, prev_link, *pcert, up, d->p);
+            }
         }
         else if (ad->cred->chain->nelts <= 1) {
             /* This cannot be the complete chain (no one signs new web certs with their root)
@@ -780,6 +997,7 @@ static apr_status_t acme_renew(md_proto_driver_t *d, md_result_t *result)
     }
 
     if (APR_SUCCESS != load_missing_creds(d)) {
+        stage_missing_privkeys(d, result);
         for (i = 0; i < ad->creds->nelts; ++i) {
             ad->cred = APR_ARRAY_IDX(ad->creds, i, md_credentials_t*);
             if (!ad->cred->pkey || md_array_is_empty(ad->cred->chain)) {
@@ -926,9 +1144,26 @@ out:
 
 static apr_status_t acme_driver_renew(md_proto_driver_t *d, md_result_t *result)
 {
+    md_acme_driver_t *ad = d->baton;
     apr_status_t rv;
 
     rv = acme_renew(d, result);
+    if (APR_SUCCESS != rv && ad->acme && ad->acme->rate_limited_until) {
+        /* The CA refused us due to its rate limits. This affects all MDs
+         * using it, so nobody asks again before the CA wants us to. */
+        md_acme_limits_hold(md_reg_ca_limits_get(d->reg), ad->acme->url, 
+                            ad->acme->rate_limited_until, d->p);
+        md_result_delay_set(result, ad->acme->rate_limited_until);
+    }
+    else if (APR_SUCCESS != rv && ad->acme && ad->acme->acct_id
+             && md_acme_problem_is_acct_gone(ad->acme->last->problem)) {
+        /* The account may have been used on the strength of a recent verification
+         * in the index. Drop it there, so the next attempt asks the CA again. At
+         * worst, this costs one more account update. */
+        md_acme_acct_index_remove(d->store, ad->acme->acct_id, d->p);
+    }
+    /* record how much time we spent talking to whom */
+    if (ad->acme) md_result_http_stats_add(result, ad->acme->totals);
     md_result_log(result, MD_LOG_DEBUG);
     return rv;
 }
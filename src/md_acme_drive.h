@@ -45,6 +45,13 @@ typedef struct md_acme_driver_t {
     
 } md_acme_driver_t;
 
+/**
+ * Ask the admission control of the CA if a new order or account may be
+ * created now. If not, the result has the problem MD_ACME_PROBLEM_CA_LIMIT
+ * and is delayed to when this becomes possible.
+ */
+apr_status_t md_acme_drive_admit(struct md_proto_driver_t *d, md_acme_limit_kind_t kind,
+                                 struct md_result_t *result);
 apr_status_t md_acme_drive_set_acct(struct md_proto_driver_t *d, 
                                     struct md_result_t *result);
 apr_status_t md_acme_drive_setup_cred_chain(struct md_proto_driver_t *d, 
@@ -0,0 +1,221 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+#include <assert.h>
+#include <stdio.h>
+
+#include <apr_lib.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_util.h"
+
+#include "md_acme_limit.h"
+#include "md_acme_issuers.h"
+
+typedef struct {
+    const char *sha256;             /* fingerprint, the identity of the entry */
+    const char *url;                /* where it was retrieved, or NULL */
+    const char *up;                 /* the up link that came with it, or NULL */
+    md_cert_t *cert;
+    apr_time_t not_after;
+} issuer_t;
+
+struct md_acme_issuers_t {
+    apr_pool_t *p;
+    struct md_store_t *store;
+    apr_hash_t *by_sha256;          /* fingerprint -> issuer_t* */
+    apr_hash_t *by_url;             /* url -> issuer_t* */
+    apr_time_t loaded;              /* modification time of the store file read */
+    apr_thread_mutex_t *mutex;      /* serializes access from renewal workers */
+};
+
+apr_status_t md_acme_issuers_create(md_acme_issuers_t **pissuers, apr_pool_t *p,
+                                    struct md_store_t *store)
+{
+    md_acme_issuers_t *issuers;
+    apr_status_t rv;
+    
+    issuers = apr_pcalloc(p, sizeof(*issuers));
+    issuers->p = p;
+    issuers->store = store;
+    issuers->by_sha256 = apr_hash_make(p);
+    issuers->by_url = apr_hash_make(p);
+    
+    rv = apr_thread_mutex_create(&issuers->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    *pissuers = (APR_SUCCESS == rv)? issuers : NULL;
+    return rv;
+}
+
+/* Entries are never freed, certificates handed out may be part of chains
+ * still being assembled. Only new fingerprints allocate from the cache's pool. */
+static issuer_t *issuer_intern(md_acme_issuers_t *issuers, const char *sha256,
+                               md_cert_t *cert, const char *url, const char *up)
+{
+    issuer_t *issuer;
+    
+    issuer = apr_hash_get(issuers->by_sha256, sha256, APR_HASH_KEY_STRING);
+    if (!issuer) {
+        issuer = apr_pcalloc(issuers->p, sizeof(*issuer));
+        issuer->sha256 = apr_pstrdup(issuers->p, sha256);
+        issuer->cert = cert;
+        issuer->not_after = md_cert_get_not_after(cert);
+        apr_hash_set(issuers->by_sha256, issuer->sha256, APR_HASH_KEY_STRING, issuer);
+    }
+    if (url && (!issuer->url || strcmp(url, issuer->url))) {
+        issuer->url = apr_pstrdup(issuers->p, url);
+        issuer->up = up? apr_pstrdup(issuers->p, up) : NULL;
+        apr_hash_set(issuers->by_url, issuer->url, APR_HASH_KEY_STRING, issuer);
+    }
+    return issuer;
+}
+
+static int issuer_from_json(void *baton, size_t index, md_json_t *json)
+{
+    md_acme_issuers_t *issuers = baton;
+    const char *sha256, *s64;
+    md_cert_t *cert;
+    
+    (void)index;
+    sha256 = md_json_gets(json, MD_KEY_SHA256_FINGERPRINT, NULL);
+    s64 = md_json_gets(json, MD_KEY_CERT, NULL);
+    if (sha256 && s64 
+        && !apr_hash_get(issuers->by_sha256, sha256, APR_HASH_KEY_STRING)
+        && APR_SUCCESS == md_cert_from_base64url(&cert, s64, issuers->p)) {
+        issuer_intern(issuers, sha256, cert, md_json_gets(json, MD_KEY_URL, NULL),
+                      md_json_gets(json, MD_KEY_UP, NULL));
+    }
+    return 1;
+}
+
+/* Pick up what other processes sharing the store have added. */
+static void issuers_sync(md_acme_issuers_t *issuers, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_time_t modified;
+    
+    modified = md_store_get_modified(issuers->store, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                                     MD_FN_ISSUERS, p);
+    if (!modified || modified == issuers->loaded) return;
+    if (APR_SUCCESS == md_store_load_json(issuers->store, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                                          MD_FN_ISSUERS, &json, p)) {
+        md_json_itera(issuer_from_json, issuers, json, MD_KEY_ISSUERS, NULL);
+        issuers->loaded = modified;
+    }
+}
+
+static void issuers_save(md_acme_issuers_t *issuers, apr_pool_t *p)
+{
+    md_json_t *json, *jissuer;
+    apr_hash_index_t *hi;
+    issuer_t *issuer;
+    const char *s64;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv;
+    
+    json = md_json_create(p);
+    for (hi = apr_hash_first(p, issuers->by_sha256); hi; hi = apr_hash_next(hi)) {
+        issuer = apr_hash_this_val(hi);
+        if (issuer->not_after <= now
+            || APR_SUCCESS != md_cert_to_base64url(&s64, issuer->cert, p)) continue;
+        jissuer = md_json_create(p);
+        md_json_sets(issuer->sha256, jissuer, MD_KEY_SHA256_FINGERPRINT, NULL);
+        if (issuer->url) md_json_sets(issuer->url, jissuer, MD_KEY_URL, NULL);
+        if (issuer->up) md_json_sets(issuer->up, jissuer, MD_KEY_UP, NULL);
+        md_json_sets(s64, jissuer, MD_KEY_CERT, NULL);
+        md_json_addj(jissuer, json, MD_KEY_ISSUERS, NULL);
+    }
+    rv = md_store_save_json(issuers->store, p, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                            MD_FN_ISSUERS, json, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "saving %s", MD_FN_ISSUERS);
+        return;
+    }
+    issuers->loaded = md_store_get_modified(issuers->store, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                                            MD_FN_ISSUERS, p);
+}
+
+apr_status_t md_acme_issuers_get(md_cert_t **pcert, const char **pup,
+                                 md_acme_issuers_t *issuers, const char *url,
+                                 apr_pool_t *p)
+{
+    issuer_t *issuer;
+    apr_status_t rv = APR_ENOENT;
+    
+    *pcert = NULL;
+    *pup = NULL;
+    apr_thread_mutex_lock(issuers->mutex);
+    issuer = apr_hash_get(issuers->by_url, url, APR_HASH_KEY_STRING);
+    if (!issuer) {
+        issuers_sync(issuers, p);
+        issuer = apr_hash_get(issuers->by_url, url, APR_HASH_KEY_STRING);
+    }
+    if (issuer && issuer->not_after <= apr_time_now()) {
+        /* expired, the CA will have a new one by now */
+        apr_hash_set(issuers->by_url, url, APR_HASH_KEY_STRING, NULL);
+        apr_hash_set(issuers->by_sha256, issuer->sha256, APR_HASH_KEY_STRING, NULL);
+        issuer = NULL;
+    }
+    if (issuer) {
+        *pcert = issuer->cert;
+        *pup = issuer->up;
+        rv = APR_SUCCESS;
+    }
+    apr_thread_mutex_unlock(issuers->mutex);
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, rv, p, "issuer cache lookup %s", url);
+    return rv;
+}
+
+md_cert_t *md_acme_issuers_add(md_acme_issuers_t *issuers, const char *url,
+                               md_cert_t *cert, const char *up, apr_pool_t *p)
+{
+    issuer_t *issuer;
+    const char *sha256, *s64;
+    md_cert_t *copy;
+    int changed = 0;
+    
+    if (md_cert_has_expired(cert)
+        || APR_SUCCESS != md_cert_to_sha256_fingerprint(&sha256, cert, p)) return cert;
+    
+    apr_thread_mutex_lock(issuers->mutex);
+    issuers_sync(issuers, p);
+    issuer = apr_hash_get(issuers->by_sha256, sha256, APR_HASH_KEY_STRING);
+    if (!issuer) {
+        /* the cache outlives the pool of cert, keep a copy of its own */
+        if (APR_SUCCESS != md_cert_to_base64url(&s64, cert, p)
+            || APR_SUCCESS != md_cert_from_base64url(&copy, s64, issuers->p)) goto leave;
+        issuer = issuer_intern(issuers, sha256, copy, url, up);
+        changed = 1;
+    }
+    else if (url && (!issuer->url || strcmp(url, issuer->url))) {
+        issuer_intern(issuers, sha256, issuer->cert, url, up);
+        changed = 1;
+    }
+    if (changed) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "issuer cache: added %s from %s", 
+                      sha256, url? url : "chain");
+        issuers_save(issuers, p);
+    }
+    cert = issuer->cert;
+leave:
+    apr_thread_mutex_unlock(issuers->mutex);
+    return cert;
+}
@@ -0,0 +1,59 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef md_acme_issuers_h
+#define md_acme_issuers_h
+
+struct md_cert_t;
+struct md_store_t;
+
+#define MD_FN_ISSUERS                   "issuers.json"
+
+/**
+ * The intermediate certificates retrieved from ACME CAs when assembling the
+ * chain of a new certificate. Nearly all managed domains share the same few
+ * intermediates, so they are kept once, in memory and next to the CA rate
+ * limits in the store, and reused for all renewals until they expire.
+ *
+ * Certificates are identified by their SHA-256 fingerprint. Those retrieved
+ * from an `up` link are also found by its url, together with the `up` link
+ * that came with them.
+ */
+typedef struct md_acme_issuers_t md_acme_issuers_t;
+
+apr_status_t md_acme_issuers_create(md_acme_issuers_t **pissuers, apr_pool_t *p,
+                                    struct md_store_t *store);
+
+/**
+ * Get the unexpired certificate retrieved from url before and the `up` link
+ * sent with it, NULL if there was none. The certificate lives as long as the
+ * cache and must not be modified.
+ * @return APR_ENOENT if url is not known
+ */
+apr_status_t md_acme_issuers_get(struct md_cert_t **pcert, const char **pup,
+                                 md_acme_issuers_t *issuers, const char *url,
+                                 apr_pool_t *p);
+
+/**
+ * Remember an issuer certificate, retrieved from url with the given `up` link.
+ * url may be NULL for certificates that arrived as part of a chain.
+ * @return the cached certificate with the same fingerprint, which can be used
+ *         in place of cert.
+ */
+struct md_cert_t *md_acme_issuers_add(md_acme_issuers_t *issuers, const char *url,
+                                      struct md_cert_t *cert, const char *up,
+                                      apr_pool_t *p);
+
+#endif /* md_acme_issuers_h */
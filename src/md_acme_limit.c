@@ -0,0 +1,230 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+#include <assert.h>
+#include <stdio.h>
+
+#include <apr_lib.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include "md.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_util.h"
+
+#include "md_acme_limit.h"
+
+struct md_acme_limits_t {
+    apr_pool_t *p;
+    struct md_store_t *store;
+    md_acme_limit_t defaults;
+    apr_hash_t *configured;         /* ca url -> md_acme_limit_t* */
+    apr_thread_mutex_t *mutex;      /* serializes updates from renewal workers */
+    int use_store_locks;            /* serialize with other servers sharing the store */
+    apr_time_t lock_wait_timeout;
+};
+
+static const char *KindNames[] = {
+    MD_KEY_ORDERS,
+    MD_KEY_ACCOUNTS,
+};
+
+const char *md_acme_limit_kind_name(md_acme_limit_kind_t kind)
+{
+    return (kind < MD_ACME_LIMIT_COUNT)? KindNames[kind] : "unknown";
+}
+
+apr_status_t md_acme_limits_create(md_acme_limits_t **plimits, apr_pool_t *p,
+                                   struct md_store_t *store, int use_store_locks,
+                                   apr_time_t lock_wait_timeout)
+{
+    md_acme_limits_t *limits;
+    apr_status_t rv;
+    
+    limits = apr_pcalloc(p, sizeof(*limits));
+    limits->p = p;
+    limits->store = store;
+    limits->use_store_locks = use_store_locks;
+    limits->lock_wait_timeout = lock_wait_timeout;
+    limits->defaults.buckets[MD_ACME_LIMIT_ORDERS].burst = MD_ACME_LIMIT_ORDERS_DEF;
+    limits->defaults.buckets[MD_ACME_LIMIT_ORDERS].period = MD_ACME_LIMIT_PERIOD_DEF;
+    limits->defaults.buckets[MD_ACME_LIMIT_ACCOUNTS].burst = MD_ACME_LIMIT_ACCOUNTS_DEF;
+    limits->defaults.buckets[MD_ACME_LIMIT_ACCOUNTS].period = MD_ACME_LIMIT_PERIOD_DEF;
+    limits->configured = apr_hash_make(p);
+    
+    rv = apr_thread_mutex_create(&limits->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    *plimits = (APR_SUCCESS == rv)? limits : NULL;
+    return rv;
+}
+
+void md_acme_limits_set(md_acme_limits_t *limits, const md_acme_limit_t *limit)
+{
+    if (limit->ca_url) {
+        apr_hash_set(limits->configured, limit->ca_url, APR_HASH_KEY_STRING, limit);
+    }
+    else {
+        limits->defaults = *limit;
+    }
+}
+
+const md_acme_limit_t *md_acme_limits_get(md_acme_limits_t *limits, const char *ca_url)
+{
+    const md_acme_limit_t *limit = NULL;
+    
+    if (ca_url) limit = apr_hash_get(limits->configured, ca_url, APR_HASH_KEY_STRING);
+    return limit? limit : &limits->defaults;
+}
+
+/* The file is read, modified and written back. Workers in this process take
+ * the mutex, other servers sharing the store are kept out by its global lock.
+ * The mutex also keeps our workers from using the one global lock of the store
+ * at the same time. */
+static apr_status_t limits_lock(md_acme_limits_t *limits, apr_pool_t *p)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    apr_thread_mutex_lock(limits->mutex);
+    if (limits->use_store_locks) {
+        rv = md_store_lock_global(limits->store, p, limits->lock_wait_timeout);
+        if (APR_SUCCESS != rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                          "unable to acquire global store lock for %s", MD_FN_CA_LIMITS);
+            apr_thread_mutex_unlock(limits->mutex);
+        }
+    }
+    return rv;
+}
+
+static void limits_unlock(md_acme_limits_t *limits, apr_pool_t *p)
+{
+    if (limits->use_store_locks) {
+        md_store_unlock_global(limits->store, p);
+    }
+    apr_thread_mutex_unlock(limits->mutex);
+}
+
+static md_json_t *limits_load(md_acme_limits_t *limits, apr_pool_t *p)
+{
+    md_json_t *json = NULL;
+    
+    if (APR_SUCCESS != md_store_load_json(limits->store, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                                          MD_FN_CA_LIMITS, &json, p)) {
+        json = md_json_create(p);
+    }
+    return json;
+}
+
+static void limits_save(md_acme_limits_t *limits, md_json_t *json, apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    rv = md_store_save_json(limits->store, p, MD_SG_STAGING, MD_ACME_LIMITS_NAME,
+                            MD_FN_CA_LIMITS, json, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "saving %s", MD_FN_CA_LIMITS);
+    }
+}
+
+apr_status_t md_acme_limits_admit(md_acme_limits_t *limits, const char *ca_url,
+                                  md_acme_limit_kind_t kind, apr_time_t *pnext,
+                                  apr_pool_t *p)
+{
+    const md_acme_bucket_t *bucket;
+    const char *name;
+    md_json_t *json;
+    apr_time_t now, updated, hold;
+    double level, rate;
+    apr_status_t rv = APR_SUCCESS;
+    
+    assert(kind < MD_ACME_LIMIT_COUNT);
+    *pnext = 0;
+    bucket = &md_acme_limits_get(limits, ca_url)->buckets[kind];
+    name = md_acme_limit_kind_name(kind);
+    
+    now = apr_time_now();
+    if (APR_SUCCESS != limits_lock(limits, p)) {
+        /* another server holds the store, try again shortly */
+        *pnext = now + MD_ACME_LIMIT_LOCK_RETRY;
+        rv = APR_EAGAIN;
+        goto out;
+    }
+    /* Always read the store, another server sharing it may have taken tokens */
+    json = limits_load(limits, p);
+    
+    hold = md_json_get_time(json, ca_url, MD_KEY_HOLD_UNTIL, NULL);
+    if (hold > now) {
+        *pnext = hold;
+        rv = APR_EAGAIN;
+        goto leave;
+    }
+    if (bucket->burst <= 0 || bucket->period <= 0) goto leave;
+    
+    if (md_json_has_key(json, ca_url, name, MD_KEY_TOKENS, NULL)) {
+        level = md_json_getn(json, ca_url, name, MD_KEY_TOKENS, NULL);
+        updated = md_json_get_time(json, ca_url, name, MD_KEY_UPDATED, NULL);
+    }
+    else {
+        level = bucket->burst;
+        updated = now;
+    }
+    /* refill since the last update, in tokens per microsecond */
+    rate = (double)bucket->burst / (double)bucket->period;
+    if (now > updated) level += (double)(now - updated) * rate;
+    if (level > bucket->burst) level = bucket->burst;
+    
+    if (level < 1.0) {
+        *pnext = now + (apr_time_t)((1.0 - level) / rate) + apr_time_from_sec(1);
+        rv = APR_EAGAIN;
+        goto leave;
+    }
+    md_json_setn(level - 1.0, json, ca_url, name, MD_KEY_TOKENS, NULL);
+    md_json_set_time(now, json, ca_url, name, MD_KEY_UPDATED, NULL);
+    limits_save(limits, json, p);
+
+leave:
+    limits_unlock(limits, p);
+out:
+    if (APR_EAGAIN == rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                      "%s: no new %s before %s", ca_url, name,
+                      md_duration_print(p, *pnext - now));
+    }
+    return rv;
+}
+
+void md_acme_limits_hold(md_acme_limits_t *limits, const char *ca_url,
+                         apr_time_t until, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_status_t rv;
+    
+    if (APR_SUCCESS != (rv = limits_lock(limits, p))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_INFO, rv, p, 
+                      "%s: CA is rate limiting, unable to record it in the store", ca_url);
+        return;
+    }
+    json = limits_load(limits, p);
+    if (until > md_json_get_time(json, ca_url, MD_KEY_HOLD_UNTIL, NULL)) {
+        md_json_set_time(until, json, ca_url, MD_KEY_HOLD_UNTIL, NULL);
+        limits_save(limits, json, p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_INFO, 0, p, 
+                      "%s: CA is rate limiting, holding requests for %s", ca_url,
+                      md_duration_print(p, until - apr_time_now()));
+    }
+    limits_unlock(limits, p);
+}
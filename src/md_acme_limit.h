@@ -0,0 +1,99 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef md_acme_limit_h
+#define md_acme_limit_h
+
+struct md_store_t;
+
+/**
+ * Requests at an ACME CA that count against its rate limits and which we
+ * therefore admit only at a certain rate, shared by all MDs using the CA.
+ */
+typedef enum {
+    MD_ACME_LIMIT_ORDERS,           /* new orders */
+    MD_ACME_LIMIT_ACCOUNTS,         /* new accounts */
+    MD_ACME_LIMIT_COUNT,            /* number of kinds */
+} md_acme_limit_kind_t;
+
+/* The defaults follow what Let's Encrypt publishes: 300 new orders per
+ * account and 10 new accounts per IP address in 3 hours. */
+#define MD_ACME_LIMIT_ORDERS_DEF        300
+#define MD_ACME_LIMIT_ACCOUNTS_DEF      10
+#define MD_ACME_LIMIT_PERIOD_DEF        apr_time_from_sec(3 * 60 * 60)
+/* When the store is locked by another server, ask again after this time */
+#define MD_ACME_LIMIT_LOCK_RETRY        apr_time_from_sec(60)
+
+/* Kept in STAGING, which the server's worker processes may write to. The
+ * name cannot clash with a managed domain. */
+#define MD_ACME_LIMITS_NAME             "_acme"
+#define MD_FN_CA_LIMITS                 "ca-limits.json"
+
+/**
+ * A token bucket holding up to `burst` tokens, refilled completely in `period`.
+ * A `burst` of 0 does not limit anything.
+ */
+typedef struct md_acme_bucket_t {
+    int burst;
+    apr_interval_time_t period;
+} md_acme_bucket_t;
+
+typedef struct md_acme_limit_t {
+    const char *ca_url;             /* the CA this applies to, NULL for the default */
+    md_acme_bucket_t buckets[MD_ACME_LIMIT_COUNT];
+} md_acme_limit_t;
+
+typedef struct md_acme_limits_t md_acme_limits_t;
+
+/**
+ * Create the admission control for ACME CAs. The bucket levels are kept in
+ * the store. A CA's `Retry-After` on a rate limited request is recorded there
+ * as well. With use_store_locks, they are updated under the global lock of
+ * the store, so that servers sharing a store also share the limits.
+ */
+apr_status_t md_acme_limits_create(md_acme_limits_t **plimits, apr_pool_t *p,
+                                   struct md_store_t *store, int use_store_locks,
+                                   apr_time_t lock_wait_timeout);
+
+/**
+ * Configure the limits for a CA or, with a NULL ca_url, the default for all CAs
+ * without their own configuration. The limit needs to live as long as limits.
+ */
+void md_acme_limits_set(md_acme_limits_t *limits, const md_acme_limit_t *limit);
+
+const md_acme_limit_t *md_acme_limits_get(md_acme_limits_t *limits, const char *ca_url);
+
+/**
+ * Ask to make a request of the given kind to the CA. Returns APR_SUCCESS and
+ * takes a token when it may be made right away. Returns APR_EAGAIN when it
+ * needs to wait, with *pnext set to the time a token is available or the CA
+ * allows requests again.
+ */
+apr_status_t md_acme_limits_admit(md_acme_limits_t *limits, const char *ca_url,
+                                  md_acme_limit_kind_t kind, apr_time_t *pnext,
+                                  apr_pool_t *p);
+
+/**
+ * Remember that the CA does not want any requests before `until`.
+ */
+void md_acme_limits_hold(md_acme_limits_t *limits, const char *ca_url,
+                         apr_time_t until, apr_pool_t *p);
+
+/**
+ * Get the string representation of a limit kind, as used in configuration and store.
+ */
+const char *md_acme_limit_kind_name(md_acme_limit_kind_t kind);
+
+#endif /* md_acme_limit_h */
@@ -227,9 +227,7 @@ static apr_status_t p_purge(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_li
     md_acme_order_t *order;
     md_store_group_t group;
     const md_t *md;
-    const char *setup_token;
     apr_table_t *env;
-    int i;
 
     group = (md_store_group_t)va_arg(ap, int);
     md = va_arg(ap, const md_t *);
@@ -237,14 +235,9 @@ static apr_status_t p_purge(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_li
 
     if (APR_SUCCESS == md_acme_order_load(store, group, md->name, &order, p)) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "order loaded for %s", md->name);
-        for (i = 0; i < order->challenge_setups->nelts; ++i) {
-            setup_token = APR_ARRAY_IDX(order->challenge_setups, i, const char*);
-            if (setup_token) {
-                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
-                              "order teardown setup %s", setup_token);
-                md_acme_authz_teardown(store, setup_token, md, env, p);
-            }
-        }
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "order teardown setups %s",
+                      apr_array_pstrcat(p, order->challenge_setups, ','));
+        md_acme_authz_teardown_all(store, order->challenge_setups, md, env, p);
     }
     return md_store_remove(store, group, md->name, MD_FN_ORDER, ptemp, 1);
 }
@@ -265,11 +258,14 @@ typedef struct {
     const char *name;
     apr_array_header_t *domains;
     md_result_t *result;
+    apr_array_header_t *authzs;
+    md_store_t *store;
 } order_ctx_t;
 
 #define ORDER_CTX_INIT(ctx, p, o, a, n, d, r) \
     (ctx)->p = (p); (ctx)->order = (o); (ctx)->acme = (a); \
-    (ctx)->name = (n); (ctx)->domains = d; (ctx)->result = r
+    (ctx)->name = (n); (ctx)->domains = d; (ctx)->result = r; (ctx)->authzs = NULL; \
+    (ctx)->store = NULL
 
 static apr_status_t identifier_to_json(void *value, md_json_t *json, apr_pool_t *p, void *baton)
 {
@@ -316,6 +312,7 @@ static apr_status_t on_order_upd(md_acme_t *acme, apr_pool_t *p, const apr_table
     }
     
     order_update_from_json(ctx->order, body, ctx->p);
+    ctx->order->retry_at = md_util_retry_after(hdrs, apr_time_now());
 out:
     return rv;
 }
@@ -348,7 +345,7 @@ apr_status_t md_acme_order_update(md_acme_order_t *order, md_acme_t *acme,
     return rv;
 }
 
-static apr_status_t await_ready(void *baton, int attempt)
+static apr_status_t await_ready(void *baton, int attempt, apr_time_t *pnext)
 {
     order_ctx_t *ctx = baton;
     apr_status_t rv = APR_SUCCESS;
@@ -362,6 +359,7 @@ static apr_status_t await_ready(void *baton, int attempt)
         case MD_ACME_ORDER_ST_VALID:
             break;
         case MD_ACME_ORDER_ST_PENDING:
+            *pnext = ctx->order->retry_at;
             rv = APR_EAGAIN;
             break;
         default:
@@ -383,12 +381,12 @@ apr_status_t md_acme_order_await_ready(md_acme_order_t *order, md_acme_t *acme,
     ORDER_CTX_INIT(&ctx, p, order, acme, md->name, NULL, result);
 
     md_result_activity_setn(result, "Waiting for order to become ready");
-    rv = md_util_try(await_ready, &ctx, 0, timeout, 0, 0, 1);
+    rv = md_util_try_next(await_ready, &ctx, 0, timeout, 0, 0, 1);
     md_result_log(result, MD_LOG_DEBUG);
     return rv;
 }
 
-static apr_status_t await_valid(void *baton, int attempt)
+static apr_status_t await_valid(void *baton, int attempt, apr_time_t *pnext)
 {
     order_ctx_t *ctx = baton;
     apr_status_t rv = APR_SUCCESS;
@@ -401,6 +399,7 @@ static apr_status_t await_valid(void *baton, int attempt)
             md_result_set(ctx->result, APR_EINVAL, "ACME server order status is 'valid'.");
             break;
         case MD_ACME_ORDER_ST_PROCESSING:
+            *pnext = ctx->order->retry_at;
             rv = APR_EAGAIN;
             break;
         case MD_ACME_ORDER_ST_INVALID:
@@ -426,7 +425,7 @@ apr_status_t md_acme_order_await_valid(md_acme_order_t *order, md_acme_t *acme,
     ORDER_CTX_INIT(&ctx, p, order, acme, md->name, NULL, result);
 
     md_result_activity_setn(result, "Waiting for finalized order to become valid");
-    rv = md_util_try(await_valid, &ctx, 0, timeout, 0, 0, 1);
+    rv = md_util_try_next(await_valid, &ctx, 0, timeout, 0, 0, 1);
     md_result_log(result, MD_LOG_DEBUG);
     return rv;
 }
@@ -442,22 +441,35 @@ apr_status_t md_acme_order_start_challenges(md_acme_order_t *order, md_acme_t *a
 {
     apr_status_t rv = APR_SUCCESS;
     md_acme_authz_t *authz;
-    const char *url, *setup_token;
+    md_acme_dns01_batch_t *dns01_batch;
+    const char *url, *setup_token, *known;
     int i;
     
     md_result_activity_printf(result, "Starting challenges for domains");
+    dns01_batch = md_acme_dns01_batch_make(md, env, p);
     for (i = 0; i < order->authz_urls->nelts; ++i) {
         url = APR_ARRAY_IDX(order->authz_urls, i, const char*);
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: check AUTHZ at %s", md->name, url);
         
         if (APR_SUCCESS != (rv = md_acme_authz_retrieve(acme, p, url, &authz))) {
-            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: check authz for %s",
-                          md->name, authz->domain);
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: check authz at %s",
+                          md->name, url);
             goto leave;
         }
+        /* An authorization validated for another MD of the same account needs no
+         * challenge, as long as the CA still says so. This one look is all it costs,
+         * the monitoring of the order then takes it as valid. */
+        if ((known = md_acme_authz_known_valid(acme, store, url, p))
+            && MD_ACME_AUTHZ_S_VALID != authz->state) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                          "%s: AUTHZ for %s no longer valid (state %d)", 
+                          md->name, known, authz->state);
+            md_acme_authz_forget(acme, store, known, p);
+        }
 
         switch (authz->state) {
             case MD_ACME_AUTHZ_S_VALID:
+                md_acme_authz_remember(authz, acme, store, p);
                 break;
                 
             case MD_ACME_AUTHZ_S_PENDING:
@@ -467,7 +479,7 @@ apr_status_t md_acme_order_start_challenges(md_acme_order_t *order, md_acme_t *a
                 rv = md_acme_authz_respond(authz, acme, store, challenge_types,
                                            md->pks,
                                            md->acme_tls_1_domains, md,
-                                           env, p, &setup_token, result);
+                                           env, p, &setup_token, result, dns01_batch);
                 if (APR_SUCCESS != rv) {
                     goto leave;
                 }
@@ -490,72 +502,121 @@ apr_status_t md_acme_order_start_challenges(md_acme_order_t *order, md_acme_t *a
                 goto leave;
         }
     }
+    /* dns-01 challenges collected in the batch are set up together */
+    rv = md_acme_dns01_batch_run(dns01_batch, acme, md, result, p);
 leave:    
     return rv;
 }
 
-static apr_status_t check_challenges(void *baton, int attempt)
+static apr_status_t check_challenges(void *baton, int attempt, apr_time_t *pnext)
 {
     order_ctx_t *ctx = baton;
     const char *url;
     md_acme_authz_t *authz;
+    apr_array_header_t *due;
+    apr_time_t now, next = 0;
     apr_status_t rv = APR_SUCCESS;
-    int i;
+    int i, pending = 0;
     
-    for (i = 0; i < ctx->order->authz_urls->nelts; ++i) {
-        url = APR_ARRAY_IDX(ctx->order->authz_urls, i, const char*);
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ctx->p, "%s: check AUTHZ at %s (attempt %d)", 
-                      ctx->name, url, attempt);
-        
-        rv = md_acme_authz_retrieve(ctx->acme, ctx->p, url, &authz);
-        if (APR_SUCCESS == rv) {
-            switch (authz->state) {
-                case MD_ACME_AUTHZ_S_VALID:
-                    md_result_printf(ctx->result, rv, 
-                                     "domain authorization for %s is valid", authz->domain);
-                    break;
-                case MD_ACME_AUTHZ_S_PENDING:
-                    rv = APR_EAGAIN;
-                    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ctx->p, 
-                                  "%s: status pending at %s", authz->domain, authz->url);
-                    goto leave;
-                case MD_ACME_AUTHZ_S_INVALID:
-                    rv = APR_EINVAL;
-                    md_result_printf(ctx->result, rv,
-                                     "domain authorization for %s failed, CA considers "
-                                     "answer to challenge invalid%s.",
-                                     authz->domain, authz->error_type? "" : ", no error given");
-                    md_result_log(ctx->result, MD_LOG_ERR);
-                    goto leave;
-                default:
-                    rv = APR_EINVAL;
-                    md_result_printf(ctx->result, rv, 
-                                     "domain authorization for %s failed with state %d", 
-                                     authz->domain, authz->state);
-                    md_result_log(ctx->result, MD_LOG_ERR);
-                    goto leave;
+    if (!ctx->authzs) {
+        ctx->authzs = apr_array_make(ctx->p, ctx->order->authz_urls->nelts, 
+                                     sizeof(md_acme_authz_t*));
+        for (i = 0; i < ctx->order->authz_urls->nelts; ++i) {
+            url = APR_ARRAY_IDX(ctx->order->authz_urls, i, const char*);
+            authz = apr_pcalloc(ctx->p, sizeof(*authz));
+            authz->url = url;
+            if ((authz->domain = md_acme_authz_known_valid(ctx->acme, ctx->store, url, ctx->p))) {
+                authz->state = MD_ACME_AUTHZ_S_VALID;
             }
+            APR_ARRAY_PUSH(ctx->authzs, md_acme_authz_t*) = authz;
         }
-        else {
-            md_result_printf(ctx->result, rv, "authorization retrieval failed for domain %s", 
-                             authz->domain);
+    }
+    
+    /* Authorizations that became valid stay that way, we only need to ask
+     * about the others. And only when the server wants us to. */
+    now = apr_time_now();
+    due = apr_array_make(ctx->p, ctx->authzs->nelts, sizeof(md_acme_authz_t*));
+    for (i = 0; i < ctx->authzs->nelts; ++i) {
+        authz = APR_ARRAY_IDX(ctx->authzs, i, md_acme_authz_t*);
+        if (MD_ACME_AUTHZ_S_VALID == authz->state) continue;
+        if (authz->retry_at > now) {
+            ++pending;
+            if (!next || authz->retry_at < next) next = authz->retry_at;
+            continue;
         }
+        APR_ARRAY_PUSH(due, md_acme_authz_t*) = authz;
     }
+    if (!due->nelts) goto leave;
+    
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ctx->p, "%s: check %d AUTHZs (attempt %d)", 
+                  ctx->name, due->nelts, attempt);
+    rv = md_acme_authz_update_all(due, ctx->acme, ctx->p);
+    for (i = 0; i < due->nelts; ++i) {
+        authz = APR_ARRAY_IDX(due, i, md_acme_authz_t*);
+        switch (authz->state) {
+            case MD_ACME_AUTHZ_S_VALID:
+                md_result_printf(ctx->result, APR_SUCCESS, 
+                                 "domain authorization for %s is valid", authz->domain);
+                md_acme_authz_remember(authz, ctx->acme, ctx->store, ctx->p);
+                break;
+            case MD_ACME_AUTHZ_S_PENDING:
+                ++pending;
+                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, APR_EAGAIN, ctx->p, 
+                              "%s: status pending at %s", authz->domain, authz->url);
+                if (!authz->retry_at) {
+                    /* no advice from the server, use our own pace */
+                    next = -1;
+                }
+                else if (next >= 0 && (!next || authz->retry_at < next)) {
+                    next = authz->retry_at;
+                }
+                break;
+            case MD_ACME_AUTHZ_S_INVALID:
+                rv = APR_EINVAL;
+                md_result_printf(ctx->result, rv,
+                                 "domain authorization for %s failed, CA considers "
+                                 "answer to challenge invalid%s.",
+                                 authz->domain, authz->error_type? "" : ", no error given");
+                md_result_log(ctx->result, MD_LOG_ERR);
+                goto leave;
+            case MD_ACME_AUTHZ_S_UNKNOWN:
+                if (APR_SUCCESS != rv) {
+                    md_result_printf(ctx->result, rv, "authorization retrieval failed for %s", 
+                                     authz->url);
+                    break;
+                }
+                /* fall through */
+            default:
+                rv = APR_EINVAL;
+                md_result_printf(ctx->result, rv, 
+                                 "domain authorization for %s failed with state %d", 
+                                 authz->domain, authz->state);
+                md_result_log(ctx->result, MD_LOG_ERR);
+                goto leave;
+        }
+    }
+    
 leave:
+    if (APR_SUCCESS == rv && pending) {
+        rv = APR_EAGAIN;
+        if (next > 0) *pnext = next;
+    }
     return rv;
 }
 
 apr_status_t md_acme_order_monitor_authzs(md_acme_order_t *order, md_acme_t *acme, 
-                                          const md_t *md, apr_interval_time_t timeout, 
+                                          md_store_t *store, const md_t *md, 
+                                          apr_interval_time_t timeout, 
                                           md_result_t *result, apr_pool_t *p)
 {
     order_ctx_t ctx;
     apr_status_t rv;
     
     ORDER_CTX_INIT(&ctx, p, order, acme, md->name, NULL, result);
+    ctx.store = store;
     
     md_result_activity_printf(result, "Monitoring challenge status for %s", md->name);
-    rv = md_util_try(check_challenges, &ctx, 0, timeout, 0, 0, 1);
+    rv = md_util_try_next(check_challenges, &ctx, 0, timeout, 0, 0, 1);
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: checked authorizations", md->name);
     return rv;
 }
@@ -38,6 +38,7 @@ struct md_acme_order_t {
     struct md_json_t *json;
     const char *finalize;
     const char *certificate;
+    apr_time_t retry_at;        /* when the server wants the order checked again or 0 */
 };
 
 #define MD_FN_ORDER             "order.json"
@@ -69,8 +70,13 @@ apr_status_t md_acme_order_start_challenges(md_acme_order_t *order, md_acme_t *a
                                             apr_table_t *env, struct md_result_t *result,
                                             apr_pool_t *p);
 
+/**
+ * Wait for all authorizations of the order to become valid. Valid ones are
+ * remembered for the account in the store, if given.
+ */
 apr_status_t md_acme_order_monitor_authzs(md_acme_order_t *order, md_acme_t *acme, 
-                                          const md_t *md, apr_interval_time_t timeout,
+                                          md_store_t *store, const md_t *md, 
+                                          apr_interval_time_t timeout,
                                           struct md_result_t *result, apr_pool_t *p);
 
 /* ACMEv2 only ************************************************************************************/
@@ -37,6 +37,7 @@
 #include "md_acme.h"
 #include "md_acme_acct.h"
 #include "md_acme_authz.h"
+#include "md_acme_limit.h"
 #include "md_acme_order.h"
 
 #include "md_acme_drive.h"
@@ -77,6 +78,9 @@ static apr_status_t ad_setup_order(md_proto_driver_t *d, md_result_t *result, in
     }
     
     md_result_activity_setn(result, "Creating new order");
+    /* the result already says why, if we may not do this now */
+    rv = md_acme_drive_admit(d, MD_ACME_LIMIT_ORDERS, result);
+    if (APR_SUCCESS != rv) goto out;
     rv = md_acme_order_register(&ad->order, ad->acme, d->p, d->md->name, ad->domains);
     if (APR_SUCCESS !=rv) goto leave;
     rv = md_acme_order_save(d->store, d->p, MD_SG_STAGING, d->md->name, ad->order, 0);
@@ -87,6 +91,7 @@ static apr_status_t ad_setup_order(md_proto_driver_t *d, md_result_t *result, in
 
 leave:
     md_acme_report_result(ad->acme, rv, result);
+out:
     return rv;
 }
 
@@ -150,13 +155,17 @@ retry:
     }
     if (APR_SUCCESS != rv) goto leave;
     
-    rv = md_acme_order_monitor_authzs(ad->order, ad->acme, d->md,
+    rv = md_acme_order_monitor_authzs(ad->order, ad->acme, d->store, d->md,
                                       ad->authz_monitor_timeout, result, d->p);
     if (APR_SUCCESS != rv) goto leave;
 
     rv = md_acme_order_await_ready(ad->order, ad->acme, d->md,
                                    ad->authz_monitor_timeout, result, d->p);
-    if (APR_SUCCESS != rv) goto leave;
+    if (APR_SUCCESS != rv) {
+        /* maybe an authorization we took as valid is no longer */
+        md_acme_authz_forget_all(ad->acme, d->store, d->p);
+        goto leave;
+    }
 
     if (MD_ACME_ORDER_ST_READY == ad->order->status) {
         rv = md_acme_drive_setup_cred_chain(d, result);
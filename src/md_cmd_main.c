@@ -27,6 +27,7 @@
 #include "md_acme.h"
 #include "md_json.h"
 #include "md_http.h"
+#include "md_http_replay.h"
 #include "md_log.h"
 #include "md_result.h"
 #include "md_reg.h"
@@ -350,6 +351,9 @@ static apr_status_t main_opts(md_cmd_ctx *ctx, int option, const char *optarg)
         case 'j':
             init_json_out(ctx);
             break;
+        case 'L':
+            md_http_replay_set_latency(apr_time_from_msec(atoi(optarg)));
+            break;
         case 'p':
             md_cmd_ctx_set_option(ctx, MD_CMD_OPT_PROXY_URL, optarg);
             break;
@@ -358,6 +362,21 @@ static apr_status_t main_opts(md_cmd_ctx *ctx, int option, const char *optarg)
                 --active_level;
             }
             break;
+        case 'R':
+        case 'P': {
+            md_http_impl_t *impl;
+            apr_status_t rv;
+
+            rv = md_http_replay_get_impl(&impl, ctx->p, optarg,
+                                         (option == 'R')? MD_HTTP_REPLAY_RECORD : MD_HTTP_REPLAY_PLAY,
+                                         md_curl_get_impl(ctx->p));
+            if (APR_SUCCESS != rv) {
+                fprintf(stderr, "error %d setting up http trace file: %s\n", rv, optarg);
+                return rv;
+            }
+            md_http_use_implementation(impl);
+            break;
+        }
         case 'v':
             if (active_level < MD_LOG_TRACE8) {
                 ++active_level;
@@ -391,8 +410,11 @@ static apr_getopt_option_t MainOptions [] = {
     { "dir",     'd', 1, "directory for file data"},
     { "help",    'h', 0, "print usage information"},
     { "json",    'j', 0, "produce json output"},
+    { "latency", 'L', 1, "milliseconds of latency to add to replayed http responses"},
     { "proxy",   'p', 1, "use the HTTP proxy url"},
     { "quiet",   'q', 0, "produce less output"},
+    { "record",  'R', 1, "record all http exchanges into the trace file"},
+    { "replay",  'P', 1, "answer http requests from the trace file, no network access"},
     { "terms",   't', 1, "you agree to the terms of services (url)" },
     { "verbose", 'v', 0, "produce more output" },
     { "version", 'V', 0, "print version" },
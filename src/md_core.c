@@ -18,6 +18,7 @@
 #include <stdlib.h>
 
 #include <apr_lib.h>
+#include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_uri.h>
 #include <apr_tables.h>
@@ -184,6 +185,271 @@ md_t *md_get_by_dns_overlap(struct apr_array_header_t *mds, const md_t *md)
     return NULL;
 }
 
+/**************************************************************************************************/
+/* domain index */
+
+typedef struct idx_entry_t idx_entry_t;
+struct idx_entry_t {
+    md_t *md;
+    int pos;                    /* position of md in the order added */
+    idx_entry_t *next;          /* other mds with the same key, in the order added */
+};
+
+struct md_domain_idx_t {
+    apr_pool_t *p;
+    apr_hash_t *names;          /* lower case name -> idx_entry_t*, wildcards included */
+    apr_hash_t *wildcards;      /* lower case "b.c" of wildcard "*.b.c" -> idx_entry_t* */
+    apr_hash_t *parents;        /* lower case "b.c" of name "a.b.c" -> idx_entry_t* */
+    int count;
+};
+
+/* longest DNS name, longer names cannot be looked up */
+#define IDX_NAME_MAX            255
+
+static const char *idx_key(char *buf, apr_size_t len, const char *name)
+{
+    apr_size_t i;
+    
+    for (i = 0; name[i]; ++i) {
+        if (i+1 >= len) return NULL;
+        buf[i] = (char)apr_tolower(name[i]);
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+static void idx_put(md_domain_idx_t *idx, apr_hash_t *ht, const char *key, md_t *md)
+{
+    idx_entry_t *e, *last = NULL;
+    
+    for (e = apr_hash_get(ht, key, APR_HASH_KEY_STRING); e; e = e->next) {
+        if (e->md == md) return;
+        last = e;
+    }
+    e = apr_pcalloc(idx->p, sizeof(*e));
+    e->md = md;
+    e->pos = idx->count;
+    if (last) {
+        last->next = e;
+    }
+    else {
+        apr_hash_set(ht, key, APR_HASH_KEY_STRING, e);
+    }
+}
+
+static const idx_entry_t *idx_get(apr_hash_t *ht, const char *key)
+{
+    return key? apr_hash_get(ht, key, APR_HASH_KEY_STRING) : NULL;
+}
+
+md_domain_idx_t *md_domain_idx_create(apr_pool_t *p)
+{
+    md_domain_idx_t *idx;
+    
+    idx = apr_pcalloc(p, sizeof(*idx));
+    idx->p = p;
+    idx->names = apr_hash_make(p);
+    idx->wildcards = apr_hash_make(p);
+    idx->parents = apr_hash_make(p);
+    return idx;
+}
+
+md_domain_idx_t *md_domain_idx_make(apr_pool_t *p, apr_array_header_t *mds)
+{
+    md_domain_idx_t *idx = md_domain_idx_create(p);
+    int i;
+    
+    for (i = 0; i < mds->nelts; ++i) {
+        md_domain_idx_add(idx, APR_ARRAY_IDX(mds, i, md_t*));
+    }
+    return idx;
+}
+
+void md_domain_idx_add(md_domain_idx_t *idx, md_t *md)
+{
+    char *key, *s;
+    int i;
+    
+    for (i = 0; i < md->domains->nelts; ++i) {
+        key = apr_pstrdup(idx->p, APR_ARRAY_IDX(md->domains, i, const char*));
+        for (s = key; *s; ++s) {
+            *s = (char)apr_tolower(*s);
+        }
+        idx_put(idx, idx->names, key, md);
+        if (key[0] == '*' && key[1] == '.') {
+            idx_put(idx, idx->wildcards, key+2, md);
+        }
+        if ((s = strchr(key, '.'))) {
+            idx_put(idx, idx->parents, s+1, md);
+        }
+    }
+    ++idx->count;
+}
+
+md_t *md_domain_idx_get(const md_domain_idx_t *idx, const char *domain)
+{
+    char buf[IDX_NAME_MAX+1];
+    const char *key, *s;
+    const idx_entry_t *e, *ew;
+    
+    if (!(key = idx_key(buf, sizeof(buf), domain))) return NULL;
+    /* as in md_dns_matches(), a wildcard covers exactly one more label */
+    e = idx_get(idx->names, key);
+    ew = idx_get(idx->wildcards, (s = strchr(key, '.'))? s+1 : NULL);
+    if (ew && (!e || ew->pos < e->pos)) e = ew;
+    return e? e->md : NULL;
+}
+
+int md_domain_idx_do(const md_domain_idx_t *idx, const char *domain, 
+                     md_domain_idx_cb *cb, void *baton)
+{
+    char buf[IDX_NAME_MAX+1];
+    const char *key, *s;
+    const idx_entry_t *e, *ew;
+    
+    if (!(key = idx_key(buf, sizeof(buf), domain))) return 1;
+    e = idx_get(idx->names, key);
+    ew = idx_get(idx->wildcards, (s = strchr(key, '.'))? s+1 : NULL);
+    /* both lists are in the order added, merge them */
+    while (e || ew) {
+        if (e && (!ew || e->pos <= ew->pos)) {
+            if (ew && ew->pos == e->pos) ew = ew->next;
+            if (!cb(baton, e->md, e->pos)) return 0;
+            e = e->next;
+        }
+        else {
+            if (!cb(baton, ew->md, ew->pos)) return 0;
+            ew = ew->next;
+        }
+    }
+    return 1;
+}
+
+static const idx_entry_t *first_other(const idx_entry_t *e, const md_t *md, 
+                                      const idx_entry_t *best)
+{
+    for (; e; e = e->next) {
+        if (best && best->pos <= e->pos) break;
+        if (strcmp(e->md->name, md->name)) return e;
+    }
+    return best;
+}
+
+md_t *md_domain_idx_get_overlap(const md_domain_idx_t *idx, const md_t *md)
+{
+    char buf[IDX_NAME_MAX+1];
+    const char *key;
+    const idx_entry_t *best = NULL;
+    int i;
+    
+    /* names of other mds that are covered by a name of md */
+    for (i = 0; i < md->domains->nelts; ++i) {
+        if (!(key = idx_key(buf, sizeof(buf), APR_ARRAY_IDX(md->domains, i, const char*)))) {
+            continue;
+        }
+        best = first_other(idx_get(idx->names, key), md, best);
+        if (key[0] == '*' && key[1] == '.') {
+            best = first_other(idx_get(idx->parents, key+2), md, best);
+        }
+    }
+    return best? best->md : NULL;
+}
+
+static void idx_del(apr_hash_t *ht, const char *key, const md_t *md)
+{
+    idx_entry_t *e, *prev = NULL;
+    
+    for (e = apr_hash_get(ht, key, APR_HASH_KEY_STRING); e; prev = e, e = e->next) {
+        if (e->md == md) {
+            if (prev) {
+                prev->next = e->next;
+            }
+            else {
+                /* the hash keeps its copy of the key */
+                apr_hash_set(ht, key, APR_HASH_KEY_STRING, e->next);
+            }
+            return;
+        }
+    }
+}
+
+void md_domain_idx_remove(md_domain_idx_t *idx, const md_t *md)
+{
+    char buf[IDX_NAME_MAX+1];
+    const char *key, *s;
+    int i;
+    
+    for (i = 0; i < md->domains->nelts; ++i) {
+        if (!(key = idx_key(buf, sizeof(buf), APR_ARRAY_IDX(md->domains, i, const char*)))) {
+            continue;
+        }
+        idx_del(idx->names, key, md);
+        if (key[0] == '*' && key[1] == '.') {
+            idx_del(idx->wildcards, key+2, md);
+        }
+        if ((s = strchr(key, '.'))) {
+            idx_del(idx->parents, s+1, md);
+        }
+    }
+}
+
+typedef struct {
+    const idx_entry_t *e;
+    apr_size_t hits;
+    int last;                   /* 1 + index of the name last counted */
+} idx_hits_t;
+
+static void count_hits(apr_hash_t *hits, const idx_entry_t *e, int i, apr_pool_t *p)
+{
+    idx_hits_t *h;
+    
+    for (; e; e = e->next) {
+        h = apr_hash_get(hits, &e->md, sizeof(e->md));
+        if (!h) {
+            h = apr_pcalloc(p, sizeof(*h));
+            h->e = e;
+            apr_hash_set(hits, &h->e->md, sizeof(h->e->md), h);
+        }
+        /* a name may be found as itself and through a wildcard */
+        if (h->last == i+1) continue;
+        h->last = i+1;
+        ++h->hits;
+    }
+}
+
+md_t *md_domain_idx_get_closest(const md_domain_idx_t *idx, const md_t *md, apr_pool_t *p)
+{
+    char buf[IDX_NAME_MAX+1];
+    const char *key, *s;
+    apr_hash_t *hits;
+    apr_hash_index_t *hi;
+    const idx_hits_t *h, *all = NULL, *most = NULL;
+    apr_size_t n;
+    int i;
+    
+    hits = apr_hash_make(p);
+    for (i = 0; i < md->domains->nelts; ++i) {
+        if (!(key = idx_key(buf, sizeof(buf), APR_ARRAY_IDX(md->domains, i, const char*)))) {
+            continue;
+        }
+        count_hits(hits, idx_get(idx->names, key), i, p);
+        count_hits(hits, idx_get(idx->wildcards, (s = strchr(key, '.'))? s+1 : NULL), i, p);
+    }
+    
+    n = (apr_size_t)md->domains->nelts;
+    for (hi = apr_hash_first(p, hits); hi; hi = apr_hash_next(hi)) {
+        h = apr_hash_this_val(hi);
+        if (h->hits == n && (apr_size_t)h->e->md->domains->nelts >= n) {
+            if (!all || h->e->pos < all->e->pos) all = h;
+        }
+        if (!most || h->hits > most->hits 
+            || (h->hits == most->hits && h->e->pos < most->e->pos)) {
+            most = h;
+        }
+    }
+    return all? all->e->md : (most? most->e->md : NULL);
+}
+
 int md_cert_count(const md_t *md)
 {
     /* cert are defined as a list of static files or a list of private key specs */
@@ -15,6 +15,7 @@
  */
  
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -28,6 +29,7 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/ocsp.h>
 #include <openssl/pem.h>
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
@@ -1206,6 +1208,43 @@ const char *md_cert_get_serial_number(const md_cert_t *cert, apr_pool_t *p)
     return s;
 }
 
+apr_status_t md_cert_get_ari_cert_id(const char **pid, const md_cert_t *cert, apr_pool_t *p)
+{
+    AUTHORITY_KEYID *akid;
+    unsigned char *der = NULL;
+    const char *kid64, *serial64;
+    md_data_t data;
+    int len, hlen;
+    apr_status_t rv = APR_ENOENT;
+    
+    *pid = NULL;
+    akid = X509_get_ext_d2i(cert->x509, NID_authority_key_identifier, NULL, NULL);
+    if (!akid || !akid->keyid) goto leave;
+    md_data_init(&data, (const char*)akid->keyid->data, (apr_size_t)akid->keyid->length);
+    kid64 = md_util_base64url_encode(&data, p);
+    
+    /* the serial is used as the content octets of its DER encoding */
+    len = i2d_ASN1_INTEGER(X509_get_serialNumber(cert->x509), &der);
+    if (len < 2) {
+        rv = APR_EINVAL;
+        goto leave;
+    }
+    hlen = (der[1] & 0x80)? 2 + (der[1] & 0x7f) : 2;
+    if (len <= hlen) {
+        rv = APR_EINVAL;
+        goto leave;
+    }
+    md_data_init(&data, (const char*)der + hlen, (apr_size_t)(len - hlen));
+    serial64 = md_util_base64url_encode(&data, p);
+    
+    *pid = apr_pstrcat(p, kid64, ".", serial64, NULL);
+    rv = APR_SUCCESS;
+leave:
+    if (der) OPENSSL_free(der);
+    if (akid) AUTHORITY_KEYID_free(akid);
+    return rv;
+}
+
 int md_certs_are_equal(const md_cert_t *a, const md_cert_t *b)
 {
     return X509_cmp(a->x509, b->x509) == 0;
@@ -1508,6 +1547,132 @@ cleanup:
     return rv;
 }
 
+#define PEM_CERT_END    "-----END CERTIFICATE-----"
+
+struct md_cert_chain_reader_t {
+    apr_array_header_t *chain;
+    BIO *bio;
+    int added;
+};
+
+static apr_status_t chain_reader_cleanup(void *data)
+{
+    md_cert_chain_reader_t *reader = data;
+
+    if (reader->bio) {
+        BIO_free(reader->bio);
+        reader->bio = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_cert_chain_reader_create(md_cert_chain_reader_t **preader,
+                                         apr_array_header_t *chain, apr_pool_t *p)
+{
+    md_cert_chain_reader_t *reader;
+
+    reader = apr_pcalloc(p, sizeof(*reader));
+    reader->chain = chain;
+    if (NULL == (reader->bio = BIO_new(BIO_s_mem()))) {
+        *preader = NULL;
+        return APR_ENOMEM;
+    }
+    apr_pool_cleanup_register(p, reader, chain_reader_cleanup, apr_pool_cleanup_null);
+    *preader = reader;
+    return APR_SUCCESS;
+}
+
+static int chain_reader_has_cert(const char *data, apr_size_t len)
+{
+    apr_size_t i, elen = sizeof(PEM_CERT_END) - 1;
+
+    /* a certificate is complete when its END line has been terminated */
+    for (i = 0; i + elen < len; ++i) {
+        if (data[i] == '-' && !memcmp(data + i, PEM_CERT_END, elen)) {
+            i += elen;
+            if (data[i] == '\n' || (data[i] == '\r' && i + 1 < len && data[i+1] == '\n')) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+apr_status_t md_cert_chain_reader_add(md_cert_chain_reader_t *reader,
+                                      const char *data, apr_size_t len)
+{
+    md_cert_t *cert;
+    char *pending;
+    long plen;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (len > INT_MAX || BIO_write(reader->bio, data, (int)len) != (int)len) {
+        rv = APR_ENOMEM;
+        goto cleanup;
+    }
+    while ((plen = BIO_get_mem_data(reader->bio, &pending)) > 0
+           && chain_reader_has_cert(pending, (apr_size_t)plen)) {
+        if (APR_SUCCESS != md_cert_read_pem(reader->bio, reader->chain->pool, &cert)) {
+            rv = APR_EINVAL;
+            goto cleanup;
+        }
+        APR_ARRAY_PUSH(reader->chain, md_cert_t *) = cert;
+        reader->added = 1;
+    }
+cleanup:
+    return rv;
+}
+
+apr_status_t md_cert_chain_reader_finish(md_cert_chain_reader_t *reader)
+{
+    md_cert_t *cert;
+    apr_status_t rv;
+
+    /* no more data will arrive, an empty BIO is at its end */
+    BIO_set_mem_eof_return(reader->bio, 0);
+    while (APR_SUCCESS == (rv = md_cert_read_pem(reader->bio, reader->chain->pool, &cert))) {
+        APR_ARRAY_PUSH(reader->chain, md_cert_t *) = cert;
+        reader->added = 1;
+    }
+    if (APR_ENOENT == rv && reader->added) {
+        rv = APR_SUCCESS;
+    }
+    return rv;
+}
+
+apr_status_t md_cert_chain_reader_body_cb(const md_http_response_t *res,
+                                          const char *data, apr_size_t len, void *baton)
+{
+    (void)res;
+    return md_cert_chain_reader_add(baton, data, len);
+}
+
+static apr_status_t chain_read_brigade(apr_array_header_t *chain, apr_pool_t *p,
+                                       apr_bucket_brigade *bb)
+{
+    md_cert_chain_reader_t *reader;
+    apr_bucket *b;
+    const char *data;
+    apr_size_t data_len;
+    apr_status_t rv;
+
+    /* parse bucket by bucket instead of flattening the complete body first */
+    if (APR_SUCCESS != (rv = md_cert_chain_reader_create(&reader, chain, p))) goto cleanup;
+    for (b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+        if (APR_BUCKET_IS_METADATA(b)) continue;
+        rv = apr_bucket_read(b, &data, &data_len, APR_BLOCK_READ);
+        if (APR_SUCCESS != rv) goto cleanup;
+        rv = md_cert_chain_reader_add(reader, data, data_len);
+        if (APR_SUCCESS != rv) goto cleanup;
+    }
+    rv = md_cert_chain_reader_finish(reader);
+cleanup:
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, rv, p, "read chain with %d certs", chain->nelts);
+    return rv;
+}
+
 apr_status_t md_cert_read_http(md_cert_t **pcert, apr_pool_t *p, 
                                const md_http_response_t *res)
 {
@@ -1556,7 +1721,6 @@ apr_status_t md_cert_chain_read_http(struct apr_array_header_t *chain,
     const char *ct = NULL;
     apr_off_t blen;
     apr_size_t data_len = 0;
-    char *data;
     md_cert_t *cert;
     apr_status_t rv = APR_ENOENT;
     
@@ -1580,16 +1744,12 @@ apr_status_t md_cert_chain_read_http(struct apr_array_header_t *chain,
     else if (!strcmp("application/pem-certificate-chain", ct)
         || !strncmp("text/plain", ct, sizeof("text/plain")-1)) {
         /* Some servers seem to think 'text/plain' is sufficient, see #232 */
-        rv = apr_brigade_pflatten(res->body, &data, &data_len, res->req->pool);
-        if (APR_SUCCESS != rv) goto cleanup;
-        rv = md_cert_read_chain(chain, res->req->pool, data, data_len);
+        rv = chain_read_brigade(chain, res->req->pool, res->body);
     }
     else {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p,
             "attempting to parse certificates from unrecognized content-type: %s", ct);
-        rv = apr_brigade_pflatten(res->body, &data, &data_len, res->req->pool);
-        if (APR_SUCCESS != rv) goto cleanup;
-        rv = md_cert_read_chain(chain, res->req->pool, data, data_len);
+        rv = chain_read_brigade(chain, res->req->pool, res->body);
         if (APR_SUCCESS == rv && chain->nelts == 0) {
             md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p,
                 "certificate chain response did not contain any certificates "
@@ -2141,6 +2301,111 @@ cleanup:
     return rv;
 }
 
+apr_status_t md_cert_info_get(md_cert_info_t **pinfo, const md_cert_t *cert,
+                              const md_cert_t *issuer, apr_pool_t *p)
+{
+    md_cert_info_t *info;
+    unsigned char iddata[SHA_DIGEST_LENGTH];
+    unsigned int ulen = 0;
+    unsigned char *der = NULL;
+    OCSP_CERTID *certid = NULL;
+    int len;
+    apr_status_t rv;
+
+    info = apr_pcalloc(p, sizeof(*info));
+    info->not_before = md_cert_get_not_before(cert);
+    info->not_after = md_cert_get_not_after(cert);
+    info->must_staple = md_cert_must_staple(cert);
+    info->serial = md_cert_get_serial_number(cert, p);
+    if (APR_SUCCESS != (rv = md_cert_to_sha256_fingerprint(&info->sha256_fingerprint, cert, p))
+        || APR_SUCCESS != (rv = md_cert_get_alt_names(&info->alt_names, cert, p))) {
+        goto leave;
+    }
+    /* both are optional */
+    md_cert_get_ari_cert_id(&info->ari_cert_id, cert, p);
+    md_cert_get_ocsp_responder_url(&info->ocsp_url, p, cert);
+
+    if (X509_digest(cert->x509, EVP_sha1(), iddata, &ulen) != 1) {
+        rv = APR_EGENERAL;
+        goto leave;
+    }
+    info->ocsp_id = apr_pcalloc(p, sizeof(*info->ocsp_id));
+    md_data_assign_pcopy(info->ocsp_id, (const char*)iddata, ulen, p);
+    if (issuer && (certid = OCSP_cert_to_id(NULL, cert->x509, issuer->x509))) {
+        len = i2d_OCSP_CERTID(certid, &der);
+        if (len > 0) {
+            info->ocsp_certid = apr_pcalloc(p, sizeof(*info->ocsp_certid));
+            md_data_assign_pcopy(info->ocsp_certid, (const char*)der, (apr_size_t)len, p);
+        }
+    }
+    rv = APR_SUCCESS;
+leave:
+    if (der) OPENSSL_free(der);
+    if (certid) OCSP_CERTID_free(certid);
+    *pinfo = (APR_SUCCESS == rv)? info : NULL;
+    return rv;
+}
+
+md_json_t *md_cert_info_to_json(const md_cert_info_t *info, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p);
+    md_timeperiod_t valid;
+
+    valid.start = info->not_before;
+    valid.end = info->not_after;
+    md_json_set_timeperiod(&valid, json, MD_KEY_VALID, NULL);
+    md_json_setb(info->must_staple, json, MD_KEY_MUST_STAPLE, NULL);
+    md_json_sets(info->serial, json, MD_KEY_SERIAL, NULL);
+    md_json_sets(info->sha256_fingerprint, json, MD_KEY_SHA256_FINGERPRINT, NULL);
+    if (info->ari_cert_id) md_json_sets(info->ari_cert_id, json, MD_KEY_ARI_CERT_ID, NULL);
+    if (info->ocsp_url) md_json_sets(info->ocsp_url, json, MD_KEY_OCSP, MD_KEY_URL, NULL);
+    md_json_sets(md_util_base64url_encode(info->ocsp_id, p), json, MD_KEY_OCSP, MD_KEY_ID, NULL);
+    if (info->ocsp_certid) {
+        md_json_sets(md_util_base64url_encode(info->ocsp_certid, p),
+                     json, MD_KEY_OCSP, MD_KEY_CERTID, NULL);
+    }
+    md_json_setsa(info->alt_names, json, MD_KEY_DOMAINS, NULL);
+    return json;
+}
+
+static md_data_t *data_from_base64url(const char *s64, apr_pool_t *p)
+{
+    md_data_t *data;
+
+    if (!s64) return NULL;
+    data = apr_pcalloc(p, sizeof(*data));
+    return (md_util_base64url_decode(data, s64, p) > 0)? data : NULL;
+}
+
+apr_status_t md_cert_info_from_json(md_cert_info_t **pinfo, md_json_t *json, apr_pool_t *p)
+{
+    md_cert_info_t *info;
+    md_timeperiod_t valid;
+    apr_status_t rv = APR_EINVAL;
+
+    info = apr_pcalloc(p, sizeof(*info));
+    if (APR_SUCCESS != md_json_get_timeperiod(&valid, json, MD_KEY_VALID, NULL)) goto leave;
+    info->not_before = valid.start;
+    info->not_after = valid.end;
+    info->must_staple = md_json_getb(json, MD_KEY_MUST_STAPLE, NULL);
+    info->serial = md_json_dups(p, json, MD_KEY_SERIAL, NULL);
+    info->sha256_fingerprint = md_json_dups(p, json, MD_KEY_SHA256_FINGERPRINT, NULL);
+    info->ari_cert_id = md_json_dups(p, json, MD_KEY_ARI_CERT_ID, NULL);
+    info->ocsp_url = md_json_dups(p, json, MD_KEY_OCSP, MD_KEY_URL, NULL);
+    info->ocsp_id = data_from_base64url(md_json_gets(json, MD_KEY_OCSP, MD_KEY_ID, NULL), p);
+    info->ocsp_certid = data_from_base64url(
+        md_json_gets(json, MD_KEY_OCSP, MD_KEY_CERTID, NULL), p);
+    info->alt_names = apr_array_make(p, 5, sizeof(const char*));
+    if (!info->serial || !info->sha256_fingerprint || !info->ocsp_id
+        || APR_SUCCESS != md_json_dupsa(info->alt_names, p, json, MD_KEY_DOMAINS, NULL)) {
+        goto leave;
+    }
+    rv = APR_SUCCESS;
+leave:
+    *pinfo = (APR_SUCCESS == rv)? info : NULL;
+    return rv;
+}
+
 apr_status_t md_check_cert_and_pkey(struct apr_array_header_t *certs, md_pkey_t *pkey)
 {
     const md_cert_t *cert;
@@ -25,6 +25,7 @@ struct md_http_response_t;
 struct md_cert_t;
 struct md_pkey_t;
 struct md_data_t;
+struct md_json_t;
 struct md_timeperiod_t;
 
 /**************************************************************************************************/
@@ -175,6 +176,30 @@ apr_status_t md_cert_read_chain(apr_array_header_t *chain, apr_pool_t *p,
 apr_status_t md_cert_chain_read_http(struct apr_array_header_t *chain,
                                      apr_pool_t *pool, const struct md_http_response_t *res);
 
+/**
+ * Incremental reading of PEM certificates from data arriving in pieces, e.g.
+ * a http response body. Certificates are added to the chain as soon as they
+ * are complete, only the data of an incomplete one is kept in between.
+ */
+typedef struct md_cert_chain_reader_t md_cert_chain_reader_t;
+
+apr_status_t md_cert_chain_reader_create(md_cert_chain_reader_t **preader,
+                                         struct apr_array_header_t *chain, apr_pool_t *p);
+apr_status_t md_cert_chain_reader_add(md_cert_chain_reader_t *reader,
+                                      const char *data, apr_size_t len);
+/**
+ * Read any remaining certificate after all data has been added. Will return
+ * APR_ENOENT if not a single certificate was found.
+ */
+apr_status_t md_cert_chain_reader_finish(md_cert_chain_reader_t *reader);
+
+/**
+ * A md_http_body_cb adding all response data to the md_cert_chain_reader_t
+ * given as baton.
+ */
+apr_status_t md_cert_chain_reader_body_cb(const struct md_http_response_t *res,
+                                          const char *data, apr_size_t len, void *baton);
+
 md_cert_state_t md_cert_state_get(const md_cert_t *cert);
 int md_cert_is_valid_now(const md_cert_t *cert);
 int md_cert_has_expired(const md_cert_t *cert);
@@ -201,6 +226,13 @@ apr_status_t md_cert_to_sha256_fingerprint(const char **pfinger, const md_cert_t
 
 const char *md_cert_get_serial_number(const md_cert_t *cert, apr_pool_t *p);
 
+/**
+ * Get the identifier of the certificate for ACME Renewal Information (RFC 9773),
+ * made from its authority key identifier and serial number.
+ * @return APR_ENOENT if the certificate has no authority key identifier
+ */
+apr_status_t md_cert_get_ari_cert_id(const char **pid, const md_cert_t *cert, apr_pool_t *p);
+
 apr_status_t md_chain_fload(struct apr_array_header_t **pcerts, 
                             apr_pool_t *p, const char *fname);
 apr_status_t md_chain_fsave(struct apr_array_header_t *certs, 
@@ -234,6 +266,43 @@ apr_status_t md_cert_get_ocsp_responder_url(const char **purl, apr_pool_t *p, co
 
 apr_status_t md_check_cert_and_pkey(struct apr_array_header_t *certs, md_pkey_t *pkey);
 
+/**************************************************************************************************/
+/* certificate information */
+
+/**
+ * The properties of a certificate that are needed after it has been loaded,
+ * extracted once so that they may be kept without the certificate itself.
+ */
+typedef struct md_cert_info_t md_cert_info_t;
+struct md_cert_info_t {
+    apr_time_t not_before;
+    apr_time_t not_after;
+    int must_staple;
+    const char *serial;                   /* serial number in hex */
+    const char *sha256_fingerprint;       /* hex of sha256 digest of DER */
+    const char *ari_cert_id;              /* RFC 9773 identifier or NULL */
+    const char *ocsp_url;                 /* OCSP responder url or NULL */
+    struct md_data_t *ocsp_id;            /* sha1 digest of DER, as used for stapling */
+    struct md_data_t *ocsp_certid;        /* DER of OCSP CERTID or NULL without issuer */
+    struct apr_array_header_t *alt_names; /* subject alternative names */
+};
+
+/**
+ * Get the information about a certificate. Without an issuer, the certificate
+ * id for OCSP requests remains unknown.
+ */
+apr_status_t md_cert_info_get(md_cert_info_t **pinfo, const md_cert_t *cert,
+                              const md_cert_t *issuer, apr_pool_t *p);
+
+struct md_json_t *md_cert_info_to_json(const md_cert_info_t *info, apr_pool_t *p);
+
+/**
+ * Restore certificate information from json.
+ * @return APR_EINVAL if the json lacks properties that every certificate has
+ */
+apr_status_t md_cert_info_from_json(md_cert_info_t **pinfo, struct md_json_t *json,
+                                    apr_pool_t *p);
+
 
 /**************************************************************************************************/
 /* X509 certificate transparency */
@@ -105,25 +105,12 @@ static size_t req_data_cb(void *data, size_t len, size_t nmemb, void *baton)
 static size_t resp_data_cb(void *data, size_t len, size_t nmemb, void *baton)
 {
     md_curl_internals_t *internals = baton;
-    md_http_response_t *res = internals->response;
     size_t blen = len * nmemb;
     apr_status_t rv;
     
-    if (res->body) {
-        if (res->req->resp_limit) {
-            apr_off_t body_len = 0;
-            apr_brigade_length(res->body, 0, &body_len);
-            if (body_len + (apr_off_t)blen > res->req->resp_limit) {
-                return 0; /* signal curl failure */
-            }
-        }
-        rv = apr_brigade_write(res->body, NULL, NULL, (const char *)data, blen);
-        if (rv != APR_SUCCESS) {
-            /* returning anything != blen will make CURL fail this */
-            return 0;
-        }
-    }
-    return blen;
+    rv = md_http_response_body_add(internals->response, (const char *)data, blen);
+    /* returning anything != blen will make CURL fail this */
+    return (APR_SUCCESS == rv)? blen : 0;
 }
 
 static size_t header_cb(void *buffer, size_t elen, size_t nmemb, void *baton)
@@ -152,6 +139,11 @@ static size_t header_cb(void *buffer, size_t elen, size_t nmemb, void *baton)
     
     if (name != NULL) {
         apr_table_add(res->headers, name, value);
+        if (!apr_strnatcasecmp("Content-Length", name)
+            && APR_SUCCESS != md_http_response_check_len(res, apr_atoi64(value))) {
+            /* no need to receive a body we are not going to accept */
+            return 0;
+        }
     }
     return clen;
 }
@@ -364,6 +356,40 @@ static apr_status_t update_status(md_http_request_t *req)
     return rv;
 }
 
+static void update_timings(md_http_request_t *req)
+{
+#if LIBCURL_VERSION_NUM >= 0x073d00
+    md_curl_internals_t *internals = req->internals;
+    curl_off_t dns = 0, conn = 0, tls = 0, start = 0, total = 0, ready;
+
+    if (!internals) return;
+    /* curl reports the times, in microseconds, passed since the start of the
+     * transfer until the end of each phase. We record the phase durations. */
+    curl_easy_getinfo(internals->curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(internals->curl, CURLINFO_CONNECT_TIME_T, &conn);
+    curl_easy_getinfo(internals->curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(internals->curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+    curl_easy_getinfo(internals->curl, CURLINFO_TOTAL_TIME_T, &total);
+
+    ready = (tls > conn)? tls : conn;
+    req->timings.dns = (apr_time_t)dns;
+    req->timings.connect = (conn > dns)? (apr_time_t)(conn - dns) : 0;
+    req->timings.tls = (tls > conn)? (apr_time_t)(tls - conn) : 0;
+    req->timings.first_byte = (start > ready)? (apr_time_t)(start - ready) : 0;
+    req->timings.total = (apr_time_t)total;
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, req->pool,
+                  "req[%d]: timings dns=%ldms connect=%ldms tls=%ldms first-byte=%ldms "
+                  "total=%ldms", req->id,
+                  (long)apr_time_as_msec(req->timings.dns),
+                  (long)apr_time_as_msec(req->timings.connect),
+                  (long)apr_time_as_msec(req->timings.tls),
+                  (long)apr_time_as_msec(req->timings.first_byte),
+                  (long)apr_time_as_msec(req->timings.total));
+#else
+    (void)req;
+#endif
+}
+
 static void fire_status(md_http_request_t *req, apr_status_t rv)
 {
     md_curl_internals_t *internals = req->internals;
@@ -395,6 +421,7 @@ static apr_status_t md_curl_perform(md_http_request_t *req)
     internals = req->internals;
     
     curle = curl_easy_perform(internals->curl);
+    update_timings(req);
     
     rv = curl_status(curle);
     if (APR_SUCCESS != rv) {
@@ -561,6 +588,7 @@ static apr_status_t md_curl_multi_perform(md_http_t *http, apr_pool_t *p,
                                   "multi_perform[%d reqs]: req[%d] done", 
                                   requests->nelts, req->id);
                     update_status(req);
+                    update_timings(req);
                     fire_status(req, curl_status(curlmsg->data.result));
                     md_array_remove(requests, req);
                     sub_http = req->http;
@@ -261,6 +261,44 @@ void md_http_set_on_response_cb(md_http_request_t *req, md_http_response_cb *cb,
     req->cb.on_response_data = baton;
 }
 
+void md_http_set_on_body_cb(md_http_request_t *req, md_http_body_cb *cb, void *baton)
+{
+    req->cb.on_body = cb;
+    req->cb.on_body_data = baton;
+}
+
+apr_status_t md_http_response_check_len(md_http_response_t *res, apr_off_t len)
+{
+    md_http_request_t *req = res->req;
+
+    if (req->resp_limit > 0 && len > req->resp_limit) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, APR_ENOSPC, req->pool,
+                      "req[%d]: response body of %ld bytes exceeds limit of %ld",
+                      req->id, (long)len, (long)req->resp_limit);
+        return APR_ENOSPC;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_http_response_body_add(md_http_response_t *res, const char *data, apr_size_t len)
+{
+    md_http_request_t *req = res->req;
+    apr_status_t rv;
+
+    /* check on the running total, no need to inspect what we already have */
+    rv = md_http_response_check_len(res, res->body_len + (apr_off_t)len);
+    if (APR_SUCCESS != rv) goto leave;
+    res->body_len += (apr_off_t)len;
+    if (req->cb.on_body) {
+        rv = req->cb.on_body(res, data, len, req->cb.on_body_data);
+    }
+    else if (res->body) {
+        rv = apr_brigade_write(res->body, NULL, NULL, data, len);
+    }
+leave:
+    return rv;
+}
+
 apr_status_t md_http_perform(md_http_request_t *req)
 {
     return req->http->impl->perform(req);
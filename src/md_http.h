@@ -39,12 +39,23 @@ typedef apr_status_t md_http_status_cb(const md_http_request_t *req, apr_status_
  */
 typedef apr_status_t md_http_response_cb(const md_http_response_t *res, void *data);
 
+/**
+ * Callback invoked with each piece of response body data as it arrives, after
+ * all response headers have been received. When set, the body is not collected
+ * in the response brigade, which stays empty.
+ * Returning anything but APR_SUCCESS aborts the request.
+ */
+typedef apr_status_t md_http_body_cb(const md_http_response_t *res, const char *data,
+                                     apr_size_t len, void *baton);
+
 typedef struct md_http_callbacks_t md_http_callbacks_t;
 struct md_http_callbacks_t {
     md_http_status_cb *on_status;
     void *on_status_data;
     md_http_response_cb *on_response;
     void *on_response_data;
+    md_http_body_cb *on_body;
+    void *on_body_data;
 };
 
 typedef struct md_http_timeouts_t md_http_timeouts_t;
@@ -55,6 +66,19 @@ struct md_http_timeouts_t {
     apr_time_t stalled;
 };
 
+/**
+ * Durations of the phases of a request, as far as the implementation is
+ * able to measure them. All values are 0 if unknown.
+ */
+typedef struct md_http_timings_t md_http_timings_t;
+struct md_http_timings_t {
+    apr_time_t dns;                 /* resolving the host name */
+    apr_time_t connect;             /* establishing the connection after name resolution */
+    apr_time_t tls;                 /* TLS handshake after connect, 0 for plain connections */
+    apr_time_t first_byte;          /* from connection ready to first response byte */
+    apr_time_t total;               /* complete request, from start to end */
+};
+
 struct md_http_request_t {
     md_http_t *http;
     apr_pool_t *pool;
@@ -72,6 +96,7 @@ struct md_http_request_t {
     apr_off_t resp_limit;
     md_http_timeouts_t timeout;
     md_http_callbacks_t cb;
+    md_http_timings_t timings;      /* filled by implementation once response is received */
     void *internals;
 };
 
@@ -80,6 +105,7 @@ struct md_http_response_t {
     int status;
     apr_table_t *headers;
     struct apr_bucket_brigade *body;
+    apr_off_t body_len;             /* number of body bytes received so far */
 };
 
 apr_status_t md_http_create(md_http_t **phttp, apr_pool_t *p, const char *user_agent,
@@ -155,6 +181,15 @@ void md_http_set_on_status_cb(md_http_request_t *req, md_http_status_cb *cb, voi
  */
 void md_http_set_on_response_cb(md_http_request_t *req, md_http_response_cb *cb, void *baton);
 
+/**
+ * Set the callback to consume the response body while it is being received,
+ * instead of collecting it in the response brigade.
+ * @param req       the request
+ * @param cb        the callback to invoke on body data
+ * @param baton     data passed to the callback    
+ */
+void md_http_set_on_body_cb(md_http_request_t *req, md_http_body_cb *cb, void *baton);
+
 /**
  * Create a GET request.
  * @param preq      the created request after success
@@ -261,6 +296,20 @@ struct md_http_impl_t {
 
 void md_http_use_implementation(md_http_impl_t *impl);
 
+/**
+ * Check a response body length announced by the server, e.g. in a Content-Length
+ * header, against the response limit of the request. Returns APR_ENOSPC when the
+ * body will not fit, so that implementations may fail early.
+ */
+apr_status_t md_http_response_check_len(md_http_response_t *res, apr_off_t len);
+
+/**
+ * Hand body data received by the implementation over to the response. The data
+ * is passed to the on_body callback, if one is set, or added to the response
+ * brigade otherwise. Fails with APR_ENOSPC when the response limit is exceeded.
+ */
+apr_status_t md_http_response_body_add(md_http_response_t *res, const char *data, apr_size_t len);
+
 /**
  * get/set data the implementation wants to remember between requests
  * in the same md_http_t instance.
@@ -0,0 +1,237 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <apr_atomic.h>
+#include <apr_lib.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include "md_http01.h"
+
+/* Removed entries leave slots that lookups need to step over. Past this
+ * many, the entries still used are inserted anew. */
+#define SLOTS_FREED_MAX     (MD_HTTP01_SLOTS / 4)
+/* A reader gives up on a slot that changes this many times while it copies
+ * it, the challenge is then answered from the store. */
+#define SLOT_READ_RETRIES   100
+
+typedef enum {
+    SLOT_EMPTY,                 /* never used, ends a probe sequence */
+    SLOT_USED,
+    SLOT_FREE,                  /* was used, probe sequences continue */
+} slot_state_t;
+
+/* A slot in shared memory. Only the process running the renewals writes,
+ * readers retry when `seq` is odd or changed while they copied the data. */
+typedef struct {
+    volatile apr_uint32_t seq;
+    apr_uint32_t state;
+    char host[MD_HTTP01_HOST_MAX];
+    char data[MD_HTTP01_DATA_MAX];
+} http01_slot_t;
+
+struct md_http01_slots_t {
+    http01_slot_t *slots;
+    apr_thread_mutex_t *mutex;  /* serializes writers in the renewing process */
+    int used;                   /* slots in SLOT_USED, as seen by the writer */
+    int freed;                  /* slots in SLOT_FREE, as seen by the writer */
+};
+
+apr_size_t md_http01_slots_size(void)
+{
+    return MD_HTTP01_SLOTS * sizeof(http01_slot_t);
+}
+
+apr_status_t md_http01_slots_create(md_http01_slots_t **pslots, void *mem, apr_pool_t *p)
+{
+    md_http01_slots_t *slots;
+    apr_status_t rv;
+
+    slots = apr_pcalloc(p, sizeof(*slots));
+    slots->slots = mem;
+    memset(slots->slots, 0, md_http01_slots_size());
+    rv = apr_thread_mutex_create(&slots->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    *pslots = (APR_SUCCESS == rv)? slots : NULL;
+    return rv;
+}
+
+static apr_uint32_t host_hash(const char *host)
+{
+    apr_uint32_t h = 2166136261u;
+
+    for (; *host; ++host) {
+        h = (h ^ (unsigned char)*host) * 16777619u;
+    }
+    return h;
+}
+
+static const char *host_key(char *buf, apr_size_t len, const char *host)
+{
+    apr_size_t i;
+
+    for (i = 0; host[i]; ++i) {
+        if (i+1 >= len) return NULL;
+        buf[i] = (char)apr_tolower(host[i]);
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+/* Find the slot of host or, if not there, the first free one on its probe sequence.
+ * Only called by writers, holding the mutex. */
+static http01_slot_t *slot_find(md_http01_slots_t *slots, const char *key)
+{
+    http01_slot_t *slot, *free_slot = NULL;
+    apr_uint32_t i, start = host_hash(key) % MD_HTTP01_SLOTS;
+
+    for (i = 0; i < MD_HTTP01_SLOTS; ++i) {
+        slot = &slots->slots[(start + i) % MD_HTTP01_SLOTS];
+        if (slot->state == SLOT_USED) {
+            if (!strcmp(key, slot->host)) return slot;
+        }
+        else {
+            if (!free_slot) free_slot = slot;
+            if (slot->state == SLOT_EMPTY) break;
+        }
+    }
+    return free_slot;
+}
+
+static void slot_write(http01_slot_t *slot, slot_state_t state, const char *key,
+                       const char *data)
+{
+    apr_atomic_inc32(&slot->seq);
+    slot->state = state;
+    apr_cpystrn(slot->host, key, sizeof(slot->host));
+    apr_cpystrn(slot->data, data, sizeof(slot->data));
+    apr_atomic_inc32(&slot->seq);
+}
+
+/* Empty all slots and insert the used ones again, so that no freed slot
+ * lengthens a lookup. Readers may miss an entry meanwhile and look in
+ * the store instead. */
+static void slots_rehash(md_http01_slots_t *slots, apr_pool_t *p)
+{
+    http01_slot_t *used = NULL, *slot;
+    int i, n = 0;
+
+    if (slots->used) {
+        used = apr_palloc(p, (apr_size_t)slots->used * sizeof(*used));
+    }
+    for (i = 0; i < MD_HTTP01_SLOTS; ++i) {
+        slot = &slots->slots[i];
+        if (slot->state == SLOT_USED && n < slots->used) {
+            memcpy(&used[n++], slot, sizeof(*slot));
+        }
+        if (slot->state != SLOT_EMPTY) {
+            slot_write(slot, SLOT_EMPTY, "", "");
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        slot = slot_find(slots, used[i].host);
+        assert(slot);
+        slot_write(slot, SLOT_USED, used[i].host, used[i].data);
+    }
+    slots->used = n;
+    slots->freed = 0;
+}
+
+apr_status_t md_http01_slots_set(md_http01_slots_t *slots, const char *host,
+                                 const char *key_authz, apr_pool_t *p)
+{
+    http01_slot_t *slot;
+    char key[MD_HTTP01_HOST_MAX];
+    apr_status_t rv = APR_SUCCESS;
+
+    if (!host_key(key, sizeof(key), host)) return APR_ENOSPC;
+    if (key_authz && strlen(key_authz) >= MD_HTTP01_DATA_MAX) {
+        /* make sure no old value stays visible */
+        md_http01_slots_set(slots, host, NULL, p);
+        return APR_ENOSPC;
+    }
+
+    apr_thread_mutex_lock(slots->mutex);
+    slot = slot_find(slots, key);
+    if (!slot) {
+        rv = APR_ENOSPC;
+    }
+    else if (key_authz) {
+        if (slot->state != SLOT_USED) {
+            if (slot->state == SLOT_FREE) --slots->freed;
+            ++slots->used;
+        }
+        slot_write(slot, SLOT_USED, key, key_authz);
+    }
+    else if (slot->state == SLOT_USED) {
+        slot_write(slot, SLOT_FREE, "", "");
+        --slots->used;
+        ++slots->freed;
+        if (!slots->used || slots->freed > SLOTS_FREED_MAX) {
+            slots_rehash(slots, p);
+        }
+    }
+    apr_thread_mutex_unlock(slots->mutex);
+    return rv;
+}
+
+const char *md_http01_slots_get(md_http01_slots_t *slots, const char *host,
+                                const char *token, apr_pool_t *p)
+{
+    http01_slot_t *slot, copy;
+    char key[MD_HTTP01_HOST_MAX];
+    apr_uint32_t i, seq, start;
+    apr_size_t token_len;
+    int retries;
+
+    if (!slots || !host || !host_key(key, sizeof(key), host)) return NULL;
+    start = host_hash(key) % MD_HTTP01_SLOTS;
+    for (i = 0; i < MD_HTTP01_SLOTS; ++i) {
+        slot = &slots->slots[(start + i) % MD_HTTP01_SLOTS];
+        retries = 0;
+        do {
+            if (++retries > SLOT_READ_RETRIES) return NULL;
+            seq = apr_atomic_read32(&slot->seq);
+            memcpy(&copy, slot, sizeof(copy));
+        } while ((seq & 1) || seq != apr_atomic_read32(&slot->seq));
+
+        if (copy.state == SLOT_EMPTY) break;
+        copy.host[sizeof(copy.host)-1] = '\0';
+        if (copy.state == SLOT_USED && !strcmp(key, copy.host)) {
+            /* the content is the key authorization "token.thumbprint" */
+            copy.data[sizeof(copy.data)-1] = '\0';
+            token_len = strlen(token);
+            if (strncmp(copy.data, token, token_len) || copy.data[token_len] != '.') {
+                return NULL;
+            }
+            return apr_pstrdup(p, copy.data);
+        }
+    }
+    return NULL;
+}
+
+int md_http01_slots_count(md_http01_slots_t *slots, int *pfreed)
+{
+    int used;
+
+    apr_thread_mutex_lock(slots->mutex);
+    used = slots->used;
+    if (pfreed) *pfreed = slots->freed;
+    apr_thread_mutex_unlock(slots->mutex);
+    return used;
+}
@@ -0,0 +1,64 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef md_http01_h
+#define md_http01_h
+
+/* Challenges being validated at the same time, when the table is full,
+ * the store has them. */
+#define MD_HTTP01_SLOTS         1024
+#define MD_HTTP01_HOST_MAX      256
+#define MD_HTTP01_DATA_MAX      256
+
+/**
+ * A hash table of http-01 challenge contents by host name, in a memory
+ * block that can be shared between processes. Only one process writes,
+ * serialized by a mutex, others read without locking.
+ */
+typedef struct md_http01_slots_t md_http01_slots_t;
+
+/**
+ * The size of the memory block the table needs.
+ */
+apr_size_t md_http01_slots_size(void);
+
+/**
+ * Create an empty table in the memory block of md_http01_slots_size() bytes.
+ */
+apr_status_t md_http01_slots_create(md_http01_slots_t **pslots, void *mem, apr_pool_t *p);
+
+/**
+ * Set the key authorization for host or, with a NULL key_authz, remove it.
+ * Returns APR_ENOSPC when the table is full or the values do not fit.
+ */
+apr_status_t md_http01_slots_set(md_http01_slots_t *slots, const char *host,
+                                 const char *key_authz, apr_pool_t *p);
+
+/**
+ * Get the content of the http-01 challenge for host with the given token,
+ * allocated from the pool, as it is stored in MD_SG_CHALLENGES. NULL when the
+ * table does not have it or its slot could not be read while it was changing.
+ */
+const char *md_http01_slots_get(md_http01_slots_t *slots, const char *host,
+                                const char *token, apr_pool_t *p);
+
+/**
+ * Get the number of slots in use and, if pfreed is not NULL, the number of
+ * slots that were used and still lengthen lookups.
+ */
+int md_http01_slots_count(md_http01_slots_t *slots, int *pfreed);
+
+#endif /* md_http01_h */
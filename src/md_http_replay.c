@@ -0,0 +1,488 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_lib.h>
+#include <apr_buckets.h>
+#include <apr_file_io.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+
+#include "md.h"
+#include "md_http.h"
+#include "md_http_replay.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+
+/* Recorded responses for one "METHOD url" */
+typedef struct {
+    apr_array_header_t *responses;  /* md_json_t* in order of recording */
+    int next;                       /* index of the response to hand out next */
+} replay_entry_t;
+
+typedef struct {
+    apr_pool_t *pool;
+    const char *fpath;
+    md_http_replay_mode_t mode;
+    md_http_impl_t *real_impl;      /* record: performing the requests */
+    apr_file_t *f;                  /* record: trace opened for appending */
+    apr_hash_t *entries;            /* play: "METHOD url" -> replay_entry_t* */
+    apr_time_t latency;
+} replay_ctx_t;
+
+typedef struct {
+    md_http_response_t *response;
+    int status_fired;
+} replay_internals_t;
+
+typedef struct {
+    md_http_response_cb *on_response;
+    void *on_response_data;
+    md_http_body_cb *on_body;
+    void *on_body_data;
+    apr_bucket_brigade *body;       /* copy of the body streamed to on_body */
+} record_baton_t;
+
+static replay_ctx_t replay_ctx;
+
+static const char *entry_key(apr_pool_t *p, const char *method, const char *url)
+{
+    return apr_pstrcat(p, method, " ", url, NULL);
+}
+
+/**************************************************************************************************/
+/* recording */
+
+typedef struct {
+    apr_pool_t *p;
+    md_json_t *json;
+} record_hdr_ctx_t;
+
+static int record_header(void *baton, const char *key, const char *value)
+{
+    record_hdr_ctx_t *ctx = baton;
+    md_json_t *hdr;
+
+    /* kept as array, responses may carry several headers of the same name */
+    hdr = md_json_create(ctx->p);
+    md_json_sets(key, hdr, MD_KEY_NAME, NULL);
+    md_json_sets(value, hdr, MD_KEY_VALUE, NULL);
+    md_json_addj(hdr, ctx->json, MD_KEY_HEADERS, NULL);
+    return 1;
+}
+
+static apr_status_t record_exchange(const md_http_response_t *res, apr_bucket_brigade *bb)
+{
+    md_http_request_t *req = res->req;
+    md_json_t *json;
+    record_hdr_ctx_t hdr_ctx;
+    md_data_t body;
+    const char *line;
+    char *data;
+    apr_size_t len;
+    apr_status_t rv;
+
+    json = md_json_create(req->pool);
+    md_json_sets(req->method, json, MD_KEY_METHOD, NULL);
+    md_json_sets(req->url, json, MD_KEY_URL, NULL);
+    md_json_setl(res->status, json, MD_KEY_STATUS, NULL);
+    hdr_ctx.p = req->pool;
+    hdr_ctx.json = json;
+    apr_table_do(record_header, &hdr_ctx, res->headers, NULL);
+    if (bb) {
+        rv = apr_brigade_pflatten(bb, &data, &len, req->pool);
+        if (APR_SUCCESS != rv) goto leave;
+        if (len > 0) {
+            md_data_init(&body, data, len);
+            md_json_sets(md_util_base64url_encode(&body, req->pool), json, MD_KEY_BODY, NULL);
+        }
+    }
+    md_json_setl((long)apr_time_as_msec(req->timings.total), json, MD_KEY_TOTAL, NULL);
+
+    line = md_json_writep(json, req->pool, MD_JSON_FMT_COMPACT);
+    if (!line) {
+        rv = APR_EINVAL;
+        goto leave;
+    }
+    rv = apr_file_write_full(replay_ctx.f, line, strlen(line), NULL);
+    if (APR_SUCCESS == rv) rv = apr_file_putc('\n', replay_ctx.f);
+    if (APR_SUCCESS == rv) rv = apr_file_flush(replay_ctx.f);
+leave:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, req->pool,
+                      "req[%d]: recording %s %s to %s", req->id, req->method, req->url,
+                      replay_ctx.fpath);
+    }
+    return rv;
+}
+
+static apr_status_t record_on_response(const md_http_response_t *res, void *data)
+{
+    record_baton_t *baton = data;
+
+    /* a failure to record should not change the outcome of the request */
+    record_exchange(res, baton->body? baton->body : res->body);
+    if (baton->on_response) {
+        return baton->on_response(res, baton->on_response_data);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t record_on_body(const md_http_response_t *res, const char *data,
+                                   apr_size_t len, void *baton)
+{
+    record_baton_t *rb = baton;
+    apr_status_t rv;
+
+    rv = apr_brigade_write(rb->body, NULL, NULL, data, len);
+    if (APR_SUCCESS != rv) return rv;
+    return rb->on_body(res, data, len, rb->on_body_data);
+}
+
+static void record_wrap(md_http_request_t *req)
+{
+    record_baton_t *baton;
+
+    baton = apr_pcalloc(req->pool, sizeof(*baton));
+    baton->on_response = req->cb.on_response;
+    baton->on_response_data = req->cb.on_response_data;
+    req->cb.on_response = record_on_response;
+    req->cb.on_response_data = baton;
+    if (req->cb.on_body) {
+        baton->on_body = req->cb.on_body;
+        baton->on_body_data = req->cb.on_body_data;
+        baton->body = apr_brigade_create(req->pool, req->bucket_alloc);
+        req->cb.on_body = record_on_body;
+        req->cb.on_body_data = baton;
+    }
+}
+
+typedef struct {
+    md_http_next_req *nextreq;
+    void *baton;
+} record_nextreq_t;
+
+static apr_status_t record_nextreq(md_http_request_t **preq, void *baton,
+                                   md_http_t *http, int in_flight)
+{
+    record_nextreq_t *proxy = baton;
+    apr_status_t rv;
+
+    rv = proxy->nextreq(preq, proxy->baton, http, in_flight);
+    if (APR_SUCCESS == rv) record_wrap(*preq);
+    return rv;
+}
+
+static apr_status_t record_init(void)
+{
+    return replay_ctx.real_impl->init();
+}
+
+static void record_req_cleanup(md_http_request_t *req)
+{
+    replay_ctx.real_impl->req_cleanup(req);
+}
+
+static apr_status_t record_perform(md_http_request_t *req)
+{
+    record_wrap(req);
+    return replay_ctx.real_impl->perform(req);
+}
+
+static apr_status_t record_multi_perform(md_http_t *http, apr_pool_t *p,
+                                         md_http_next_req *nextreq, void *baton)
+{
+    record_nextreq_t proxy;
+
+    proxy.nextreq = nextreq;
+    proxy.baton = baton;
+    return replay_ctx.real_impl->multi_perform(http, p, record_nextreq, &proxy);
+}
+
+static void record_cleanup(md_http_t *http, apr_pool_t *p)
+{
+    replay_ctx.real_impl->cleanup(http, p);
+}
+
+static md_http_impl_t record_impl = {
+    record_init,
+    record_req_cleanup,
+    record_perform,
+    record_multi_perform,
+    record_cleanup,
+};
+
+/**************************************************************************************************/
+/* replaying */
+
+static apr_status_t trace_add(apr_pool_t *p, const char *line, apr_size_t len)
+{
+    md_json_t *json;
+    replay_entry_t *entry;
+    const char *method, *url, *key;
+    apr_status_t rv;
+
+    if (APR_SUCCESS != (rv = md_json_readd(&json, p, line, len))) goto leave;
+    method = md_json_gets(json, MD_KEY_METHOD, NULL);
+    url = md_json_gets(json, MD_KEY_URL, NULL);
+    if (!method || !url) {
+        rv = APR_EINVAL;
+        goto leave;
+    }
+    key = entry_key(p, method, url);
+    entry = apr_hash_get(replay_ctx.entries, key, APR_HASH_KEY_STRING);
+    if (!entry) {
+        entry = apr_pcalloc(p, sizeof(*entry));
+        entry->responses = apr_array_make(p, 2, sizeof(md_json_t*));
+        apr_hash_set(replay_ctx.entries, key, APR_HASH_KEY_STRING, entry);
+    }
+    APR_ARRAY_PUSH(entry->responses, md_json_t*) = json;
+leave:
+    return rv;
+}
+
+static apr_status_t trace_load(apr_pool_t *p, const char *fpath)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    char *data, *line, *end;
+    int lineno = 0, count = 0;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, fpath, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, p);
+    if (APR_SUCCESS != rv) goto leave;
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (APR_SUCCESS == rv) {
+        data = apr_palloc(p, (apr_size_t)finfo.size + 1);
+        rv = apr_file_read_full(f, data, (apr_size_t)finfo.size, NULL);
+        data[finfo.size] = '\0';
+    }
+    apr_file_close(f);
+    if (APR_SUCCESS != rv) goto leave;
+
+    for (line = data; *line; line = *end? end + 1 : end) {
+        ++lineno;
+        end = strchr(line, '\n');
+        if (!end) end = line + strlen(line);
+        if (end == line) continue;
+        if (APR_SUCCESS != (rv = trace_add(p, line, (apr_size_t)(end - line)))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p,
+                          "%s:%d: not a recorded exchange", fpath, lineno);
+            goto leave;
+        }
+        ++count;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "%s: loaded %d exchanges for %d urls",
+                  fpath, count, (int)apr_hash_count(replay_ctx.entries));
+leave:
+    return rv;
+}
+
+static int replay_header(void *baton, size_t index, md_json_t *json)
+{
+    md_http_response_t *res = baton;
+    const char *name, *value;
+
+    (void)index;
+    name = md_json_gets(json, MD_KEY_NAME, NULL);
+    value = md_json_gets(json, MD_KEY_VALUE, NULL);
+    if (name && value) {
+        apr_table_add(res->headers, apr_pstrdup(res->req->pool, name),
+                      apr_pstrdup(res->req->pool, value));
+    }
+    return 1;
+}
+
+static apr_status_t replay_setup(md_http_request_t *req)
+{
+    replay_internals_t *internals;
+    replay_entry_t *entry;
+    md_http_response_t *res;
+    md_json_t *json;
+    md_data_t body;
+    const char *s;
+    apr_status_t rv = APR_SUCCESS;
+
+    internals = apr_pcalloc(req->pool, sizeof(*internals));
+    req->internals = internals;
+
+    entry = apr_hash_get(replay_ctx.entries, entry_key(req->pool, req->method, req->url),
+                         APR_HASH_KEY_STRING);
+    if (!entry) {
+        rv = APR_ENOENT;
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, req->pool,
+                      "req[%d]: %s %s not recorded", req->id, req->method, req->url);
+        goto leave;
+    }
+    json = APR_ARRAY_IDX(entry->responses, entry->next, md_json_t*);
+    if (entry->next + 1 < entry->responses->nelts) ++entry->next;
+
+    res = apr_pcalloc(req->pool, sizeof(*res));
+    res->req = req;
+    res->status = (int)md_json_getl(json, MD_KEY_STATUS, NULL);
+    res->headers = apr_table_make(req->pool, 5);
+    md_json_itera(replay_header, res, json, MD_KEY_HEADERS, NULL);
+    res->body = apr_brigade_create(req->pool, req->bucket_alloc);
+    if ((s = md_json_gets(json, MD_KEY_BODY, NULL))) {
+        md_util_base64url_decode(&body, s, req->pool);
+        rv = md_http_response_body_add(res, body.data, body.len);
+        if (APR_SUCCESS != rv) goto leave;
+    }
+    internals->response = res;
+    req->timings.first_byte = req->timings.total = replay_ctx.latency;
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, req->pool, "req[%d]: %s %s <-- %d (replay)",
+                  req->id, req->method, req->url, res->status);
+leave:
+    return rv;
+}
+
+static void replay_fire(md_http_request_t *req, apr_status_t rv)
+{
+    replay_internals_t *internals = req->internals;
+
+    if (internals && !internals->status_fired) {
+        internals->status_fired = 1;
+        if ((APR_SUCCESS == rv) && req->cb.on_response) {
+            rv = req->cb.on_response(internals->response, req->cb.on_response_data);
+        }
+        if (req->cb.on_status) {
+            req->cb.on_status(req, rv, req->cb.on_status_data);
+        }
+    }
+}
+
+static apr_status_t replay_init(void)
+{
+    return APR_SUCCESS;
+}
+
+static void replay_req_cleanup(md_http_request_t *req)
+{
+    req->internals = NULL;
+}
+
+static apr_status_t replay_perform(md_http_request_t *req)
+{
+    apr_status_t rv;
+
+    rv = replay_setup(req);
+    if (replay_ctx.latency > 0) apr_sleep(replay_ctx.latency);
+    replay_fire(req, rv);
+    md_http_req_destroy(req);
+    return rv;
+}
+
+static apr_status_t replay_multi_perform(md_http_t *http, apr_pool_t *p,
+                                         md_http_next_req *nextreq, void *baton)
+{
+    apr_array_header_t *requests;
+    md_http_request_t *req;
+    apr_status_t rv;
+    int i;
+
+    requests = apr_array_make(p, 10, sizeof(md_http_request_t*));
+    while (1) {
+        /* fetch as many requests as nextreq gives us, they are all "in flight" */
+        while (APR_SUCCESS == (rv = nextreq(&req, baton, http, requests->nelts))) {
+            APR_ARRAY_PUSH(requests, md_http_request_t*) = req;
+        }
+        if (!APR_STATUS_IS_ENOENT(rv)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, rv, p,
+                          "multi_perform[%d reqs]: nextreq() failed", requests->nelts);
+        }
+        if (!requests->nelts) break;
+
+        if (replay_ctx.latency > 0) apr_sleep(replay_ctx.latency);
+        for (i = 0; i < requests->nelts; ++i) {
+            req = APR_ARRAY_IDX(requests, i, md_http_request_t*);
+            replay_fire(req, replay_setup(req));
+            md_http_req_destroy(req);
+        }
+        apr_array_clear(requests);
+        if (!APR_STATUS_IS_ENOENT(rv)) break;
+    }
+    return rv;
+}
+
+static void replay_cleanup(md_http_t *http, apr_pool_t *p)
+{
+    (void)http;
+    (void)p;
+}
+
+static md_http_impl_t replay_impl = {
+    replay_init,
+    replay_req_cleanup,
+    replay_perform,
+    replay_multi_perform,
+    replay_cleanup,
+};
+
+/**************************************************************************************************/
+/* setup */
+
+apr_status_t md_http_replay_get_impl(md_http_impl_t **pimpl, apr_pool_t *p,
+                                     const char *fpath, md_http_replay_mode_t mode,
+                                     md_http_impl_t *real_impl)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    *pimpl = NULL;
+    if (replay_ctx.f) {
+        apr_file_close(replay_ctx.f);
+    }
+    replay_ctx.pool = p;
+    replay_ctx.fpath = apr_pstrdup(p, fpath);
+    replay_ctx.mode = mode;
+    replay_ctx.real_impl = real_impl;
+    replay_ctx.f = NULL;
+    replay_ctx.entries = apr_hash_make(p);
+
+    switch (mode) {
+        case MD_HTTP_REPLAY_RECORD:
+            if (!real_impl) {
+                rv = APR_EINVAL;
+                goto leave;
+            }
+            rv = apr_file_open(&replay_ctx.f, fpath,
+                               APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_APPEND|APR_FOPEN_BINARY,
+                               MD_FPROT_F_UONLY, p);
+            if (APR_SUCCESS != rv) goto leave;
+            *pimpl = &record_impl;
+            break;
+        case MD_HTTP_REPLAY_PLAY:
+            rv = trace_load(p, fpath);
+            if (APR_SUCCESS != rv) goto leave;
+            *pimpl = &replay_impl;
+            break;
+        default:
+            rv = APR_EINVAL;
+            break;
+    }
+leave:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "setting up http %s with %s",
+                      (mode == MD_HTTP_REPLAY_RECORD)? "recording" : "replay", fpath);
+    }
+    return rv;
+}
+
+void md_http_replay_set_latency(apr_time_t latency)
+{
+    replay_ctx.latency = latency;
+}
@@ -0,0 +1,61 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef md_http_replay_h
+#define md_http_replay_h
+
+struct md_http_impl_t;
+
+typedef enum {
+    MD_HTTP_REPLAY_RECORD,          /* perform real requests, append exchanges to trace */
+    MD_HTTP_REPLAY_PLAY,            /* answer requests from the exchanges in the trace */
+} md_http_replay_mode_t;
+
+/**
+ * Get a http implementation that records exchanges into a trace file or
+ * replays them from it, without any network access.
+ *
+ * In record mode, all requests are performed by `real_impl` and each response
+ * is appended as one JSON object per line to the trace file.
+ *
+ * In play mode, the trace file is read completely and requests are answered
+ * with the recorded responses for the same method and url, in the order they
+ * were recorded. When all recorded responses for a request have been used up,
+ * the last one is repeated. Requests without any recording fail with APR_ENOENT.
+ *
+ * There is only one record/replay instance per process, calling this again
+ * replaces the previous setup. It is meant for tools like a2md, not for use
+ * inside the multi-threaded server.
+ *
+ * @param pimpl     the implementation to pass to md_http_use_implementation()
+ * @param p         the pool to keep the trace data in, needs to outlive all requests
+ * @param fpath     the path of the trace file
+ * @param mode      record or play
+ * @param real_impl the implementation performing requests in record mode
+ */
+apr_status_t md_http_replay_get_impl(struct md_http_impl_t **pimpl, apr_pool_t *p,
+                                     const char *fpath, md_http_replay_mode_t mode,
+                                     struct md_http_impl_t *real_impl);
+
+/**
+ * Set the latency injected for every replayed response. Requests performed
+ * together via md_http_multi_perform() see this latency only once per batch,
+ * as if they were in flight in parallel.
+ * Set to 0 to answer requests immediately, which is the default.
+ */
+void md_http_replay_set_latency(apr_time_t latency);
+
+#endif /* md_http_replay_h */
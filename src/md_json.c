@@ -118,6 +118,11 @@ md_json_t *md_json_clone(apr_pool_t *pool, const md_json_t *json)
     return json_create(pool, json_deep_copy(json->j));
 }
 
+int md_json_equal(const md_json_t *json1, const md_json_t *json2)
+{
+    return json_equal(json1->j, json2->j);
+}
+
 /**************************************************************************************************/
 /* selectors */
 
@@ -49,6 +49,8 @@ void md_json_destroy(md_json_t *json);
 
 md_json_t *md_json_copy(apr_pool_t *pool, const md_json_t *json);
 md_json_t *md_json_clone(apr_pool_t *pool, const md_json_t *json);
+/* Return != 0 iff both hold the same value, regardless of key order in objects */
+int md_json_equal(const md_json_t *json1, const md_json_t *json2);
 
 
 int md_json_has_key(const md_json_t *json, ...);
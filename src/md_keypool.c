@@ -0,0 +1,416 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+#include <assert.h>
+#include <stdio.h>
+
+#include <apr_atomic.h>
+#include <apr_lib.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_util.h"
+#include "md_keypool.h"
+
+/* Keys being written and keys claimed are renamed to these, so a key is only
+ * visible in the pool when complete and claimed by exactly one. */
+#define KP_NEW_PREFIX           "new-"
+#define KP_CLAIMED_PREFIX       "claimed-"
+/* leftovers of crashed writers/claimers are removed after this time */
+#define KP_STALE_AGE            apr_time_from_sec(MD_SECS_PER_HOUR)
+/* a kind not counted yet, its keys are in the store only */
+#define KP_COUNT_UNKNOWN        ((apr_uint32_t)-1)
+
+typedef struct {
+    md_pkey_spec_t *spec;
+    int index;                      /* in the counts */
+} kp_kind_t;
+
+struct md_keypool_t {
+    apr_pool_t *p;
+    struct md_store_t *store;
+    int depth;                      /* keys to keep per kind, 0 when disabled */
+    int workers;                    /* max threads generating keys */
+    apr_hash_t *kinds;              /* kind name -> kp_kind_t* */
+    volatile apr_uint32_t *counts;  /* keys available per kind index */
+    volatile apr_uint32_t local_counts[MD_KEYPOOL_KINDS_MAX];
+};
+
+apr_status_t md_keypool_create(md_keypool_t **pkeypool, apr_pool_t *p, 
+                               struct md_store_t *store)
+{
+    md_keypool_t *keypool;
+    
+    keypool = apr_pcalloc(p, sizeof(*keypool));
+    keypool->p = p;
+    keypool->store = store;
+    keypool->workers = 1;
+    keypool->kinds = apr_hash_make(p);
+    md_keypool_use_counts(keypool, NULL);
+    *pkeypool = keypool;
+    return APR_SUCCESS;
+}
+
+void md_keypool_use_counts(md_keypool_t *keypool, volatile apr_uint32_t *counts)
+{
+    int i;
+    
+    keypool->counts = counts? counts : keypool->local_counts;
+    for (i = 0; i < MD_KEYPOOL_KINDS_MAX; ++i) {
+        apr_atomic_set32(&keypool->counts[i], KP_COUNT_UNKNOWN);
+    }
+}
+
+void md_keypool_configure(md_keypool_t *keypool, int depth, int workers)
+{
+    keypool->depth = (depth > 0)? depth : 0;
+    keypool->workers = (workers > 0)? workers : 1;
+}
+
+int md_keypool_is_enabled(md_keypool_t *keypool)
+{
+    return keypool && keypool->depth > 0;
+}
+
+static const char *kind_name(const md_pkey_spec_t *spec, apr_pool_t *p)
+{
+    switch (spec? spec->type : MD_PKEY_TYPE_DEFAULT) {
+        case MD_PKEY_TYPE_RSA:
+            return apr_psprintf(p, "rsa%u", spec->params.rsa.bits? 
+                                spec->params.rsa.bits : MD_PKEY_RSA_BITS_DEF);
+        case MD_PKEY_TYPE_EC:
+            return spec->params.ec.curve;
+        default:
+            return apr_psprintf(p, "rsa%u", MD_PKEY_RSA_BITS_DEF);
+    }
+}
+
+void md_keypool_add_spec(md_keypool_t *keypool, const md_pkey_spec_t *spec)
+{
+    const char *name = kind_name(spec, keypool->p);
+    kp_kind_t *kind;
+    
+    if (!apr_hash_get(keypool->kinds, name, APR_HASH_KEY_STRING)) {
+        kind = apr_pcalloc(keypool->p, sizeof(*kind));
+        if (spec) {
+            kind->spec = md_pkey_spec_from_json(md_pkey_spec_to_json(spec, keypool->p), 
+                                                keypool->p);
+        }
+        else {
+            kind->spec = apr_pcalloc(keypool->p, sizeof(*kind->spec));
+            kind->spec->type = MD_PKEY_TYPE_DEFAULT;
+        }
+        kind->index = (int)apr_hash_count(keypool->kinds);
+        apr_hash_set(keypool->kinds, name, APR_HASH_KEY_STRING, kind);
+    }
+}
+
+/* The count of keys of a kind in memory, NULL if there is no room for it */
+static volatile apr_uint32_t *kind_count(md_keypool_t *keypool, const char *name)
+{
+    kp_kind_t *kind = apr_hash_get(keypool->kinds, name, APR_HASH_KEY_STRING);
+    
+    return (kind && kind->index < MD_KEYPOOL_KINDS_MAX)? &keypool->counts[kind->index] : NULL;
+}
+
+/* Only the process filling the pool changes counts, claims of other servers
+ * sharing the store show in the next fill. */
+static void count_add(md_keypool_t *keypool, const char *name, int delta)
+{
+    volatile apr_uint32_t *count = kind_count(keypool, name);
+    apr_uint32_t n;
+    
+    if (!count || KP_COUNT_UNKNOWN == (n = apr_atomic_read32(count))) return;
+    if (delta > 0 || n > 0) apr_atomic_set32(count, (apr_uint32_t)((int)n + delta));
+}
+
+static apr_status_t rand_id(const char **pid, apr_pool_t *p)
+{
+    md_data_t data;
+    apr_status_t rv;
+    
+    md_data_pinit(&data, 8, p);
+    if (APR_SUCCESS != (rv = md_rand_bytes((unsigned char*)data.data, data.len, p))) {
+        return rv;
+    }
+    return md_data_to_hex(pid, 0, p, &data);
+}
+
+static int collect_name(void *baton, const char *name, const char *aspect,
+                        md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
+{
+    apr_array_header_t *names = baton;
+    
+    (void)aspect;
+    (void)vtype;
+    (void)value;
+    (void)ptemp;
+    APR_ARRAY_PUSH(names, const char*) = apr_pstrdup(names->pool, name);
+    return 1;
+}
+
+static apr_array_header_t *list_names(md_keypool_t *keypool, const char *pattern, 
+                                      apr_pool_t *p)
+{
+    apr_array_header_t *names = apr_array_make(p, 10, sizeof(const char*));
+    
+    md_store_iter_names(collect_name, names, keypool->store, p, MD_SG_KEYPOOL, pattern);
+    return names;
+}
+
+apr_status_t md_keypool_claim(md_pkey_t **ppkey, md_keypool_t *keypool,
+                              const md_pkey_spec_t *spec, apr_pool_t *p)
+{
+    apr_array_header_t *names;
+    const char *name, *id, *claimed;
+    apr_status_t rv = APR_ENOENT;
+    int i;
+    
+    *ppkey = NULL;
+    if (!md_keypool_is_enabled(keypool)) return APR_ENOENT;
+    
+    names = list_names(keypool, apr_pstrcat(p, kind_name(spec, p), "-*", NULL), p);
+    for (i = 0; i < names->nelts; ++i) {
+        name = APR_ARRAY_IDX(names, i, const char*);
+        if (APR_SUCCESS != (rv = rand_id(&id, p))) break;
+        claimed = apr_pstrcat(p, KP_CLAIMED_PREFIX, id, NULL);
+        /* Only one of several claimers succeeds in the rename */
+        rv = md_store_rename(keypool->store, p, MD_SG_KEYPOOL, name, claimed);
+        if (APR_SUCCESS != rv 
+            || md_store_get_modified(keypool->store, MD_SG_KEYPOOL, claimed, 
+                                     MD_FN_PRIVKEY, p) == 0) {
+            rv = APR_ENOENT;
+            continue;
+        }
+        rv = md_pkey_load(keypool->store, MD_SG_KEYPOOL, claimed, NULL, ppkey, p);
+        md_store_purge(keypool->store, p, MD_SG_KEYPOOL, claimed);
+        if (APR_SUCCESS == rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
+                          "key pool: claimed %s key %s", kind_name(spec, p), name);
+            count_add(keypool, kind_name(spec, p), -1);
+            break;
+        }
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                      "key pool: unable to load %s, removed", name);
+    }
+    return rv;
+}
+
+static apr_status_t gen_key(md_keypool_t *keypool, const char *kind, apr_pool_t *p)
+{
+    kp_kind_t *k;
+    md_pkey_t *pkey;
+    const char *id, *tmp;
+    apr_status_t rv;
+    
+    k = apr_hash_get(keypool->kinds, kind, APR_HASH_KEY_STRING);
+    assert(k);
+    if (APR_SUCCESS != (rv = rand_id(&id, p))
+        || APR_SUCCESS != (rv = md_pkey_gen(&pkey, p, k->spec))) goto leave;
+    tmp = apr_pstrcat(p, KP_NEW_PREFIX, id, NULL);
+    if (APR_SUCCESS != (rv = md_pkey_save(keypool->store, p, MD_SG_KEYPOOL, tmp, 
+                                          NULL, pkey, 1))) goto leave;
+    /* published in the pool only when completely written */
+    rv = md_store_rename(keypool->store, p, MD_SG_KEYPOOL, tmp, 
+                         apr_pstrcat(p, kind, "-", id, NULL));
+    if (APR_SUCCESS == rv) count_add(keypool, kind, 1);
+leave:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                      "key pool: generating %s key", kind);
+    }
+    return rv;
+}
+
+/* The keys to generate in a fill, handed out to the workers one at a time. */
+typedef struct {
+    md_keypool_t *keypool;
+    apr_array_header_t *todo;       /* kind names, one per key to generate */
+    int next;
+    int generated;
+    apr_thread_mutex_t *mutex;
+} fill_ctx_t;
+
+static const char *fill_next(fill_ctx_t *ctx, apr_status_t last_rv)
+{
+    const char *kind = NULL;
+    
+    if (ctx->mutex) apr_thread_mutex_lock(ctx->mutex);
+    if (APR_SUCCESS == last_rv) ++ctx->generated;
+    if (ctx->next < ctx->todo->nelts) {
+        kind = APR_ARRAY_IDX(ctx->todo, ctx->next++, const char*);
+    }
+    if (ctx->mutex) apr_thread_mutex_unlock(ctx->mutex);
+    return kind;
+}
+
+static void fill_run(fill_ctx_t *ctx, apr_pool_t *ptemp)
+{
+    const char *kind;
+    apr_status_t rv = APR_EINCOMPLETE;
+    
+    while ((kind = fill_next(ctx, rv))) {
+        rv = gen_key(ctx->keypool, kind, ptemp);
+        apr_pool_clear(ptemp);
+    }
+}
+
+#if APR_HAS_THREADS
+
+static void * APR_THREAD_FUNC fill_worker(apr_thread_t *thread, void *baton)
+{
+    fill_ctx_t *ctx = baton;
+    apr_allocator_t *allocator;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+    
+    /* workers run concurrently, each needs a pool with its own allocator */
+    apr_allocator_create(&allocator);
+    apr_allocator_max_free_set(allocator, 1);
+    rv = apr_pool_create_ex(&ptemp, NULL, NULL, allocator);
+    if (APR_SUCCESS != rv) {
+        apr_allocator_destroy(allocator);
+        goto leave;
+    }
+    apr_allocator_owner_set(allocator, ptemp);
+    apr_pool_tag(ptemp, "md_keypool_worker");
+    fill_run(ctx, ptemp);
+    apr_pool_destroy(ptemp);
+leave:
+    apr_thread_exit(thread, rv);
+    return NULL;
+}
+
+static int fill_parallel(fill_ctx_t *ctx, int nworkers, apr_pool_t *p)
+{
+    apr_thread_t **threads;
+    apr_status_t trv;
+    int i, started = 0;
+    
+    if (APR_SUCCESS != apr_thread_mutex_create(&ctx->mutex, APR_THREAD_MUTEX_DEFAULT, p)) {
+        return 0;
+    }
+    threads = apr_pcalloc(p, (apr_size_t)nworkers * sizeof(apr_thread_t *));
+    for (i = 0; i < nworkers; ++i) {
+        if (APR_SUCCESS != apr_thread_create(&threads[i], NULL, fill_worker, ctx, p)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, 0, p, 
+                          "key pool: unable to start worker %d", i);
+            break;
+        }
+        ++started;
+    }
+    for (i = 0; i < started; ++i) {
+        apr_thread_join(&trv, threads[i]);
+    }
+    return started;
+}
+
+#endif /* APR_HAS_THREADS */
+
+static int remove_stale(void *baton, const char *name, const char *aspect,
+                        md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
+{
+    md_keypool_t *keypool = baton;
+    apr_time_t modified;
+    
+    (void)aspect;
+    (void)vtype;
+    (void)value;
+    modified = md_store_get_modified(keypool->store, MD_SG_KEYPOOL, name, MD_FN_PRIVKEY, ptemp);
+    if (modified + KP_STALE_AGE < apr_time_now()) {
+        md_store_purge(keypool->store, ptemp, MD_SG_KEYPOOL, name);
+    }
+    return 1;
+}
+
+int md_keypool_fill(md_keypool_t *keypool, apr_pool_t *p)
+{
+    fill_ctx_t ctx;
+    apr_hash_index_t *hi;
+    apr_pool_t *ptemp;
+    volatile apr_uint32_t *count;
+    const char *kind;
+    int i, n, missing, total = 0, nworkers;
+    
+    if (!md_keypool_is_enabled(keypool) || apr_hash_count(keypool->kinds) == 0) return 0;
+    
+    md_store_iter_names(remove_stale, keypool, keypool->store, p, MD_SG_KEYPOOL, 
+                        KP_NEW_PREFIX "*");
+    md_store_iter_names(remove_stale, keypool, keypool->store, p, MD_SG_KEYPOOL, 
+                        KP_CLAIMED_PREFIX "*");
+    
+    /* One key per worker, so that a fill takes about as long as generating a
+     * single key. The caller comes back for the others. */
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.keypool = keypool;
+    ctx.todo = apr_array_make(p, keypool->workers, sizeof(const char*));
+    for (hi = apr_hash_first(p, keypool->kinds); hi; hi = apr_hash_next(hi)) {
+        kind = apr_hash_this_key(hi);
+        n = list_names(keypool, apr_pstrcat(p, kind, "-*", NULL), p)->nelts;
+        if ((count = kind_count(keypool, kind))) apr_atomic_set32(count, (apr_uint32_t)n);
+        missing = keypool->depth - n;
+        for (i = 0; i < missing; ++i) {
+            if (ctx.todo->nelts < keypool->workers) {
+                APR_ARRAY_PUSH(ctx.todo, const char*) = kind;
+            }
+            ++total;
+        }
+    }
+    if (ctx.todo->nelts == 0) return 0;
+    
+    nworkers = ctx.todo->nelts;
+#if APR_HAS_THREADS
+    if (nworkers > 1 && fill_parallel(&ctx, nworkers, p) > 0) goto leave;
+#endif
+    (void)nworkers;
+    apr_pool_create(&ptemp, p);
+    apr_pool_tag(ptemp, "md_keypool_fill");
+    fill_run(&ctx, ptemp);
+    apr_pool_destroy(ptemp);
+#if APR_HAS_THREADS
+leave:
+#endif
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
+                  "key pool: generated %d of %d missing keys", ctx.generated, total);
+    return total - ctx.generated;
+}
+
+md_json_t *md_keypool_status(md_keypool_t *keypool, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_hash_index_t *hi;
+    volatile apr_uint32_t *count;
+    const char *kind;
+    apr_uint32_t n;
+    
+    json = md_json_create(p);
+    md_json_setl(keypool->depth, json, MD_KEY_DEPTH, NULL);
+    for (hi = apr_hash_first(p, keypool->kinds); hi; hi = apr_hash_next(hi)) {
+        kind = apr_hash_this_key(hi);
+        count = kind_count(keypool, kind);
+        if (!count || KP_COUNT_UNKNOWN == (n = apr_atomic_read32(count))) {
+            n = (apr_uint32_t)list_names(keypool, apr_pstrcat(p, kind, "-*", NULL), p)->nelts;
+        }
+        md_json_setl((long)n, json, MD_KEY_KEYS, kind, NULL);
+    }
+    return json;
+}
@@ -0,0 +1,83 @@
+/* Copyright 2019 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef md_keypool_h
+#define md_keypool_h
+
+struct apr_hash_t;
+struct md_json_t;
+struct md_pkey_t;
+struct md_pkey_spec_t;
+struct md_store_t;
+
+/**
+ * A pool of private keys, generated ahead of time in the store group
+ * MD_SG_KEYPOOL, so that renewals do not have to wait for their generation.
+ * Keys are kept per kind, e.g. `rsa2048` or `secp384r1`, each in its own
+ * directory `<kind>-<id>`. They are encrypted like keys in STAGING.
+ */
+typedef struct md_keypool_t md_keypool_t;
+
+/* Kinds whose number of keys is kept in memory */
+#define MD_KEYPOOL_KINDS_MAX    16
+/* Time between fills while keys are missing */
+#define MD_KEYPOOL_FILL_PAUSE   apr_time_from_sec(1)
+
+apr_status_t md_keypool_create(md_keypool_t **pkeypool, apr_pool_t *p, 
+                               struct md_store_t *store);
+
+/**
+ * Set how many keys of each kind to keep ready, 0 disables the pool, and
+ * how many threads may generate them in parallel.
+ */
+void md_keypool_configure(md_keypool_t *keypool, int depth, int workers);
+
+int md_keypool_is_enabled(md_keypool_t *keypool);
+
+/**
+ * Keep the number of available keys per kind in the given array of
+ * MD_KEYPOOL_KINDS_MAX elements, e.g. in shared memory, so that all processes
+ * report them without looking at the store. NULL keeps them in the keypool.
+ */
+void md_keypool_use_counts(md_keypool_t *keypool, volatile apr_uint32_t *counts);
+
+/**
+ * Have the pool generate keys of the given kind. Called before the first
+ * md_keypool_fill() with the key specifications of all MDs that will renew.
+ */
+void md_keypool_add_spec(md_keypool_t *keypool, const struct md_pkey_spec_t *spec);
+
+/**
+ * Take a pre-generated key matching spec out of the pool. Each key is given
+ * out only once, even to several processes sharing the store.
+ * @return APR_ENOENT when no key is available
+ */
+apr_status_t md_keypool_claim(struct md_pkey_t **ppkey, md_keypool_t *keypool,
+                              const struct md_pkey_spec_t *spec, apr_pool_t *p);
+
+/**
+ * Generate keys missing in the pool, at most one per worker, so that a call
+ * takes about as long as generating a single key.
+ * @return the number of keys still missing
+ */
+int md_keypool_fill(md_keypool_t *keypool, apr_pool_t *p);
+
+/**
+ * The pool's depth and the number of keys available per kind, as last seen
+ * by the process filling the pool.
+ */
+struct md_json_t *md_keypool_status(md_keypool_t *keypool, apr_pool_t *p);
+
+#endif /* md_keypool_h */
@@ -311,10 +311,21 @@ cleanup:
 
 apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
                            md_cert_t *cert, md_cert_t *issuer, const md_t *md)
+{
+    md_cert_info_t *info;
+    apr_status_t rv;
+    
+    rv = md_cert_info_get(&info, cert, issuer, reg->p);
+    if (APR_SUCCESS != rv) return rv;
+    return md_ocsp_prime_info(reg, ext_id, ext_id_len, info, md);
+}
+
+apr_status_t md_ocsp_prime_info(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
+                                const md_cert_info_t *info, const md_t *md)
 {
     md_ocsp_status_t *ostat;
     const char *name;
-    md_data_t id;
+    const unsigned char *der;
     apr_status_t rv = APR_SUCCESS;
     
     /* Called during post_config. no mutex protection needed */
@@ -322,37 +333,35 @@ apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ex
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, reg->p,
                   "md[%s]: priming OCSP status", name);
 
-    rv = md_ocsp_init_id(&id, reg->p, cert);
-    if (APR_SUCCESS != rv) goto cleanup;
-
-    ostat = apr_hash_get(reg->ostat_by_id, id.data, (apr_ssize_t)id.len);
+    ostat = apr_hash_get(reg->ostat_by_id, info->ocsp_id->data, (apr_ssize_t)info->ocsp_id->len);
     if (ostat) goto cleanup; /* already seen it, cert is used in >1 server_rec */
 
     ostat = apr_pcalloc(reg->p, sizeof(*ostat));
-    ostat->id = id;
+    md_data_assign_pcopy(&ostat->id, info->ocsp_id->data, info->ocsp_id->len, reg->p);
     ostat->reg = reg;
     ostat->md_name = name;
     md_data_to_hex(&ostat->hexid, 0, reg->p, &ostat->id);
     ostat->file_name = apr_psprintf(reg->p, "ocsp-%s.json", ostat->hexid);
-    rv = md_cert_to_sha256_fingerprint(&ostat->hex_sha256, cert, reg->p); 
-    if (APR_SUCCESS != rv) goto cleanup;
+    ostat->hex_sha256 = apr_pstrdup(reg->p, info->sha256_fingerprint);
 
-    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, reg->p, 
-                  "md[%s]: getting ocsp responder from cert", name);
-    rv = md_cert_get_ocsp_responder_url(&ostat->responder_url, reg->p, cert);
-    if (APR_SUCCESS != rv) {
+    if (!info->ocsp_url) {
+        rv = APR_ENOENT;
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, reg->p,
                       "md[%s]: certificate with serial %s has no OCSP responder URL",
-                      name, md_cert_get_serial_number(cert, reg->p));
+                      name, info->serial);
         goto cleanup;
     }
+    ostat->responder_url = apr_pstrdup(reg->p, info->ocsp_url);
 
-    ostat->certid = OCSP_cert_to_id(NULL, md_cert_get_X509(cert), md_cert_get_X509(issuer));
+    if (info->ocsp_certid) {
+        der = (const unsigned char*)info->ocsp_certid->data;
+        ostat->certid = d2i_OCSP_CERTID(NULL, &der, (long)info->ocsp_certid->len);
+    }
     if (!ostat->certid) {
         rv = APR_EGENERAL;
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, reg->p, 
                       "md[%s]: unable to create OCSP certid for certificate with serial %s", 
-                      name, md_cert_get_serial_number(cert, reg->p));
+                      name, info->serial);
         goto cleanup;
     }
     
@@ -366,7 +375,7 @@ apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ex
         md_ocsp_id_map_t *id_map;
 
         id_map = apr_pcalloc(reg->p, sizeof(*id_map));
-        id_map->id = id;
+        id_map->id = ostat->id;
         md_data_assign_pcopy(&id_map->external_id, ext_id, ext_id_len, reg->p);
         /* check for collision/uniqness? */
         apr_hash_set(reg->id_by_external_id, id_map->external_id.data,
@@ -462,15 +471,14 @@ static void ocsp_get_meta(md_ocsp_cert_stat_t *pstat, md_timeperiod_t *pvalid,
 }
 
 apr_status_t md_ocsp_get_meta(md_ocsp_cert_stat_t *pstat, md_timeperiod_t *pvalid,
-                              md_ocsp_reg_t *reg, const md_cert_t *cert,
+                              md_ocsp_reg_t *reg, const md_data_t *id,
                               apr_pool_t *p, const md_t *md)
 {
     md_ocsp_status_t *ostat;
     const char *name;
-    apr_status_t rv;
+    apr_status_t rv = APR_SUCCESS;
     md_timeperiod_t valid;
     md_ocsp_cert_stat_t stat;
-    md_data_t id;
     
     (void)p;
     (void)md;
@@ -480,10 +488,7 @@ apr_status_t md_ocsp_get_meta(md_ocsp_cert_stat_t *pstat, md_timeperiod_t *pvali
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, reg->p, 
                   "md[%s]: OCSP, get_status", name);
     
-    rv = md_ocsp_init_id(&id, p, cert);
-    if (APR_SUCCESS != rv) goto cleanup;
-    
-    ostat = apr_hash_get(reg->ostat_by_id, id.data, (apr_ssize_t)id.len);
+    ostat = id? apr_hash_get(reg->ostat_by_id, id->data, (apr_ssize_t)id->len) : NULL;
     if (!ostat) {
         rv = APR_ENOENT;
         goto cleanup;
@@ -500,6 +505,33 @@ apr_size_t md_ocsp_count(md_ocsp_reg_t *reg)
     return apr_hash_count(reg->ostat_by_id);
 }
 
+typedef struct {
+    md_ocsp_meta_cb *cb;
+    void *baton;
+} ocsp_iter_ctx_t;
+
+static int iter_meta(void *baton, const void *key, apr_ssize_t klen, const void *val)
+{
+    ocsp_iter_ctx_t *ctx = baton;
+    const md_ocsp_status_t *ostat = val;
+    
+    (void)key;
+    (void)klen;
+    return ctx->cb(ctx->baton, ostat->md_name, ostat->hexid, 
+                   ostat->resp_stat, &ostat->resp_valid);
+}
+
+void md_ocsp_iter_meta(md_ocsp_reg_t *reg, md_ocsp_meta_cb *cb, void *baton)
+{
+    ocsp_iter_ctx_t ctx;
+    
+    ctx.cb = cb;
+    ctx.baton = baton;
+    apr_thread_mutex_lock(reg->mutex);
+    apr_hash_do(iter_meta, &ctx, reg->ostat_by_id);
+    apr_thread_mutex_unlock(reg->mutex);
+}
+
 static const char *certid_as_hex(const OCSP_CERTID *certid, apr_pool_t *p)
 {
     md_data_t der;
@@ -736,7 +768,7 @@ static apr_status_t ostat_on_req_status(const md_http_request_t *req, apr_status
     md_ocsp_update_t *update = baton;
     md_ocsp_status_t *ostat = update->ostat;
 
-    (void)req;
+    md_result_http_timings_add(update->result, req->url, &req->timings);
     md_job_end_run(update->job, update->result);
     if (APR_SUCCESS != status) {
         ++ostat->errors;
@@ -838,6 +870,7 @@ static apr_status_t next_todo(md_http_request_t **preq, void *baton,
             if (APR_SUCCESS != rv) goto cleanup;
             md_http_set_on_status_cb(req, ostat_on_req_status, update);
             md_http_set_on_response_cb(req, ostat_on_resp, update);
+            md_counter_inc(MD_CNT_OCSP_REQUESTS);
             rv = APR_SUCCESS;
             md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, req->pool,
                           "scheduling OCSP request[%d] for %s, %d request in flight",
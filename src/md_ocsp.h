@@ -46,6 +46,13 @@ apr_status_t md_ocsp_init_id(struct md_data_t *id, apr_pool_t *p, const md_cert_
 apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
                            md_cert_t *x, md_cert_t *issuer, const md_t *md);
 
+/**
+ * Prime the OCSP status of a certificate from the information kept about it,
+ * without the need to have the certificate itself.
+ */
+apr_status_t md_ocsp_prime_info(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
+                                const md_cert_info_t *info, const md_t *md);
+
 typedef void md_ocsp_copy_der(const unsigned char *der, apr_size_t der_len, void *userdata);
 
 apr_status_t md_ocsp_get_status(md_ocsp_copy_der *cb, void *userdata, md_ocsp_reg_t *reg,
@@ -53,11 +60,23 @@ apr_status_t md_ocsp_get_status(md_ocsp_copy_der *cb, void *userdata, md_ocsp_re
                                 apr_pool_t *p, const md_t *md);
 
 apr_status_t md_ocsp_get_meta(md_ocsp_cert_stat_t *pstat, md_timeperiod_t *pvalid,
-                              md_ocsp_reg_t *reg, const md_cert_t *cert,
+                              md_ocsp_reg_t *reg, const struct md_data_t *id,
                               apr_pool_t *p, const md_t *md);
 
 apr_size_t md_ocsp_count(md_ocsp_reg_t *reg);
 
+/**
+ * Callback for md_ocsp_iter_meta(), return 0 to stop the iteration.
+ */
+typedef int md_ocsp_meta_cb(void *baton, const char *md_name, const char *hexid,
+                            md_ocsp_cert_stat_t stat, const md_timeperiod_t *valid);
+
+/**
+ * Iterate over the status of all certificates as known in memory, without 
+ * looking into the store. The callback must not call other md_ocsp functions.
+ */
+void md_ocsp_iter_meta(md_ocsp_reg_t *reg, md_ocsp_meta_cb *cb, void *baton);
+
 void md_ocsp_renew(md_ocsp_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp, apr_time_t *pnext_run);
 
 apr_status_t md_ocsp_remove_responses_older_than(md_ocsp_reg_t *reg, apr_pool_t *p, 
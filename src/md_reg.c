@@ -21,12 +21,15 @@
 
 #include <apr_lib.h>
 #include <apr_hash.h>
+#include <apr_thread_mutex.h>
 #include <apr_strings.h>
 #include <apr_uri.h>
 
 #include "md.h"
 #include "md_crypt.h"
 #include "md_event.h"
+#include "md_http.h"
+#include "md_keypool.h"
 #include "md_log.h"
 #include "md_json.h"
 #include "md_result.h"
@@ -38,6 +41,9 @@
 
 #include "md_acme.h"
 #include "md_acme_acct.h"
+#include "md_acme_authz.h"
+#include "md_acme_issuers.h"
+#include "md_acme_limit.h"
 
 struct md_reg_t {
     apr_pool_t *p;
@@ -57,6 +63,17 @@ struct md_reg_t {
     int retry_failover;
     int use_store_locks;
     apr_time_t lock_wait_timeout;
+    struct md_acme_limits_t *ca_limits;
+    struct md_keypool_t *keypool;
+    struct md_acme_issuers_t *issuers;
+    md_domain_idx_t *domain_idx;
+    md_json_t *snapshot_old;        /* certificate snapshot as found in the store */
+    md_json_t *snapshot;            /* snapshot entries of the certificates loaded */
+    int snapshot_changed;
+    apr_pool_t *ari_pool;           /* allocations of the ari cache */
+    apr_hash_t *ari_cache;          /* md name -> ari_cached_t* */
+    apr_hash_t *ari_dirs;           /* ca url -> ari_dir_t* */
+    apr_thread_mutex_t *mutex;      /* serializes caches used from renewal workers */
 };
 
 /**************************************************************************************************/
@@ -108,9 +125,19 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *p, struct md_store_t *st
 
     md_timeslice_create(&reg->renew_window, p, MD_TIME_LIFE_NORM, MD_TIME_RENEW_WINDOW_DEF); 
     md_timeslice_create(&reg->warn_window, p, MD_TIME_LIFE_NORM, MD_TIME_WARN_WINDOW_DEF); 
+    reg->ari_cache = apr_hash_make(p);
+    reg->ari_dirs = apr_hash_make(p);
     
-    if (APR_SUCCESS == (rv = md_acme_protos_add(reg->protos, p))
-        && APR_SUCCESS == (rv = md_tailscale_protos_add(reg->protos, p))) {
+    if (APR_SUCCESS == (rv = apr_thread_mutex_create(&reg->mutex, APR_THREAD_MUTEX_DEFAULT, p))
+        && APR_SUCCESS == (rv = apr_pool_create(&reg->ari_pool, p))
+        && APR_SUCCESS == (rv = md_acme_acct_index_init(p))
+        && APR_SUCCESS == (rv = md_acme_authz_known_init(p))
+        && APR_SUCCESS == (rv = md_acme_protos_add(reg->protos, p))
+        && APR_SUCCESS == (rv = md_tailscale_protos_add(reg->protos, p))
+        && APR_SUCCESS == (rv = md_acme_limits_create(&reg->ca_limits, p, store, 
+                                                        use_store_locks, lock_wait_timeout))
+        && APR_SUCCESS == (rv = md_keypool_create(&reg->keypool, p, store))
+        && APR_SUCCESS == (rv = md_acme_issuers_create(&reg->issuers, p, store))) {
         rv = load_props(reg, p);
     }
     
@@ -123,6 +150,21 @@ struct md_store_t *md_reg_store_get(md_reg_t *reg)
     return reg->store;
 }
 
+struct md_acme_limits_t *md_reg_ca_limits_get(md_reg_t *reg)
+{
+    return reg->ca_limits;
+}
+
+struct md_keypool_t *md_reg_keypool_get(md_reg_t *reg)
+{
+    return reg->keypool;
+}
+
+struct md_acme_issuers_t *md_reg_issuers_get(md_reg_t *reg)
+{
+    return reg->issuers;
+}
+
 /**************************************************************************************************/
 /* checks */
 
@@ -218,7 +260,6 @@ static apr_status_t state_init(md_reg_t *reg, apr_pool_t *p, md_t *md)
     md_state_t state = MD_S_COMPLETE;
     const char *state_descr = NULL;
     const md_pubcert_t *pub;
-    const md_cert_t *cert;
     const md_pkey_spec_t *spec;
     apr_status_t rv = APR_SUCCESS;
     int i;
@@ -237,14 +278,13 @@ static apr_status_t state_init(md_reg_t *reg, apr_pool_t *p, md_t *md)
                       "md{%s}: check cert %s", md->name, md_pkey_spec_name(spec));
         rv = md_reg_get_pubcert(&pub, reg, md, i, p);
         if (APR_SUCCESS == rv) {
-            cert = APR_ARRAY_IDX(pub->certs, 0, const md_cert_t*);
             if (!md_is_covered_by_alt_names(md, pub->alt_names)) {
                 state = MD_S_INCOMPLETE;
                 state_descr = apr_psprintf(p, "certificate(%s) does not cover all domains.",
                                            md_pkey_spec_name(spec));
                 goto cleanup;
             }
-            if (!md->must_staple != !md_cert_must_staple(cert)) {
+            if (!md->must_staple != !pub->info->must_staple) {
                 state = MD_S_INCOMPLETE;
                 state_descr = apr_psprintf(p, "'must-staple' is%s requested, but "
                               "certificate(%s) has it%s enabled.",
@@ -353,7 +393,13 @@ static int find_domain(void *baton, md_reg_t *reg, md_t *md)
 md_t *md_reg_find(md_reg_t *reg, const char *domain, apr_pool_t *p)
 {
     find_domain_ctx ctx;
+    md_t *md;
 
+    if (reg->domain_idx) {
+        /* domains are frozen, no need to look at all of them */
+        md = md_domain_idx_get(reg->domain_idx, domain);
+        return md? md_reg_get(reg, md->name, p) : NULL;
+    }
     ctx.domain = domain;
     ctx.md = NULL;
     
@@ -548,6 +594,7 @@ apr_status_t md_reg_delete_acct(md_reg_t *reg, apr_pool_t *p, const char *acct_i
     rv = md_store_remove(reg->store, MD_SG_ACCOUNTS, acct_id, MD_FN_ACCOUNT, p, 1);
     if (APR_SUCCESS == rv) {
         md_store_remove(reg->store, MD_SG_ACCOUNTS, acct_id, MD_FN_ACCT_KEY, p, 1);
+        md_acme_acct_index_remove(reg->store, acct_id, p);
     }
     return rv;
 }
@@ -555,6 +602,106 @@ apr_status_t md_reg_delete_acct(md_reg_t *reg, apr_pool_t *p, const char *acct_i
 /**************************************************************************************************/
 /* certificate related */
 
+/* Every start of the server needs the certificates of all mds, but rarely
+ * any of them has changed since the last one. The snapshot keeps what is
+ * needed of them, keyed by file path and stamped with inode, modification
+ * time and size of the file, so that unchanged ones are not parsed again. */
+#define MD_CERT_SNAPSHOT_VERSION    1
+
+static int snapshot_count_entry(void *baton, const char *key, md_json_t *json)
+{
+    (void)key;
+    (void)json;
+    ++(*(int*)baton);
+    return 1;
+}
+
+static int snapshot_count(md_json_t *json)
+{
+    int count = 0;
+    md_json_iterkey(snapshot_count_entry, &count, json, MD_KEY_CERTS, NULL);
+    return count;
+}
+
+static void snapshot_init(md_reg_t *reg)
+{
+    md_json_t *json;
+
+    if (reg->snapshot) return;
+    reg->snapshot = md_json_create(reg->p);
+    md_json_setl(MD_CERT_SNAPSHOT_VERSION, reg->snapshot, MD_KEY_VERSION, NULL);
+    if (APR_SUCCESS == md_store_load_json(reg->store, MD_SG_NONE, NULL,
+                                          MD_FN_CERT_SNAPSHOT, &json, reg->p)
+        && MD_CERT_SNAPSHOT_VERSION == md_json_getl(json, MD_KEY_VERSION, NULL)) {
+        reg->snapshot_old = json;
+    }
+}
+
+static apr_status_t snapshot_stamp(const char **pstamp, const char *fpath, apr_pool_t *p)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    *pstamp = NULL;
+    rv = apr_stat(&finfo, fpath, APR_FINFO_SIZE|APR_FINFO_MTIME|APR_FINFO_INODE, p);
+    if (APR_STATUS_IS_INCOMPLETE(rv)) rv = APR_SUCCESS;
+    if (APR_SUCCESS != rv) return rv;
+    if ((finfo.valid & (APR_FINFO_SIZE|APR_FINFO_MTIME)) == (APR_FINFO_SIZE|APR_FINFO_MTIME)) {
+        *pstamp = apr_psprintf(p, "%" APR_UINT64_T_FMT "-%" APR_TIME_T_FMT "-%" APR_OFF_T_FMT,
+                               (finfo.valid & APR_FINFO_INODE)? (apr_uint64_t)finfo.inode : 0,
+                               finfo.mtime, finfo.size);
+    }
+    return APR_SUCCESS;
+}
+
+static md_cert_info_t *snapshot_get(md_reg_t *reg, const char *fpath, const char *stamp,
+                                    apr_pool_t *p)
+{
+    md_json_t *entry;
+    md_cert_info_t *info;
+    const char *s;
+
+    snapshot_init(reg);
+    if (!stamp || !reg->snapshot_old) return NULL;
+    entry = md_json_getj(reg->snapshot_old, MD_KEY_CERTS, fpath, NULL);
+    if (!entry || !(s = md_json_gets(entry, MD_KEY_STAMP, NULL)) || strcmp(s, stamp)
+        || APR_SUCCESS != md_cert_info_from_json(&info, md_json_getj(entry, MD_KEY_CERT, NULL), p)) {
+        return NULL;
+    }
+    md_json_setj(entry, reg->snapshot, MD_KEY_CERTS, fpath, NULL);
+    return info;
+}
+
+static void snapshot_set(md_reg_t *reg, const char *fpath, const char *stamp,
+                         const md_cert_info_t *info, apr_pool_t *p)
+{
+    md_json_t *entry;
+
+    snapshot_init(reg);
+    if (!stamp) return;
+    entry = md_json_create(p);
+    md_json_sets(stamp, entry, MD_KEY_STAMP, NULL);
+    md_json_setj(md_cert_info_to_json(info, p), entry, MD_KEY_CERT, NULL);
+    md_json_setj(entry, reg->snapshot, MD_KEY_CERTS, fpath, NULL);
+    reg->snapshot_changed = 1;
+}
+
+static void snapshot_save(md_reg_t *reg, apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    if (!reg->snapshot) return;
+    /* nothing new and nothing to forget */
+    if (!reg->snapshot_changed && reg->snapshot_old
+        && snapshot_count(reg->snapshot_old) == snapshot_count(reg->snapshot)) return;
+    rv = md_store_save_json(reg->store, p, MD_SG_NONE, NULL,
+                            MD_FN_CERT_SNAPSHOT, reg->snapshot, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "saving certificate snapshot");
+    }
+    reg->snapshot_changed = 0;
+}
+
 static apr_status_t pubcert_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_reg_t *reg = baton;
@@ -562,9 +709,11 @@ static apr_status_t pubcert_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp,
     md_pubcert_t *pubcert, **ppubcert;
     const md_t *md;
     int index;
-    const md_cert_t *cert;
+    const md_cert_t *cert, *issuer;
     md_cert_state_t cert_state;
     md_store_group_t group;
+    md_pkey_spec_t *spec = NULL;
+    const char *fpath, *stamp;
     apr_status_t rv;
     
     ppubcert = va_arg(ap, md_pubcert_t **);
@@ -573,25 +722,46 @@ static apr_status_t pubcert_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp,
     index = va_arg(ap, int);
     
     if (md->cert_files && md->cert_files->nelts) {
-        rv = md_chain_fload(&certs, p, APR_ARRAY_IDX(md->cert_files, index, const char *));
+        fpath = APR_ARRAY_IDX(md->cert_files, index, const char *);
     }
     else {
-        md_pkey_spec_t *spec = md_pkeys_spec_get(md->pks, index);;
+        spec = md_pkeys_spec_get(md->pks, index);
+        rv = md_store_get_fname(&fpath, reg->store, group, md->name,
+                                md_chain_filename(spec, ptemp), p);
+        if (APR_SUCCESS != rv) goto leave;
+    }
+    if (APR_SUCCESS != (rv = snapshot_stamp(&stamp, fpath, ptemp))) goto leave;
+
+    pubcert = apr_pcalloc(p, sizeof(*pubcert));
+    pubcert->cert_file = fpath;
+    if ((pubcert->info = snapshot_get(reg, fpath, stamp, p))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, ptemp,
+                      "md{%s}: certificate(%d) unchanged, using snapshot", md->name, index);
+        pubcert->alt_names = pubcert->info->alt_names;
+        goto leave;
+    }
+
+    if (spec) {
         rv = md_pubcert_load(reg->store, group, md->name, spec, &certs, p);
     }
+    else {
+        rv = md_chain_fload(&certs, p, fpath);
+    }
     if (APR_SUCCESS != rv) goto leave;
     if (certs->nelts == 0) {
         rv = APR_ENOENT;
         goto leave;
     }
 
-    pubcert = apr_pcalloc(p, sizeof(*pubcert));
     pubcert->certs = certs;
     cert = APR_ARRAY_IDX(certs, 0, const md_cert_t *);
-    if (APR_SUCCESS != (rv = md_cert_get_alt_names(&pubcert->alt_names, cert, p))) goto leave;
+    issuer = (certs->nelts > 1)? APR_ARRAY_IDX(certs, 1, const md_cert_t *) : NULL;
+    if (APR_SUCCESS != (rv = md_cert_info_get(&pubcert->info, cert, issuer, p))) goto leave;
+    pubcert->alt_names = pubcert->info->alt_names;
     switch ((cert_state = md_cert_state_get(cert))) {
         case MD_CERT_VALID:
         case MD_CERT_EXPIRED:
+            snapshot_set(reg, fpath, stamp, pubcert->info, ptemp);
             break;
         default:
             md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_EINVAL, ptemp, 
@@ -624,7 +794,7 @@ apr_status_t md_reg_get_pubcert(const md_pubcert_t **ppubcert, md_reg_t *reg,
         apr_hash_set(reg->certs, name, (apr_ssize_t)strlen(name), pubcert);
     }
 leave:
-    if (APR_SUCCESS == rv && (!pubcert || !pubcert->certs)) {
+    if (APR_SUCCESS == rv && (!pubcert || !pubcert->info)) {
         rv = APR_ENOENT;
     }
     *ppubcert = (APR_SUCCESS == rv)? pubcert : NULL;
@@ -649,7 +819,6 @@ apr_status_t md_reg_get_cred_files(const char **pkeyfile, const char **pcertfile
 apr_time_t md_reg_valid_until(md_reg_t *reg, const md_t *md, apr_pool_t *p)
 {
     const md_pubcert_t *pub;
-    const md_cert_t *cert;
     int i;
     apr_time_t t, valid_until = 0;
     apr_status_t rv;
@@ -657,8 +826,7 @@ apr_time_t md_reg_valid_until(md_reg_t *reg, const md_t *md, apr_pool_t *p)
     for (i = 0; i < md_cert_count(md); ++i) {
         rv = md_reg_get_pubcert(&pub, reg, md, i, p);
         if (APR_SUCCESS == rv) {
-            cert = APR_ARRAY_IDX(pub->certs, 0, const md_cert_t*);
-            t = md_cert_get_not_after(cert);
+            t = pub->info->not_after;
             if (valid_until == 0 || t < valid_until) {
                 valid_until = t;
             }
@@ -667,23 +835,397 @@ apr_time_t md_reg_valid_until(md_reg_t *reg, const md_t *md, apr_pool_t *p)
     return valid_until;
 }
 
+/**************************************************************************************************/
+/* ACME Renewal Information (RFC 9773) */
+
+#define MD_ARI_POLL_DEFAULT     apr_time_from_sec(6 * MD_SECS_PER_HOUR)
+#define MD_ARI_POLL_ERROR       apr_time_from_sec(MD_SECS_PER_HOUR)
+#define MD_ARI_POLL_MIN         apr_time_from_sec(60)
+#define MD_ARI_POLL_MAX         apr_time_from_sec(MD_SECS_PER_DAY)
+#define MD_ARI_MAX_PARALLEL     8
+#define MD_ARI_DIR_MAX_AGE      apr_time_from_sec(MD_SECS_PER_DAY)
+#define MD_ARI_STAT_INTERVAL    apr_time_from_sec(60)
+
+static const char *ari_ca_url(const md_t *md)
+{
+    if (md->ca_proto && strcmp(MD_PROTO_ACME, md->ca_proto)) return NULL;
+    if (md->ca_effective) return md->ca_effective;
+    if (md->ca_urls && md->ca_urls->nelts > 0) {
+        return APR_ARRAY_IDX(md->ca_urls, 0, const char*);
+    }
+    return NULL;
+}
+
+static md_json_t *ari_load(md_reg_t *reg, const md_t *md, apr_pool_t *p)
+{
+    md_json_t *json = NULL;
+    
+    if (!ari_ca_url(md)) return NULL;
+    md_store_load_json(reg->store, MD_SG_STAGING, md->name, MD_FN_RENEWAL_INFO, &json, p);
+    return json;
+}
+
+/* The renewal times the CA suggested, as last read from an md's renewal info.
+ * Status pages and the renew watchdog ask often, the file changes rarely and
+ * maybe in another process, so it is only read again when its mtime changes.
+ * That is looked at once per MD_ARI_STAT_INTERVAL, updates made in this
+ * process invalidate the entry right away. */
+typedef struct {
+    apr_time_t loaded;              /* modification time of the file read, -1 to reload */
+    apr_time_t checked;             /* when the modification time was last looked at */
+    apr_hash_t *renew_at;           /* cert id -> apr_time_t* */
+} ari_cached_t;
+
+static int ari_cache_add(void *baton, const char *key, md_json_t *json)
+{
+    md_reg_t *reg = ((void**)baton)[0];
+    ari_cached_t *cached = ((void**)baton)[1];
+    apr_time_t *pt;
+
+    if (!(pt = apr_hash_get(cached->renew_at, key, APR_HASH_KEY_STRING))) {
+        pt = apr_pcalloc(reg->ari_pool, sizeof(*pt));
+        apr_hash_set(cached->renew_at, apr_pstrdup(reg->ari_pool, key), APR_HASH_KEY_STRING, pt);
+    }
+    *pt = md_json_get_time(json, MD_KEY_RENEW_AT, NULL);
+    return 1;
+}
+
+/* Get the cache entry of the md, up to date with the store. Call with reg->mutex held. */
+static ari_cached_t *ari_cache_get(md_reg_t *reg, const md_t *md, apr_pool_t *p)
+{
+    ari_cached_t *cached;
+    apr_hash_index_t *hi;
+    apr_time_t modified, now;
+    md_json_t *json;
+    void *baton[2];
+
+    cached = apr_hash_get(reg->ari_cache, md->name, APR_HASH_KEY_STRING);
+    if (!cached) {
+        cached = apr_pcalloc(reg->ari_pool, sizeof(*cached));
+        cached->loaded = -1;
+        cached->renew_at = apr_hash_make(reg->ari_pool);
+        apr_hash_set(reg->ari_cache, apr_pstrdup(reg->ari_pool, md->name),
+                     APR_HASH_KEY_STRING, cached);
+    }
+    now = apr_time_now();
+    if (cached->loaded != -1 && now - cached->checked < MD_ARI_STAT_INTERVAL) return cached;
+    cached->checked = now;
+    modified = md_store_get_modified(reg->store, MD_SG_STAGING, md->name,
+                                     MD_FN_RENEWAL_INFO, p);
+    if (modified == cached->loaded) return cached;
+
+    for (hi = apr_hash_first(p, cached->renew_at); hi; hi = apr_hash_next(hi)) {
+        *(apr_time_t*)apr_hash_this_val(hi) = 0;
+    }
+    if (modified && (json = ari_load(reg, md, p))) {
+        baton[0] = reg;
+        baton[1] = cached;
+        md_json_iterkey(ari_cache_add, baton, json, MD_KEY_CERTS, NULL);
+    }
+    cached->loaded = modified;
+    return cached;
+}
+
+static void ari_cache_invalidate(md_reg_t *reg, const md_t *md)
+{
+    ari_cached_t *cached;
+
+    apr_thread_mutex_lock(reg->mutex);
+    cached = apr_hash_get(reg->ari_cache, md->name, APR_HASH_KEY_STRING);
+    if (cached) cached->loaded = -1;
+    apr_thread_mutex_unlock(reg->mutex);
+}
+
+/* The renewal time the CA suggested for the certificate, if we know one. */
+static apr_time_t ari_renew_at(ari_cached_t *cached, const md_cert_info_t *info)
+{
+    apr_time_t *pt;
+
+    if (!cached || !info->ari_cert_id) return 0;
+    pt = apr_hash_get(cached->renew_at, info->ari_cert_id, APR_HASH_KEY_STRING);
+    return pt? *pt : 0;
+}
+
+typedef struct {
+    apr_pool_t *p;
+    md_reg_t *reg;
+    const md_t *md;
+    md_json_t *json;                /* renewal info of the md, as stored */
+    const char *cert_id;
+    const char *url;
+    int changed;
+} ari_fetch_t;
+
+typedef struct {
+    apr_array_header_t *fetches;
+    int next;
+} ari_batch_t;
+
+static void ari_set_next_update(ari_fetch_t *fetch, apr_time_t now, apr_time_t next)
+{
+    if (next < now + MD_ARI_POLL_MIN) next = now + MD_ARI_POLL_MIN;
+    if (next > now + MD_ARI_POLL_MAX) next = now + MD_ARI_POLL_MAX;
+    md_json_set_time(next, fetch->json, MD_KEY_CERTS, fetch->cert_id, MD_KEY_NEXT_UPDATE, NULL);
+    fetch->changed = 1;
+}
+
+static apr_status_t ari_on_response(const md_http_response_t *res, void *baton)
+{
+    ari_fetch_t *fetch = baton;
+    md_json_t *body = NULL;
+    md_timeperiod_t window, old;
+    apr_time_t now = apr_time_now(), next, renew_at;
+    apr_uint64_t rnd;
+    const char *s;
+    apr_status_t rv = APR_SUCCESS;
+
+    next = md_util_retry_after(res->headers, now);
+    if (res->status != 200 
+        || APR_SUCCESS != (rv = md_json_read_http(&body, fetch->p, res))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, fetch->p, 
+                      "%s: renewal info not available (http status %d) at %s", 
+                      fetch->md->name, res->status, fetch->url);
+        ari_set_next_update(fetch, now, next? next : now + MD_ARI_POLL_ERROR);
+        return APR_SUCCESS;
+    }
+    
+    window.start = md_time_parse_rfc3339(md_json_gets(body, "suggestedWindow", "start", NULL));
+    window.end = md_time_parse_rfc3339(md_json_gets(body, "suggestedWindow", "end", NULL));
+    if (!window.start || window.end < window.start) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, APR_EINVAL, fetch->p, 
+                      "%s: renewal info without valid window at %s", 
+                      fetch->md->name, fetch->url);
+        ari_set_next_update(fetch, now, next? next : now + MD_ARI_POLL_ERROR);
+        return APR_SUCCESS;
+    }
+    
+    /* Pick a random time inside the window, so that renewals spread out. 
+     * Keep the time we picked as long as the window stays the same. */
+    md_json_get_timeperiod(&old, fetch->json, MD_KEY_CERTS, fetch->cert_id, MD_KEY_WINDOW, NULL);
+    renew_at = md_json_get_time(fetch->json, MD_KEY_CERTS, fetch->cert_id, MD_KEY_RENEW_AT, NULL);
+    if (!renew_at || old.start != window.start || old.end != window.end) {
+        renew_at = window.start;
+        if (window.end > window.start 
+            && APR_SUCCESS == md_rand_bytes((unsigned char*)&rnd, sizeof(rnd), fetch->p)) {
+            /* the window is in microseconds and often several days wide */
+            renew_at += (apr_time_t)(rnd % (apr_uint64_t)(window.end - window.start));
+        }
+        md_json_set_timeperiod(&window, fetch->json, MD_KEY_CERTS, fetch->cert_id, 
+                               MD_KEY_WINDOW, NULL);
+        md_json_set_time(renew_at, fetch->json, MD_KEY_CERTS, fetch->cert_id, 
+                         MD_KEY_RENEW_AT, NULL);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, fetch->p, 
+                      "%s: CA suggests renewal in [%s], picked %s", fetch->md->name,
+                      md_timeperiod_print(fetch->p, &window), 
+                      md_duration_print(fetch->p, renew_at - now));
+    }
+    if ((s = md_json_gets(body, "explanationURL", NULL))) {
+        md_json_sets(s, fetch->json, MD_KEY_CERTS, fetch->cert_id, MD_KEY_EXPLANATION, NULL);
+    }
+    ari_set_next_update(fetch, now, next? next : now + MD_ARI_POLL_DEFAULT);
+    return APR_SUCCESS;
+}
+
+static apr_status_t ari_next_req(md_http_request_t **preq, void *baton, 
+                                 md_http_t *http, int in_flight)
+{
+    ari_batch_t *batch = baton;
+    ari_fetch_t *fetch;
+    apr_status_t rv;
+    
+    if (in_flight >= MD_ARI_MAX_PARALLEL || batch->next >= batch->fetches->nelts) {
+        return APR_ENOENT;
+    }
+    fetch = APR_ARRAY_IDX(batch->fetches, batch->next++, ari_fetch_t*);
+    rv = md_http_GET_create(preq, http, fetch->url, NULL);
+    if (APR_SUCCESS == rv) {
+        md_http_set_on_response_cb(*preq, ari_on_response, fetch);
+    }
+    return rv;
+}
+
+/* The renewalInfo url from a CA's directory. It is looked up again after
+ * MD_ARI_DIR_MAX_AGE, not on every update. */
+typedef struct {
+    apr_time_t looked_up;
+    const char *renewal_info;       /* NULL when the CA does not offer it */
+} ari_dir_t;
+
+static apr_status_t ari_dir_get(const char **pbase, md_reg_t *reg, md_acme_t *acme, 
+                                apr_pool_t *p)
+{
+    ari_dir_t *dir;
+    const char *base;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(reg->mutex);
+    dir = apr_hash_get(reg->ari_dirs, acme->url, APR_HASH_KEY_STRING);
+    if (dir && now - dir->looked_up < MD_ARI_DIR_MAX_AGE) {
+        *pbase = dir->renewal_info;
+        apr_thread_mutex_unlock(reg->mutex);
+        return md_acme_http_init(acme);
+    }
+    apr_thread_mutex_unlock(reg->mutex);
+
+    if (APR_SUCCESS != (rv = md_acme_setup(acme, md_result_make(p, APR_SUCCESS)))) {
+        *pbase = NULL;
+        return rv;
+    }
+    base = *pbase = acme->api.v2.renewal_info;
+    
+    apr_thread_mutex_lock(reg->mutex);
+    if (!dir) {
+        dir = apr_pcalloc(reg->ari_pool, sizeof(*dir));
+        apr_hash_set(reg->ari_dirs, apr_pstrdup(reg->ari_pool, acme->url), 
+                     APR_HASH_KEY_STRING, dir);
+    }
+    if (!base) {
+        dir->renewal_info = NULL;
+    }
+    else if (!dir->renewal_info || strcmp(base, dir->renewal_info)) {
+        dir->renewal_info = apr_pstrdup(reg->ari_pool, base);
+    }
+    dir->looked_up = now;
+    apr_thread_mutex_unlock(reg->mutex);
+    return APR_SUCCESS;
+}
+
+static void ari_fetch_from(md_reg_t *reg, const char *ca_url, 
+                           apr_array_header_t *fetches, apr_pool_t *p)
+{
+    md_acme_t *acme;
+    ari_fetch_t *fetch;
+    ari_batch_t batch;
+    const char *base;
+    apr_status_t rv;
+    int i;
+    
+    if (APR_SUCCESS != (rv = md_acme_create(&acme, p, ca_url, reg->proxy_url, reg->ca_file))
+        || APR_SUCCESS != (rv = ari_dir_get(&base, reg, acme, p))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                      "renewal info: unable to contact CA %s", ca_url);
+        return;
+    }
+    for (i = 0; i < fetches->nelts; ++i) {
+        fetch = APR_ARRAY_IDX(fetches, i, ari_fetch_t*);
+        if (!base) {
+            /* CA does not offer this, ask again some time later */
+            ari_set_next_update(fetch, apr_time_now(), apr_time_now() + MD_ARI_POLL_MAX);
+            continue;
+        }
+        fetch->url = apr_pstrcat(p, base, (base[strlen(base)-1] == '/')? "" : "/", 
+                                 fetch->cert_id, NULL);
+    }
+    if (!base) return;
+    
+    batch.fetches = fetches;
+    batch.next = 0;
+    rv = md_http_multi_perform(acme->http, ari_next_req, &batch);
+    if (!APR_STATUS_IS_ENOENT(rv) && APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
+                      "renewal info: requests to CA %s failed", ca_url);
+    }
+}
+
+apr_status_t md_reg_ari_update(md_reg_t *reg, apr_array_header_t *mds, apr_pool_t *p)
+{
+    apr_hash_t *by_ca;
+    apr_hash_index_t *hi;
+    apr_array_header_t *fetches, *loaded;
+    const md_pubcert_t *pub;
+    const md_t *md;
+    const char *ca_url, *cert_id;
+    md_json_t *json, *certs;
+    ari_fetch_t *fetch;
+    apr_time_t now = apr_time_now();
+    int i, j;
+    
+    by_ca = apr_hash_make(p);
+    loaded = apr_array_make(p, mds->nelts, sizeof(ari_fetch_t*));
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, const md_t*);
+        if (!(ca_url = ari_ca_url(md)) || md->state == MD_S_INCOMPLETE) continue;
+        
+        json = ari_load(reg, md, p);
+        /* only keep what is known about the current certificates */
+        certs = md_json_create(p);
+        for (j = 0; j < md_cert_count(md); ++j) {
+            if (APR_SUCCESS != md_reg_get_pubcert(&pub, reg, md, j, p)) continue;
+            if (!(cert_id = pub->info->ari_cert_id)) continue;
+            
+            if (json && md_json_has_key(json, MD_KEY_CERTS, cert_id, NULL)) {
+                md_json_setj(md_json_getj(json, MD_KEY_CERTS, cert_id, NULL), 
+                             certs, cert_id, NULL);
+                if (now < md_json_get_time(json, MD_KEY_CERTS, cert_id, 
+                                           MD_KEY_NEXT_UPDATE, NULL)) continue;
+            }
+            
+            fetch = apr_pcalloc(p, sizeof(*fetch));
+            fetch->p = p;
+            fetch->reg = reg;
+            fetch->md = md;
+            fetch->cert_id = cert_id;
+            if (!(fetches = apr_hash_get(by_ca, ca_url, APR_HASH_KEY_STRING))) {
+                fetches = apr_array_make(p, 5, sizeof(ari_fetch_t*));
+                apr_hash_set(by_ca, ca_url, APR_HASH_KEY_STRING, fetches);
+            }
+            APR_ARRAY_PUSH(fetches, ari_fetch_t*) = fetch;
+            APR_ARRAY_PUSH(loaded, ari_fetch_t*) = fetch;
+        }
+        /* all fetches of an md share its json */
+        json = md_json_create(p);
+        md_json_setj(certs, json, MD_KEY_CERTS, NULL);
+        for (j = loaded->nelts - 1; j >= 0; --j) {
+            fetch = APR_ARRAY_IDX(loaded, j, ari_fetch_t*);
+            if (fetch->md != md) break;
+            fetch->json = json;
+        }
+    }
+    
+    /* One batch of parallel requests per CA */
+    for (hi = apr_hash_first(p, by_ca); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, (const void**)&ca_url, NULL, (void**)&fetches);
+        ari_fetch_from(reg, ca_url, fetches, p);
+    }
+    
+    for (i = 0; i < loaded->nelts; ++i) {
+        fetch = APR_ARRAY_IDX(loaded, i, ari_fetch_t*);
+        if (!fetch->changed) continue;
+        /* save each md's json only once */
+        for (j = i + 1; j < loaded->nelts; ++j) {
+            if (APR_ARRAY_IDX(loaded, j, ari_fetch_t*)->json == fetch->json) {
+                APR_ARRAY_IDX(loaded, j, ari_fetch_t*)->changed = 0;
+            }
+        }
+        md_store_save_json(reg->store, p, MD_SG_STAGING, fetch->md->name, 
+                           MD_FN_RENEWAL_INFO, fetch->json, 0);
+        ari_cache_invalidate(reg, fetch->md);
+    }
+    return APR_SUCCESS;
+}
+
 apr_time_t md_reg_renew_at(md_reg_t *reg, const md_t *md, apr_pool_t *p)
 {
     const md_pubcert_t *pub;
-    const md_cert_t *cert;
     md_timeperiod_t certlife, renewal;
+    ari_cached_t *ari = NULL;
     int i;
-    apr_time_t renew_at = 0;
+    apr_time_t renew_at = 0, ari_at;
     apr_status_t rv;
     
     if (md->state == MD_S_INCOMPLETE) return apr_time_now();
+    apr_thread_mutex_lock(reg->mutex);
+    if (ari_ca_url(md)) ari = ari_cache_get(reg, md, p);
     for (i = 0; i < md_cert_count(md); ++i) {
         rv = md_reg_get_pubcert(&pub, reg, md, i, p);
-        if (APR_STATUS_IS_ENOENT(rv)) return apr_time_now();
+        if (APR_STATUS_IS_ENOENT(rv)) {
+            renew_at = apr_time_now();
+            break;
+        }
         if (APR_SUCCESS == rv) {
-            cert = APR_ARRAY_IDX(pub->certs, 0, const md_cert_t*);
-            certlife.start = md_cert_get_not_before(cert);
-            certlife.end = md_cert_get_not_after(cert);
+            certlife.start = pub->info->not_before;
+            certlife.end = pub->info->not_after;
 
             renewal = md_timeperiod_slice_before_end(&certlife, md->renew_window);
             if (md_log_is_level(p, MD_LOG_TRACE1)) {
@@ -694,11 +1236,20 @@ apr_time_t md_reg_renew_at(md_reg_t *reg, const md_t *md, apr_pool_t *p)
                               md_timeperiod_print(p, &renewal));
             }
             
+            /* The time the CA suggests replaces our renew window, earlier to
+             * replace certificates before their time or later to spread the
+             * load. It is never later than the certificate's expiry. */
+            ari_at = ari_renew_at(ari, pub->info);
+            if (ari_at) {
+                renewal.start = (ari_at < certlife.end)? ari_at : certlife.end;
+            }
+            
             if (renew_at == 0 || renewal.start < renew_at) {
                 renew_at = renewal.start; 
             }
         }
     }
+    apr_thread_mutex_unlock(reg->mutex);
     return renew_at;
 }
 
@@ -713,7 +1264,6 @@ int md_reg_should_renew(md_reg_t *reg, const md_t *md, apr_pool_t *p)
 int md_reg_should_warn(md_reg_t *reg, const md_t *md, apr_pool_t *p)
 {
     const md_pubcert_t *pub;
-    const md_cert_t *cert;
     md_timeperiod_t certlife, warn;
     int i;
     apr_status_t rv;
@@ -723,9 +1273,8 @@ int md_reg_should_warn(md_reg_t *reg, const md_t *md, apr_pool_t *p)
         rv = md_reg_get_pubcert(&pub, reg, md, i, p);
         if (APR_STATUS_IS_ENOENT(rv)) return 0;
         if (APR_SUCCESS == rv) {
-            cert = APR_ARRAY_IDX(pub->certs, 0, const md_cert_t*);
-            certlife.start = md_cert_get_not_before(cert);
-            certlife.end = md_cert_get_not_after(cert);
+            certlife.start = pub->info->not_before;
+            certlife.end = pub->info->not_after;
             
             warn = md_timeperiod_slice_before_end(&certlife, md->warn_window);
             if (md_log_is_level(p, MD_LOG_TRACE1)) {
@@ -764,57 +1313,31 @@ apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int ca
     return APR_SUCCESS;
 }
 
-static md_t *find_closest_match(apr_array_header_t *mds, const md_t *md)
-{
-    md_t *candidate, *m;
-    apr_size_t cand_n, n;
-    int i;
-    
-    candidate = md_get_by_name(mds, md->name);
-    if (!candidate) {
-        /* try to find an instance that contains all domain names from md */ 
-        for (i = 0; i < mds->nelts; ++i) {
-            m = APR_ARRAY_IDX(mds, i, md_t *);
-            if (md_contains_domains(m, md)) {
-                return m;
-            }
-        }
-        /* no matching name and no md in the list has all domains.
-         * We consider that managed domain as closest match that contains at least one
-         * domain name from md, ONLY if there is no other one that also has.
-         */
-        cand_n = 0;
-        for (i = 0; i < mds->nelts; ++i) {
-            m = APR_ARRAY_IDX(mds, i, md_t *);
-            n = md_common_name_count(md, m);
-            if (n > cand_n) {
-                candidate = m;
-                cand_n = n;
-            }
-        }
-    }
-    return candidate;
-}
-
 typedef struct {
     apr_pool_t *p;
     apr_array_header_t *master_mds;
     apr_array_header_t *store_names;
+    apr_hash_t *store_names_idx;    /* name -> int* position in store_names */
     apr_array_header_t *maybe_new_mds;
     apr_array_header_t *new_mds;
-    apr_array_header_t *unassigned_mds;
+    md_domain_idx_t *unassigned_idx;
 } sync_ctx_v2;
 
 static int iter_add_name(void *baton, const char *dir, const char *name, 
                          md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
 {
     sync_ctx_v2 *ctx = baton;
+    int *ppos;
     
     (void)dir;
     (void)value;
     (void)ptemp;
     (void)vtype;
-    APR_ARRAY_PUSH(ctx->store_names, const char*) = apr_pstrdup(ctx->p, name);
+    ppos = apr_palloc(ctx->p, sizeof(*ppos));
+    *ppos = ctx->store_names->nelts;
+    name = apr_pstrdup(ctx->p, name);
+    APR_ARRAY_PUSH(ctx->store_names, const char*) = name;
+    apr_hash_set(ctx->store_names_idx, name, APR_HASH_KEY_STRING, ppos);
     return APR_SUCCESS;
 }
 
@@ -829,6 +1352,8 @@ static int iter_add_name(void *baton, const char *dir, const char *name,
  *      - if we find it, we assume this is a rename and move the old MD to the new name.
  *      - if not, MD is completely new.
  *  4. Any MD in store that does not match the "master_mds" will just be left as is. 
+ * Names are matched through a hash and overlaps through an index of the 
+ * domain names, so that this does not need time quadratic in the number of MDs.
  */
 apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, apr_pool_t *p) 
 {
@@ -836,16 +1361,18 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
     apr_status_t rv;
     md_t *md, *oldmd;
     const char *name;
-    int i, idx;
+    char *assigned;
+    int i, unassigned, *ppos;
     
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "sync MDs, start");
      
     ctx.p = p;
     ctx.master_mds = master_mds;
     ctx.store_names = apr_array_make(p, master_mds->nelts + 100, sizeof(const char*));
+    ctx.store_names_idx = apr_hash_make(p);
     ctx.maybe_new_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
     ctx.new_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
-    ctx.unassigned_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
+    ctx.unassigned_idx = md_domain_idx_create(p);
     
     rv = md_store_iter_names(iter_add_name, &ctx, reg->store, p, MD_SG_DOMAINS, "*");
     if (APR_SUCCESS != rv) {
@@ -854,26 +1381,32 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
     }
     
     /* Get all MDs that are not already present in store */
+    assigned = apr_pcalloc(p, (apr_size_t)ctx.store_names->nelts + 1);
+    unassigned = ctx.store_names->nelts;
     for (i = 0; i < ctx.master_mds->nelts; ++i) {
         md = APR_ARRAY_IDX(ctx.master_mds, i, md_t*);
-        idx = md_array_str_index(ctx.store_names, md->name, 0, 1);
-        if (idx < 0) {
+        ppos = apr_hash_get(ctx.store_names_idx, md->name, APR_HASH_KEY_STRING);
+        if (!ppos) {
             APR_ARRAY_PUSH(ctx.maybe_new_mds, md_t*) = md;
-            md_array_remove_at(ctx.store_names, idx);
+        }
+        else if (!assigned[*ppos]) {
+            assigned[*ppos] = 1;
+            --unassigned;
         }
     }
     
     if (ctx.maybe_new_mds->nelts == 0) goto leave; /* none new */
-    if (ctx.store_names->nelts == 0) goto leave;   /* all new */
+    if (unassigned == 0) goto leave;               /* all new */
     
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
                   "sync MDs, %d potentially new MDs detected, looking for renames among "
                   "the %d unassigned store domains", (int)ctx.maybe_new_mds->nelts,
-                  (int)ctx.store_names->nelts);
+                  unassigned);
     for (i = 0; i < ctx.store_names->nelts; ++i) {
+        if (assigned[i]) continue;
         name = APR_ARRAY_IDX(ctx.store_names, i, const char*);
         if (APR_SUCCESS == md_load(reg->store, MD_SG_DOMAINS, name, &md, p)) {
-            APR_ARRAY_PUSH(ctx.unassigned_mds, md_t*) = md;
+            md_domain_idx_add(ctx.unassigned_idx, md);
         } 
     }
     
@@ -881,7 +1414,7 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
                   "sync MDs, %d MDs maybe new, checking store", (int)ctx.maybe_new_mds->nelts);
     for (i = 0; i < ctx.maybe_new_mds->nelts; ++i) {
         md = APR_ARRAY_IDX(ctx.maybe_new_mds, i, md_t*);
-        oldmd = find_closest_match(ctx.unassigned_mds, md);
+        oldmd = md_domain_idx_get_closest(ctx.unassigned_idx, md, p);
         if (oldmd) {
             /* found the rename, move the domains and possible staging directory */
             md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
@@ -893,7 +1426,7 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
                 /* ignore it? */
             }
             md_store_rename(reg->store, p, MD_SG_STAGING, oldmd->name, md->name);
-            md_array_remove(ctx.unassigned_mds, oldmd);
+            md_domain_idx_remove(ctx.unassigned_idx, oldmd);
         }
         else {
             APR_ARRAY_PUSH(ctx.new_mds, md_t*) = md;
@@ -1286,6 +1819,11 @@ void md_reg_unlock_global(md_reg_t *reg, apr_pool_t *p)
     }
 }
 
+md_domain_idx_t *md_reg_domain_idx(md_reg_t *reg)
+{
+    return reg->domain_idx;
+}
+
 apr_status_t md_reg_freeze_domains(md_reg_t *reg, apr_array_header_t *mds)
 {
     apr_status_t rv = APR_SUCCESS;
@@ -1298,10 +1836,14 @@ apr_status_t md_reg_freeze_domains(md_reg_t *reg, apr_array_header_t *mds)
     for (i = 0; i < mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mds, i, md_t*);
         for (j = 0; j < md_cert_count(md); ++j) {
-            rv = md_reg_get_pubcert(&pubcert, reg, md, i, reg->p);
+            rv = md_reg_get_pubcert(&pubcert, reg, md, j, reg->p);
             if (APR_SUCCESS != rv && !APR_STATUS_IS_ENOENT(rv)) goto leave;
         }
     }
+    rv = APR_SUCCESS;
+    /* all certificates are known now, keep what was learned for the next start */
+    snapshot_save(reg, reg->p);
+    reg->domain_idx = md_domain_idx_make(reg->p, mds);
     reg->domains_frozen = 1;
 leave:
     return rv;
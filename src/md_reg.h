@@ -23,6 +23,9 @@ struct md_pkey_t;
 struct md_cert_t;
 struct md_result_t;
 struct md_pkey_spec_t;
+struct md_acme_limits_t;
+struct md_keypool_t;
+struct md_acme_issuers_t;
 
 #include "md_store.h"
 
@@ -49,6 +52,21 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *pm, md_store_t *store,
 
 md_store_t *md_reg_store_get(md_reg_t *reg);
 
+/**
+ * Get the admission control for requests to ACME CAs, shared by all MDs.
+ */
+struct md_acme_limits_t *md_reg_ca_limits_get(md_reg_t *reg);
+
+/**
+ * Get the pool of private keys generated ahead of renewals, shared by all MDs.
+ */
+struct md_keypool_t *md_reg_keypool_get(md_reg_t *reg);
+
+/**
+ * Get the cache of intermediate certificates retrieved from ACME CAs, shared by all MDs.
+ */
+struct md_acme_issuers_t *md_reg_issuers_get(md_reg_t *reg);
+
 apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int can_https);
 
 /**
@@ -169,6 +187,12 @@ apr_status_t md_reg_cleanup_challenges(md_reg_t *reg, apr_pool_t *p, apr_pool_t
  */
 apr_status_t md_reg_freeze_domains(md_reg_t *reg, apr_array_header_t *mds);
 
+/**
+ * Get the index of the names of the MDs given to md_reg_freeze_domains(),
+ * or NULL when domains have not been frozen.
+ */
+md_domain_idx_t *md_reg_domain_idx(md_reg_t *reg);
+
 /**
  * Return if the certificate of the MD should be renewed. This includes reaching
  * the renewal window of an otherwise valid certificate. It return also !0 iff
@@ -182,6 +206,16 @@ int md_reg_should_renew(md_reg_t *reg, const md_t *md, apr_pool_t *p);
  */
 apr_time_t md_reg_renew_at(md_reg_t *reg, const md_t *md, apr_pool_t *p);
 
+/**
+ * Update the ACME Renewal Information (RFC 9773) of the certificates of the
+ * given MDs, where it is not known or the CA asked us to check again. The
+ * requests for all MDs using the same CA are made in parallel.
+ * The CA's suggested windows are kept in the STAGING area of each MD, together
+ * with a random time inside the window, which md_reg_renew_at() uses instead
+ * of the configured renew window, up to the expiry of the certificate.
+ */
+apr_status_t md_reg_ari_update(md_reg_t *reg, apr_array_header_t *mds, apr_pool_t *p);
+
 /**
  * Return the timestamp up to which *all* certificates for the MD can be used.
  * A value of 0 indicates that there is no certificate.
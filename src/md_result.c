@@ -23,8 +23,10 @@
 #include <apr_date.h>
 #include <apr_time.h>
 #include <apr_strings.h>
+#include <apr_uri.h>
 
 #include "md.h"
+#include "md_http.h"
 #include "md_json.h"
 #include "md_log.h"
 #include "md_result.h"
@@ -154,6 +156,7 @@ md_result_t*md_result_from_json(const struct md_json_t *json, apr_pool_t *p)
     s = md_json_dups(p, json, MD_KEY_VALID_FROM, NULL);
     if (s && *s) result->ready_at = apr_date_parse_rfc(s);
     result->subproblems = md_json_dupj(p, json, MD_KEY_SUBPROBLEMS, NULL);
+    result->http_stats = md_json_dupj(p, json, MD_KEY_HTTP_TIMINGS, NULL);
     return result;
 }
 
@@ -179,6 +182,9 @@ struct md_json_t *md_result_to_json(const md_result_t *result, apr_pool_t *p)
     if (result->subproblems) {
         md_json_setj(result->subproblems, json, MD_KEY_SUBPROBLEMS, NULL);
     }
+    if (result->http_stats) {
+        md_json_setj(result->http_stats, json, MD_KEY_HTTP_TIMINGS, NULL);
+    }
     return json;
 }
 
@@ -255,6 +261,68 @@ void md_result_log(md_result_t *result, unsigned int level)
     }
 }
 
+/* Per host statistics are kept as JSON object, keyed by host name, each having
+ * the number of requests and the accumulated milliseconds spent in each phase. */
+static const char *TimingKeys[] = {
+    MD_KEY_DNS, MD_KEY_CONNECT, MD_KEY_TLS, MD_KEY_FIRST_BYTE, MD_KEY_TOTAL,
+};
+
+static void host_stats_add(md_json_t *stats, const char *host, long requests, 
+                           const long *msecs, long max_total)
+{
+    size_t i;
+
+    md_json_setl(md_json_getl(stats, host, MD_KEY_REQUESTS, NULL) + requests, 
+                 stats, host, MD_KEY_REQUESTS, NULL);
+    for (i = 0; i < sizeof(TimingKeys)/sizeof(TimingKeys[0]); ++i) {
+        md_json_setl(md_json_getl(stats, host, TimingKeys[i], NULL) + msecs[i], 
+                     stats, host, TimingKeys[i], NULL);
+    }
+    if (max_total > md_json_getl(stats, host, MD_KEY_MAX, NULL)) {
+        md_json_setl(max_total, stats, host, MD_KEY_MAX, NULL);
+    }
+}
+
+void md_result_http_timings_add(md_result_t *result, const char *url, 
+                                const md_http_timings_t *timings)
+{
+    apr_uri_t uri;
+    const char *host = NULL;
+    long msecs[5];
+
+    if (!url || !timings) return;
+    if (APR_SUCCESS == apr_uri_parse(result->p, url, &uri)) host = uri.hostname;
+    if (!host) host = MD_KEY_UNKNOWN;
+    msecs[0] = (long)apr_time_as_msec(timings->dns);
+    msecs[1] = (long)apr_time_as_msec(timings->connect);
+    msecs[2] = (long)apr_time_as_msec(timings->tls);
+    msecs[3] = (long)apr_time_as_msec(timings->first_byte);
+    msecs[4] = (long)apr_time_as_msec(timings->total);
+    if (!result->http_stats) result->http_stats = md_json_create(result->p);
+    host_stats_add(result->http_stats, host, 1, msecs, msecs[4]);
+}
+
+static int add_host_stats(void *baton, const char *host, md_json_t *json)
+{
+    md_result_t *dest = baton;
+    long msecs[5];
+    size_t i;
+
+    for (i = 0; i < sizeof(TimingKeys)/sizeof(TimingKeys[0]); ++i) {
+        msecs[i] = md_json_getl(json, TimingKeys[i], NULL);
+    }
+    host_stats_add(dest->http_stats, host, md_json_getl(json, MD_KEY_REQUESTS, NULL),
+                   msecs, md_json_getl(json, MD_KEY_MAX, NULL));
+    return 1;
+}
+
+void md_result_http_stats_add(md_result_t *dest, const md_result_t *src)
+{
+    if (!src || !src->http_stats || dest == src) return;
+    if (!dest->http_stats) dest->http_stats = md_json_create(dest->p);
+    md_json_iterkey(add_host_stats, dest, src->http_stats, NULL);
+}
+
 void md_result_on_change(md_result_t *result, md_result_change_cb *cb, void *data)
 {
     result->on_change = cb;
@@ -19,6 +19,7 @@
 
 struct md_json_t;
 struct md_t;
+struct md_http_timings_t;
 
 typedef struct md_result_t md_result_t;
 
@@ -35,6 +36,7 @@ struct md_result_t {
     const struct md_json_t *subproblems;
     const char *activity;
     apr_time_t ready_at;
+    struct md_json_t *http_stats;   /* per host timings of HTTP requests made or NULL */
     md_result_change_cb *on_change;
     void *on_change_data;
     md_result_raise_cb *on_raise;
@@ -74,6 +76,19 @@ void md_result_dup(md_result_t *dest, const md_result_t *src);
 
 void md_result_log(md_result_t *result, unsigned int level);
 
+/**
+ * Add the timings of a HTTP request against the url to the per host
+ * statistics of the result. The statistics are not part of the outcome
+ * of a result and are therefore not copied by md_result_assign()/md_result_dup().
+ */
+void md_result_http_timings_add(md_result_t *result, const char *url, 
+                                const struct md_http_timings_t *timings);
+
+/**
+ * Add all HTTP statistics collected in src to the ones in dest.
+ */
+void md_result_http_stats_add(md_result_t *dest, const md_result_t *src);
+
 void md_result_on_change(md_result_t *result, md_result_change_cb *cb, void *data);
 
 /* events in the context of a result genesis */
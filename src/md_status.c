@@ -28,6 +28,7 @@
 #include "md_acme.h"
 #include "md_crypt.h"
 #include "md_event.h"
+#include "md_keypool.h"
 #include "md_log.h"
 #include "md_ocsp.h"
 #include "md_store.h"
@@ -41,20 +42,19 @@
 /**************************************************************************************************/
 /* certificate status information */
 
-static apr_status_t status_get_cert_json(md_json_t **pjson, const md_cert_t *cert, apr_pool_t *p)
+static apr_status_t status_get_cert_json(md_json_t **pjson, const md_cert_info_t *info,
+                                         apr_pool_t *p)
 {
-    const char *finger;
     apr_status_t rv = APR_SUCCESS;
     md_timeperiod_t valid;
     md_json_t *json;
     
     json = md_json_create(p);
-    valid.start = md_cert_get_not_before(cert);
-    valid.end = md_cert_get_not_after(cert);
+    valid.start = info->not_before;
+    valid.end = info->not_after;
     md_json_set_timeperiod(&valid, json, MD_KEY_VALID, NULL);
-    md_json_sets(md_cert_get_serial_number(cert, p), json, MD_KEY_SERIAL, NULL);
-    if (APR_SUCCESS != (rv = md_cert_to_sha256_fingerprint(&finger, cert, p))) goto leave;
-    md_json_sets(finger, json, MD_KEY_SHA256_FINGERPRINT, NULL);
+    md_json_sets(info->serial, json, MD_KEY_SERIAL, NULL);
+    md_json_sets(info->sha256_fingerprint, json, MD_KEY_SHA256_FINGERPRINT, NULL);
 
 #if MD_STATUS_WITH_SCTS
     do {
@@ -83,7 +83,6 @@ static apr_status_t status_get_cert_json(md_json_t **pjson, const md_cert_t *cer
         }
     while (0);
 #endif
-leave:
     *pjson = (APR_SUCCESS == rv)? json : NULL;
     return rv;
 }
@@ -101,7 +100,7 @@ static apr_status_t job_loadj(md_json_t **pjson, md_store_group_t group, const c
 
 static apr_status_t status_get_cert_json_ex(
     md_json_t **pjson,
-    const md_cert_t *cert,
+    const md_cert_info_t *info,
     const md_t *md,
     md_reg_t *reg,
     md_ocsp_reg_t *ocsp,
@@ -113,9 +112,9 @@ static apr_status_t status_get_cert_json_ex(
     md_ocsp_cert_stat_t cert_stat;
     apr_status_t rv;
 
-    if (APR_SUCCESS != (rv = status_get_cert_json(&certj, cert, p))) goto leave;
+    if (APR_SUCCESS != (rv = status_get_cert_json(&certj, info, p))) goto leave;
     if (md->stapling && ocsp) {
-        rv = md_ocsp_get_meta(&cert_stat, &ocsp_valid, ocsp, cert, p, md);
+        rv = md_ocsp_get_meta(&cert_stat, &ocsp_valid, ocsp, info->ocsp_id, p, md);
         if (APR_SUCCESS == rv) {
             md_json_sets(md_ocsp_cert_stat_name(cert_stat), certj, MD_KEY_OCSP, MD_KEY_STATUS, NULL);
             md_json_set_timeperiod(&ocsp_valid, certj, MD_KEY_OCSP, MD_KEY_VALID, NULL);
@@ -148,7 +147,7 @@ static const char *get_cert_name(const md_t *md, int i, int from_staging, apr_po
     return md_pkey_spec_name(md_pkeys_spec_get(md->pks, i));
 }
 
-static apr_status_t status_get_certs_json(md_json_t **pjson, apr_array_header_t *certs,
+static apr_status_t status_get_certs_json(md_json_t **pjson, apr_array_header_t *infos,
                                           int from_staging,
                                           const md_t *md, md_reg_t *reg,  
                                           md_ocsp_reg_t *ocsp, int with_logs,
@@ -156,18 +155,19 @@ static apr_status_t status_get_certs_json(md_json_t **pjson, apr_array_header_t
 {
     md_json_t *json, *certj;
     md_timeperiod_t certs_valid = {0, 0}, valid;
-    md_cert_t *cert;
+    const md_cert_info_t *info;
     int i;
     apr_status_t rv = APR_SUCCESS;   
     
     json = md_json_create(p);
     for (i = 0; i < get_cert_count(md, from_staging); ++i) {
-        cert = APR_ARRAY_IDX(certs, i, md_cert_t*);
-        if (!cert) continue;
+        info = APR_ARRAY_IDX(infos, i, const md_cert_info_t*);
+        if (!info) continue;
 
-        rv = status_get_cert_json_ex(&certj, cert, md, reg, ocsp, with_logs, p);
+        rv = status_get_cert_json_ex(&certj, info, md, reg, ocsp, with_logs, p);
         if (APR_SUCCESS != rv) goto leave;
-        valid = md_cert_get_valid(cert);
+        valid.start = info->not_before;
+        valid.end = info->not_after;
         certs_valid = i? md_timeperiod_common(&certs_valid, &valid) : valid;
         md_json_setj(certj, json, get_cert_name(md, i, from_staging, p), NULL);
     }
@@ -185,58 +185,57 @@ static apr_status_t get_staging_certs_json(md_json_t **pjson, const md_t *md,
 { 
     md_pkey_spec_t *spec;
     int i;
-    apr_array_header_t *chain, *certs;
-    const md_cert_t *cert;
+    apr_array_header_t *chain, *infos;
+    md_cert_info_t *info;
     apr_status_t rv;
     
-    certs = apr_array_make(p, 5, sizeof(md_cert_t*));
+    infos = apr_array_make(p, 5, sizeof(md_cert_info_t*));
     for (i = 0; i < get_cert_count(md, 1); ++i) {
         spec = md_pkeys_spec_get(md->pks, i);
-        cert = NULL;
+        info = NULL;
         rv = md_pubcert_load(md_reg_store_get(reg), MD_SG_STAGING, md->name, spec, &chain, p);
-        if (APR_SUCCESS == rv) {
-            cert = APR_ARRAY_IDX(chain, 0, const md_cert_t*);
+        if (APR_SUCCESS == rv && chain->nelts > 0) {
+            md_cert_info_get(&info, APR_ARRAY_IDX(chain, 0, const md_cert_t*), NULL, p);
         }
-        APR_ARRAY_PUSH(certs, const md_cert_t*) = cert;
+        APR_ARRAY_PUSH(infos, const md_cert_info_t*) = info;
     }
-    return status_get_certs_json(pjson, certs, 1, md, reg, NULL, 0, p);
+    return status_get_certs_json(pjson, infos, 1, md, reg, NULL, 0, p);
 }
 
 static apr_status_t status_get_md_json(md_json_t **pjson, const md_t *md, 
                                        md_reg_t *reg, md_ocsp_reg_t *ocsp, 
-                                       int with_logs, apr_pool_t *p)
+                                       apr_time_t renew_at, int with_logs, apr_pool_t *p)
 {
     md_json_t *mdj, *certsj, *jobj;
     int renew;
     const md_pubcert_t *pubcert;
-    const md_cert_t *cert = NULL;
-    apr_array_header_t *certs;
+    const md_cert_info_t *info;
+    apr_array_header_t *infos;
     apr_status_t rv = APR_SUCCESS;
-    apr_time_t renew_at;
     int i;
 
     mdj = md_to_public_json(md, p);
-    certs = apr_array_make(p, 5, sizeof(md_cert_t*));
+    infos = apr_array_make(p, 5, sizeof(md_cert_info_t*));
     for (i = 0; i < get_cert_count(md, 0); ++i) {
-        cert = NULL;
+        info = NULL;
         if (APR_SUCCESS == md_reg_get_pubcert(&pubcert, reg, md, i, p)) {
-            cert = APR_ARRAY_IDX(pubcert->certs, 0, const md_cert_t*);
+            info = pubcert->info;
         }
-        APR_ARRAY_PUSH(certs, const md_cert_t*) = cert;
+        APR_ARRAY_PUSH(infos, const md_cert_info_t*) = info;
     }
     
-    rv = status_get_certs_json(&certsj, certs, 0, md, reg, ocsp, with_logs, p);
+    rv = status_get_certs_json(&certsj, infos, 0, md, reg, ocsp, with_logs, p);
     if (APR_SUCCESS != rv) goto leave;
     md_json_setj(certsj, mdj, MD_KEY_CERT, NULL);
     
-    renew_at = md_reg_renew_at(reg, md, p);
+    if (!renew_at) renew_at = md_reg_renew_at(reg, md, p);
     if (renew_at > 0) {
         md_json_set_time(renew_at, mdj, MD_KEY_RENEW_AT, NULL);
     }
     
     md_json_setb(md->stapling, mdj, MD_KEY_STAPLING, NULL);
     md_json_setb(md->watched, mdj, MD_KEY_WATCHED, NULL);
-    renew = md_reg_should_renew(reg, md, p);
+    renew = renew_at && (renew_at <= apr_time_now());
     if (renew) {
         md_json_setb(renew, mdj, MD_KEY_RENEW, NULL);
         rv = job_loadj(&jobj, MD_SG_STAGING, md->name, reg, with_logs, p);
@@ -261,7 +260,14 @@ leave:
 apr_status_t md_status_get_md_json(md_json_t **pjson, const md_t *md, 
                                    md_reg_t *reg, md_ocsp_reg_t *ocsp, apr_pool_t *p)
 {
-    return status_get_md_json(pjson, md, reg, ocsp, 1, p);
+    return status_get_md_json(pjson, md, reg, ocsp, 0, 1, p);
+}
+
+apr_status_t md_status_get_md_json_at(md_json_t **pjson, const md_t *md, md_reg_t *reg, 
+                                      md_ocsp_reg_t *ocsp, apr_time_t renew_at, 
+                                      apr_pool_t *p)
+{
+    return status_get_md_json(pjson, md, reg, ocsp, renew_at, 0, p);
 }
 
 apr_status_t md_status_get_json(md_json_t **pjson, apr_array_header_t *mds, 
@@ -275,9 +281,12 @@ apr_status_t md_status_get_json(md_json_t **pjson, apr_array_header_t *mds,
     md_json_sets(MOD_MD_VERSION, json, MD_KEY_VERSION, NULL);
     for (i = 0; i < mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mds, i, const md_t *);
-        status_get_md_json(&mdj, md, reg, ocsp, 0, p);
+        status_get_md_json(&mdj, md, reg, ocsp, 0, 0, p);
         md_json_addj(mdj, json, MD_KEY_MDS, NULL);
     }
+    if (md_keypool_is_enabled(md_reg_keypool_get(reg))) {
+        md_json_setj(md_keypool_status(md_reg_keypool_get(reg), p), json, MD_KEY_KEY_POOL, NULL);
+    }
     *pjson = json;
     return APR_SUCCESS;
 }
@@ -317,6 +326,7 @@ static void md_job_from_json(md_job_t *job, md_json_t *json, apr_pool_t *p)
     if (s && *s) job->next_run = apr_date_parse_rfc(s);
     s = md_json_dups(p, json, MD_KEY_LAST_RUN, NULL);
     if (s && *s) job->last_run = apr_date_parse_rfc(s);
+    job->last_duration = apr_time_from_msec(md_json_getl(json, MD_KEY_LAST_DURATION, NULL));
     s = md_json_dups(p, json, MD_KEY_VALID_FROM, NULL);
     if (s && *s) job->valid_from = apr_date_parse_rfc(s);
     job->error_runs = (int)md_json_getl(json, MD_KEY_ERRORS, NULL);
@@ -342,6 +352,8 @@ static void job_to_json(md_json_t *json, const md_job_t *job,
     if (job->last_run > 0) {
         apr_rfc822_date(ts, job->last_run);
         md_json_sets(ts, json, MD_KEY_LAST_RUN, NULL);
+        md_json_setl((long)apr_time_as_msec(job->last_duration), 
+                     json, MD_KEY_LAST_DURATION, NULL);
     }
     if (job->valid_from > 0) {
         apr_rfc822_date(ts, job->valid_from);
@@ -360,6 +372,8 @@ apr_status_t md_job_load(md_job_t *job)
     md_json_t *jprops;
     apr_status_t rv;
     
+    job->stored_at = md_store_get_modified(job->store, job->group, job->mdomain, 
+                                           MD_FN_JOB, job->p);
     rv = md_store_load_json(job->store, job->group, job->mdomain, MD_FN_JOB, &jprops, job->p);
     if (APR_SUCCESS == rv) {
         md_job_from_json(job, jprops, job->p);
@@ -367,6 +381,17 @@ apr_status_t md_job_load(md_job_t *job)
     return rv;
 }
 
+apr_status_t md_job_load_if_changed(md_job_t *job, apr_pool_t *p)
+{
+    apr_time_t modified;
+    
+    modified = md_store_get_modified(job->store, job->group, job->mdomain, MD_FN_JOB, p);
+    if (modified && modified == job->stored_at) {
+        return APR_SUCCESS;
+    }
+    return md_job_load(job);
+}
+
 apr_status_t md_job_save(md_job_t *job, md_result_t *result, apr_pool_t *p)
 {
     md_json_t *jprops;
@@ -375,7 +400,11 @@ apr_status_t md_job_save(md_job_t *job, md_result_t *result, apr_pool_t *p)
     jprops = md_json_create(p);
     job_to_json(jprops, job, result, p);
     rv = md_store_save_json(job->store, p, job->group, job->mdomain, MD_FN_JOB, jprops, 0);
-    if (APR_SUCCESS == rv) job->dirty = 0;
+    if (APR_SUCCESS == rv) {
+        job->dirty = 0;
+        job->stored_at = md_store_get_modified(job->store, job->group, job->mdomain, 
+                                               MD_FN_JOB, p);
+    }
     return rv;
 }
 
@@ -610,6 +639,7 @@ apr_time_t md_job_delay_on_errors(md_job_t *job, int err_count, const char *last
 
 void md_job_end_run(md_job_t *job, md_result_t *result)
 {
+    job->last_duration = apr_time_now() - job->last_run;
     if (APR_SUCCESS == result->status) {
         job->finished = 1;
         job->valid_from = result->ready_at;
@@ -617,6 +647,14 @@ void md_job_end_run(md_job_t *job, md_result_t *result)
         job->dirty = 1;
         md_job_log_append(job, "finished", NULL, NULL);
     }
+    else if (result->ready_at > apr_time_now() 
+             && md_acme_problem_is_rate_limited(result->problem)) {
+        /* Held back by rate limits of the CA. This is not an error of ours
+         * and we know when to try again, no need to back off further. */
+        job->dirty = 1;
+        job->next_run = result->ready_at;
+        md_job_log_append(job, "rate-limited", result->problem, result->detail);
+    }
     else {
         ++job->error_runs;
         job->dirty = 1;
@@ -31,6 +31,15 @@ apr_status_t md_status_get_md_json(struct md_json_t **pjson, const md_t *md,
                                    struct md_reg_t *reg, struct md_ocsp_reg_t *ocsp,
                                    apr_pool_t *p);
 
+/** 
+ * Get the JSON summary of the MD without job logs, as md_status_get_json()
+ * has it, using the given time the MD needs renewal. With a renew_at of 0,
+ * the time is determined from the certificates.
+ */
+apr_status_t md_status_get_md_json_at(struct md_json_t **pjson, const md_t *md, 
+                                      struct md_reg_t *reg, struct md_ocsp_reg_t *ocsp,
+                                      apr_time_t renew_at, apr_pool_t *p);
+
 /** 
  * Get a JSON summary of all MDs and their status.
  */
@@ -56,6 +65,7 @@ struct md_job_t {
     apr_pool_t *p;     
     apr_time_t next_run;   /* Time this job wants to be processed next */
     apr_time_t last_run;   /* Time this job ran last (or 0) */
+    apr_interval_time_t last_duration; /* How long the last run took (or 0) */
     struct md_result_t *last_result; /* Result from last run */
     int finished;          /* true iff the job finished successfully */
     int notified;          /* true iff notifications were handled successfully */
@@ -69,6 +79,7 @@ struct md_job_t {
     int dirty;
     struct md_result_t *observing;
     apr_time_t min_delay;  /* smallest delay a repeated attempt should have */
+    apr_time_t stored_at;  /* modification time of the persisted job when last loaded/saved */
 };
 
 /**
@@ -86,6 +97,13 @@ void md_job_set_group(md_job_t *job, md_store_group_t group);
  */
 apr_status_t md_job_load(md_job_t *job);
 
+/**
+ * Update the job from storage in <group>/job->mdomain, but only if it was
+ * changed there since the job was last loaded or saved, e.g. by another process.
+ * Returns APR_SUCCESS when the job is up to date afterwards.
+ */
+apr_status_t md_job_load_if_changed(md_job_t *job, apr_pool_t *p);
+
 /**
  * Update storage from job in <group>/job->mdomain.
  */
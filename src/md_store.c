@@ -56,6 +56,7 @@ static const char *GROUP_NAME[] = {
     "archive",
     "tmp",
     "ocsp",
+    "keypool",
     NULL
 };
 
@@ -72,6 +73,7 @@ apr_status_t md_store_load(md_store_t *store, md_store_group_t group,
                            md_store_vtype_t vtype, void **pdata, 
                            apr_pool_t *p)
 {
+    md_counter_inc(MD_CNT_STORE_LOADS);
     return store->load(store, group, name, aspect, vtype, pdata, p);
 }
 
@@ -80,6 +82,7 @@ apr_status_t md_store_save(md_store_t *store, apr_pool_t *p, md_store_group_t gr
                            md_store_vtype_t vtype, void *data, 
                            int create)
 {
+    md_counter_inc(MD_CNT_STORE_SAVES);
     return store->save(store, p, group, name, aspect, vtype, data, create);
 }
 
@@ -321,6 +321,9 @@ apr_status_t md_store_fs_init(md_store_t **pstore, apr_pool_t *p, const char *pa
     /* OCSP data is readable by all, no secrets involved */ 
     s_fs->group_perms[MD_SG_OCSP].dir = MD_FPROT_D_UALL_WREAD;
     s_fs->group_perms[MD_SG_OCSP].file = MD_FPROT_F_UALL_WREAD;
+    /* pooled keys are generated by the child processes, encrypted */
+    s_fs->group_perms[MD_SG_KEYPOOL].dir = MD_FPROT_D_UALL_WREAD;
+    s_fs->group_perms[MD_SG_KEYPOOL].file = MD_FPROT_F_UALL_WREAD;
 
     s_fs->base = apr_pstrdup(p, path);
 
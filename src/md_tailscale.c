@@ -40,7 +40,13 @@ typedef struct {
     const char *unix_socket_path;
     md_t *md;
     apr_array_header_t *chain;
+    md_cert_chain_reader_t *chain_reader;
     md_pkey_t *pkey;
+    const char *domain;
+    apr_array_header_t *fetches;    /* ts_fetch_t* to perform */
+    int next_fetch;
+    md_json_t *validators;          /* ETag/Last-Modified of the live cert and key */
+    md_json_t *validators_new;      /* validators of what was retrieved now */
 } ts_ctx_t;
 
 static apr_status_t ts_init(md_proto_driver_t *d, md_result_t *result)
@@ -98,6 +104,7 @@ static apr_status_t ts_preload(md_proto_driver_t *d,
     md_credentials_t *creds;
     md_pkey_spec_t *pkspec;
     apr_array_header_t *all_creds;
+    md_json_t *validators;
     const char *name;
     int i;
 
@@ -151,6 +158,17 @@ static apr_status_t ts_preload(md_proto_driver_t *d,
         }
     }
 
+    /* validators for conditional requests, if the agent gave us any */
+    if (APR_SUCCESS == md_store_load_json(d->store, MD_SG_STAGING, name, MD_FN_TAILSCALE,
+                                          &validators, d->p)) {
+        rv = md_store_save_json(d->store, d->p, load_group, name, MD_FN_TAILSCALE,
+                                validators, 0);
+        if (APR_SUCCESS != rv) {
+            md_result_set(result, rv, "writing tailscale validators");
+            goto leave;
+        }
+    }
+
     md_result_set(result, APR_SUCCESS, "saved staged data successfully");
 
 leave:
@@ -176,43 +194,126 @@ static apr_status_t rv_of_response(const md_http_response_t *res)
     return APR_SUCCESS;
 }
 
-static apr_status_t on_get_cert(const md_http_response_t *res, void *baton)
+typedef struct {
+    ts_ctx_t *ts_ctx;
+    const char *type;               /* what to get, "crt" or "key" */
+    int conditional;                /* send validators from the last retrieval */
+    int unchanged;                  /* agent answered 304, nothing new */
+    apr_status_t rv;
+} ts_fetch_t;
+
+static apr_status_t on_fetch_response(const md_http_response_t *res, void *baton)
 {
-    ts_ctx_t *ts_ctx = baton;
+    ts_fetch_t *fetch = baton;
+    ts_ctx_t *ts_ctx = fetch->ts_ctx;
+    const char *s;
     apr_status_t rv;
 
+    if (304 == res->status && fetch->conditional) {
+        fetch->unchanged = 1;
+        return APR_SUCCESS;
+    }
     rv = rv_of_response(res);
     if (APR_SUCCESS != rv) goto leave;
-    apr_array_clear(ts_ctx->chain);
-    rv = md_cert_chain_read_http(ts_ctx->chain, ts_ctx->pool, res);
+    if (!strcmp("crt", fetch->type)) {
+        /* certificates have been parsed while the body arrived */
+        rv = md_cert_chain_reader_finish(ts_ctx->chain_reader);
+    }
+    else {
+        rv = md_pkey_read_http(&ts_ctx->pkey, ts_ctx->pool, res);
+    }
     if (APR_SUCCESS != rv) goto leave;
 
+    /* remember how to ask for this again, if the agent tells us */
+    if ((s = apr_table_get(res->headers, "ETag"))) {
+        md_json_sets(s, ts_ctx->validators_new, fetch->type, MD_KEY_ETAG, NULL);
+    }
+    if ((s = apr_table_get(res->headers, "Last-Modified"))) {
+        md_json_sets(s, ts_ctx->validators_new, fetch->type, MD_KEY_LAST_MODIFIED, NULL);
+    }
 leave:
     return rv;
 }
 
-static apr_status_t on_get_key(const md_http_response_t *res, void *baton)
+static apr_status_t on_fetch_status(const md_http_request_t *req, apr_status_t status,
+                                    void *baton)
+{
+    ts_fetch_t *fetch = baton;
+
+    (void)req;
+    fetch->rv = status;
+    return APR_SUCCESS;
+}
+
+static apr_status_t next_fetch(md_http_request_t **preq, void *baton,
+                               md_http_t *http, int in_flight)
 {
     ts_ctx_t *ts_ctx = baton;
+    ts_fetch_t *fetch;
+    apr_table_t *headers;
+    const char *url, *s;
     apr_status_t rv;
 
-    rv = rv_of_response(res);
-    if (APR_SUCCESS != rv) goto leave;
-    rv = md_pkey_read_http(&ts_ctx->pkey, ts_ctx->pool, res);
-    if (APR_SUCCESS != rv) goto leave;
+    (void)in_flight;
+    if (ts_ctx->next_fetch >= ts_ctx->fetches->nelts) return APR_ENOENT;
+    fetch = APR_ARRAY_IDX(ts_ctx->fetches, ts_ctx->next_fetch++, ts_fetch_t*);
 
+    headers = apr_table_make(ts_ctx->pool, 2);
+    if (fetch->conditional) {
+        if ((s = md_json_gets(ts_ctx->validators, fetch->type, MD_KEY_ETAG, NULL))) {
+            apr_table_set(headers, "If-None-Match", s);
+        }
+        if ((s = md_json_gets(ts_ctx->validators, fetch->type, MD_KEY_LAST_MODIFIED, NULL))) {
+            apr_table_set(headers, "If-Modified-Since", s);
+        }
+        fetch->conditional = !apr_is_empty_table(headers);
+    }
+    url = apr_psprintf(ts_ctx->pool, "http://localhost/localapi/v0/cert/%s?type=%s",
+                       ts_ctx->domain, fetch->type);
+    rv = md_http_GET_create(preq, http, url, headers);
+    if (APR_SUCCESS != rv) goto leave;
+    if (!strcmp("crt", fetch->type)) {
+        md_http_set_on_body_cb(*preq, md_cert_chain_reader_body_cb, ts_ctx->chain_reader);
+    }
+    md_http_set_on_response_cb(*preq, on_fetch_response, fetch);
+    md_http_set_on_status_cb(*preq, on_fetch_status, fetch);
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, 0, ts_ctx->pool, "%s: GET %s%s",
+                  ts_ctx->md->name, url, fetch->conditional? " (conditional)" : "");
 leave:
     return rv;
 }
 
+static ts_fetch_t *fetch_add(ts_ctx_t *ts_ctx, const char *type, int conditional)
+{
+    ts_fetch_t *fetch;
+
+    fetch = apr_pcalloc(ts_ctx->pool, sizeof(*fetch));
+    fetch->ts_ctx = ts_ctx;
+    fetch->type = type;
+    fetch->conditional = conditional;
+    fetch->rv = APR_EGENERAL;
+    APR_ARRAY_PUSH(ts_ctx->fetches, ts_fetch_t*) = fetch;
+    return fetch;
+}
+
+static apr_status_t fetch_all(ts_ctx_t *ts_ctx, md_http_t *http)
+{
+    apr_status_t rv;
+
+    /* All fetches run in parallel against the local agent */
+    ts_ctx->next_fetch = 0;
+    rv = md_http_multi_perform(http, next_fetch, ts_ctx);
+    return APR_STATUS_IS_ENOENT(rv)? APR_SUCCESS : rv;
+}
+
 static apr_status_t ts_renew(md_proto_driver_t *d, md_result_t *result)
 {
-    const char *name, *domain, *url;
+    const char *name, *domain, *finger;
     apr_status_t rv = APR_ENOENT;
     ts_ctx_t *ts_ctx = d->baton;
     md_http_t *http;
     const md_pubcert_t *pubcert;
-    md_cert_t *old_cert, *new_cert;
+    ts_fetch_t *fetch_crt, *fetch_key;
     int reset_staging = d->reset;
 
     /* "renewing" the certificate from tailscale. Since tailscale has its
@@ -296,42 +397,74 @@ static apr_status_t ts_renew(md_proto_driver_t *d, md_result_t *result)
     if (!domain) {
         rv = APR_EINVAL;
         md_result_set(result, rv, "no domain names available");
+        goto leave;
     }
 
-    url = apr_psprintf(d->p, "http://localhost/localapi/v0/cert/%s?type=crt",
-                       domain);
-    rv = md_http_GET_perform(http, url, NULL, on_get_cert, ts_ctx);
+    ts_ctx->domain = domain;
+
+    /* Validators are only useful when we have the live cert they were given for */
+    ts_ctx->validators = NULL;
+    ts_ctx->validators_new = md_json_create(d->p);
+    rv = md_reg_get_pubcert(&pubcert, d->reg, d->md, 0, d->p);
+    if (APR_SUCCESS == rv) {
+        md_store_load_json(d->store, MD_SG_DOMAINS, name, MD_FN_TAILSCALE,
+                           &ts_ctx->validators, d->p);
+    }
+    else {
+        pubcert = NULL;
+    }
+
+    /* Get cert and key at the same time, so that a new certificate does not
+     * wait for a second round trip to the agent. */
+    apr_array_clear(ts_ctx->chain);
+    ts_ctx->pkey = NULL;
+    rv = md_cert_chain_reader_create(&ts_ctx->chain_reader, ts_ctx->chain, d->p);
     if (APR_SUCCESS != rv) {
         md_result_set(result, rv, "retrieving certificate from tailscale");
         goto leave;
     }
-    if (ts_ctx->chain->nelts <= 0) {
+    ts_ctx->fetches = apr_array_make(d->p, 2, sizeof(ts_fetch_t*));
+    fetch_crt = fetch_add(ts_ctx, "crt", ts_ctx->validators != NULL);
+    fetch_key = fetch_add(ts_ctx, "key", ts_ctx->validators != NULL);
+    rv = fetch_all(ts_ctx, http);
+    if (APR_SUCCESS == rv) rv = fetch_crt->rv;
+    if (APR_SUCCESS != rv) {
+        md_result_set(result, rv, "retrieving certificate from tailscale");
+        goto leave;
+    }
+    if (fetch_crt->unchanged) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, d->p, "%s: certificate not modified", name);
+    }
+    else if (ts_ctx->chain->nelts <= 0) {
         rv = APR_ENOENT;
         md_result_set(result, rv, "tailscale returned no certificates");
         goto leave;
     }
 
-    /* Got the key and the chain, is it new? */
-    rv = md_reg_get_pubcert(&pubcert, d->reg,d->md, 0, d->p);
-    if (APR_SUCCESS == rv) {
-        old_cert = APR_ARRAY_IDX(pubcert->certs, 0, md_cert_t*);
-        new_cert = APR_ARRAY_IDX(ts_ctx->chain, 0, md_cert_t*);
-        if (md_certs_are_equal(old_cert, new_cert)) {
-            /* tailscale has not renewed the certificate, yet */
-            rv = APR_ENOENT;
-            md_result_set(result, rv, "tailscale has not renewed the certificate yet");
-            /* let's check this daily */
-            md_result_delay_set(result, apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY));
-            goto leave;
-        }
+    /* Got the chain, is it new? The live one may only be known by its info. */
+    if (fetch_crt->unchanged || (pubcert
+        && APR_SUCCESS == md_cert_to_sha256_fingerprint(
+            &finger, APR_ARRAY_IDX(ts_ctx->chain, 0, md_cert_t*), d->p)
+        && !strcmp(finger, pubcert->info->sha256_fingerprint))) {
+        /* tailscale has not renewed the certificate, yet */
+        rv = APR_ENOENT;
+        md_result_set(result, rv, "tailscale has not renewed the certificate yet");
+        /* let's check this daily */
+        md_result_delay_set(result, apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY));
+        goto leave;
     }
 
     /* We have a new certificate (or had none before).
-     * Get the key and store both in STAGING.
+     * Make sure we have its key and store both in STAGING.
      */
-    url = apr_psprintf(d->p, "http://localhost/localapi/v0/cert/%s?type=key",
-                       domain);
-    rv = md_http_GET_perform(http, url, NULL, on_get_key, ts_ctx);
+    if (APR_SUCCESS == fetch_key->rv && fetch_key->unchanged) {
+        /* the key is not supposed to stay the same, ask for it without conditions */
+        apr_array_clear(ts_ctx->fetches);
+        fetch_key = fetch_add(ts_ctx, "key", 0);
+        rv = fetch_all(ts_ctx, http);
+    }
+    if (APR_SUCCESS == rv) rv = fetch_key->rv;
+    if (APR_SUCCESS == rv && !ts_ctx->pkey) rv = APR_ENOENT;
     if (APR_SUCCESS != rv) {
         md_result_set(result, rv, "retrieving key from tailscale");
         goto leave;
@@ -350,6 +483,14 @@ static apr_status_t ts_renew(md_proto_driver_t *d, md_result_t *result)
         goto leave;
     }
 
+    /* goes live together with the certificate, see ts_preload() */
+    rv = md_store_save_json(d->store, d->p, MD_SG_STAGING, name, MD_FN_TAILSCALE,
+                            ts_ctx->validators_new, 0);
+    if (APR_SUCCESS != rv) {
+        md_result_printf(result, rv, "saving tailscale validators.");
+        goto leave;
+    }
+
     md_result_set(result, APR_SUCCESS,
         "A new tailscale certificate has been retrieved successfully and can "
         "be used. A graceful server restart is recommended.");
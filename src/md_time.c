@@ -105,6 +105,45 @@ static const char *duration_print(apr_pool_t *p, int roughly, apr_interval_time_
     return s;
 }
 
+apr_time_t md_time_parse_rfc3339(const char *s)
+{
+    apr_time_exp_t texp;
+    apr_time_t t;
+    int year, mon, mday, hour, min, sec, n = 0, offset = 0, oh, om;
+    
+    if (!s || sscanf(s, "%4d-%2d-%2d%*1[Tt ]%2d:%2d:%2d%n", 
+                     &year, &mon, &mday, &hour, &min, &sec, &n) != 6 || !n) {
+        return 0;
+    }
+    s += n;
+    if (*s == '.') {
+        /* fractions of a second are of no interest here */
+        for (++s; apr_isdigit(*s); ++s);
+    }
+    if (*s == 'Z' || *s == 'z') {
+        ++s;
+    }
+    else if ((*s == '+' || *s == '-') && sscanf(s + 1, "%2d:%2d", &oh, &om) == 2) {
+        offset = (oh * 60 + om) * 60;
+        if (*s == '-') offset = -offset;
+        s += 6;
+    }
+    else {
+        return 0;
+    }
+    if (*s) return 0;
+    
+    memset(&texp, 0, sizeof(texp));
+    texp.tm_year = year - 1900;
+    texp.tm_mon = mon - 1;
+    texp.tm_mday = mday;
+    texp.tm_hour = hour;
+    texp.tm_min = min;
+    texp.tm_sec = sec;
+    if (APR_SUCCESS != apr_time_exp_gmt_get(&t, &texp)) return 0;
+    return t - apr_time_from_sec(offset);
+}
+
 const char *md_duration_print(apr_pool_t *p, apr_interval_time_t duration)
 {
     return duration_print(p, 0, duration);
@@ -43,6 +43,12 @@ md_timeperiod_t md_timeperiod_common(const md_timeperiod_t *a, const md_timeperi
 
 char *md_timeperiod_print(apr_pool_t *p, const md_timeperiod_t *period);
 
+/**
+ * Parse a RFC 3339 timestamp, e.g. "2024-02-29T12:00:00Z", as used in ACME.
+ * @return the time or 0 if the string could not be parsed
+ */
+apr_time_t md_time_parse_rfc3339(const char *s);
+
 /**
  * Print a human readable form of the give duration in days/hours/min/sec 
  */
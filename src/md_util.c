@@ -17,9 +17,11 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <apr_atomic.h>
 #include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_portable.h>
+#include <apr_date.h>
 #include <apr_file_info.h>
 #include <apr_fnmatch.h>
 #include <apr_tables.h>
@@ -1037,20 +1039,47 @@ apr_status_t md_util_abs_http_uri_check(apr_pool_t *p, const char *uri, const ch
 
 /* try and retry for a while **********************************************************************/
 
+typedef struct {
+    md_util_try_fn *fn;
+    void *baton;
+} try_plain_ctx;
+
+static apr_status_t try_plain(void *baton, int i, apr_time_t *pnext)
+{
+    try_plain_ctx *ctx = baton;
+
+    (void)pnext;
+    return ctx->fn(ctx->baton, i);
+}
+
 apr_status_t md_util_try(md_util_try_fn *fn, void *baton, int ignore_errs, 
                          apr_interval_time_t timeout, apr_interval_time_t start_delay, 
                          apr_interval_time_t max_delay, int backoff)
+{
+    try_plain_ctx ctx;
+    
+    ctx.fn = fn;
+    ctx.baton = baton;
+    return md_util_try_next(try_plain, &ctx, ignore_errs, timeout, 
+                            start_delay, max_delay, backoff);
+}
+
+apr_status_t md_util_try_next(md_util_try_next_fn *fn, void *baton, int ignore_errs, 
+                              apr_interval_time_t timeout, apr_interval_time_t start_delay, 
+                              apr_interval_time_t max_delay, int backoff)
 {
     apr_status_t rv;
     apr_time_t now = apr_time_now();
     apr_time_t giveup = now + timeout;
+    apr_time_t next;
     apr_interval_time_t nap_duration = start_delay? start_delay : apr_time_from_msec(100);
     apr_interval_time_t nap_max = max_delay? max_delay : apr_time_from_sec(10);
-    apr_interval_time_t left;
+    apr_interval_time_t left, nap;
     int i = 0;
     
     while (1) {
-        if (APR_SUCCESS == (rv = fn(baton, i++))) {
+        next = 0;
+        if (APR_SUCCESS == (rv = fn(baton, i++, &next))) {
             break;
         }
         else if (!APR_STATUS_IS_EAGAIN(rv) && !ignore_errs) {
@@ -1071,7 +1100,12 @@ apr_status_t md_util_try(md_util_try_fn *fn, void *baton, int ignore_errs,
             nap_duration = nap_max;
         }
         
-        apr_sleep(nap_duration);
+        nap = nap_duration;
+        if (next > now) {
+            /* asked to come back at a certain time, do not come earlier */
+            nap = (next - now > left)? left : (next - now);
+        }
+        apr_sleep(nap);
         if (backoff) {
             nap_duration *= 2;
         } 
@@ -1544,6 +1578,25 @@ const char *md_link_find_relation(const apr_table_t *headers,
     return ctx.url;
 }
 
+apr_time_t md_util_retry_after(const apr_table_t *headers, apr_time_t now)
+{
+    const char *s;
+    char *end;
+    apr_int64_t secs;
+    
+    s = headers? apr_table_get(headers, "Retry-After") : NULL;
+    if (!s || !*s) return 0;
+    if (apr_isdigit(*s)) {
+        secs = apr_strtoi64(s, &end, 10);
+        if (secs >= 0 && (!*end || apr_isspace(*end))) {
+            return now + apr_time_from_sec(secs);
+        }
+        return 0;
+    }
+    /* APR_DATE_BAD is 0 */
+    return apr_date_parse_http(s);
+}
+
 const char *md_util_parse_ct(apr_pool_t *pool, const char *cth)
 {
     char       *type;
@@ -1564,3 +1617,24 @@ const char *md_util_parse_ct(apr_pool_t *pool, const char *cth)
     /* Could parse and return parameters here, but we don't need any at present.
      */
 }
+
+/**************************************************************************************************/
+/* counters */
+
+static volatile apr_uint32_t local_counters[MD_CNT_MAX];
+static volatile apr_uint32_t *counters = local_counters;
+
+void md_counters_use(volatile apr_uint32_t *shared)
+{
+    counters = shared? shared : local_counters;
+}
+
+void md_counter_inc(md_counter_t counter)
+{
+    if (counter < MD_CNT_MAX) apr_atomic_inc32(&counters[counter]);
+}
+
+apr_uint32_t md_counter_get(md_counter_t counter)
+{
+    return (counter < MD_CNT_MAX)? apr_atomic_read32(&counters[counter]) : 0;
+}
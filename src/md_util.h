@@ -246,6 +246,13 @@ const char *md_link_find_relation(const struct apr_table_t *headers,
                                   apr_pool_t *pool, const char *relation);
 
 const char *md_util_parse_ct(apr_pool_t *pool, const char *cth);
+
+/**
+ * Get the time a server asks us to retry at from a "Retry-After" header,
+ * either given as delay in seconds or as HTTP date.
+ * @return the time to retry at or 0 if there is no such header
+ */
+apr_time_t md_util_retry_after(const struct apr_table_t *headers, apr_time_t now);
 /**************************************************************************************************/
 /* retry logic */
 
@@ -255,4 +262,41 @@ apr_status_t md_util_try(md_util_try_fn *fn, void *baton, int ignore_errs,
                          apr_interval_time_t timeout, apr_interval_time_t start_delay, 
                          apr_interval_time_t max_delay, int backoff);
 
+/**
+ * Like md_util_try_fn, but the function may set *pnext to the time it
+ * wants to be called again, e.g. as announced by a server. Leaving it at 0
+ * uses the normal nap duration.
+ */
+typedef apr_status_t md_util_try_next_fn(void *baton, int i, apr_time_t *pnext);
+
+/**
+ * Like md_util_try(), but a time proposed by the function takes precedence
+ * over the nap duration and max_delay, as long as it lies before the timeout.
+ */
+apr_status_t md_util_try_next(md_util_try_next_fn *fn, void *baton, int ignore_errs,  
+                              apr_interval_time_t timeout, apr_interval_time_t start_delay, 
+                              apr_interval_time_t max_delay, int backoff);
+
+/**************************************************************************************************/
+/* counters */
+
+typedef enum {
+    MD_CNT_ACME_REQUESTS,       /* requests sent to ACME CAs */
+    MD_CNT_OCSP_REQUESTS,       /* requests sent to OCSP responders */
+    MD_CNT_STORE_LOADS,         /* items loaded from the store */
+    MD_CNT_STORE_SAVES,         /* items saved to the store */
+    MD_CNT_RENEWALS,            /* renewals that obtained new certificates */
+    MD_CNT_RENEWAL_ERRORS,      /* renewal runs that failed */
+    MD_CNT_MAX
+} md_counter_t;
+
+/**
+ * Keep the counters in the given array of MD_CNT_MAX elements, e.g. in shared
+ * memory so that all processes add to the same. NULL counts in this process only.
+ */
+void md_counters_use(volatile apr_uint32_t *counters);
+
+void md_counter_inc(md_counter_t counter);
+apr_uint32_t md_counter_get(md_counter_t counter);
+
 #endif /* md_util_h */
@@ -15,8 +15,11 @@
  */
 
 #include <assert.h>
+#include <apr_hash.h>
+#include <apr_lib.h>
 #include <apr_optional.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
 #include <mpm_common.h>
 #include <httpd.h>
@@ -36,6 +39,7 @@
 #include "md_event.h"
 #include "md_http.h"
 #include "md_json.h"
+#include "md_keypool.h"
 #include "md_store.h"
 #include "md_store_fs.h"
 #include "md_log.h"
@@ -47,10 +51,13 @@
 #include "md_version.h"
 #include "md_acme.h"
 #include "md_acme_authz.h"
+#include "md_acme_limit.h"
 
 #include "mod_md.h"
 #include "mod_md_config.h"
 #include "mod_md_drive.h"
+#include "mod_md_http01.h"
+#include "mod_md_jobs.h"
 #include "mod_md_ocsp.h"
 #include "mod_md_os.h"
 #include "mod_md_status.h"
@@ -241,7 +248,7 @@ static apr_status_t store_file_ev(void *baton, struct md_store_t *store,
     ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s, "store event=%d on %s %s (group %d)",
                  ev, (ftype == APR_DIR)? "dir" : "file", fname, group);
 
-    /* Directories in group CHALLENGES, STAGING and OCSP are written to
+    /* Directories in group CHALLENGES, STAGING, OCSP and KEYPOOL are written to
      * under a different user. Give her ownership.
      */
     if (ftype == APR_DIR) {
@@ -249,6 +256,7 @@ static apr_status_t store_file_ev(void *baton, struct md_store_t *store,
             case MD_SG_CHALLENGES:
             case MD_SG_STAGING:
             case MD_SG_OCSP:
+            case MD_SG_KEYPOOL:
                 rv = md_make_worker_accessible(fname, p);
                 if (APR_ENOTIMPL != rv) {
                     return rv;
@@ -292,6 +300,7 @@ static apr_status_t setup_store(md_store_t **pstore, md_mod_conf_t *mc,
         || APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_STAGING, p, s))
         || APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_ACCOUNTS, p, s))
         || APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_OCSP, p, s))
+        || APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_KEYPOOL, p, s))
         ) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10047)
                      "setup challenges directory");
@@ -455,7 +464,8 @@ set_and_leave:
     return md_reg_set_props(mc->reg, p, mc->can_http, mc->can_https);
 }
 
-static server_rec *get_public_https_server(md_t *md, const char *domain, server_rec *base_server)
+static server_rec *get_public_https_server(md_t *md, const char *domain, server_rec *base_server,
+                                          apr_array_header_t *servers)
 {
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
@@ -477,48 +487,46 @@ static server_rec *get_public_https_server(md_t *md, const char *domain, server_
     if (check_port && !mc->can_https) return NULL;
 
     /* find an ssl server matching domain from MD */
-    for (s = base_server; s; s = s->next) {
+    for (i = 0; i < servers->nelts; ++i) {
+        s = APR_ARRAY_IDX(servers, i, server_rec*);
         sc = md_config_get(s);
-        if (!sc || !sc->is_ssl || !sc->assigned) continue;
+        if (!sc || !sc->is_ssl) continue;
         if (base_server == s && !mc->manage_base_server) continue;
         if (base_server != s && check_port && mc->local_443 > 0 && !uses_port(s, mc->local_443)) continue;
-        for (i = 0; i < sc->assigned->nelts; ++i) {
-            if (md == APR_ARRAY_IDX(sc->assigned, i, md_t*)) {
-                r.server = s;
-                if (ap_matches_request_vhost(&r, domain, s->port)) {
-                    if (check_port) {
-                        return s;
-                    }
-                    else {
-                        /* there may be multiple matching servers because we ignore the port.
-                           if possible, choose a server that supports the acme-tls/1 protocol */
-                        if (ap_is_allowed_protocol(NULL, NULL, s, PROTO_ACME_TLS_1)) {
-                            return s;
-                        }
-                        res = s;
-                    }
+        r.server = s;
+        if (ap_matches_request_vhost(&r, domain, s->port)) {
+            if (check_port) {
+                return s;
+            }
+            else {
+                /* there may be multiple matching servers because we ignore the port.
+                   if possible, choose a server that supports the acme-tls/1 protocol */
+                if (ap_is_allowed_protocol(NULL, NULL, s, PROTO_ACME_TLS_1)) {
+                    return s;
                 }
+                res = s;
             }
         }
     }
     return res;
 }
 
-static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, apr_pool_t *p)
+static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, 
+                                     apr_array_header_t *servers, apr_pool_t *p)
 {
     md_srv_conf_t *sc;
     server_rec *s;
     apr_status_t rv = APR_SUCCESS;
-    int updates;
+    int i, updates;
 
     /* Ad all domain names used in SSL VirtualHosts, if not already there */
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, base_server,
                  "md[%s]: auto add domains", md->name);
     updates = 0;
-    for (s = base_server; s; s = s->next) {
+    for (i = 0; i < servers->nelts; ++i) {
+        s = APR_ARRAY_IDX(servers, i, server_rec*);
         sc = md_config_get(s);
-        if (!sc || !sc->is_ssl || !sc->assigned || sc->assigned->nelts != 1) continue;
-        if (md != APR_ARRAY_IDX(sc->assigned, 0, md_t*)) continue;
+        if (!sc || !sc->is_ssl || sc->assigned->nelts != 1) continue;
         if (APR_SUCCESS != (rv = md_cover_server(md, s, &updates, p))) {
             return rv;
         }
@@ -526,7 +534,8 @@ static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, apr_pool
     return rv;
 }
 
-static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
+static void init_acme_tls_1_domains(md_t *md, server_rec *base_server, 
+                                    apr_array_header_t *servers)
 {
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
@@ -542,7 +551,7 @@ static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
     apr_array_clear(md->acme_tls_1_domains);
     for (i = 0; i < md->domains->nelts; ++i) {
         domain = APR_ARRAY_IDX(md->domains, i, const char*);
-        s = get_public_https_server(md, domain, base_server);
+        s = get_public_https_server(md, domain, base_server, servers);
         /* If we did not find a specific virtualhost for md and manage
          * the base_server, that one is inspected */
         if (NULL == s && mc->manage_base_server) s = base_server;
@@ -561,97 +570,196 @@ static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
     }
 }
 
-static apr_status_t link_md_to_servers(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
-                                       apr_pool_t *p)
+static void link_md_to_server(md_mod_conf_t *mc, md_t *md, server_rec *s,
+                              server_rec *base_server, apr_pool_t *p)
 {
-    server_rec *s;
     request_rec r;
     md_srv_conf_t *sc;
     int i;
     const char *domain, *uri;
 
-    sc = md_config_get(base_server);
-
-    /* Assign the MD to all server_rec configs that it matches. If there already
+    /* Assign the MD to the server_rec config if it matches. If there already
      * is an assigned MD not equal this one, the configuration is in error.
      */
     memset(&r, 0, sizeof(r));
+    r.server = s;
+    for (i = 0; i < md->domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+
+        if ((mc->match_mode == MD_MATCH_ALL &&
+             ap_matches_request_vhost(&r, domain, s->port))
+            || (((mc->match_mode == MD_MATCH_SERVERNAMES) || md_dns_is_wildcard(p, domain)) &&
+                md_dns_matches(domain, s->server_hostname))) {
+            /* Create a unique md_srv_conf_t record for this server, if there is none yet */
+            sc = md_config_get_unique(s, p);
+            if (!sc->assigned) sc->assigned = apr_array_make(p, 2, sizeof(md_t*));
+            if (sc->assigned->nelts == 1 && mc->match_mode == MD_MATCH_SERVERNAMES) {
+                /* there is already an MD assigned for this server. But in
+                 * this match mode, wildcard matches are pre-empted by non-wildcards */
+                int existing_wild = md_is_wild_match(
+                      APR_ARRAY_IDX(sc->assigned, 0, const md_t*)->domains,
+                      s->server_hostname);
+                if (!existing_wild && md_dns_is_wildcard(p, domain))
+                    continue;  /* do not add */
+                if (existing_wild && !md_dns_is_wildcard(p, domain))
+                    sc->assigned->nelts = 0;  /* overwrite existing */
+            }
+            APR_ARRAY_PUSH(sc->assigned, md_t*) = md;
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
+                         "Server %s:%d matches md %s (config %s, match-mode=%d) "
+                         "for domain %s, has now %d MDs",
+                         s->server_hostname, s->port, md->name, sc->name,
+                         mc->match_mode, domain, (int)sc->assigned->nelts);
+
+            if (md->contacts && md->contacts->nelts > 0) {
+                /* set explicitly */
+            }
+            else if (sc->ca_contact && sc->ca_contact[0]) {
+                uri = md_util_schemify(p, sc->ca_contact, "mailto");
+                if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
+                    APR_ARRAY_PUSH(md->contacts, const char *) = uri;
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
+                                 "%s: added contact %s", md->name, uri);
+                }
+            }
+            else if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
+                uri = md_util_schemify(p, s->server_admin, "mailto");
+                if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
+                    APR_ARRAY_PUSH(md->contacts, const char *) = uri;
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10237)
+                                 "%s: added contact %s", md->name, uri);
+                }
+            }
+            break;
+        }
+    }
+}
+
+typedef struct {
+    char *seen;                 /* by position in mc->mds */
+    apr_array_header_t *found;  /* positions of the MDs found */
+} link_candidates_t;
+
+static int add_candidate(void *baton, md_t *md, int pos)
+{
+    link_candidates_t *cands = baton;
+
+    (void)md;
+    if (!cands->seen[pos]) {
+        cands->seen[pos] = 1;
+        APR_ARRAY_PUSH(cands->found, int) = pos;
+    }
+    return 1;
+}
+
+static int pos_cmp(const void *v1, const void *v2)
+{
+    return *(const int*)v1 - *(const int*)v2;
+}
+
+static apr_status_t link_mds_to_servers(md_mod_conf_t *mc, server_rec *base_server, 
+                                        apr_pool_t *p, apr_pool_t *ptemp)
+{
+    md_domain_idx_t *idx;
+    link_candidates_t cands;
+    server_rec *s;
+    server_addr_rec *sar;
+    int i;
+
+    apr_array_clear(mc->unused_names);
+    if (mc->mds->nelts == 0) return APR_SUCCESS;
+    /* Instead of trying every MD on every server, only try those having
+     * a name of the server. Positions in the index are those in mc->mds. */
+    idx = md_domain_idx_make(ptemp, mc->mds);
+    cands.seen = apr_pcalloc(ptemp, (apr_size_t)mc->mds->nelts);
+    cands.found = apr_array_make(ptemp, 5, sizeof(int));
     for (s = base_server; s; s = s->next) {
         if (!mc->manage_base_server && s == base_server) {
             /* we shall not assign ourselves to the base server */
             continue;
         }
+        if (mc->match_mode == MD_MATCH_ALL && s->wild_names && s->wild_names->nelts) {
+            /* aliases with wildcards may match any MD name */
+            for (i = 0; i < mc->mds->nelts; ++i) {
+                link_md_to_server(mc, APR_ARRAY_IDX(mc->mds, i, md_t*), s, base_server, p);
+            }
+            continue;
+        }
 
-        r.server = s;
-        for (i = 0; i < md->domains->nelts; ++i) {
-            domain = APR_ARRAY_IDX(md->domains, i, const char*);
-
-            if ((mc->match_mode == MD_MATCH_ALL &&
-                 ap_matches_request_vhost(&r, domain, s->port))
-                || (((mc->match_mode == MD_MATCH_SERVERNAMES) || md_dns_is_wildcard(p, domain)) &&
-                    md_dns_matches(domain, s->server_hostname))) {
-                /* Create a unique md_srv_conf_t record for this server, if there is none yet */
-                sc = md_config_get_unique(s, p);
-                if (!sc->assigned) sc->assigned = apr_array_make(p, 2, sizeof(md_t*));
-                if (sc->assigned->nelts == 1 && mc->match_mode == MD_MATCH_SERVERNAMES) {
-                    /* there is already an MD assigned for this server. But in
-                     * this match mode, wildcard matches are pre-empted by non-wildcards */
-                    int existing_wild = md_is_wild_match(
-                          APR_ARRAY_IDX(sc->assigned, 0, const md_t*)->domains,
-                          s->server_hostname);
-                    if (!existing_wild && md_dns_is_wildcard(p, domain))
-                        continue;  /* do not add */
-                    if (existing_wild && !md_dns_is_wildcard(p, domain))
-                        sc->assigned->nelts = 0;  /* overwrite existing */
-                }
-                APR_ARRAY_PUSH(sc->assigned, md_t*) = md;
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
-                             "Server %s:%d matches md %s (config %s, match-mode=%d) "
-                             "for domain %s, has now %d MDs",
-                             s->server_hostname, s->port, md->name, sc->name,
-                             mc->match_mode, domain, (int)sc->assigned->nelts);
-
-                if (md->contacts && md->contacts->nelts > 0) {
-                    /* set explicitly */
-                }
-                else if (sc->ca_contact && sc->ca_contact[0]) {
-                    uri = md_util_schemify(p, sc->ca_contact, "mailto");
-                    if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
-                        APR_ARRAY_PUSH(md->contacts, const char *) = uri;
-                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
-                                     "%s: added contact %s", md->name, uri);
-                    }
-                }
-                else if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
-                    uri = md_util_schemify(p, s->server_admin, "mailto");
-                    if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
-                        APR_ARRAY_PUSH(md->contacts, const char *) = uri;
-                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10237)
-                                     "%s: added contact %s", md->name, uri);
-                    }
-                }
-                break;
+        if (s->server_hostname) {
+            md_domain_idx_do(idx, s->server_hostname, add_candidate, &cands);
+        }
+        if (mc->match_mode == MD_MATCH_ALL) {
+            for (i = 0; s->names && i < s->names->nelts; ++i) {
+                md_domain_idx_do(idx, APR_ARRAY_IDX(s->names, i, const char*), 
+                                 add_candidate, &cands);
             }
+            for (sar = s->addrs; sar; sar = sar->next) {
+                if (sar->virthost) md_domain_idx_do(idx, sar->virthost, add_candidate, &cands);
+            }
+        }
+        /* in the order of mc->mds, as when trying all */
+        qsort(cands.found->elts, (size_t)cands.found->nelts, sizeof(int), pos_cmp);
+        for (i = 0; i < cands.found->nelts; ++i) {
+            link_md_to_server(mc, APR_ARRAY_IDX(mc->mds, APR_ARRAY_IDX(cands.found, i, int), md_t*),
+                              s, base_server, p);
+            cands.seen[APR_ARRAY_IDX(cands.found, i, int)] = 0;
         }
+        apr_array_clear(cands.found);
     }
     return APR_SUCCESS;
 }
 
-static apr_status_t link_mds_to_servers(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p)
+static void init_server_hosts(md_mod_conf_t *mc, server_rec *base_server, apr_pool_t *p)
 {
-    int i;
-    md_t *md;
-    apr_status_t rv = APR_SUCCESS;
-
-    apr_array_clear(mc->unused_names);
-    for (i = 0; i < mc->mds->nelts; ++i) {
-        md = APR_ARRAY_IDX(mc->mds, i, md_t*);
-        if (APR_SUCCESS != (rv = link_md_to_servers(mc, md, s, p))) {
-            goto leave;
+    server_rec *s;
+    md_srv_conf_t *sc;
+    md_host_conf_t *hc;
+    const md_t *md, *owner;
+    apr_array_header_t *wild;
+    char *name, *c;
+    int i, j, k, has_wild;
+
+    /* Resolve, for each name a server may see in requests, the MD and what
+     * it requires. This saves looking through the MDs on every request. */
+    wild = apr_array_make(p, 5, sizeof(const md_t*));
+    for (s = base_server; s; s = s->next) {
+        sc = md_config_get(s);
+        if (!sc || !sc->assigned || !sc->assigned->nelts || sc->hosts) continue;
+        sc->hosts = apr_hash_make(p);
+        apr_array_clear(wild);
+        for (i = 0; i < sc->assigned->nelts; ++i) {
+            md = APR_ARRAY_IDX(sc->assigned, i, const md_t*);
+            has_wild = 0;
+            for (j = 0; j < md->domains->nelts; ++j) {
+                name = apr_pstrdup(p, APR_ARRAY_IDX(md->domains, j, const char*));
+                /* wildcards are matched on request */
+                if (name[0] == '*') {
+                    has_wild = 1;
+                    continue;
+                }
+                for (c = name; *c; ++c) *c = (char)apr_tolower(*c);
+                if (apr_hash_get(sc->hosts, name, APR_HASH_KEY_STRING)) continue;
+                /* As in md_get_for_domain(), the first MD assigned that has the
+                 * name wins, also when it has it by a wildcard. */
+                owner = md;
+                for (k = 0; k < wild->nelts; ++k) {
+                    if (md_contains(APR_ARRAY_IDX(wild, k, const md_t*), name, 0)) {
+                        owner = APR_ARRAY_IDX(wild, k, const md_t*);
+                        break;
+                    }
+                }
+                hc = apr_pcalloc(p, sizeof(*hc));
+                hc->md = owner;
+                hc->require_https = owner->require_https;
+                hc->hsts_header = (owner->require_https == MD_REQUIRE_PERMANENT)?
+                                   mc->hsts_header : NULL;
+                hc->https_prefix = apr_pstrcat(p, "https://", name, NULL);
+                apr_hash_set(sc->hosts, name, APR_HASH_KEY_STRING, hc);
+            }
+            if (has_wild) APR_ARRAY_PUSH(wild, const md_t*) = md;
         }
     }
-leave:
-    return rv;
 }
 
 static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
@@ -659,6 +767,7 @@ static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
 {
     md_srv_conf_t *base_conf;
     md_t *md, *omd;
+    md_domain_idx_t *completed;
     const char *domain;
     md_timeslice_t *ts;
     apr_status_t rv = APR_SUCCESS;
@@ -678,15 +787,16 @@ static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
     /* Complete the properties of the MDs, now that we have the complete, merged
      * server configurations.
      */
+    completed = md_domain_idx_create(p);
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t*);
         merge_srv_config(md, base_conf, p);
 
         if (mc->match_mode == MD_MATCH_ALL) {
           /* Check that we have no overlap with the MDs already completed */
-          for (j = 0; j < i; ++j) {
-              omd = APR_ARRAY_IDX(mc->mds, j, md_t*);
-              if ((domain = md_common_name(md, omd)) != NULL) {
+          for (j = 0; j < md->domains->nelts; ++j) {
+              domain = APR_ARRAY_IDX(md->domains, j, const char*);
+              if ((omd = md_domain_idx_get(completed, domain)) != NULL) {
                   ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10038)
                                "two Managed Domains have an overlap in domain '%s'"
                                ", first definition in %s(line %d), second in %s(line %d)",
@@ -695,6 +805,7 @@ static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
                   return APR_EINVAL;
               }
           }
+          md_domain_idx_add(completed, md);
         }
 
         if (md->cert_files && md->cert_files->nelts) {
@@ -727,6 +838,32 @@ static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
     return rv;
 }
 
+/* The servers each MD is assigned to, by MD name, in server order */
+static apr_hash_t *get_servers_by_md(server_rec *base_server, apr_pool_t *p)
+{
+    apr_hash_t *servers_by_md = apr_hash_make(p);
+    apr_array_header_t *servers;
+    server_rec *s;
+    md_srv_conf_t *sc;
+    const md_t *md;
+    int i;
+
+    for (s = base_server; s; s = s->next) {
+        sc = md_config_get(s);
+        if (!sc || !sc->assigned) continue;
+        for (i = 0; i < sc->assigned->nelts; ++i) {
+            md = APR_ARRAY_IDX(sc->assigned, i, const md_t*);
+            servers = apr_hash_get(servers_by_md, md->name, APR_HASH_KEY_STRING);
+            if (!servers) {
+                servers = apr_array_make(p, 2, sizeof(server_rec*));
+                apr_hash_set(servers_by_md, md->name, APR_HASH_KEY_STRING, servers);
+            }
+            APR_ARRAY_PUSH(servers, server_rec*) = s;
+        }
+    }
+    return servers_by_md;
+}
+
 static apr_status_t check_invalid_duplicates(server_rec *base_server)
 {
     server_rec *s;
@@ -750,26 +887,16 @@ static apr_status_t check_invalid_duplicates(server_rec *base_server)
 }
 
 static apr_status_t check_usage(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
-                                apr_pool_t *p, apr_pool_t *ptemp)
+                                apr_array_header_t *servers)
 {
-    server_rec *s;
     md_srv_conf_t *sc;
     apr_status_t rv = APR_SUCCESS;
     int i, has_ssl;
-    apr_array_header_t *servers;
 
-    (void)p;
-    servers = apr_array_make(ptemp, 5, sizeof(server_rec*));
     has_ssl = 0;
-    for (s = base_server; s; s = s->next) {
-        sc = md_config_get(s);
-        if (!sc || !sc->assigned) continue;
-        for (i = 0; i < sc->assigned->nelts; ++i) {
-            if (md == APR_ARRAY_IDX(sc->assigned, i, md_t*)) {
-                APR_ARRAY_PUSH(servers, server_rec*) = s;
-                if (sc->is_ssl) has_ssl = 1;
-            }
-        }
+    for (i = 0; i < servers->nelts; ++i) {
+        sc = md_config_get(APR_ARRAY_IDX(servers, i, server_rec*));
+        if (sc && sc->is_ssl) has_ssl = 1;
     }
 
     if (!has_ssl && md->require_https > MD_REQUIRE_OFF) {
@@ -843,7 +970,7 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
     apr_status_t rv = APR_SUCCESS;
-    int dry_run = 0, log_level = APLOG_DEBUG;
+    int i, dry_run = 0, log_level = APLOG_DEBUG;
     md_store_t *store;
 
     apr_pool_userdata_get(&data, mod_md_init_key, s->process->pool);
@@ -890,6 +1017,11 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10072) "setup md registry");
         goto leave;
     }
+    for (i = 0; i < mc->ca_limits->nelts; ++i) {
+        md_acme_limits_set(md_reg_ca_limits_get(mc->reg), 
+                           APR_ARRAY_IDX(mc->ca_limits, i, const md_acme_limit_t*));
+    }
+    md_keypool_configure(md_reg_keypool_get(mc->reg), mc->keypool_depth, mc->keypool_workers);
 
     /* renew on 30% remaining /*/
     rv = md_ocsp_reg_make(&mc->ocsp, p, store, mc->ocsp_renew_window,
@@ -926,7 +1058,7 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
     /*2*/
     if (APR_SUCCESS != (rv = merge_mds_with_conf(mc, p, s, log_level))) goto leave;
     /*3*/
-    if (APR_SUCCESS != (rv = link_mds_to_servers(mc, s, p))) goto leave;
+    if (APR_SUCCESS != (rv = link_mds_to_servers(mc, s, p, ptemp))) goto leave;
     /*4*/
     if (APR_SUCCESS != (rv = md_reg_lock_global(mc->reg, ptemp))) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10398)
@@ -955,10 +1087,11 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
     md_srv_conf_t *sc;
     apr_status_t rv = APR_SUCCESS;
     md_mod_conf_t *mc;
+    apr_hash_t *servers_by_md;
+    apr_array_header_t *servers, *no_servers;
     int watched, i;
     md_t *md;
 
-    (void)ptemp;
     (void)plog;
     sc = md_config_get(s);
 
@@ -971,16 +1104,20 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
         goto leave;
     }
     apr_array_clear(mc->unused_names);
+    servers_by_md = get_servers_by_md(s, ptemp);
+    no_servers = apr_array_make(ptemp, 1, sizeof(server_rec*));
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t *);
+        servers = apr_hash_get(servers_by_md, md->name, APR_HASH_KEY_STRING);
+        if (!servers) servers = no_servers;
 
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: auto_add", md->name);
-        if (APR_SUCCESS != (rv = auto_add_domains(md, s, p))) {
+        if (APR_SUCCESS != (rv = auto_add_domains(md, s, servers, p))) {
             goto leave;
         }
-        init_acme_tls_1_domains(md, s);
+        init_acme_tls_1_domains(md, s, servers);
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: check_usage", md->name);
-        if (APR_SUCCESS != (rv = check_usage(mc, md, s, p, ptemp))) {
+        if (APR_SUCCESS != (rv = check_usage(mc, md, s, servers))) {
             goto leave;
         }
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: sync_finish", md->name);
@@ -1000,6 +1137,12 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
     /* From here on, the domains in the registry are readonly
      * and only staging/challenges may be manipulated */
     md_reg_freeze_domains(mc->reg, mc->mds);
+    mc->domain_idx = md_reg_domain_idx(mc->reg);
+    init_server_hosts(mc, s, p);
+    mc->mds_by_name = md_status_sort_mds(mc->mds, p);
+    /* without it, server-status reads job states from the store and
+     * counters are kept per process */
+    md_jobs_table_create(&mc->jobs_table, mc->mds, md_reg_keypool_get(mc->reg), p, s);
 
     if (watched) {
         /*10*/
@@ -1007,6 +1150,8 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
                      "%d out of %d mds need watching", watched, mc->mds->nelts);
 
         md_http_use_implementation(md_curl_get_impl(p));
+        /* without it, challenges are answered from the store */
+        md_http01_table_create(&mc->http01_table, p, s);
         rv = md_renew_start_watching(mc, s, p);
     }
     else {
@@ -1285,6 +1430,99 @@ static int md_add_fallback_cert_files(server_rec *s, apr_pool_t *p,
     return DECLINED;
 }
 
+/* Challenge certificates and keys already read by this child. An entry is
+ * used as long as the certificate file in the store is unchanged, a teardown
+ * from any process removes it. mod_ssl only takes PEM here, so that is
+ * what we keep. */
+#define ALPN_CACHE_MAX      256
+
+typedef struct {
+    const char *cert_pem;
+    const char *key_pem;
+    apr_ino_t inode;
+    apr_time_t mtime;
+    apr_off_t size;
+} alpn_cert_t;
+
+static apr_hash_t *alpn_certs;          /* "servername cert_name" -> alpn_cert_t* */
+static apr_thread_mutex_t *alpn_mutex;
+
+static void alpn_cache_init(apr_pool_t *pchild)
+{
+    if (APR_SUCCESS == apr_thread_mutex_create(&alpn_mutex, APR_THREAD_MUTEX_DEFAULT, pchild)) {
+        alpn_certs = apr_hash_make(pchild);
+    }
+}
+
+static void alpn_cache_remove(const char *key)
+{
+    alpn_cert_t *e;
+
+    if ((e = apr_hash_get(alpn_certs, key, APR_HASH_KEY_STRING))) {
+        apr_hash_set(alpn_certs, key, APR_HASH_KEY_STRING, NULL);
+        free(e);
+    }
+}
+
+static void alpn_cache_clear(void)
+{
+    apr_hash_index_t *hi;
+    const void *key;
+    void *e;
+
+    for (hi = apr_hash_first(NULL, alpn_certs); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, &key, NULL, &e);
+        apr_hash_set(alpn_certs, key, APR_HASH_KEY_STRING, NULL);
+        free(e);
+    }
+}
+
+/* Get the PEMs of the entry for key, if it matches the file info, copied into p */
+static int alpn_cache_get(const char *key, const apr_finfo_t *finfo,
+                          const char **pcert_pem, const char **pkey_pem, apr_pool_t *p)
+{
+    alpn_cert_t *e;
+    int found = 0;
+
+    apr_thread_mutex_lock(alpn_mutex);
+    if ((e = apr_hash_get(alpn_certs, key, APR_HASH_KEY_STRING))) {
+        if (e->inode == finfo->inode && e->mtime == finfo->mtime && e->size == finfo->size) {
+            *pcert_pem = apr_pstrdup(p, e->cert_pem);
+            *pkey_pem = apr_pstrdup(p, e->key_pem);
+            found = 1;
+        }
+        else {
+            alpn_cache_remove(key);
+        }
+    }
+    apr_thread_mutex_unlock(alpn_mutex);
+    return found;
+}
+
+static void alpn_cache_put(const char *key, const apr_finfo_t *finfo,
+                           const char *cert_pem, const char *key_pem)
+{
+    alpn_cert_t *e;
+    apr_size_t klen = strlen(key) + 1, clen = strlen(cert_pem) + 1, plen = strlen(key_pem) + 1;
+    char *s;
+
+    /* one allocation, freed on removal */
+    if (!(e = malloc(sizeof(*e) + klen + clen + plen))) return;
+    s = (char*)(e + 1);
+    e->cert_pem = memcpy(s, cert_pem, clen);
+    e->key_pem = memcpy(s + clen, key_pem, plen);
+    e->inode = finfo->inode;
+    e->mtime = finfo->mtime;
+    e->size = finfo->size;
+    key = memcpy(s + clen + plen, key, klen);
+
+    apr_thread_mutex_lock(alpn_mutex);
+    alpn_cache_remove(key);
+    if (apr_hash_count(alpn_certs) >= ALPN_CACHE_MAX) alpn_cache_clear();
+    apr_hash_set(alpn_certs, key, APR_HASH_KEY_STRING, e);
+    apr_thread_mutex_unlock(alpn_mutex);
+}
+
 static int md_answer_challenge(conn_rec *c, const char *servername,
                                const char **pcert_pem, const char **pkey_pem)
 {
@@ -1294,8 +1532,9 @@ static int md_answer_challenge(conn_rec *c, const char *servername,
     md_srv_conf_t *sc;
     md_store_t *store;
     char *cert_name, *pkey_name;
-    const char *cert_pem, *key_pem;
-    int i;
+    const char *cert_pem, *key_pem, *fpath, *key;
+    apr_finfo_t finfo;
+    int i, cached;
 
     if (!servername
         || !(protocol = md_protocol_get(c))
@@ -1313,19 +1552,41 @@ static int md_answer_challenge(conn_rec *c, const char *servername,
         tls_alpn01_fnames(c->pool, md_pkeys_spec_get(sc->pks,i),
                           &pkey_name, &cert_name);
 
-        rv = md_store_load(store, MD_SG_CHALLENGES, servername, cert_name, MD_SV_TEXT,
-                           (void**)&cert_pem, c->pool);
-        if (APR_STATUS_IS_ENOENT(rv)) continue;
-        if (APR_SUCCESS != rv) goto cleanup;
+        cached = 0;
+        key = NULL;
+        if (alpn_certs
+            && APR_SUCCESS == md_store_get_fname(&fpath, store, MD_SG_CHALLENGES, 
+                                                 servername, cert_name, c->pool)) {
+            key = apr_pstrcat(c->pool, servername, " ", cert_name, NULL);
+            rv = apr_stat(&finfo, fpath, APR_FINFO_INODE|APR_FINFO_MTIME|APR_FINFO_SIZE, 
+                          c->pool);
+            if (APR_STATUS_IS_ENOENT(rv)) {
+                /* torn down */
+                apr_thread_mutex_lock(alpn_mutex);
+                alpn_cache_remove(key);
+                apr_thread_mutex_unlock(alpn_mutex);
+                continue;
+            }
+            if (APR_SUCCESS != rv && !APR_STATUS_IS_INCOMPLETE(rv)) goto cleanup;
+            cached = alpn_cache_get(key, &finfo, &cert_pem, &key_pem, c->pool);
+        }
 
-        rv = md_store_load(store, MD_SG_CHALLENGES, servername, pkey_name, MD_SV_TEXT,
-                           (void**)&key_pem, c->pool);
-        if (APR_STATUS_IS_ENOENT(rv)) continue;
-        if (APR_SUCCESS != rv) goto cleanup;
+        if (!cached) {
+            rv = md_store_load(store, MD_SG_CHALLENGES, servername, cert_name, MD_SV_TEXT,
+                               (void**)&cert_pem, c->pool);
+            if (APR_STATUS_IS_ENOENT(rv)) continue;
+            if (APR_SUCCESS != rv) goto cleanup;
+
+            rv = md_store_load(store, MD_SG_CHALLENGES, servername, pkey_name, MD_SV_TEXT,
+                               (void**)&key_pem, c->pool);
+            if (APR_STATUS_IS_ENOENT(rv)) continue;
+            if (APR_SUCCESS != rv) goto cleanup;
+            if (key) alpn_cache_put(key, &finfo, cert_pem, key_pem);
+        }
 
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
-                      "Found challenge cert %s, key %s for %s",
-                      cert_name, pkey_name, servername);
+                      "Found challenge cert %s, key %s for %s%s",
+                      cert_name, pkey_name, servername, cached? " (cached)" : "");
         *pcert_pem = cert_pem;
         *pkey_pem = key_pem;
         hook_rv = OK;
@@ -1364,7 +1625,8 @@ static int md_http_challenge_pr(request_rec *r)
             ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
                           "access inside /.well-known/acme-challenge for %s%s",
                           r->hostname, r->parsed_uri.path);
-            md = md_get_by_domain(sc->mc->mds, r->hostname);
+            md = sc->mc->domain_idx? md_domain_idx_get(sc->mc->domain_idx, r->hostname)
+                                   : md_get_by_domain(sc->mc->mds, r->hostname);
             name = r->parsed_uri.path + sizeof(ACME_CHALLENGE_PREFIX)-1;
             reg = sc && sc->mc? sc->mc->reg : NULL;
 
@@ -1380,8 +1642,11 @@ static int md_http_challenge_pr(request_rec *r)
             if (strlen(name) && !ap_strchr_c(name, '/') && reg) {
                 md_store_t *store = md_reg_store_get(reg);
 
-                rv = md_store_load(store, MD_SG_CHALLENGES, r->hostname,
-                                   MD_FN_HTTP01, MD_SV_TEXT, (void**)&data, r->pool);
+                /* challenges set up by our renewals are in shared memory */
+                data = md_http01_table_get(sc->mc->http01_table, r->hostname, name, r->pool);
+                rv = data? APR_SUCCESS : md_store_load(store, MD_SG_CHALLENGES, r->hostname,
+                                                       MD_FN_HTTP01, MD_SV_TEXT, 
+                                                       (void**)&data, r->pool);
                 ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
                               "loading challenge for %s (%s)", r->hostname, r->uri);
                 if (APR_SUCCESS == rv) {
@@ -1428,12 +1693,36 @@ static int md_http_challenge_pr(request_rec *r)
 /**************************************************************************************************/
 /* Require Https hook */
 
+static const md_host_conf_t *get_host_conf(const md_srv_conf_t *sc, const char *host,
+                                           md_host_conf_t *buf, request_rec *r)
+{
+    char key[256];
+    const md_host_conf_t *hc;
+    apr_size_t i;
+
+    for (i = 0; host[i] && i+1 < sizeof(key); ++i) {
+        key[i] = (char)apr_tolower(host[i]);
+    }
+    key[i] = '\0';
+    if (!host[i] && sc->hosts 
+        && (hc = apr_hash_get(sc->hosts, key, APR_HASH_KEY_STRING))) {
+        return hc;
+    }
+    /* a name matching a wildcard (or one added after post_config) */
+    if (!(buf->md = md_get_for_domain(r->server, host))) return NULL;
+    buf->require_https = buf->md->require_https;
+    buf->hsts_header = (buf->md->require_https == MD_REQUIRE_PERMANENT)?
+                        sc->mc->hsts_header : NULL;
+    buf->https_prefix = NULL;
+    return buf;
+}
+
 static int md_require_https_maybe(request_rec *r)
 {
     const md_srv_conf_t *sc;
-    apr_uri_t uri;
+    const md_host_conf_t *hc;
+    md_host_conf_t hc_buf;
     const char *s, *host;
-    const md_t *md;
     int status;
 
     /* Requests outside the /.well-known path are subject to possible
@@ -1446,44 +1735,37 @@ static int md_require_https_maybe(request_rec *r)
     }
 
     host = ap_get_server_name_for_url(r);
-    md = md_get_for_domain(r->server, host);
-    if (!md) goto declined;
+    if (!(hc = get_host_conf(sc, host, &hc_buf, r))) goto declined;
 
     if (ap_ssl_conn_is_ssl(r->connection)) {
         /* Using https:
          * if 'permanent' and no one else set a HSTS header already, do it */
-        if (md->require_https == MD_REQUIRE_PERMANENT
-            && sc->mc->hsts_header && !apr_table_get(r->headers_out, MD_HSTS_HEADER)) {
-            apr_table_setn(r->headers_out, MD_HSTS_HEADER, sc->mc->hsts_header);
+        if (hc->hsts_header && !apr_table_get(r->headers_out, MD_HSTS_HEADER)) {
+            apr_table_setn(r->headers_out, MD_HSTS_HEADER, hc->hsts_header);
         }
     }
     else {
-        if (md->require_https > MD_REQUIRE_OFF) {
+        if (hc->require_https > MD_REQUIRE_OFF) {
             /* Not using https:, but require it. Redirect. */
             if (r->method_number == M_GET) {
                 /* safe to use the old-fashioned codes */
-                status = ((MD_REQUIRE_PERMANENT == md->require_https)?
+                status = ((MD_REQUIRE_PERMANENT == hc->require_https)?
                           HTTP_MOVED_PERMANENTLY : HTTP_MOVED_TEMPORARILY);
             }
             else {
                 /* these should keep the method unchanged on retry */
-                status = ((MD_REQUIRE_PERMANENT == md->require_https)?
+                status = ((MD_REQUIRE_PERMANENT == hc->require_https)?
                           HTTP_PERMANENT_REDIRECT : HTTP_TEMPORARY_REDIRECT);
             }
-
-            s = ap_construct_url(r->pool, r->uri, r);
-            if (APR_SUCCESS == apr_uri_parse(r->pool, s, &uri)) {
-                uri.scheme = (char*)"https";
-                uri.port = 443;
-                uri.port_str = (char*)"443";
-                uri.query = r->parsed_uri.query;
-                uri.fragment = r->parsed_uri.fragment;
-                s = apr_uri_unparse(r->pool, &uri, APR_URI_UNP_OMITUSERINFO);
-                if (s && *s) {
-                    apr_table_setn(r->headers_out, "Location", s);
-                    return status;
-                }
-            }
+            /* https: on the default port, same path, query and fragment */
+            s = apr_pstrcat(r->pool, hc->https_prefix? hc->https_prefix : "https://", 
+                            hc->https_prefix? "" : host, r->uri,
+                            r->parsed_uri.query? "?" : "", 
+                            r->parsed_uri.query? r->parsed_uri.query : "",
+                            r->parsed_uri.fragment? "#" : "", 
+                            r->parsed_uri.fragment? r->parsed_uri.fragment : "", NULL);
+            apr_table_setn(r->headers_out, "Location", s);
+            return status;
         }
     }
 declined:
@@ -1495,8 +1777,9 @@ declined:
  */
 static void md_child_init(apr_pool_t *pool, server_rec *s)
 {
-    (void)pool;
     (void)s;
+    alpn_cache_init(pool);
+    md_status_child_init(pool);
 }
 
 /* Install this module into the apache2 infrastructure.
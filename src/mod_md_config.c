@@ -27,6 +27,7 @@
 
 #include "md.h"
 #include "md_acme.h"
+#include "md_acme_limit.h"
 #include "md_crypt.h"
 #include "md_log.h"
 #include "md_json.h"
@@ -86,9 +87,17 @@ static md_mod_conf_t defmc = {
     NULL,                      /* CA cert file to use */
     apr_time_from_sec(5),      /* minimum delay for retries */
     13,                        /* retry_failover after 14 errors, with 5s delay ~ half a day */
+    1,                         /* renew_workers, drive one MD at a time */
+    NULL,                      /* ca limits, built-in defaults */
+    0,                         /* keypool_depth, no keys generated ahead */
+    1,                         /* keypool_workers */
     0,                         /* store locks, disabled by default */
     apr_time_from_sec(5),      /* max time to wait to obaint a store lock */
     MD_MATCH_ALL,              /* match vhost severname and aliases */
+    NULL,                      /* domain index, post config */
+    NULL,                      /* http-01 challenge table, post config */
+    NULL,                      /* renewal job table, post config */
+    NULL,                      /* mds sorted by name, post config */
 };
 
 static md_timeslice_t def_renew_window = {
@@ -124,6 +133,7 @@ static md_srv_conf_t defconf = {
     NULL,                      /* dns01_cmd */
     NULL,                      /* currently defined md */
     NULL,                      /* assigned md, post config */
+    NULL,                      /* hosts of assigned mds, post config */
     0,                         /* is_ssl, set during mod_ssl post_config */
 };
 
@@ -149,6 +159,7 @@ static md_mod_conf_t *md_mod_conf_get(apr_pool_t *pool, int create)
         mod_md_config->unused_names = apr_array_make(pool, 5, sizeof(const md_t *));
         mod_md_config->env = apr_table_make(pool, 10);
         mod_md_config->init_errors = apr_hash_make(pool);
+        mod_md_config->ca_limits = apr_array_make(pool, 3, sizeof(md_acme_limit_t *));
          
         apr_pool_cleanup_register(pool, NULL, cleanup_mod_config, apr_pool_cleanup_null);
     }
@@ -655,6 +666,127 @@ static const char *md_config_set_retry_failover(cmd_parms *cmd, void *dc, const
     return NULL;
 }
 
+static const char *md_config_set_renew_workers(cmd_parms *cmd, void *dc, const char *value)
+{
+    md_srv_conf_t *config = md_config_get(cmd->server);
+    const char *err = md_conf_check_location(cmd, MD_LOC_NOT_MD);
+    int renew_workers;
+
+    (void)dc;
+    if (err) return err;
+    renew_workers = atoi(value);
+    if (renew_workers <= 0) {
+        return "invalid argument, must be a number > 0";
+    }
+#if !APR_HAS_THREADS
+    if (renew_workers > 1) {
+        return "more than 1 worker requires a server with thread support";
+    }
+#endif
+    config->mc->renew_workers = renew_workers;
+    return NULL;
+}
+
+static const char *md_config_set_keypool(cmd_parms *cmd, void *dc, 
+                                         const char *depth, const char *workers)
+{
+    md_srv_conf_t *config = md_config_get(cmd->server);
+    const char *err = md_conf_check_location(cmd, MD_LOC_NOT_MD);
+    int n;
+
+    (void)dc;
+    if (err) return err;
+    if (!apr_strnatcasecmp("off", depth)) {
+        n = 0;
+    }
+    else if ((n = atoi(depth)) <= 0) {
+        return "invalid argument, must be 'off' or a number > 0";
+    }
+    config->mc->keypool_depth = n;
+    if (workers) {
+        n = atoi(workers);
+        if (n <= 0) {
+            return "invalid number of workers, must be a number > 0";
+        }
+#if !APR_HAS_THREADS
+        if (n > 1) {
+            return "more than 1 worker requires a server with thread support";
+        }
+#endif
+        config->mc->keypool_workers = n;
+    }
+    return NULL;
+}
+
+static const char *set_ca_bucket(md_acme_bucket_t *bucket, const char *value, 
+                                 apr_pool_t *p)
+{
+    const char *sep;
+    apr_interval_time_t period = MD_ACME_LIMIT_PERIOD_DEF;
+    int burst;
+    
+    if (!apr_strnatcasecmp("off", value)) {
+        bucket->burst = 0;
+        return NULL;
+    }
+    if ((sep = strchr(value, '/'))) {
+        if (APR_SUCCESS != md_duration_parse(&period, sep + 1, "h") || period <= 0) {
+            return apr_psprintf(p, "'%s' has no valid duration after the '/'", value);
+        }
+    }
+    burst = atoi(value);
+    if (burst <= 0) {
+        return apr_psprintf(p, "'%s' needs a number > 0 of requests", value);
+    }
+    bucket->burst = burst;
+    bucket->period = period;
+    return NULL;
+}
+
+static const char *md_config_set_ca_limit(cmd_parms *cmd, void *dc, 
+                                          int argc, char *const argv[])
+{
+    md_srv_conf_t *config = md_config_get(cmd->server);
+    const char *err = md_conf_check_location(cmd, MD_LOC_NOT_MD);
+    md_acme_limit_t *limit;
+    const char *url, *val;
+    int i;
+
+    (void)dc;
+    if (err) return err;
+    if (argc < 2) return "needs a CA and at least one limit";
+    
+    limit = apr_pcalloc(cmd->pool, sizeof(*limit));
+    limit->buckets[MD_ACME_LIMIT_ORDERS].burst = MD_ACME_LIMIT_ORDERS_DEF;
+    limit->buckets[MD_ACME_LIMIT_ORDERS].period = MD_ACME_LIMIT_PERIOD_DEF;
+    limit->buckets[MD_ACME_LIMIT_ACCOUNTS].burst = MD_ACME_LIMIT_ACCOUNTS_DEF;
+    limit->buckets[MD_ACME_LIMIT_ACCOUNTS].period = MD_ACME_LIMIT_PERIOD_DEF;
+    if (strcmp("*", argv[0])) {
+        if (APR_SUCCESS != md_get_ca_url_from_name(&url, cmd->pool, argv[0])) {
+            return url;
+        }
+        limit->ca_url = url;
+    }
+    for (i = 1; i < argc; ++i) {
+        val = argv[i];
+        if (!strncmp("orders=", val, sizeof("orders=") - 1)) {
+            val += sizeof("orders=") - 1;
+            err = set_ca_bucket(&limit->buckets[MD_ACME_LIMIT_ORDERS], val, cmd->pool);
+        }
+        else if (!strncmp("accounts=", val, sizeof("accounts=") - 1)) {
+            val += sizeof("accounts=") - 1;
+            err = set_ca_bucket(&limit->buckets[MD_ACME_LIMIT_ACCOUNTS], val, cmd->pool);
+        }
+        else {
+            err = apr_psprintf(cmd->pool, "unknown limit '%s', use 'orders=' or 'accounts='", 
+                               argv[i]);
+        }
+        if (err) return err;
+    }
+    APR_ARRAY_PUSH(config->mc->ca_limits, md_acme_limit_t *) = limit;
+    return NULL;
+}
+
 static const char *md_config_set_store_locks(cmd_parms *cmd, void *dc, const char *s)
 {
     md_srv_conf_t *config = md_config_get(cmd->server);
@@ -1016,11 +1148,11 @@ static const char *md_config_set_dns01_version(cmd_parms *cmd, void *mconfig, co
     if ((err = md_conf_check_location(cmd, MD_LOC_NOT_MD))) {
         return err;
     }
-    if (!strcmp("1", value) || !strcmp("2", value)) {
+    if (!strcmp("1", value) || !strcmp("2", value) || !strcmp("3", value)) {
         apr_table_set(sc->mc->env, MD_KEY_DNS01_VERSION, value);
     }
     else {
-        return "Only versions `1` and `2` are supported";
+        return "Only versions `1`, `2` and `3` are supported";
     }
     return NULL;
 }
@@ -1300,6 +1432,13 @@ const command_rec md_cmds[] = {
                   "Time length for first retry, doubled on every consecutive error."),
     AP_INIT_TAKE1("MDRetryFailover", md_config_set_retry_failover, NULL, RSRC_CONF,
                   "The number of errors before a failover to another CA is triggered."),
+    AP_INIT_TAKE1("MDRenewWorkers", md_config_set_renew_workers, NULL, RSRC_CONF,
+                  "The maximum number of managed domains renewed in parallel."),
+    AP_INIT_TAKE12("MDPrivateKeyPool", md_config_set_keypool, NULL, RSRC_CONF,
+                  "Number of private keys of each kind to generate ahead of renewals "
+                  "and the threads to use for it."),
+    AP_INIT_TAKE_ARGV("MDCARateLimit", md_config_set_ca_limit, NULL, RSRC_CONF,
+                  "Limit the rate of new orders/accounts at a CA, e.g. orders=300/3h."),
     AP_INIT_TAKE1("MDStoreLocks", md_config_set_store_locks, NULL, RSRC_CONF,
                   "Configure locking of store for updates."),
     AP_INIT_TAKE1("MDMatchNames", md_config_set_match_mode, NULL, RSRC_CONF,
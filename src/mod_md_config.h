@@ -77,11 +77,27 @@ struct md_mod_conf_t {
     const char *ca_certs;              /* root certificates to use for connections */
     apr_time_t min_delay;              /* minimum delay for retries */
     int retry_failover;                /* number of errors to trigger CA failover */
+    int renew_workers;                 /* max number of threads driving renewals in parallel */
+    apr_array_header_t *ca_limits;     /* md_acme_limit_t* configured per CA */
+    int keypool_depth;                 /* private keys to pre-generate per kind, 0 = off */
+    int keypool_workers;               /* max threads generating pool keys in parallel */
     int use_store_locks;               /* use locks when updating store */
     apr_time_t lock_wait_timeout;      /* fail after this time when unable to obtain lock */
     md_match_mode_t match_mode;        /* how dns names are match to vhosts */
+    md_domain_idx_t *domain_idx;       /* post config, index of the names of all mds */
+    struct md_http01_table_t *http01_table; /* post config, active http-01 challenges */
+    struct md_jobs_table_t *jobs_table; /* post config, renewal job states of all mds */
+    apr_array_header_t *mds_by_name;   /* post config, mds sorted by name for status */
 };
 
+/* Precomputed per server for each name of its assigned MDs */
+typedef struct md_host_conf_t {
+    const md_t *md;                    /* MD the name belongs to */
+    md_require_t require_https;        /* the MD's https: requirement */
+    const char *hsts_header;           /* HSTS header to add on https: requests or NULL */
+    const char *https_prefix;          /* "https://name" to redirect http: requests to */
+} md_host_conf_t;
+
 typedef struct md_srv_conf_t {
     const char *name;
     const server_rec *s;               /* server this config belongs to */
@@ -110,6 +126,7 @@ typedef struct md_srv_conf_t {
 
     md_t *current;                     /* md currently defined in <MDomainSet xxx> section */
     struct apr_array_header_t *assigned; /* post_config: MDs that apply to this server */
+    struct apr_hash_t *hosts;          /* post_config: lower case name -> md_host_conf_t* */
     int is_ssl;                        /* SSLEngine is enabled here */
 } md_srv_conf_t;
 
@@ -19,6 +19,8 @@
 #include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_date.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
 
 #include <httpd.h>
 #include <http_core.h>
@@ -34,6 +36,7 @@
 #include "md_event.h"
 #include "md_http.h"
 #include "md_json.h"
+#include "md_keypool.h"
 #include "md_status.h"
 #include "md_store.h"
 #include "md_store_fs.h"
@@ -50,6 +53,7 @@
 #include "mod_md_config.h"
 #include "mod_md_status.h"
 #include "mod_md_drive.h"
+#include "mod_md_jobs.h"
 
 /**************************************************************************************************/
 /* watchdog based impl. */
@@ -67,16 +71,27 @@ struct md_renew_ctx_t {
     ap_watchdog_t *watchdog;
     
     apr_array_header_t *jobs;
+    apr_array_header_t *queue;     /* min-heap of drive_entry_t, ordered by due time */
 };
 
+static apr_time_t next_run_default(void)
+{
+    /* we'd like to run at least twice a day by default */
+    return apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY / 2);
+}
+
 static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *ptemp)
 {
-    const md_t *md;
+    const md_t *md = NULL;
     md_result_t *result = NULL;
+    apr_time_t renew_at = 0;
     apr_status_t rv;
+    int was_finished;
     
-    md_job_load(job);
-    /* Evaluate again on loaded value. Values will change when watchdog switches child process */
+    /* Only reload when another process changed the job, e.g. after the watchdog
+     * switched child processes. */
+    md_job_load_if_changed(job, ptemp);
+    /* Evaluate again on loaded value. */
     if (apr_time_now() < job->next_run) return;
     
     job->next_run = 0;
@@ -108,9 +123,15 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
         ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10052) 
                      "md(%s): state=%d, driving", job->mdomain, md->state);
 
-        if (!md_reg_should_renew(dctx->mc->reg, md, dctx->p)) {
+        if (!md_reg_should_renew(dctx->mc->reg, md, ptemp)) {
             ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10053) 
                          "md(%s): no need to renew", job->mdomain);
+            /* The CA's renewal information may want us back before our next
+             * regular run. */
+            renew_at = md_reg_renew_at(dctx->mc->reg, md, ptemp);
+            if (renew_at > apr_time_now() && renew_at < next_run_default()) {
+                job->next_run = renew_at;
+            }
             goto expiry;
         }
     
@@ -124,11 +145,13 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
                 goto leave;
         }
 
+        was_finished = job->finished;
         md_job_start_run(job, result, md_reg_store_get(dctx->mc->reg));
         md_reg_renew(dctx->mc->reg, md, dctx->mc->env, 0, job->error_runs, result, ptemp);
         md_job_end_run(job, result);
         
         if (APR_SUCCESS == result->status) {
+            if (!was_finished) md_counter_inc(MD_CNT_RENEWALS);
             /* Finished jobs might take a while before the results become valid.
              * If that is in the future, request to run then */
             if (apr_time_now() < result->ready_at) {
@@ -141,7 +164,13 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
                 md_job_notify(job, "renewed", result);
             }
         }
+        else if (!strcmp(MD_ACME_PROBLEM_CA_LIMIT, result->problem? result->problem : "")) {
+            /* we held back ourself to stay within the CA's limits, not an error */
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, dctx->s, APLOGNO(10401)
+                         "%s: %s", job->mdomain, result->detail);
+        }
         else {
+            md_counter_inc(MD_CNT_RENEWAL_ERRORS);
             ap_log_error( APLOG_MARK, APLOG_ERR, result->status, dctx->s, APLOGNO(10056) 
                          "processing %s: %s", job->mdomain, result->detail);
             md_job_log_append(job, "renewal-error", result->problem, result->detail);
@@ -154,7 +183,7 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
     }
 
 expiry:
-    if (!job->finished && md_reg_should_warn(dctx->mc->reg, md, dctx->p)) {
+    if (!job->finished && md_reg_should_warn(dctx->mc->reg, md, ptemp)) {
         ap_log_error( APLOG_MARK, APLOG_TRACE1, 0, dctx->s,
                      "md(%s): warn about expiration", md->name);
         md_job_start_run(job, result, md_reg_store_get(dctx->mc->reg));
@@ -167,6 +196,10 @@ leave:
         rv = md_job_save(job, result, ptemp);
         ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, dctx->s, "%s: saving job props", job->mdomain);
     }
+    if (dctx->mc->jobs_table) {
+        if (md && !renew_at) renew_at = md_reg_renew_at(dctx->mc->reg, md, ptemp);
+        md_jobs_table_set(dctx->mc->jobs_table, job, renew_at);
+    }
 }
 
 int md_will_renew_cert(const md_t *md)
@@ -180,18 +213,161 @@ int md_will_renew_cert(const md_t *md)
     return 1;
 }
 
-static apr_time_t next_run_default(void)
+/* The drive jobs are kept in a binary min-heap on the time they are due next, so that
+ * a watchdog run only touches the jobs it processes and not all that exist. */
+typedef struct {
+    apr_time_t due;
+    md_job_t *job;
+} drive_entry_t;
+
+#define DRIVE_ENTRY(q, i)     APR_ARRAY_IDX((q), (i), drive_entry_t)
+
+static void queue_push(apr_array_header_t *queue, md_job_t *job, apr_time_t due)
 {
-    /* we'd like to run at least twice a day by default */
-    return apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY / 2);
+    drive_entry_t e, *parent;
+    int i, iparent;
+    
+    e.due = due;
+    e.job = job;
+    i = queue->nelts;
+    APR_ARRAY_PUSH(queue, drive_entry_t) = e;
+    while (i > 0) {
+        iparent = (i - 1) / 2;
+        parent = &DRIVE_ENTRY(queue, iparent);
+        if (parent->due <= e.due) break;
+        DRIVE_ENTRY(queue, i) = *parent;
+        i = iparent;
+    }
+    DRIVE_ENTRY(queue, i) = e;
+}
+
+static md_job_t *queue_pop(apr_array_header_t *queue)
+{
+    drive_entry_t e;
+    md_job_t *job;
+    int i, ichild, n;
+    
+    if (queue->nelts <= 0) return NULL;
+    job = DRIVE_ENTRY(queue, 0).job;
+    n = --queue->nelts;
+    if (n > 0) {
+        e = DRIVE_ENTRY(queue, n);
+        i = 0;
+        while ((ichild = 2 * i + 1) < n) {
+            if (ichild + 1 < n 
+                && DRIVE_ENTRY(queue, ichild + 1).due < DRIVE_ENTRY(queue, ichild).due) {
+                ++ichild;
+            }
+            if (e.due <= DRIVE_ENTRY(queue, ichild).due) break;
+            DRIVE_ENTRY(queue, i) = DRIVE_ENTRY(queue, ichild);
+            i = ichild;
+        }
+        DRIVE_ENTRY(queue, i) = e;
+    }
+    return job;
+}
+
+#if APR_HAS_THREADS
+
+/* Jobs due in a watchdog run, handed out to the workers one at a time. Each job
+ * is taken by exactly one worker, so a MD is never driven by two threads at once. */
+typedef struct {
+    md_renew_ctx_t *dctx;
+    apr_thread_mutex_t *mutex;
+    apr_array_header_t *due;
+    int next;
+} drive_queue_t;
+
+static md_job_t *drive_queue_next(drive_queue_t *q)
+{
+    md_job_t *job = NULL;
+    
+    apr_thread_mutex_lock(q->mutex);
+    if (q->next < q->due->nelts) {
+        job = APR_ARRAY_IDX(q->due, q->next++, md_job_t *);
+    }
+    apr_thread_mutex_unlock(q->mutex);
+    return job;
+}
+
+static void * APR_THREAD_FUNC drive_worker(apr_thread_t *thread, void *baton)
+{
+    drive_queue_t *q = baton;
+    apr_allocator_t *allocator;
+    apr_pool_t *ptemp;
+    md_job_t *job;
+    apr_status_t rv;
+    
+    /* workers run concurrently, each needs a pool with its own allocator */
+    apr_allocator_create(&allocator);
+    apr_allocator_max_free_set(allocator, 1);
+    rv = apr_pool_create_ex(&ptemp, NULL, NULL, allocator);
+    if (APR_SUCCESS != rv) {
+        apr_allocator_destroy(allocator);
+        goto leave;
+    }
+    apr_allocator_owner_set(allocator, ptemp);
+    apr_pool_tag(ptemp, "md_renew_worker");
+    
+    while ((job = drive_queue_next(q))) {
+        process_drive_job(q->dctx, job, ptemp);
+        apr_pool_clear(ptemp);
+    }
+    apr_pool_destroy(ptemp);
+leave:
+    apr_thread_exit(thread, rv);
+    return NULL;
+}
+
+static apr_status_t drive_parallel(md_renew_ctx_t *dctx, apr_array_header_t *due,
+                                   int nworkers, apr_pool_t *ptemp)
+{
+    drive_queue_t q;
+    apr_thread_t **threads;
+    apr_status_t rv, trv;
+    int i, started = 0;
+    
+    q.dctx = dctx;
+    q.due = due;
+    q.next = 0;
+    rv = apr_thread_mutex_create(&q.mutex, APR_THREAD_MUTEX_DEFAULT, ptemp);
+    if (APR_SUCCESS != rv) goto leave;
+    
+    threads = apr_pcalloc(ptemp, (apr_size_t)nworkers * sizeof(apr_thread_t *));
+    for (i = 0; i < nworkers; ++i) {
+        rv = apr_thread_create(&threads[i], NULL, drive_worker, &q, ptemp);
+        if (APR_SUCCESS != rv) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, dctx->s, APLOGNO(10399)
+                         "md watchdog: unable to start renew worker %d", i);
+            break;
+        }
+        ++started;
+    }
+    if (started) {
+        rv = APR_SUCCESS;
+        for (i = 0; i < started; ++i) {
+            apr_thread_join(&trv, threads[i]);
+        }
+    }
+    /* if no worker could be started, the caller drives the jobs itself */
+leave:
+    return rv;
 }
 
+#endif /* APR_HAS_THREADS */
+
 static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
 {
     md_renew_ctx_t *dctx = baton;
     md_job_t *job;
-    apr_time_t next_run, wait_time;
-    int i;
+    md_t *md;
+    md_keypool_t *keypool;
+    apr_array_header_t *due, *mds;
+    apr_time_t now, next_run, wait_time;
+    int i, driven = 0;
+#if APR_HAS_THREADS
+    int nworkers;
+#endif
     
     /* mod_watchdog invoked us as a single thread inside the whole server (on this machine).
      * This might be a repeated run inside the same child (mod_watchdog keeps affinity as
@@ -207,21 +383,49 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10055)
                          "md watchdog run, auto drive %d mds", dctx->jobs->nelts);
                          
-            /* Process all drive jobs. They will update their next_run property
-             * and we schedule ourself at the earliest of all. A job may specify 0
-             * as next_run to indicate that it wants to participate in the normal
-             * regular runs. */
+            /* Process all drive jobs that are due. They will update their next_run
+             * property and we schedule ourself at the earliest of all. A job may
+             * specify 0 as next_run to indicate that it wants to participate in
+             * the normal regular runs. */
+            now = apr_time_now();
+            due = apr_array_make(ptemp, 5, sizeof(md_job_t *));
+            while (dctx->queue->nelts > 0 && DRIVE_ENTRY(dctx->queue, 0).due <= now) {
+                APR_ARRAY_PUSH(due, md_job_t *) = queue_pop(dctx->queue);
+            }
+            
+            /* Refresh what the CAs tell us about the renewal of the due certificates,
+             * one batch of requests per CA, before looking at them one by one. */
+            mds = apr_array_make(ptemp, due->nelts, sizeof(md_t *));
+            for (i = 0; i < due->nelts; ++i) {
+                job = APR_ARRAY_IDX(due, i, md_job_t *);
+                md = md_get_by_name(dctx->mc->mds, job->mdomain);
+                if (md && md_will_renew_cert(md)) APR_ARRAY_PUSH(mds, md_t *) = md;
+            }
+            if (mds->nelts > 0) md_reg_ari_update(dctx->mc->reg, mds, ptemp);
+            
+            /* With more than one worker configured, due jobs are driven in parallel,
+             * so that a MD waiting on its CA does not hold up all others. */
+#if APR_HAS_THREADS
+            nworkers = (dctx->mc->renew_workers < due->nelts)? 
+                        dctx->mc->renew_workers : due->nelts;
+            driven = (nworkers > 1 && APR_SUCCESS == drive_parallel(dctx, due, nworkers, ptemp));
+#endif
             next_run = next_run_default();
-            for (i = 0; i < dctx->jobs->nelts; ++i) {
-                job = APR_ARRAY_IDX(dctx->jobs, i, md_job_t *);
-                
-                if (apr_time_now() >= job->next_run) {
-                    process_drive_job(dctx, job, ptemp);
-                }
-                
-                if (job->next_run && job->next_run < next_run) {
-                    next_run = job->next_run;
-                }
+            for (i = 0; i < due->nelts; ++i) {
+                job = APR_ARRAY_IDX(due, i, md_job_t *);
+                if (!driven) process_drive_job(dctx, job, ptemp);
+                queue_push(dctx->queue, job, job->next_run? job->next_run : next_run);
+            }
+            if (dctx->queue->nelts > 0 && DRIVE_ENTRY(dctx->queue, 0).due < next_run) {
+                next_run = DRIVE_ENTRY(dctx->queue, 0).due;
+            }
+            
+            /* Generate private keys for renewals to come, a few per run so that
+             * jobs due are not held up. Come back soon while keys are missing. */
+            keypool = md_reg_keypool_get(dctx->mc->reg);
+            if (md_keypool_is_enabled(keypool) && md_keypool_fill(keypool, ptemp) > 0
+                && next_run > apr_time_now() + MD_KEYPOOL_FILL_PAUSE) {
+                next_run = apr_time_now() + MD_KEYPOOL_FILL_PAUSE;
             }
 
             wait_time = next_run - apr_time_now();
@@ -245,11 +449,11 @@ apr_status_t md_renew_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_
 {
     apr_allocator_t *allocator;
     md_renew_ctx_t *dctx;
-    apr_pool_t *dctxp;
+    apr_pool_t *dctxp, *jobp;
     apr_status_t rv;
     md_t *md;
     md_job_t *job;
-    int i;
+    int i, j;
     
     /* We use mod_watchdog to run a single thread in one of the child processes
      * to monitor the MDs marked as watched, using the const data in the list
@@ -304,8 +508,30 @@ apr_status_t md_renew_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_
         md = APR_ARRAY_IDX(mc->mds, i, md_t*);
         if (!md || !md->watched) continue;
         
-        job = md_reg_job_make(mc->reg, md->name, p);
+        /* Jobs may be driven by different worker threads, give each its own
+         * pool and allocator for the data kept across runs. */
+        apr_allocator_create(&allocator);
+        apr_allocator_max_free_set(allocator, 1);
+        rv = apr_pool_create_ex(&jobp, dctxp, NULL, allocator);
+        if (rv != APR_SUCCESS) {
+            apr_allocator_destroy(allocator);
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10400) 
+                         "md(%s): create drive job pool", md->name);
+            apr_pool_destroy(dctx->p);
+            return rv;
+        }
+        apr_allocator_owner_set(allocator, jobp);
+        apr_pool_tag(jobp, "md_renew_job");
+        
+        job = md_reg_job_make(mc->reg, md->name, jobp);
         APR_ARRAY_PUSH(dctx->jobs, md_job_t*) = job;
+        
+        if (md_will_renew_cert(md) && (!md->ca_proto || !strcmp(MD_PROTO_ACME, md->ca_proto))) {
+            /* keep keys ready for the next renewal */
+            for (j = 0; j < md_pkeys_spec_count(md->pks); ++j) {
+                md_keypool_add_spec(md_reg_keypool_get(mc->reg), md_pkeys_spec_get(md->pks, j));
+            }
+        }
         ap_log_error( APLOG_MARK, APLOG_TRACE1, 0, dctx->s,  
                      "md(%s): state=%d, created drive job", md->name, md->state);
         
@@ -324,6 +550,13 @@ apr_status_t md_renew_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_
             md_store_purge(md_reg_store_get(dctx->mc->reg), p, MD_SG_CHALLENGES, md->name);
             job->error_runs = 0;
         }
+        md_jobs_table_set(mc->jobs_table, job, 0);
+    }
+
+    dctx->queue = apr_array_make(dctx->p, dctx->jobs->nelts, sizeof(drive_entry_t));
+    for (i = 0; i < dctx->jobs->nelts; ++i) {
+        job = APR_ARRAY_IDX(dctx->jobs, i, md_job_t *);
+        queue_push(dctx->queue, job, job->next_run);
     }
 
     if (!dctx->jobs->nelts) {
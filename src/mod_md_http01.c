@@ -0,0 +1,90 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+#include <assert.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include "md.h"
+#include "md_acme.h"
+#include "md_acme_authz.h"
+#include "md_http01.h"
+
+#include "mod_md.h"
+#include "mod_md_config.h"
+#include "mod_md_private.h"
+#include "mod_md_http01.h"
+
+struct md_http01_table_t {
+    apr_shm_t *shm;
+    md_http01_slots_t *slots;
+    server_rec *s;
+};
+
+static void http01_publish(void *baton, const char *domain, const char *key_authz, 
+                           apr_pool_t *p)
+{
+    md_http01_table_t *table = baton;
+    
+    if (APR_ENOSPC == md_http01_slots_set(table->slots, domain, key_authz, p) && key_authz) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, table->s, APLOGNO(10402)
+                     "http-01 challenge for %s does not fit the table, it is "
+                     "answered from the store", domain);
+    }
+}
+
+apr_status_t md_http01_table_create(md_http01_table_t **ptable, apr_pool_t *p, server_rec *s)
+{
+    md_http01_table_t *table;
+    apr_size_t size = md_http01_slots_size();
+    const char *fname;
+    apr_status_t rv;
+    
+    table = apr_pcalloc(p, sizeof(*table));
+    table->s = s;
+    rv = apr_shm_create(&table->shm, size, NULL, p);
+    if (APR_ENOTIMPL == rv) {
+        /* no anonymous shared memory on this platform. A file left behind
+         * by a crashed server would make the creation fail. */
+        fname = ap_runtime_dir_relative(p, "mod_md-http01.shm");
+        apr_shm_remove(fname, p);
+        rv = apr_shm_create(&table->shm, size, fname, p);
+    }
+    if (APR_SUCCESS != rv) goto leave;
+    rv = md_http01_slots_create(&table->slots, apr_shm_baseaddr_get(table->shm), p);
+    if (APR_SUCCESS != rv) goto leave;
+    md_acme_authz_set_http01_publish(http01_publish, table);
+leave:
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10403)
+                     "unable to create shared http-01 challenge table, "
+                     "challenges are answered from the store");
+        md_acme_authz_set_http01_publish(NULL, NULL);
+        table = NULL;
+    }
+    *ptable = table;
+    return rv;
+}
+
+const char *md_http01_table_get(md_http01_table_t *table, const char *host,
+                                const char *token, apr_pool_t *p)
+{
+    return table? md_http01_slots_get(table->slots, host, token, p) : NULL;
+}
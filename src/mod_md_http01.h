@@ -0,0 +1,38 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef mod_md_md_http01_h
+#define mod_md_md_http01_h
+
+typedef struct md_http01_table_t md_http01_table_t;
+
+/**
+ * Create the table of active http-01 challenges in shared memory, so that
+ * challenges set up by the renewal watchdog in one child can be answered
+ * by all children. Needs to be called in post_config, before children are
+ * started. Registers itself for challenges set up in md_acme_authz.
+ */
+apr_status_t md_http01_table_create(md_http01_table_t **ptable, apr_pool_t *p, server_rec *s);
+
+/**
+ * Get the content of the http-01 challenge for host with the given token,
+ * as it is in the store, allocated from the pool. Returns NULL when the
+ * table does not have it, the store might still.
+ */
+const char *md_http01_table_get(md_http01_table_t *table, const char *host,
+                                const char *token, apr_pool_t *p);
+
+#endif /* mod_md_md_http01_h */
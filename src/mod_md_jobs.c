@@ -0,0 +1,170 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+
+#include <assert.h>
+#include <apr_atomic.h>
+#include <apr_hash.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include "md.h"
+#include "md_json.h"
+#include "md_keypool.h"
+#include "md_result.h"
+#include "md_status.h"
+#include "md_util.h"
+
+#include "mod_md.h"
+#include "mod_md_config.h"
+#include "mod_md_private.h"
+#include "mod_md_jobs.h"
+
+#define JOB_KNOWN           0x01
+#define JOB_FINISHED        0x02
+/* A reader gives up on a slot that changes this many times while it copies it */
+#define JOB_READ_RETRIES    100
+
+/* A slot in shared memory, one for each MD. Only the job's watchdog worker
+ * writes it, readers retry when `seq` is odd or changed while they copied. */
+typedef struct {
+    volatile apr_uint32_t seq;
+    apr_uint32_t flags;
+    apr_int32_t error_runs;
+    apr_int32_t last_status;
+    apr_time_t next_run;
+    apr_time_t last_run;
+    apr_interval_time_t last_duration;
+    apr_time_t renew_at;
+} job_slot_t;
+
+/* Shared memory layout: the counters first, then one slot per MD */
+typedef struct {
+    volatile apr_uint32_t counters[MD_CNT_MAX];
+    volatile apr_uint32_t keypool[MD_KEYPOOL_KINDS_MAX];
+    job_slot_t slots[1];
+} jobs_shm_t;
+
+struct md_jobs_table_t {
+    apr_shm_t *shm;
+    struct md_keypool_t *keypool;
+    jobs_shm_t *data;
+    job_slot_t *slots;
+    apr_hash_t *slots_by_name;  /* MD name -> job_slot_t*, readonly in children */
+};
+
+static apr_status_t counters_detach(void *data)
+{
+    md_jobs_table_t *table = data;
+    
+    /* the shared memory goes away with the pool, count locally again */
+    md_counters_use(NULL);
+    if (table->keypool) md_keypool_use_counts(table->keypool, NULL);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_jobs_table_create(md_jobs_table_t **ptable, apr_array_header_t *mds,
+                                  struct md_keypool_t *keypool, apr_pool_t *p, server_rec *s)
+{
+    md_jobs_table_t *table;
+    const md_t *md;
+    apr_size_t size;
+    apr_status_t rv;
+    int i;
+    
+    table = apr_pcalloc(p, sizeof(*table));
+    size = sizeof(jobs_shm_t) 
+           + (apr_size_t)(mds->nelts > 1? mds->nelts - 1 : 0) * sizeof(job_slot_t);
+    rv = apr_shm_create(&table->shm, size, NULL, p);
+    if (APR_ENOTIMPL == rv) {
+        /* no anonymous shared memory on this platform */
+        rv = apr_shm_create(&table->shm, size, 
+                            ap_runtime_dir_relative(p, "mod_md-jobs.shm"), p);
+    }
+    if (APR_SUCCESS != rv) goto leave;
+    table->data = apr_shm_baseaddr_get(table->shm);
+    memset(table->data, 0, size);
+    table->slots = table->data->slots;
+    table->slots_by_name = apr_hash_make(p);
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, const md_t*);
+        apr_hash_set(table->slots_by_name, md->name, APR_HASH_KEY_STRING, &table->slots[i]);
+    }
+    md_counters_use(table->data->counters);
+    if (keypool) {
+        table->keypool = keypool;
+        md_keypool_use_counts(keypool, table->data->keypool);
+    }
+    apr_pool_cleanup_register(p, table, counters_detach, apr_pool_cleanup_null);
+leave:
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10404)
+                     "unable to create shared renewal job table, "
+                     "status is read from the store");
+        table = NULL;
+    }
+    *ptable = table;
+    return rv;
+}
+
+static job_slot_t *slot_get(md_jobs_table_t *table, const char *name)
+{
+    return table? apr_hash_get(table->slots_by_name, name, APR_HASH_KEY_STRING) : NULL;
+}
+
+void md_jobs_table_set(md_jobs_table_t *table, const md_job_t *job, apr_time_t renew_at)
+{
+    job_slot_t *slot;
+    
+    if (!(slot = slot_get(table, job->mdomain))) return;
+    apr_atomic_inc32(&slot->seq);
+    slot->flags = JOB_KNOWN | (job->finished? JOB_FINISHED : 0);
+    slot->error_runs = job->error_runs;
+    slot->last_status = job->last_result? (apr_int32_t)job->last_result->status : APR_SUCCESS;
+    slot->next_run = job->next_run;
+    slot->last_run = job->last_run;
+    slot->last_duration = job->last_duration;
+    if (renew_at) slot->renew_at = renew_at;
+    apr_atomic_inc32(&slot->seq);
+}
+
+int md_jobs_table_get(md_jobs_table_t *table, const char *name, md_job_state_t *state)
+{
+    job_slot_t *slot, copy;
+    apr_uint32_t seq;
+    int retries = 0;
+    
+    if (!(slot = slot_get(table, name))) return 0;
+    do {
+        if (++retries > JOB_READ_RETRIES) return 0;
+        seq = apr_atomic_read32(&slot->seq);
+        memcpy(&copy, slot, sizeof(copy));
+    } while ((seq & 1) || seq != apr_atomic_read32(&slot->seq));
+    
+    if (!(copy.flags & JOB_KNOWN)) return 0;
+    state->finished = (copy.flags & JOB_FINISHED) != 0;
+    state->error_runs = copy.error_runs;
+    state->last_status = copy.last_status;
+    state->next_run = copy.next_run;
+    state->last_run = copy.last_run;
+    state->last_duration = copy.last_duration;
+    state->renew_at = copy.renew_at;
+    return 1;
+}
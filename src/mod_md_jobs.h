@@ -0,0 +1,60 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef mod_md_md_jobs_h
+#define mod_md_md_jobs_h
+
+struct md_job_t;
+struct md_keypool_t;
+
+typedef struct md_jobs_table_t md_jobs_table_t;
+
+/* What the renewal watchdog last knew about the job of a MD */
+typedef struct md_job_state_t {
+    int finished;                      /* job finished successfully */
+    int error_runs;                    /* number of errored runs */
+    apr_status_t last_status;          /* status of the last run */
+    apr_time_t next_run;               /* when the job runs next, 0 if not planned */
+    apr_time_t last_run;               /* when the job ran last, 0 if never */
+    apr_interval_time_t last_duration; /* how long the last run took */
+    apr_time_t renew_at;               /* when the MD needs renewal, 0 if not known */
+} md_job_state_t;
+
+/**
+ * Create the table of renewal job states in shared memory for the given mds, 
+ * so that the renewal watchdog in one child can make them known to all. 
+ * The table also holds the counters (see md_counter_inc()) of all processes
+ * and the number of keys in the keypool.
+ * Needs to be called in post_config, before children are started.
+ */
+apr_status_t md_jobs_table_create(md_jobs_table_t **ptable, apr_array_header_t *mds,
+                                  struct md_keypool_t *keypool, apr_pool_t *p, server_rec *s);
+
+/**
+ * Update the state of the job's MD in the table. A renew_at of 0 keeps
+ * what the table has. Different jobs may be updated in parallel, a single
+ * job only by one thread at a time.
+ */
+void md_jobs_table_set(md_jobs_table_t *table, const struct md_job_t *job, 
+                       apr_time_t renew_at);
+
+/**
+ * Get the last known state of the MD's job. Returns 0 when the table
+ * has nothing on it or its slot could not be read while it was changing.
+ */
+int md_jobs_table_get(md_jobs_table_t *table, const char *name, md_job_state_t *state);
+
+#endif /* mod_md_md_jobs_h */
@@ -58,14 +58,32 @@ int md_ocsp_prime_status(server_rec *s, apr_pool_t *p,
 {
     md_srv_conf_t *sc;
     const md_t *md;
+    const md_pubcert_t *pubcert;
     apr_array_header_t *chain;
     apr_status_t rv = APR_ENOENT;
+    int i;
 
     sc = md_config_get(s);
     if (!staple_here(sc)) goto cleanup;
 
     md = ((sc->assigned && sc->assigned->nelts == 1)?
           APR_ARRAY_IDX(sc->assigned, 0, const md_t*) : NULL);
+    if (md && sc->mc->reg) {
+        /* The id is the sha1 of the certificate, if it is one of the md's,
+         * all that is needed is already known without parsing the PEM. */
+        for (i = 0; i < md_cert_count(md); ++i) {
+            if (APR_SUCCESS != md_reg_get_pubcert(&pubcert, sc->mc->reg, md, i, p)) continue;
+            if (pubcert->info->ocsp_id->len == id_len
+                && !memcmp(pubcert->info->ocsp_id->data, id, id_len)) {
+                /* without the issuer in the store, the PEM data has to provide it */
+                if (!pubcert->info->ocsp_certid) break;
+                rv = md_ocsp_prime_info(sc->mc->ocsp, id, id_len, pubcert->info, md);
+                ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, s, "init stapling for: %s, "
+                             "from certificate info", md->name);
+                goto cleanup;
+            }
+        }
+    }
     chain = apr_array_make(p, 5, sizeof(md_cert_t*));
     rv = md_cert_read_chain(chain, p, pem, strlen(pem));
     if (APR_SUCCESS != rv) {
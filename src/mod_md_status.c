@@ -19,6 +19,7 @@
 #include <apr_time.h>
 #include <apr_date.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
 #include <httpd.h>
 #include <http_core.h>
@@ -34,11 +35,13 @@
 #include "md_http.h"
 #include "md_ocsp.h"
 #include "md_json.h"
+#include "md_keypool.h"
 #include "md_status.h"
 #include "md_store.h"
 #include "md_store_fs.h"
 #include "md_log.h"
 #include "md_reg.h"
+#include "md_result.h"
 #include "md_util.h"
 #include "md_version.h"
 #include "md_acme.h"
@@ -48,6 +51,7 @@
 #include "mod_md_private.h"
 #include "mod_md_config.h"
 #include "mod_md_drive.h"
+#include "mod_md_jobs.h"
 #include "mod_md_status.h"
 
 /**************************************************************************************************/
@@ -57,44 +61,106 @@
 #define MD_STATUS_RESOURCE          APACHE_PREFIX"certificate-status"
 #define HTML_STATUS(X)              (!((X)->flags & AP_STATUS_SHORT))
 
-int md_http_cert_status(request_rec *r)
-{
-    int i;
-    md_json_t *resp, *mdj, *cj;
-    const md_srv_conf_t *sc;
-    const md_t *md;
-    md_pkey_spec_t *spec;
-    const char *keyname;
-    apr_bucket_brigade *bb;
-    apr_status_t rv;
+/* Responses already sent by this child, per MD and format. A response is
+ * sent again as long as the staging files it was made from are unchanged
+ * and the MD has not reached its renewal time since. The live certificates
+ * only change with a restart and thus with new child processes. */
+typedef struct {
+    const char *stamp;
+    apr_time_t expires;
+    const char *etag;
+    const char *body;
+    apr_size_t body_len;
+} cert_status_t;
 
-    if (!r->parsed_uri.path || strcmp(MD_STATUS_RESOURCE, r->parsed_uri.path))
-        return DECLINED;
+static apr_hash_t *cert_status_cache;   /* "name format" -> cert_status_t* */
+static apr_thread_mutex_t *cert_status_mutex;
 
-    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
-                  "requesting status for: %s", r->hostname);
+void md_status_child_init(apr_pool_t *pchild)
+{
+    if (APR_SUCCESS == apr_thread_mutex_create(&cert_status_mutex, 
+                                               APR_THREAD_MUTEX_DEFAULT, pchild)) {
+        cert_status_cache = apr_hash_make(pchild);
+    }
+}
 
-    /* We are looking for information about a staged certificate */
-    sc = ap_get_module_config(r->server->module_config, &md_module);
-    if (!sc || !sc->mc || !sc->mc->reg || !sc->mc->certificate_status_enabled) return DECLINED;
-    md = md_get_by_domain(sc->mc->mds, r->hostname);
-    if (!md) return DECLINED;
+/* The modification times of everything besides the live certificates that 
+ * the status of an MD is made from */
+static const char *cert_status_stamp(const md_t *md, md_reg_t *reg, apr_pool_t *p)
+{
+    md_store_t *store = md_reg_store_get(reg);
+    const char *stamp, *fname;
+    int i;
 
-    if (r->method_number != M_GET) {
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
-                      "md(%s): status supports only GET", md->name);
-        return HTTP_NOT_IMPLEMENTED;
+    stamp = apr_psprintf(p, "%" APR_TIME_T_FMT " %" APR_TIME_T_FMT,
+        md_store_get_modified(store, MD_SG_STAGING, md->name, MD_FN_JOB, p),
+        md_store_get_modified(store, MD_SG_STAGING, md->name, MD_FN_RENEWAL_INFO, p));
+    for (i = 0; i < md_pkeys_spec_count(md->pks); ++i) {
+        fname = md_chain_filename(md_pkeys_spec_get(md->pks, i), p);
+        stamp = apr_psprintf(p, "%s %" APR_TIME_T_FMT, stamp,
+                             md_store_get_modified(store, MD_SG_STAGING, md->name, fname, p));
     }
+    return stamp;
+}
 
-    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
-                  "requesting status for MD: %s", md->name);
+static const cert_status_t *cert_status_get(const char *key, const char *stamp, 
+                                            apr_pool_t *p)
+{
+    cert_status_t *e, *status = NULL;
+
+    if (!cert_status_cache) return NULL;
+    apr_thread_mutex_lock(cert_status_mutex);
+    e = apr_hash_get(cert_status_cache, key, APR_HASH_KEY_STRING);
+    if (e && !strcmp(stamp, e->stamp) && (!e->expires || apr_time_now() < e->expires)) {
+        status = apr_pmemdup(p, e, sizeof(*e));
+        status->etag = apr_pstrdup(p, e->etag);
+        status->body = apr_pstrmemdup(p, e->body, e->body_len);
+        status->stamp = NULL;
+    }
+    apr_thread_mutex_unlock(cert_status_mutex);
+    return status;
+}
 
-    rv = md_status_get_md_json(&mdj, md, sc->mc->reg, sc->mc->ocsp, r->pool);
-    if (APR_SUCCESS != rv) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10204)
-                      "loading md status for %s", md->name);
-        return HTTP_INTERNAL_SERVER_ERROR;
-    }
+static void cert_status_put(const char *key, const cert_status_t *status)
+{
+    apr_size_t klen = strlen(key) + 1, slen = strlen(status->stamp) + 1;
+    apr_size_t elen = strlen(status->etag) + 1;
+    cert_status_t *e, *old;
+    char *s;
+
+    if (!cert_status_cache) return;
+    /* one allocation, freed on replacement */
+    if (!(e = malloc(sizeof(*e) + klen + slen + elen + status->body_len))) return;
+    s = (char*)(e + 1);
+    *e = *status;
+    e->stamp = memcpy(s, status->stamp, slen);
+    e->etag = memcpy(s + slen, status->etag, elen);
+    e->body = memcpy(s + slen + elen, status->body, status->body_len);
+    key = memcpy(s + slen + elen + status->body_len, key, klen);
+
+    apr_thread_mutex_lock(cert_status_mutex);
+    old = apr_hash_get(cert_status_cache, key, APR_HASH_KEY_STRING);
+    /* a replaced entry keeps its key, which lives in the old allocation */
+    if (old) apr_hash_set(cert_status_cache, key, APR_HASH_KEY_STRING, NULL);
+    apr_hash_set(cert_status_cache, key, APR_HASH_KEY_STRING, e);
+    apr_thread_mutex_unlock(cert_status_mutex);
+    if (old) free(old);
+}
+
+static apr_status_t cert_status_make(cert_status_t *status, const md_t *md, md_reg_t *reg,
+                                     md_json_fmt_t fmt, request_rec *r)
+{
+    int i;
+    md_json_t *resp, *mdj, *cj;
+    md_pkey_spec_t *spec;
+    const char *keyname;
+    md_data_t data;
+    apr_time_t renew_at;
+    apr_status_t rv;
+
+    /* OCSP information is not part of the public status, leave it out */
+    rv = md_status_get_md_json(&mdj, md, reg, NULL, r->pool);
+    if (APR_SUCCESS != rv) goto leave;
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
                   "status for MD: %s is %s", md->name, md_json_writep(mdj, r->pool, MD_JSON_FMT_INDENT));
@@ -135,10 +201,91 @@ int md_http_cert_status(request_rec *r)
            md_json_setj(cj, resp, MD_KEY_RENEWAL, MD_KEY_CERT, NULL);
      }
 
-    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "md[%s]: sending status", md->name);
-    apr_table_set(r->headers_out, "Content-Type", "application/json");
+    status->body = md_json_writep(resp, r->pool, fmt);
+    if (!status->body) {
+        rv = APR_EINVAL;
+        goto leave;
+    }
+    status->body_len = strlen(status->body);
+    md_data_init(&data, status->body, status->body_len);
+    rv = md_crypt_sha256_digest64(&status->etag, r->pool, &data);
+    if (APR_SUCCESS != rv) goto leave;
+    status->etag = apr_pstrcat(r->pool, "\"", status->etag, "\"", NULL);
+    /* not renewing, the status changes when the renewal time is reached */
+    renew_at = md_json_get_time(mdj, MD_KEY_RENEW_AT, NULL);
+    status->expires = md_json_getb(mdj, MD_KEY_RENEW, NULL)? 0 : renew_at;
+leave:
+    return rv;
+}
+
+int md_http_cert_status(request_rec *r)
+{
+    const md_srv_conf_t *sc;
+    const md_t *md;
+    const cert_status_t *cached;
+    cert_status_t status;
+    md_json_fmt_t fmt;
+    const char *key;
+    apr_bucket_brigade *bb;
+    apr_status_t rv;
+
+    if (!r->parsed_uri.path || strcmp(MD_STATUS_RESOURCE, r->parsed_uri.path))
+        return DECLINED;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "requesting status for: %s", r->hostname);
+
+    /* We are looking for information about a staged certificate */
+    sc = ap_get_module_config(r->server->module_config, &md_module);
+    if (!sc || !sc->mc || !sc->mc->reg || !sc->mc->certificate_status_enabled) return DECLINED;
+    md = sc->mc->domain_idx? md_domain_idx_get(sc->mc->domain_idx, r->hostname)
+                           : md_get_by_domain(sc->mc->mds, r->hostname);
+    if (!md) return DECLINED;
+
+    if (r->method_number != M_GET) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "md(%s): status supports only GET", md->name);
+        return HTTP_NOT_IMPLEMENTED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "requesting status for MD: %s", md->name);
+
+    fmt = (r->parsed_uri.query && !strcmp("compact", r->parsed_uri.query))?
+          MD_JSON_FMT_COMPACT : MD_JSON_FMT_INDENT;
+    key = apr_pstrcat(r->pool, md->name, (fmt == MD_JSON_FMT_COMPACT)? " compact" : " indent", NULL);
+    memset(&status, 0, sizeof(status));
+    status.stamp = cert_status_stamp(md, sc->mc->reg, r->pool);
+    if ((cached = cert_status_get(key, status.stamp, r->pool))) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "md[%s]: status unchanged", md->name);
+        status.etag = cached->etag;
+        status.body = cached->body;
+        status.body_len = cached->body_len;
+    }
+    else {
+        rv = cert_status_make(&status, md, sc->mc->reg, fmt, r);
+        if (APR_SUCCESS != rv) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10204)
+                          "loading md status for %s", md->name);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        cert_status_put(key, &status);
+    }
+
+    apr_table_setn(r->headers_out, "ETag", status.etag);
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
     bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
-    md_json_writeb(resp, MD_JSON_FMT_INDENT, bb);
+    if (HTTP_NOT_MODIFIED == ap_meets_conditions(r)) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "md[%s]: status not modified", md->name);
+        r->status = HTTP_NOT_MODIFIED;
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    }
+    else {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "md[%s]: sending status", md->name);
+        apr_table_set(r->headers_out, "Content-Type", "application/json");
+        apr_brigade_write(bb, NULL, NULL, status.body, status.body_len);
+    }
     ap_pass_brigade(r->output_filters, bb);
     apr_brigade_cleanup(bb);
 
@@ -237,7 +384,7 @@ static void print_date(status_ctx *ctx, apr_time_t timestamp, const char *title)
         if (HTML_STATUS(ctx)) {
             apr_brigade_printf(bb, NULL, NULL,
                                "<span title='%s' style='white-space: nowrap;'>%s</span>",
-                               ap_escape_html2(bb->p, title, 1), ts);
+                               ap_escape_html2(ctx->p, title, 1), ts);
         }
         else {
             apr_brigade_printf(bb, NULL, NULL, "%s%s: %s\n",
@@ -285,7 +432,7 @@ static void print_time(status_ctx *ctx, const char *label, apr_time_t t)
         }
         else {
             apr_brigade_printf(bb, NULL, NULL, "%s%s<span title='%s'>%s%s%s</span>",
-                               label, sep, ts, pre, md_duration_roughly(bb->p, delta), post);
+                               label, sep, ts, pre, md_duration_roughly(ctx->p, delta), post);
         }
     }
     else {
@@ -447,7 +594,7 @@ static void print_job_summary(status_ctx *ctx, md_json_t *mdj, const char *key,
         char *errstr = apr_strerror(rv, buffer, sizeof(buffer));
         s = md_json_gets(mdj, key, MD_KEY_LAST, MD_KEY_PROBLEM, NULL);
         if (HTML_STATUS(ctx)) {
-            line = apr_psprintf(bb->p, "%s Error[%s]: %s", line,
+            line = apr_psprintf(ctx->p, "%s Error[%s]: %s", line,
                                 errstr, s? s : "");
         }
         else {
@@ -465,11 +612,11 @@ static void print_job_summary(status_ctx *ctx, md_json_t *mdj, const char *key,
         md_json_iterkey(count_certs, &cert_count, mdj, key, MD_KEY_CERT, NULL);
         if (HTML_STATUS(ctx)) {
             if (cert_count > 0) {
-                line =apr_psprintf(bb->p, "%s  finished, %d new certificate%s staged.",
+                line =apr_psprintf(ctx->p, "%s  finished, %d new certificate%s staged.",
                                    line, cert_count, cert_count > 1? "s" : "");
             }
             else {
-                line = apr_psprintf(bb->p, "%s  finished successfully.", line);
+                line = apr_psprintf(ctx->p, "%s  finished successfully.", line);
             }
         }
         else {
@@ -480,7 +627,7 @@ static void print_job_summary(status_ctx *ctx, md_json_t *mdj, const char *key,
         s = md_json_gets(mdj, key, MD_KEY_LAST, MD_KEY_DETAIL, NULL);
         if (s) {
             if (HTML_STATUS(ctx)) {
-                line = apr_psprintf(bb->p, "%s %s", line, s);
+                line = apr_psprintf(ctx->p, "%s %s", line, s);
             }
             else {
                 apr_brigade_printf(bb, NULL, NULL, "%sLastDetail: %s\n", ctx->prefix, s);
@@ -491,7 +638,7 @@ static void print_job_summary(status_ctx *ctx, md_json_t *mdj, const char *key,
     errors = (int)md_json_getl(mdj, MD_KEY_ERRORS, NULL);
     if (errors > 0) {
         if (HTML_STATUS(ctx)) {
-            line = apr_psprintf(bb->p, "%s (%d retr%s) ", line,
+            line = apr_psprintf(ctx->p, "%s (%d retr%s) ", line,
                                 errors, (errors > 1)? "y" : "ies");
         }
         else {
@@ -741,20 +888,211 @@ static int md_name_cmp(const void *v1, const void *v2)
     return strcmp((*(const md_t**)v1)->name, (*(const md_t**)v2)->name);
 }
 
+apr_array_header_t *md_status_sort_mds(apr_array_header_t *mds, apr_pool_t *p)
+{
+    apr_array_header_t *sorted = apr_array_copy(p, mds);
+
+    qsort(sorted->elts, (size_t)sorted->nelts, sizeof(md_t *), md_name_cmp);
+    return sorted;
+}
+
+static int count_pooled(void *baton, const char *key, md_json_t *json)
+{
+    int *pcount = baton;
+    (void)key;
+    *pcount += (int)md_json_getl(json, NULL);
+    return 1;
+}
+
+/* Which managed domains to show, from the server-status query arguments:
+ *   md-state=good|expired|incomplete|error|missing
+ *   md-errored                    only those with failed renewals
+ *   md-expiring-before=<duration> e.g. "30d"
+ *   md-ca=<CA name>               as shown in the CA column
+ *   md-offset=<n>, md-limit=<n>   page of the matching ones
+ */
+typedef struct {
+    const char *state;
+    int errored;
+    apr_time_t expiring_before;
+    const char *ca;
+    int offset;
+    int limit;                  /* -1 for no limit */
+} md_filter_t;
+
+static void md_filter_parse(md_filter_t *filter, request_rec *r)
+{
+    char *args, *arg, *val, *last;
+    apr_interval_time_t duration;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->limit = -1;
+    if (!r->args) return;
+
+    args = apr_pstrdup(r->pool, r->args);
+    for (arg = apr_strtok(args, "&;", &last); arg; arg = apr_strtok(NULL, "&;", &last)) {
+        if ((val = strchr(arg, '='))) {
+            *val++ = '\0';
+            ap_unescape_url(val);
+        }
+        if (strncmp("md-", arg, 3)) continue;
+        arg += 3;
+        if (!strcmp("errored", arg)) {
+            /* "md-errored" alone selects, "md-errored=0" does not */
+            filter->errored = !val || strcmp("0", val);
+        }
+        else if (!val || !*val) {
+            continue;
+        }
+        else if (!strcmp("state", arg)) {
+            filter->state = val;
+        }
+        else if (!strcmp("expiring-before", arg)) {
+            if (APR_SUCCESS == md_duration_parse(&duration, val, "d")) {
+                filter->expiring_before = apr_time_now() + duration;
+            }
+        }
+        else if (!strcmp("ca", arg)) {
+            filter->ca = val;
+        }
+        else if (!strcmp("offset", arg)) {
+            filter->offset = atoi(val) > 0? atoi(val) : 0;
+        }
+        else if (!strcmp("limit", arg)) {
+            filter->limit = atoi(val) >= 0? atoi(val) : -1;
+        }
+    }
+}
+
+/* What is needed of a MD to count and filter it, without building its status */
+typedef struct {
+    const md_t *md;
+    const char *state;
+    apr_time_t valid_until;
+    apr_time_t renew_at;
+    int renewing;
+    int errored;
+    int ready;
+} md_row_t;
+
+static const char *md_state_label(const md_t *md, apr_time_t valid_until)
+{
+    switch (md->state) {
+        case MD_S_INCOMPLETE: return "incomplete";
+        case MD_S_EXPIRED_DEPRECATED:
+        case MD_S_COMPLETE:
+            return (valid_until && valid_until <= apr_time_now())? "expired" : "good";
+        case MD_S_ERROR: return "error";
+        case MD_S_MISSING_INFORMATION: return "missing";
+        default: return "unknown";
+    }
+}
+
+static void md_row_init(md_row_t *row, const md_t *md, const md_mod_conf_t *mc, 
+                        apr_pool_t *p)
+{
+    md_job_state_t js;
+    md_job_t *job;
+    int known;
+
+    memset(row, 0, sizeof(*row));
+    row->md = md;
+    row->valid_until = md_reg_valid_until(mc->reg, md, p);
+    row->state = md_state_label(md, row->valid_until);
+
+    /* the watchdog keeps the job states in shared memory, the store has
+     * them when there is no table or it does not know the MD yet. */
+    known = md_jobs_table_get(mc->jobs_table, md->name, &js);
+    row->renew_at = (known && js.renew_at)? js.renew_at : md_reg_renew_at(mc->reg, md, p);
+    switch (md->state) {
+        case MD_S_COMPLETE:
+        case MD_S_INCOMPLETE:
+            row->renewing = row->renew_at && (row->renew_at <= apr_time_now());
+            if (!row->renewing) break;
+            if (!known) {
+                job = md_reg_job_make(mc->reg, md->name, p);
+                if (APR_SUCCESS != md_job_load(job)) break;
+                js.finished = job->finished;
+                js.error_runs = job->error_runs;
+                js.last_status = job->last_result? job->last_result->status : APR_SUCCESS;
+            }
+            if (js.error_runs > 0 || js.last_status != APR_SUCCESS) {
+                row->errored = 1;
+            }
+            else if (js.finished) {
+                row->ready = 1;
+            }
+            break;
+        default: 
+            row->errored = 1; 
+            break;
+    }
+}
+
+static int md_row_matches(const md_row_t *row, const md_filter_t *filter, apr_pool_t *p)
+{
+    const md_t *md = row->md;
+    const char *url;
+    int i;
+
+    if (filter->state && strcmp(filter->state, row->state)) return 0;
+    if (filter->errored && !row->errored) return 0;
+    if (filter->expiring_before 
+        && (!row->valid_until || row->valid_until >= filter->expiring_before)) return 0;
+    if (filter->ca) {
+        if (md->ca_proto && !strcmp("tailscale", md->ca_proto)) {
+            return !apr_strnatcasecmp(filter->ca, "tailscale");
+        }
+        if (md->ca_effective) {
+            return !apr_strnatcasecmp(filter->ca, md_get_ca_name_from_url(p, md->ca_effective));
+        }
+        for (i = 0; md->ca_urls && i < md->ca_urls->nelts; ++i) {
+            url = APR_ARRAY_IDX(md->ca_urls, i, const char*);
+            if (!apr_strnatcasecmp(filter->ca, md_get_ca_name_from_url(p, url))) return 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/* link to the page of the status starting at offset, keeping the other arguments */
+static void add_page_link(status_ctx *ctx, request_rec *r, int offset, const char *label)
+{
+    char *args, *arg, *last;
+    const char *query = "";
+
+    if (r->args) {
+        args = apr_pstrdup(ctx->p, r->args);
+        for (arg = apr_strtok(args, "&;", &last); arg; arg = apr_strtok(NULL, "&;", &last)) {
+            if (!strncmp("md-offset=", arg, 10)) continue;
+            query = apr_pstrcat(ctx->p, query, arg, "&", NULL);
+        }
+    }
+    apr_brigade_printf(ctx->bb, NULL, NULL, " <a href=\"?%smd-offset=%d\">%s</a>",
+                       ap_escape_html2(ctx->p, query, 1), offset, label);
+}
+
+#define STATUS_ROWS_PER_PASS    100
+
 int md_domains_status_hook(request_rec *r, int flags)
 {
     const md_srv_conf_t *sc;
     const md_mod_conf_t *mc;
-    int i;
+    int i, matched, shown;
     status_ctx ctx;
     apr_array_header_t *mds;
-    md_json_t *jstatus, *jstock;
+    apr_pool_t *ptemp;
+    md_filter_t filter;
+    md_row_t row, *rows = NULL, *prow;
+    md_json_t *mdj;
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "server-status for managed domains, start");
     sc = ap_get_module_config(r->server->module_config, &md_module);
     if (!sc) return DECLINED;
     mc = sc->mc;
     if (!mc || !mc->server_status_enabled) return DECLINED;
+    if (APR_SUCCESS != apr_pool_create(&ptemp, r->pool)) return DECLINED;
+    apr_pool_tag(ptemp, "md_status_row");
 
     ctx.p = r->pool;
     ctx.mc = mc;
@@ -763,30 +1101,38 @@ int md_domains_status_hook(request_rec *r, int flags)
     ctx.prefix = "ManagedCertificates";
     ctx.separator = " ";
 
-    mds = apr_array_copy(r->pool, mc->mds);
-    qsort(mds->elts, (size_t)mds->nelts, sizeof(md_t *), md_name_cmp);
+    /* sorted once at startup, rows are generated one after the other */
+    mds = mc->mds_by_name? mc->mds_by_name : md_status_sort_mds(mc->mds, r->pool);
+    md_filter_parse(&filter, r);
 
     if (!HTML_STATUS(&ctx)) {
         int total = 0, complete = 0, renewing = 0, errored = 0, ready = 0;
         ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "no-html managed domain status summary");
-        if (mc->mds->nelts > 0) {
-            md_status_take_stock(&jstock, mds, mc->reg, r->pool);
-            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "got JSON managed domain status summary");
-            total = (int)md_json_getl(jstock, MD_KEY_TOTAL, NULL);
-            complete = (int)md_json_getl(jstock, MD_KEY_COMPLETE, NULL);
-            renewing = (int)md_json_getl(jstock, MD_KEY_RENEWING, NULL);
-            errored = (int)md_json_getl(jstock, MD_KEY_ERRORED, NULL);
-            ready = (int)md_json_getl(jstock, MD_KEY_READY, NULL);
+        /* the rows are kept for the listing below, they are small */
+        rows = apr_pcalloc(r->pool, (apr_size_t)(mds->nelts > 0? mds->nelts : 1) * sizeof(*rows));
+        for (i = 0; i < mds->nelts; ++i) {
+            prow = &rows[i];
+            md_row_init(prow, APR_ARRAY_IDX(mds, i, const md_t*), mc, ptemp);
+            ++total;
+            if (prow->md->state == MD_S_COMPLETE) ++complete;
+            if (prow->renewing) ++renewing;
+            if (prow->errored) ++errored;
+            if (prow->ready) ++ready;
+            apr_pool_clear(ptemp);
         }
         apr_brigade_printf(ctx.bb, NULL, NULL, "%sTotal: %d\n", ctx.prefix, total);
         apr_brigade_printf(ctx.bb, NULL, NULL, "%sOK: %d\n", ctx.prefix, complete);
         apr_brigade_printf(ctx.bb, NULL, NULL, "%sRenew: %d\n", ctx.prefix, renewing);
         apr_brigade_printf(ctx.bb, NULL, NULL, "%sErrored: %d\n", ctx.prefix, errored);
         apr_brigade_printf(ctx.bb, NULL, NULL, "%sReady: %d\n", ctx.prefix, ready);
+        if (md_keypool_is_enabled(md_reg_keypool_get(mc->reg))) {
+            md_json_t *jpool = md_keypool_status(md_reg_keypool_get(mc->reg), r->pool);
+            int pooled = 0;
+            md_json_iterkey(count_pooled, &pooled, jpool, MD_KEY_KEYS, NULL);
+            apr_brigade_printf(ctx.bb, NULL, NULL, "%sKeyPool: %d\n", ctx.prefix, pooled);
+        }
     }
-    if (mc->mds->nelts > 0) {
-        md_status_get_json(&jstatus, mds, mc->reg, mc->ocsp, r->pool);
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "got JSON managed domain status");
+    if (mds->nelts > 0) {
         if (HTML_STATUS(&ctx)) {
             ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "html managed domain status table");
             apr_brigade_puts(ctx.bb, NULL, NULL,
@@ -799,15 +1145,57 @@ int md_domains_status_hook(request_rec *r, int flags)
         else {
             ctx.prefix = "ManagedDomain";
         }
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "iterating JSON managed domain status");
-        md_json_itera(add_md_row, &ctx, jstatus, MD_KEY_MDS, NULL);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "streaming managed domain status");
+        /* Each row is made in its own pool and the output is passed on
+         * regularly, so memory does not grow with the number of MDs. */
+        ctx.p = ptemp;
+        matched = shown = 0;
+        for (i = 0; i < mds->nelts; ++i) {
+            if (rows) {
+                prow = &rows[i];
+            }
+            else {
+                prow = &row;
+                md_row_init(prow, APR_ARRAY_IDX(mds, i, const md_t*), mc, ptemp);
+            }
+            if (md_row_matches(prow, &filter, ptemp)) {
+                if (matched >= filter.offset && (filter.limit < 0 || shown < filter.limit)) {
+                    md_status_get_md_json_at(&mdj, prow->md, mc->reg, mc->ocsp, 
+                                             prow->renew_at, ptemp);
+                    add_md_row(&ctx, (apr_size_t)matched, mdj);
+                    if (++shown % STATUS_ROWS_PER_PASS == 0) {
+                        ap_pass_brigade(r->output_filters, ctx.bb);
+                        apr_brigade_cleanup(ctx.bb);
+                    }
+                }
+                ++matched;
+            }
+            apr_pool_clear(ptemp);
+        }
+        ctx.p = r->pool;
         if (HTML_STATUS(&ctx)) {
             apr_brigade_puts(ctx.bb, NULL, NULL, "</td></tr>\n</tbody>\n</table>\n");
+            if (shown < matched) {
+                apr_brigade_printf(ctx.bb, NULL, NULL, "<p>%d - %d of %d", 
+                                   shown? filter.offset + 1 : 0, filter.offset + shown, matched);
+                if (filter.offset > 0) {
+                    add_page_link(&ctx, r, (filter.limit > 0 && filter.offset > filter.limit)?
+                                  filter.offset - filter.limit : 0, "previous");
+                }
+                if (filter.offset + shown < matched) {
+                    add_page_link(&ctx, r, filter.offset + shown, "next");
+                }
+                apr_brigade_puts(ctx.bb, NULL, NULL, "</p>\n");
+            }
+        }
+        else {
+            apr_brigade_printf(ctx.bb, NULL, NULL, "ManagedDomainsMatched: %d\n", matched);
         }
     }
 
     ap_pass_brigade(r->output_filters, ctx.bb);
     apr_brigade_cleanup(ctx.bb);
+    apr_pool_destroy(ptemp);
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "server-status for managed domains, end");
 
     return OK;
@@ -929,6 +1317,271 @@ int md_ocsp_status_hook(request_rec *r, int flags)
     return OK;
 }
 
+/**************************************************************************************************/
+/* Metrics in Prometheus/OpenMetrics text format, from memory and the jobs table only */
+
+typedef struct {
+    apr_pool_t *p;
+    apr_bucket_brigade *bb;
+    int openmetrics;
+} metrics_ctx;
+
+/* What the metrics show of a MD */
+typedef struct {
+    const char *name;               /* label escaped */
+    const char *state;
+    apr_time_t valid_until;
+    int known;                      /* job state is known */
+    md_job_state_t js;
+} md_metric_t;
+
+static const char *metrics_states[] = {
+    "good", "expired", "incomplete", "error", "missing", "unknown", NULL
+};
+
+static const char *metric_label_escape(apr_pool_t *p, const char *s)
+{
+    const char *c;
+    char *e, *d;
+
+    if (!strpbrk(s, "\\\"\n")) return s;
+    e = d = apr_palloc(p, strlen(s) * 2 + 1);
+    for (c = s; *c; ++c) {
+        if (*c == '\\' || *c == '"') *d++ = '\\';
+        if (*c == '\n') { *d++ = '\\'; *d++ = 'n'; continue; }
+        *d++ = *c;
+    }
+    *d = '\0';
+    return e;
+}
+
+static void metric_family(metrics_ctx *ctx, const char *name, const char *type, 
+                          const char *help)
+{
+    apr_size_t len = strlen(name);
+
+    apr_brigade_printf(ctx->bb, NULL, NULL, "# HELP %s %s\n", name, help);
+    /* OpenMetrics names the counter family without the suffix of its sample */
+    if (ctx->openmetrics && !strcmp("counter", type) 
+        && len > 6 && !strcmp("_total", name + len - 6)) {
+        apr_brigade_printf(ctx->bb, NULL, NULL, "# TYPE %.*s %s\n", (int)(len - 6), name, type);
+    }
+    else {
+        apr_brigade_printf(ctx->bb, NULL, NULL, "# TYPE %s %s\n", name, type);
+    }
+}
+
+static void metric_time(metrics_ctx *ctx, const char *name, const char *labels, apr_time_t t)
+{
+    apr_brigade_printf(ctx->bb, NULL, NULL, "%s{%s} %" APR_TIME_T_FMT "\n", 
+                       name, labels, apr_time_sec(t));
+}
+
+static void metric_int(metrics_ctx *ctx, const char *name, const char *labels, long val)
+{
+    apr_brigade_printf(ctx->bb, NULL, NULL, "%s{%s} %ld\n", name, labels, val);
+}
+
+static const char *metric_labels(metrics_ctx *ctx, const md_metric_t *row)
+{
+    return apr_psprintf(ctx->p, "md=\"%s\"", row->name);
+}
+
+static void metrics_mds(metrics_ctx *ctx, md_metric_t *rows, int count)
+{
+    const char *labels;
+    int i, j;
+
+    metric_family(ctx, "mod_md_cert_expiry_timestamp_seconds", "gauge",
+                  "When the first certificate of the managed domain expires.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].valid_until) {
+            metric_time(ctx, "mod_md_cert_expiry_timestamp_seconds",
+                        metric_labels(ctx, &rows[i]), rows[i].valid_until);
+        }
+    }
+    metric_family(ctx, "mod_md_state", "gauge", "State of the managed domain.");
+    for (i = 0; i < count; ++i) {
+        for (j = 0; metrics_states[j]; ++j) {
+            labels = apr_psprintf(ctx->p, "md=\"%s\",state=\"%s\"", 
+                                  rows[i].name, metrics_states[j]);
+            metric_int(ctx, "mod_md_state", labels, !strcmp(metrics_states[j], rows[i].state));
+        }
+    }
+    metric_family(ctx, "mod_md_renew_at_timestamp_seconds", "gauge",
+                  "When the managed domain is due for renewal.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known && rows[i].js.renew_at) {
+            metric_time(ctx, "mod_md_renew_at_timestamp_seconds",
+                        metric_labels(ctx, &rows[i]), rows[i].js.renew_at);
+        }
+    }
+    metric_family(ctx, "mod_md_renewing", "gauge",
+                  "1 if the managed domain is being renewed.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known) {
+            metric_int(ctx, "mod_md_renewing",
+                       metric_labels(ctx, &rows[i]), 
+                       rows[i].js.renew_at && rows[i].js.renew_at <= apr_time_now());
+        }
+    }
+    metric_family(ctx, "mod_md_renewal_finished", "gauge",
+                  "1 if the renewal obtained new certificates, active on the next reload.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known) {
+            metric_int(ctx, "mod_md_renewal_finished", metric_labels(ctx, &rows[i]), 
+                       rows[i].js.finished);
+        }
+    }
+    metric_family(ctx, "mod_md_renewal_error_runs", "gauge",
+                  "Number of failed renewal runs in a row.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known) {
+            metric_int(ctx, "mod_md_renewal_error_runs",
+                       metric_labels(ctx, &rows[i]), rows[i].js.error_runs);
+        }
+    }
+    metric_family(ctx, "mod_md_renewal_next_run_timestamp_seconds", "gauge",
+                  "When the renewal runs next.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known && rows[i].js.next_run) {
+            metric_time(ctx, "mod_md_renewal_next_run_timestamp_seconds",
+                        metric_labels(ctx, &rows[i]), rows[i].js.next_run);
+        }
+    }
+    metric_family(ctx, "mod_md_renewal_last_run_timestamp_seconds", "gauge",
+                  "When the renewal ran last.");
+    for (i = 0; i < count; ++i) {
+        if (rows[i].known && rows[i].js.last_run) {
+            metric_time(ctx, "mod_md_renewal_last_run_timestamp_seconds",
+                        metric_labels(ctx, &rows[i]), rows[i].js.last_run);
+        }
+    }
+    metric_family(ctx, "mod_md_renewal_last_run_duration_seconds", "gauge",
+                  "How long the last renewal run took.");
+    for (i = 0; i < count; ++i) {
+        /* job states of earlier versions do not have the duration */
+        if (rows[i].known && rows[i].js.last_run && rows[i].js.last_duration) {
+            apr_brigade_printf(ctx->bb, NULL, NULL, 
+                               "mod_md_renewal_last_run_duration_seconds{%s} %.3f\n",
+                               metric_labels(ctx, &rows[i]), 
+                               (double)rows[i].js.last_duration / APR_USEC_PER_SEC);
+        }
+    }
+}
+
+typedef struct {
+    metrics_ctx *ctx;
+    apr_array_header_t *lines;
+    const char *family;
+} ocsp_metrics_ctx;
+
+static int ocsp_metric_add(void *baton, const char *md_name, const char *hexid,
+                           md_ocsp_cert_stat_t stat, const md_timeperiod_t *valid)
+{
+    ocsp_metrics_ctx *octx = baton;
+    apr_pool_t *p = octx->ctx->p;
+    const char *labels;
+
+    labels = apr_psprintf(p, "md=\"%s\",certid=\"%s\"", 
+                          metric_label_escape(p, md_name? md_name : ""), hexid);
+    if (!strcmp("mod_md_ocsp_status", octx->family)) {
+        APR_ARRAY_PUSH(octx->lines, const char*) = apr_psprintf(p, 
+            "mod_md_ocsp_status{%s,status=\"%s\"} 1\n", labels, md_ocsp_cert_stat_name(stat));
+    }
+    else if (!strcmp("mod_md_ocsp_valid_from_timestamp_seconds", octx->family)) {
+        if (valid->start) APR_ARRAY_PUSH(octx->lines, const char*) = apr_psprintf(p, 
+            "%s{%s} %" APR_TIME_T_FMT "\n", octx->family, labels, apr_time_sec(valid->start));
+    }
+    else if (valid->end) {
+        APR_ARRAY_PUSH(octx->lines, const char*) = apr_psprintf(p, 
+            "%s{%s} %" APR_TIME_T_FMT "\n", octx->family, labels, apr_time_sec(valid->end));
+    }
+    return 1;
+}
+
+static void metrics_ocsp_family(metrics_ctx *ctx, md_ocsp_reg_t *ocsp, const char *family,
+                                const char *help)
+{
+    ocsp_metrics_ctx octx;
+    int i;
+
+    octx.ctx = ctx;
+    octx.family = family;
+    octx.lines = apr_array_make(ctx->p, (int)md_ocsp_count(ocsp), sizeof(const char*));
+    /* collect first, the OCSP registry is locked during iteration */
+    md_ocsp_iter_meta(ocsp, ocsp_metric_add, &octx);
+    metric_family(ctx, family, "gauge", help);
+    for (i = 0; i < octx.lines->nelts; ++i) {
+        apr_brigade_puts(ctx->bb, NULL, NULL, APR_ARRAY_IDX(octx.lines, i, const char*));
+    }
+}
+
+static void metrics_counter(metrics_ctx *ctx, const char *name, md_counter_t counter,
+                            const char *help)
+{
+    metric_family(ctx, name, "counter", help);
+    apr_brigade_printf(ctx->bb, NULL, NULL, "%s %lu\n", name, 
+                       (unsigned long)md_counter_get(counter));
+}
+
+static void status_metrics(metrics_ctx *ctx, const md_mod_conf_t *mc, apr_array_header_t *mds)
+{
+    md_metric_t *rows;
+    const md_t *md;
+    int i;
+
+    rows = apr_pcalloc(ctx->p, (apr_size_t)(mds->nelts > 0? mds->nelts : 1) * sizeof(*rows));
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, const md_t*);
+        rows[i].name = metric_label_escape(ctx->p, md->name);
+        /* pubcerts of the live domains are held by the registry */
+        rows[i].valid_until = md_reg_valid_until(mc->reg, md, ctx->p);
+        rows[i].state = md_state_label(md, rows[i].valid_until);
+        rows[i].known = md_jobs_table_get(mc->jobs_table, md->name, &rows[i].js);
+    }
+    metrics_mds(ctx, rows, mds->nelts);
+
+    if (mc->ocsp && md_ocsp_count(mc->ocsp) > 0) {
+        metrics_ocsp_family(ctx, mc->ocsp, "mod_md_ocsp_status",
+                            "OCSP status of the certificate, as stapled by this process.");
+        metrics_ocsp_family(ctx, mc->ocsp, "mod_md_ocsp_valid_from_timestamp_seconds",
+                            "Since when the stapled OCSP response is valid.");
+        metrics_ocsp_family(ctx, mc->ocsp, "mod_md_ocsp_valid_until_timestamp_seconds",
+                            "Until when the stapled OCSP response is valid.");
+    }
+
+    metrics_counter(ctx, "mod_md_renewals_total", MD_CNT_RENEWALS,
+                    "Renewals that obtained new certificates.");
+    metrics_counter(ctx, "mod_md_renewal_errors_total", MD_CNT_RENEWAL_ERRORS,
+                    "Renewal runs that failed.");
+    metrics_counter(ctx, "mod_md_acme_requests_total", MD_CNT_ACME_REQUESTS,
+                    "Requests sent to ACME servers.");
+    metrics_counter(ctx, "mod_md_ocsp_requests_total", MD_CNT_OCSP_REQUESTS,
+                    "Requests sent to OCSP responders.");
+    metrics_counter(ctx, "mod_md_store_loads_total", MD_CNT_STORE_LOADS,
+                    "Items loaded from the store.");
+    metrics_counter(ctx, "mod_md_store_saves_total", MD_CNT_STORE_SAVES,
+                    "Items saved to the store.");
+    if (ctx->openmetrics) {
+        apr_brigade_puts(ctx->bb, NULL, NULL, "# EOF\n");
+    }
+}
+
+/* The metrics format asked for in the query "format=prometheus|openmetrics", or NULL */
+static const char *metrics_format(request_rec *r)
+{
+    char *args, *arg, *last;
+
+    if (!r->args) return NULL;
+    args = apr_pstrdup(r->pool, r->args);
+    for (arg = apr_strtok(args, "&;", &last); arg; arg = apr_strtok(NULL, "&;", &last)) {
+        if (!strcmp("format=prometheus", arg)) return "prometheus";
+        if (!strcmp("format=openmetrics", arg)) return "openmetrics";
+    }
+    return NULL;
+}
+
 /**************************************************************************************************/
 /* Status handlers */
 
@@ -940,7 +1593,8 @@ int md_status_handler(request_rec *r)
     md_json_t *jstatus;
     apr_bucket_brigade *bb;
     const md_t *md;
-    const char *name;
+    const char *name, *format;
+    metrics_ctx mctx;
 
     if (strcmp(r->handler, "md-status")) {
         return DECLINED;
@@ -961,7 +1615,30 @@ int md_status_handler(request_rec *r)
     if (r->path_info && r->path_info[0] == '/' && r->path_info[1] != '\0') {
         name = strrchr(r->path_info, '/') + 1;
         md = md_get_by_name(mc->mds, name);
-        if (!md) md = md_get_by_domain(mc->mds, name);
+        if (!md) md = mc->domain_idx? md_domain_idx_get(mc->domain_idx, name)
+                                    : md_get_by_domain(mc->mds, name);
+    }
+
+    if ((format = metrics_format(r))) {
+        memset(&mctx, 0, sizeof(mctx));
+        mctx.p = r->pool;
+        mctx.openmetrics = !strcmp("openmetrics", format);
+        if (md) {
+            mds = apr_array_make(r->pool, 1, sizeof(const md_t*));
+            APR_ARRAY_PUSH(mds, const md_t*) = md;
+        }
+        else {
+            mds = mc->mds_by_name? mc->mds_by_name : md_status_sort_mds(mc->mds, r->pool);
+        }
+        ap_set_content_type(r, mctx.openmetrics? 
+                            "application/openmetrics-text; version=1.0.0; charset=utf-8" :
+                            "text/plain; version=0.0.4; charset=utf-8");
+        apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+        mctx.bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        status_metrics(&mctx, mc, mds);
+        ap_pass_brigade(r->output_filters, mctx.bb);
+        apr_brigade_cleanup(mctx.bb);
+        return DONE;
     }
 
     if (md) {
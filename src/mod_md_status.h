@@ -17,8 +17,12 @@
 #ifndef mod_md_md_status_h
 #define mod_md_md_status_h
 
+void md_status_child_init(apr_pool_t *pchild);
 int md_http_cert_status(request_rec *r);
 
+/* The mds sorted by name, as listed in the status */
+apr_array_header_t *md_status_sort_mds(apr_array_header_t *mds, apr_pool_t *p);
+
 int md_domains_status_hook(request_rec *r, int flags);
 int md_ocsp_status_hook(request_rec *r, int flags);
 
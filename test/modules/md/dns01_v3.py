@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+
+import subprocess
+import sys
+
+curl = "curl"
+challtestsrv = "localhost:8055"
+
+
+def run(args):
+    sys.stderr.write(f"run: {' '.join(args)}\n")
+    p = subprocess.Popen(args, stdin=None, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    output, errput = p.communicate(None)
+    rv = p.wait()
+    if rv != 0:
+        sys.stderr.write(errput.decode())
+    sys.stdout.write(output.decode())
+    return rv
+
+
+def teardown(domain):
+    rv = run([curl, '-s', '-d', f'{{"host":"_acme-challenge.{domain}"}}',
+              f'{challtestsrv}/clear-txt'])
+    if rv == 0:
+        rv = run([curl, '-s', '-d', f'{{"host":"{domain}"}}',
+                  f'{challtestsrv}/set-txt'])
+    return rv
+
+
+def setup(domain, challenge):
+    rv = run([curl, '-s', '-d', f'{{"host":"{domain}", "addresses":["127.0.0.1"]}}',
+              f'{challtestsrv}/set-txt'])
+    if rv == 0:
+        rv = run([curl, '-s', '-d', f'{{"host":"_acme-challenge.{domain}.", "value":"{challenge}"}}',
+                  f'{challtestsrv}/set-txt'])
+    return rv
+
+
+def main(argv):
+    if len(argv) > 1:
+        # all domains of an order come in one call: <domain> <challenge> pairs
+        pairs = list(zip(argv[2::2], argv[3::2]))
+        if len(argv) < 4 or len(argv) % 2 != 0:
+            sys.stderr.write(f"wrong number of arguments: dns01_v3.py {argv[1]} "
+                             "<domain> <challenge> [<domain> <challenge>...]\n")
+            sys.exit(2)
+        if argv[1] == 'setup':
+            # a domain and its wildcard share one name, clear it only once
+            rv = 0
+            for domain in dict.fromkeys([d for d, c in pairs]):
+                rv = rv or teardown(domain)
+            for domain, challenge in pairs:
+                rv = rv or setup(domain, challenge)
+        elif argv[1] == 'teardown':
+            rv = 0
+            for domain in dict.fromkeys([d for d, c in pairs]):
+                rv = rv or teardown(domain)
+        else:
+            sys.stderr.write(f"unknown option {argv[1]}\n")
+            rv = 2
+    else:
+        sys.stderr.write("dns01_v3.py wrong number of arguments\n")
+        rv = 2
+    sys.exit(rv)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -239,7 +239,8 @@ class MDTestEnv(HttpdTestEnv):
         assert len(self._store_dir) > 1
         if not os.path.exists(self._store_dir):
             os.makedirs(self._store_dir)
-        for dirpath in ["challenges", "tmp", "archive", "domains", "accounts", "staging", "ocsp"]:
+        for dirpath in ["challenges", "tmp", "archive", "domains", "accounts", "staging", "ocsp",
+                        "keypool"]:
             shutil.rmtree(os.path.join(self._store_dir, dirpath), ignore_errors=True)
 
     def clear_ocsp_store(self):
@@ -271,6 +271,10 @@ class TestDrivev2:
         exp_location = "https://%s/name.txt" % name
         assert r.response['header']['location'] == exp_location
         assert 'strict-transport-security' not in r.response['header']
+        # query is kept
+        r = env.get_meta(name, "/name.txt?a=b&c", use_https=False)
+        assert r.response['status'] == 301
+        assert r.response['header']['location'] == exp_location + "?a=b&c"
         # should see this
         r = env.get_meta(name, "/name.txt", use_https=True)
         assert r.response['header']['strict-transport-security'] == 'max-age=15768000'
@@ -373,6 +377,24 @@ class TestDrivev2:
                  ], intext="GET https:// HTTP/1.1\nHost: example.com\n\n")
         assert env.apache_restart() == 0
 
+    def test_md_502_130(self, env):
+        # test case: a second md finds the account of the first in the index
+        domain = self.test_domain
+        name_a = "a." + domain
+        name_b = "b." + domain
+        self._prepare_md(env, [name_a])
+        self._prepare_md(env, [name_b])
+        assert env.apache_restart() == 0
+        assert env.a2md(["drive", name_a]).exit_code == 0
+        assert env.a2md(["drive", name_b]).exit_code == 0
+        acct_a = env.a2md(["list", name_a]).json['output'][0]['ca']['account']
+        acct_b = env.a2md(["list", name_b]).json['output'][0]['ca']['account']
+        assert acct_a == acct_b
+        with open(os.path.join(env.store_dir, 'accounts', '_index', 'index.json')) as fd:
+            index = json.load(fd)
+        assert index['accounts'][acct_a]['status'] == 'valid'
+        assert 'verified' in index['accounts'][acct_a]
+
     # --------- critical state change -> drive again ---------
 
     def test_md_502_200(self, env):
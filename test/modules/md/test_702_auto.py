@@ -1,3 +1,4 @@
+import json
 import os
 import time
 
@@ -808,3 +809,109 @@ class TestAutov2:
         assert env.await_completion(domains)
         env.check_md_complete(domains[0])
 
+
+    # test case: two MDs, but the CA only admits one new order, the other waits
+    def test_md_702_080(self, env):
+        domain = self.test_domain
+        domain_a = "a-" + domain
+        domain_b = "b-" + domain
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.add("MDCARateLimit * orders=1/1d")
+        conf.add_md([domain_a])
+        conf.add_md([domain_b])
+        conf.add_vhost(domain_a)
+        conf.add_vhost(domain_b)
+        conf.install()
+        assert env.apache_restart() == 0
+        # one of them gets its certificate, the other is held back without errors
+        held = None
+        try_until = time.time() + 60
+        while held is None and time.time() < try_until:
+            time.sleep(1)
+            for name in [domain_a, domain_b]:
+                md = env.get_md_status(name)
+                if md and 'renewal' in md and 'last' in md['renewal'] \
+                        and md['renewal']['last'].get('problem') == \
+                        'urn:org:apache:httpd:md:ca-limit':
+                    held = name
+        assert held, "no MD was held back by the rate limit"
+        done = domain_b if held == domain_a else domain_a
+        assert env.await_completion([done])
+        md = env.get_md_status(held)
+        assert md['renewal']['errors'] == 0
+        assert os.path.isfile(env.store_staged_file('_acme', 'ca-limits.json'))
+
+    # test case: with a key pool, the watchdog generates keys ahead of time
+    # while it is idle, one per key type and pool slot
+    def test_md_702_090(self, env):
+        domain = self.test_domain
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.add("MDPrivateKeyPool 2")
+        conf.add("MDPrivateKeys rsa2048 secp256r1")
+        conf.add_md([domain])
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain])
+        pool_dir = os.path.join(env.store_dir, 'keypool')
+        try_until = time.time() + 60
+        keys = []
+        while len(keys) < 4 and time.time() < try_until:
+            time.sleep(1)
+            if os.path.isdir(pool_dir):
+                keys = sorted([name for name in os.listdir(pool_dir)
+                               if name.startswith('rsa2048-') or name.startswith('secp256r1-')])
+        assert len([k for k in keys if k.startswith('rsa2048-')]) == 2, f"{keys}"
+        assert len([k for k in keys if k.startswith('secp256r1-')]) == 2, f"{keys}"
+
+    # test case: intermediates of new certificates are kept once for all MDs
+    def test_md_702_091(self, env):
+        domain = self.test_domain
+        domain_a = "a-" + domain
+        domain_b = "b-" + domain
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.add_md([domain_a])
+        conf.add_md([domain_b])
+        conf.add_vhost(domain_a)
+        conf.add_vhost(domain_b)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain_a, domain_b])
+        with open(env.store_staged_file('_acme', 'issuers.json')) as fd:
+            issuers = json.load(fd)['issuers']
+        fingerprints = [i['sha256-fingerprint'] for i in issuers]
+        assert len(fingerprints) > 0
+        assert len(fingerprints) == len(set(fingerprints))
+
+    # test case: with httpd started as root, the watchdog child running as
+    # another user keeps the account index and its verifications up to date
+    @pytest.mark.skipif(condition=os.geteuid() != 0, reason="needs httpd started as root")
+    def test_md_702_092(self, env):
+        import grp
+        import pwd
+        user = pwd.getpwnam('nobody')
+        group = grp.getgrgid(user.pw_gid)
+        domain = self.test_domain
+        domain_a = "a-" + domain
+        domain_b = "b-" + domain
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.add(f"User {user.pw_name}")
+        conf.add(f"Group {group.gr_name}")
+        conf.add_md([domain_a])
+        conf.add_vhost(domain_a)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain_a])
+        # the second MD uses the account of the first, verified by the child
+        conf.add_md([domain_b])
+        conf.add_vhost(domain_b)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain_b])
+        accounts = env.list_accounts()
+        assert len(accounts) == 1
+        with open(env.store_staged_file('_acme', 'accounts-index.json')) as fd:
+            index = json.load(fd)['accounts']
+        assert 'verified' in index[accounts[0]], f"{index}"
+        # authorizations of the account are remembered by the child as well
+        assert os.path.isfile(env.store_staged_file('_acme', f"authzs-{accounts[0]}.json"))
@@ -1,3 +1,4 @@
+import json
 import os
 
 import pytest
@@ -122,3 +123,42 @@ class TestStatic:
                 "AH10171"   # Managed Domain has MDCertificateKeyFile(s) but no MDCertificateFile
             ]
         )
+
+    def test_md_730_004(self, env):
+        # MD with static cert files, what is known about them is kept in
+        # a snapshot and taken from there for as long as the file is unchanged
+        domain = self.test_domain
+        domains = [domain, 'www.%s' % domain]
+        testpath = os.path.join(env.gen_dir, 'test_730_004')
+        env.create_self_signed_cert(domains, {"notBefore": -80, "notAfter": 10},
+                                    serial=730004, path=testpath)
+        cert_file = os.path.join(testpath, 'pubcert.pem')
+        pkey_file = os.path.join(testpath, 'privkey.pem')
+        conf = MDConf(env)
+        conf.start_md(domains)
+        conf.add(f"MDCertificateFile {cert_file}")
+        conf.add(f"MDCertificateKeyFile {pkey_file}")
+        conf.end_md()
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0
+        snap_file = os.path.join(env.store_dir, 'cert-snapshot.json')
+        with open(snap_file) as fd:
+            snap = json.load(fd)
+        assert snap['version'] == 1
+        entry = snap['certs'][cert_file]
+        assert int(entry['cert']['serial'], 16) == 730004
+        assert sorted(entry['cert']['domains']) == sorted(domains)
+        # unchanged, same info
+        assert env.apache_restart() == 0
+        with open(snap_file) as fd:
+            assert json.load(fd)['certs'][cert_file]['stamp'] == entry['stamp']
+        assert env.get_md_status(domain)['cert']['valid'] is not None
+        # a new certificate in the file is noticed
+        env.create_self_signed_cert(domains, {"notBefore": -1, "notAfter": 80},
+                                    serial=730005, path=testpath)
+        assert env.apache_restart() == 0
+        assert env.get_cert(domain).same_serial_as(730005)
+        with open(snap_file) as fd:
+            entry = json.load(fd)['certs'][cert_file]
+        assert int(entry['cert']['serial'], 16) == 730005
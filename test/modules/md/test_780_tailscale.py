@@ -1,3 +1,5 @@
+import hashlib
+import json
 import os
 import re
 import socket
@@ -15,10 +17,11 @@ class TailscaleFaker:
         self.env = env
         self._uds_path = path
         self._done = False
+        self.requests = []
 
     def start(self):
         def process(self):
-            self._socket.listen(1)
+            self._socket.listen(5)
             self._process()
 
         try:
@@ -43,11 +46,25 @@ Connection: close\r
 \r
 """.encode())
 
-    def send_data(self, c, ctype: str, data: bytes):
+    @staticmethod
+    def etag_of(data: bytes) -> str:
+        return f'"{hashlib.sha256(data).hexdigest()[:16]}"'
+
+    def send_data(self, c, ctype: str, data: bytes, if_none_match=None):
+        etag = self.etag_of(data)
+        if if_none_match == etag:
+            c.sendall(f"""HTTP/1.1 304 Not Modified\r
+Server: TailscaleFaker\r
+ETag: {etag}\r
+Connection: close\r
+\r
+""".encode())
+            return
         c.sendall(f"""HTTP/1.1 200 OK\r
 Server: TailscaleFaker\r
 Content-Type: {ctype}\r
 Content-Length: {len(data)}\r
+ETag: {etag}\r
 Connection: close\r
 \r
 """.encode() + data)
@@ -71,16 +88,21 @@ Connection: close\r
                         continue
                     domain = m.group('domain')
                     cred_type = m.group('type')
+                    if_none_match = None
+                    for line in lines[1:]:
+                        if line.lower().startswith('if-none-match:'):
+                            if_none_match = line.split(':', 1)[1].strip()
+                    self.requests.append((domain, cred_type, if_none_match))
                     creds = self.env.get_credentials_for_name(domain)
                     sys.stderr.write(f"lookup domain={domain}, type={cred_type} -> {creds}\n")
                     if creds is None or len(creds) == 0:
                         self.send_error(c, 404, "Not Found")
                         continue
                     if cred_type == 'crt':
-                        self.send_data(c, "text/plain", creds[0].cert_pem)
+                        self.send_data(c, "text/plain", creds[0].cert_pem, if_none_match)
                         pass
                     elif cred_type == 'key':
-                        self.send_data(c, "text/plain", creds[0].pkey_pem)
+                        self.send_data(c, "text/plain", creds[0].pkey_pem, if_none_match)
                     else:
                         self.send_error(c, 404, "Not Found")
                         continue
@@ -99,6 +121,7 @@ class TestTailscale:
         TestTailscale.UDS_PATH = UDS_PATH
         faker = TailscaleFaker(env=env, path=UDS_PATH)
         faker.start()
+        TestTailscale.FAKER = faker
         env.APACHE_CONF_SRC = "data/test_auto"
         acme.start(config='default')
         env.clear_store()
@@ -196,3 +219,33 @@ class TestTailscale:
                 "AH10056"   # retrieving certificate from tailscale
             ]
         )
+
+    # create a MD using `tailscale` as protocol, check that cert and key are
+    # retrieved together and that the validators for conditional requests are kept
+    def test_md_780_004(self, env):
+        domain = env.tailscale_domain
+        domains = [domain]
+        self.FAKER.requests.clear()
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.start_md(domains)
+        conf.add([
+            "MDCertificateProtocol tailscale",
+            f"MDCertificateAuthority file://{self.UDS_PATH}",
+        ])
+        conf.end_md()
+        conf.add_vhost(domains)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion(domains)
+        assert env.apache_restart() == 0
+        env.check_md_complete(domain)
+        # first retrieval is unconditional for both cert and key
+        types = sorted([t for d, t, inm in self.FAKER.requests if d == domain])
+        assert types[:2] == ['crt', 'key'], f"{self.FAKER.requests}"
+        assert all(inm is None for d, t, inm in self.FAKER.requests[:2])
+        # the ETags of what went live are kept next to it
+        with open(env.store_domain_file(domain, 'tailscale.json')) as fd:
+            validators = json.load(fd)
+        creds = env.get_credentials_for_name(domain)
+        assert validators['crt']['etag'] == TailscaleFaker.etag_of(creds[0].cert_pem)
+        assert validators['key']['etag'] == TailscaleFaker.etag_of(creds[0].pkey_pem)
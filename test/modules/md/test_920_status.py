@@ -106,6 +106,67 @@ class TestStatus:
         assert "managed-domains" in status
         assert 1 == len(status["managed-domains"])
 
+    # status responses carry an ETag, are answered with 304 when unchanged
+    # and change when the staging does
+    def test_md_920_005(self, env):
+        domain = self.test_domain
+        domains = [domain]
+        conf = MDConf(env)
+        conf.add_md(domains)
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain], restart=False)
+        url = f"https://{domain}:{env.https_port}/.httpd/certificate-status"
+        r = env.curl_get(url, insecure=True)
+        assert r.response['status'] == 200
+        etag = r.response['header']['etag']
+        assert etag.startswith('"')
+        assert 'renewal' in r.json
+        r = env.curl_get(url, insecure=True, options=['-H', f'If-None-Match: {etag}'])
+        assert r.response['status'] == 304
+        assert r.response['header']['etag'] == etag
+        # the compact format is a different representation
+        r = env.curl_get(f"{url}?compact", insecure=True)
+        assert r.response['status'] == 200
+        assert r.response['header']['etag'] != etag
+        assert '\n' not in r.stdout.strip()
+        assert 'renewal' in r.json
+        # a changed staging gives a new status
+        staged_cert = os.path.join(env.store_dir, 'staging', domain, 'pubcert.pem')
+        real_cert = os.path.join(env.test_dir, '../modules/md/data', 'test_920', '002.pubcert')
+        assert copyfile(real_cert, staged_cert)
+        r = env.curl_get(url, insecure=True, options=['-H', f'If-None-Match: {etag}'])
+        assert r.response['status'] == 200
+        assert r.response['header']['etag'] != etag
+        assert '03039C464D454EDE79FCD2CAE859F668F269' == \
+               r.json['renewal']['cert']['rsa']['serial']
+
+    # the cached status of a MD is replaced each time its staging job changes
+    def test_md_920_006(self, env):
+        domain = self.test_domain
+        domains = [domain]
+        conf = MDConf(env)
+        conf.add_md(domains)
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0
+        assert env.await_completion([domain], restart=False)
+        url = f"https://{domain}:{env.https_port}/.httpd/certificate-status"
+        r = env.curl_get(url, insecure=True)
+        assert r.response['status'] == 200
+        job_file = env.path_job(domain)
+        for i in range(3):
+            st = os.stat(job_file)
+            os.utime(job_file, (st.st_atime, st.st_mtime + 10 * (i + 1)))
+            r = env.curl_get(url, insecure=True)
+            assert r.response['status'] == 200
+            etag = r.response['header']['etag']
+            assert 'renewal' in r.json
+            r = env.curl_get(url, insecure=True, options=['-H', f'If-None-Match: {etag}'])
+            assert r.response['status'] == 304, f"round {i}"
+            assert r.response['header']['etag'] == etag
+
     # get the status of a domain on base server
     def test_md_920_010(self, env):
         domain = self.test_domain
@@ -159,6 +220,43 @@ Protocols h2 http/1.1 acme-tls/1
         assert int(m.group(1)) == 0
         m = re.search(r'ManagedCertificatesReady: (\d+)', status, re.MULTILINE)
         assert int(m.group(1)) == 1
+        assert re.search(r'ManagedDomain\[0\]Domain: ', status, re.MULTILINE)
+        # filter and page the managed domains listed
+        status = env.get_server_status(query="?auto&md-state=incomplete",
+                                       via_domain=env.http_addr, use_https=False)
+        assert re.search(r'ManagedDomainsMatched: 1', status, re.MULTILINE), status
+        status = env.get_server_status(query="?auto&md-state=good",
+                                       via_domain=env.http_addr, use_https=False)
+        assert re.search(r'ManagedDomainsMatched: 0', status, re.MULTILINE), status
+        assert not re.search(r'ManagedDomain\[0\]', status, re.MULTILINE)
+        status = env.get_server_status(query="?auto&md-limit=0",
+                                       via_domain=env.http_addr, use_https=False)
+        assert re.search(r'ManagedDomainsMatched: 1', status, re.MULTILINE), status
+        assert not re.search(r'ManagedDomain\[0\]', status, re.MULTILINE)
+        # the summary is about all of them
+        m = re.search(r'ManagedCertificatesTotal: (\d+)', status, re.MULTILINE)
+        assert int(m.group(1)) == 1
+        status = env.get_server_status(query="?auto&md-errored",
+                                       via_domain=env.http_addr, use_https=False)
+        assert re.search(r'ManagedDomainsMatched: 0', status, re.MULTILINE), status
+        status = env.get_server_status(query="?auto&md-errored=0",
+                                       via_domain=env.http_addr, use_https=False)
+        assert re.search(r'ManagedDomainsMatched: 1', status, re.MULTILINE), status
+        # metrics for scraping
+        metrics = env.get_content(env.http_addr, "/md-status?format=prometheus",
+                                  use_https=False)
+        assert re.search(r'^# TYPE mod_md_renewals_total counter$', metrics, re.MULTILINE)
+        assert re.search(r'^mod_md_renewals_total 1$', metrics, re.MULTILINE), metrics
+        assert re.search(r'^mod_md_renewal_finished\{md="%s"\} 1$' % domain,
+                         metrics, re.MULTILINE), metrics
+        assert re.search(r'^mod_md_state\{md="%s",state="incomplete"\} 1$' % domain,
+                         metrics, re.MULTILINE), metrics
+        m = re.search(r'^mod_md_acme_requests_total (\d+)$', metrics, re.MULTILINE)
+        assert m and int(m.group(1)) > 0, metrics
+        metrics = env.get_content(env.http_addr, "/md-status?format=openmetrics",
+                                  use_https=False)
+        assert re.search(r'^# TYPE mod_md_renewals counter$', metrics, re.MULTILINE)
+        assert metrics.endswith("# EOF\n")
 
     def test_md_920_011(self, env):
         # MD with static cert files in base server, see issue #161
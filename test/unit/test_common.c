@@ -0,0 +1,94 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_json.h"
+#include "md_util.h"
+
+/*
+ * Helpers shared by the test source files
+ */
+
+md_t *make_md(apr_pool_t *p, const char *name, ...)
+{
+    apr_array_header_t *domains = apr_array_make(p, 5, sizeof(const char*));
+    const char *s;
+    va_list ap;
+
+    APR_ARRAY_PUSH(domains, const char*) = name;
+    va_start(ap, name);
+    while ((s = va_arg(ap, const char*))) {
+        APR_ARRAY_PUSH(domains, const char*) = s;
+    }
+    va_end(ap);
+    return md_create(p, domains);
+}
+
+const char *rfc3339(apr_time_t t, apr_pool_t *p)
+{
+    apr_time_exp_t exp;
+    apr_size_t len;
+    char buf[64];
+
+    apr_time_exp_gmt(&exp, t);
+    apr_strftime(buf, &len, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &exp);
+    return apr_pstrdup(p, buf);
+}
+
+static void add_header(md_json_t *json, const char *name, const char *value, apr_pool_t *p)
+{
+    md_json_t *hdr = md_json_create(p);
+
+    md_json_sets(name, hdr, MD_KEY_NAME, NULL);
+    md_json_sets(value, hdr, MD_KEY_VALUE, NULL);
+    md_json_addj(hdr, json, MD_KEY_HEADERS, NULL);
+}
+
+void trace_add(apr_file_t *f, const char *method, const char *url, int status,
+               const char *retry_after, md_json_t *body, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p);
+    md_data_t data;
+
+    md_json_sets(method, json, MD_KEY_METHOD, NULL);
+    md_json_sets(url, json, MD_KEY_URL, NULL);
+    md_json_setl(status, json, MD_KEY_STATUS, NULL);
+    add_header(json, "Replay-Nonce", "bm9uY2U", p);
+    if (retry_after) add_header(json, "Retry-After", retry_after, p);
+    if (body) {
+        add_header(json, "Content-Type", "application/json", p);
+        md_data_init_str(&data, md_json_writep(body, p, MD_JSON_FMT_COMPACT));
+        md_json_sets(md_util_base64url_encode(&data, p), json, MD_KEY_BODY, NULL);
+    }
+    apr_file_printf(f, "%s\n", md_json_writep(json, p, MD_JSON_FMT_COMPACT));
+}
+
+md_json_t *acme_dir(const char *renewal_info, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p);
+
+    md_json_sets("https://ca.test/new-acct", json, "newAccount", NULL);
+    md_json_sets("https://ca.test/new-order", json, "newOrder", NULL);
+    md_json_sets("https://ca.test/new-nonce", json, "newNonce", NULL);
+    if (renewal_info) md_json_sets(renewal_info, json, "renewalInfo", NULL);
+    return json;
+}
@@ -17,6 +17,8 @@
  */
 
 #include <apr.h>   /* for pid_t on Windows, needed by Check */
+#include <apr_file_io.h>
+#include <apr_time.h>
 #include <check.h>
 
 /*
@@ -40,5 +42,33 @@
  * main_test_suite() in main.c.
  */
 
+TCase *md_acme_test_case(void);
+TCase *md_core_test_case(void);
+TCase *md_http01_test_case(void);
 TCase *md_json_test_case(void);
+TCase *md_reg_test_case(void);
 TCase *md_util_test_case(void);
+
+/*
+ * Helpers shared by the test source files, in test_common.c.
+ */
+
+struct md_json_t;
+struct md_t;
+
+/* An md for the NULL terminated list of domain names, starting with name. */
+struct md_t *make_md(apr_pool_t *p, const char *name, ...);
+
+/* The time in the format ACME servers use, e.g. "2024-01-31T12:00:00Z". */
+const char *rfc3339(apr_time_t t, apr_pool_t *p);
+
+/*
+ * Append a response to a request to a trace, as md_http_replay reads it. Like
+ * an ACME server, every response carries a Replay-Nonce. retry_after and body
+ * (sent as application/json) are optional.
+ */
+void trace_add(apr_file_t *f, const char *method, const char *url, int status,
+               const char *retry_after, struct md_json_t *body, apr_pool_t *p);
+
+/* The directory of an ACME CA at https://ca.test, renewal_info is optional. */
+struct md_json_t *acme_dir(const char *renewal_info, apr_pool_t *p);
@@ -0,0 +1,186 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_http.h"
+#include "md_http_replay.h"
+#include "md_json.h"
+#include "md_result.h"
+#include "md_store.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+#include "md_acme.h"
+#include "md_acme_acct.h"
+#include "md_acme_authz.h"
+#include "md_acme_order.h"
+
+/*
+ * Helpers
+ */
+
+static md_json_t *authz_json(const char *domain, const char *status, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p), *jcha = md_json_create(p);
+
+    md_json_sets(status, json, MD_KEY_STATUS, NULL);
+    md_json_sets("dns", json, MD_KEY_IDENTIFIER, MD_KEY_TYPE, NULL);
+    md_json_sets(domain, json, MD_KEY_IDENTIFIER, MD_KEY_VALUE, NULL);
+    md_json_sets(rfc3339(apr_time_now() + apr_time_from_sec(30 * MD_SECS_PER_DAY), p),
+                 json, MD_KEY_EXPIRES, NULL);
+    md_json_sets("http-01", jcha, MD_KEY_TYPE, NULL);
+    md_json_sets(status, jcha, MD_KEY_STATUS, NULL);
+    if (!strcmp("invalid", status)) {
+        md_json_sets("urn:ietf:params:acme:error:unauthorized", jcha, MD_KEY_ERROR, MD_KEY_TYPE, NULL);
+        md_json_sets("authorization deactivated", jcha, MD_KEY_ERROR, MD_KEY_DETAIL, NULL);
+    }
+    md_json_addj(jcha, json, MD_KEY_CHALLENGES, NULL);
+    return json;
+}
+
+static md_acme_order_t *make_order(apr_pool_t *p, ...)
+{
+    md_acme_order_t *order = md_acme_order_create(p);
+    const char *url;
+    va_list ap;
+
+    va_start(ap, p);
+    while ((url = va_arg(ap, const char *))) {
+        APR_ARRAY_PUSH(order->authz_urls, const char*) = url;
+    }
+    va_end(ap);
+    return order;
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static md_store_t *g_store;
+
+static void md_acme_test_setup(void)
+{
+    const char *tmp;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    ck_assert_int_eq(apr_temp_dir_get(&tmp, g_pool), APR_SUCCESS);
+    g_dir = apr_psprintf(g_pool, "%s/md-unit-acme-%" APR_TIME_T_FMT, tmp, apr_time_now());
+    ck_assert_int_eq(md_store_fs_init(&g_store, g_pool, g_dir), APR_SUCCESS);
+    ck_assert_int_eq(md_acme_authz_known_init(g_pool), APR_SUCCESS);
+}
+
+static void md_acme_test_teardown(void)
+{
+    md_http_use_implementation(NULL);
+    md_util_rm_recursive(g_dir, g_pool, 5);
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+
+START_TEST(authz_md_acme_reuse)
+{
+    const char *url_a = "https://ca.test/authz/a", *url_b = "https://ca.test/authz/b";
+    apr_array_header_t *challenges = apr_array_make(g_pool, 1, sizeof(const char*));
+    apr_table_t *env = apr_table_make(g_pool, 1);
+    struct md_http_impl_t *impl;
+    md_result_t *result = md_result_make(g_pool, APR_SUCCESS);
+    md_acme_order_t *order;
+    md_pkey_spec_t spec;
+    md_acme_t *acme;
+    const char *tpath;
+    apr_uint32_t requests;
+    apr_file_t *f;
+    md_t *md;
+
+    /* authz a stays valid, authz b is no longer on its second look */
+    tpath = apr_psprintf(g_pool, "%s/authz-trace.json", g_dir);
+    ck_assert_int_eq(apr_dir_make_recursive(g_dir, APR_OS_DEFAULT, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(apr_file_open(&f, tpath, APR_FOPEN_WRITE|APR_FOPEN_CREATE,
+                                   APR_OS_DEFAULT, g_pool), APR_SUCCESS);
+    trace_add(f, "GET", "https://ca.test/dir", 200, NULL, acme_dir(NULL, g_pool), g_pool);
+    trace_add(f, "HEAD", "https://ca.test/new-nonce", 200, NULL, NULL, g_pool);
+    trace_add(f, "POST", url_a, 200, NULL, authz_json("a.test", "valid", g_pool), g_pool);
+    trace_add(f, "POST", url_b, 200, NULL, authz_json("b.test", "valid", g_pool), g_pool);
+    trace_add(f, "POST", url_b, 200, NULL, authz_json("b.test", "invalid", g_pool), g_pool);
+    apr_file_close(f);
+    ck_assert_int_eq(md_http_replay_get_impl(&impl, g_pool, tpath, MD_HTTP_REPLAY_PLAY, NULL),
+                     APR_SUCCESS);
+    md_http_use_implementation(impl);
+
+    ck_assert_int_eq(md_acme_create(&acme, g_pool, "https://ca.test/dir", NULL, NULL),
+                     APR_SUCCESS);
+    acme->acct_id = "ACME-ca.test-0000";
+    acme->acct = apr_pcalloc(g_pool, sizeof(*acme->acct));
+    acme->acct->url = "https://ca.test/acct/1";
+    acme->acct->ca_url = acme->url;
+    spec.type = MD_PKEY_TYPE_EC;
+    spec.params.ec.curve = "P-256";
+    ck_assert_int_eq(md_pkey_gen(&acme->acct_key, g_pool, &spec), APR_SUCCESS);
+    APR_ARRAY_PUSH(challenges, const char*) = "http-01";
+    md = md_create(g_pool, apr_array_make(g_pool, 1, sizeof(const char*)));
+    md->name = "a.test";
+
+    /* the first order remembers both authorizations */
+    order = make_order(g_pool, url_a, url_b, NULL);
+    ck_assert_int_eq(md_acme_order_start_challenges(order, acme, challenges, g_store, md,
+                                                    env, result, g_pool), APR_SUCCESS);
+    ck_assert_str_eq(md_acme_authz_known_valid(acme, g_store, url_a, g_pool), "a.test");
+    ck_assert_str_eq(md_acme_authz_known_valid(acme, g_store, url_b, g_pool), "b.test");
+
+    /* a second order looks at the authorization once and no longer monitors it */
+    order = make_order(g_pool, url_a, NULL);
+    ck_assert_int_eq(md_acme_order_start_challenges(order, acme, challenges, g_store, md,
+                                                    env, result, g_pool), APR_SUCCESS);
+    requests = md_counter_get(MD_CNT_ACME_REQUESTS);
+    ck_assert_int_eq(md_acme_order_monitor_authzs(order, acme, g_store, md,
+                                                  apr_time_from_sec(5), result, g_pool),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_counter_get(MD_CNT_ACME_REQUESTS), requests);
+
+    /* an authorization the CA no longer has as valid is forgotten */
+    order = make_order(g_pool, url_b, NULL);
+    ck_assert_int_eq(md_acme_order_start_challenges(order, acme, challenges, g_store, md,
+                                                    env, result, g_pool), APR_EINVAL);
+    ck_assert(md_acme_authz_known_valid(acme, g_store, url_b, g_pool) == NULL);
+    ck_assert_str_eq(md_acme_authz_known_valid(acme, g_store, url_a, g_pool), "a.test");
+}
+END_TEST
+
+TCase *md_acme_test_case(void)
+{
+    TCase *testcase = tcase_create("md_acme");
+
+    tcase_add_checked_fixture(testcase, md_acme_test_setup, md_acme_test_teardown);
+
+    tcase_add_test(testcase, authz_md_acme_reuse);
+
+    return testcase;
+}
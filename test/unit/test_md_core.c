@@ -0,0 +1,206 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include "test_common.h"
+#include "md.h"
+
+/*
+ * Helpers
+ */
+
+/* mds with 5 names each, one of them a wildcard */
+static apr_array_header_t *make_many(apr_pool_t *p, int count)
+{
+    apr_array_header_t *mds = apr_array_make(p, count, sizeof(md_t*));
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        APR_ARRAY_PUSH(mds, md_t*) = make_md(p,
+            apr_psprintf(p, "site%d.example.org", i),
+            apr_psprintf(p, "www.site%d.example.org", i),
+            apr_psprintf(p, "*.cdn%d.example.org", i),
+            apr_psprintf(p, "mail%d.example.net", i),
+            apr_psprintf(p, "api.Site%d.Example.NET", i), NULL);
+    }
+    return mds;
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void md_core_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_core_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+START_TEST(domain_idx_md_core_get)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 5, sizeof(md_t*));
+    md_domain_idx_t *idx;
+    md_t *md1, *md2, *md3;
+
+    md1 = make_md(g_pool, "example.org", "www.example.org", NULL);
+    md2 = make_md(g_pool, "*.Example.org", "example.net", NULL);
+    md3 = make_md(g_pool, "a.example.org", NULL);
+    APR_ARRAY_PUSH(mds, md_t*) = md1;
+    APR_ARRAY_PUSH(mds, md_t*) = md2;
+    APR_ARRAY_PUSH(mds, md_t*) = md3;
+    idx = md_domain_idx_make(g_pool, mds);
+
+    ck_assert(md_domain_idx_get(idx, "example.org") == md1);
+    ck_assert(md_domain_idx_get(idx, "WWW.example.ORG") == md1);
+    ck_assert(md_domain_idx_get(idx, "example.net") == md2);
+    ck_assert(md_domain_idx_get(idx, "*.example.org") == md2);
+    ck_assert(md_domain_idx_get(idx, "other.example.org") == md2);
+    /* the wildcard of md2 was added before md3 */
+    ck_assert(md_domain_idx_get(idx, "a.example.org") == md2);
+    ck_assert(md_domain_idx_get(idx, "b.a.example.org") == NULL);
+    ck_assert(md_domain_idx_get(idx, "example.com") == NULL);
+    ck_assert(md_domain_idx_get(idx, "org") == NULL);
+
+    ck_assert(md_domain_idx_get_overlap(idx, md1) == NULL);
+    ck_assert(md_domain_idx_get_overlap(idx, md2) == md1);
+    ck_assert(md_domain_idx_get_overlap(idx, md3) == NULL);
+    ck_assert(md_get_by_dns_overlap(mds, md2) == md1);
+}
+END_TEST
+
+START_TEST(domain_idx_md_core_same_as_list)
+{
+    apr_array_header_t *mds = make_many(g_pool, 500);
+    md_domain_idx_t *idx = md_domain_idx_make(g_pool, mds);
+    const char *names[] = {
+        "site7.example.org", "WWW.SITE99.example.org", "x.cdn250.example.org",
+        "*.cdn499.example.org", "a.b.cdn3.example.org", "mail0.example.net",
+        "api.site42.example.net", "site500.example.org", "cdn1.example.org", NULL
+    };
+    int i;
+
+    for (i = 0; names[i]; ++i) {
+        ck_assert(md_domain_idx_get(idx, names[i]) == md_get_by_domain(mds, names[i]));
+    }
+    for (i = 0; i < mds->nelts; i += 37) {
+        md_t *md = APR_ARRAY_IDX(mds, i, md_t*);
+        ck_assert(md_domain_idx_get_overlap(idx, md) == md_get_by_dns_overlap(mds, md));
+    }
+}
+END_TEST
+
+static int collect_md(void *baton, md_t *md, int pos)
+{
+    apr_array_header_t *found = baton;
+
+    (void)pos;
+    APR_ARRAY_PUSH(found, md_t*) = md;
+    return 1;
+}
+
+START_TEST(domain_idx_md_core_do)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 5, sizeof(md_t*));
+    apr_array_header_t *found = apr_array_make(g_pool, 5, sizeof(md_t*));
+    md_domain_idx_t *idx;
+    md_t *md1, *md2, *md3;
+
+    md1 = make_md(g_pool, "*.example.org", NULL);
+    md2 = make_md(g_pool, "a.example.org", "*.example.org", NULL);
+    md3 = make_md(g_pool, "A.Example.org", NULL);
+    APR_ARRAY_PUSH(mds, md_t*) = md1;
+    APR_ARRAY_PUSH(mds, md_t*) = md2;
+    APR_ARRAY_PUSH(mds, md_t*) = md3;
+    idx = md_domain_idx_make(g_pool, mds);
+
+    /* each one once, in the order added */
+    ck_assert(md_domain_idx_do(idx, "a.example.ORG", collect_md, found));
+    ck_assert_int_eq(found->nelts, 3);
+    ck_assert(APR_ARRAY_IDX(found, 0, md_t*) == md1);
+    ck_assert(APR_ARRAY_IDX(found, 1, md_t*) == md2);
+    ck_assert(APR_ARRAY_IDX(found, 2, md_t*) == md3);
+    apr_array_clear(found);
+    md_domain_idx_do(idx, "b.example.org", collect_md, found);
+    ck_assert_int_eq(found->nelts, 2);
+    apr_array_clear(found);
+    md_domain_idx_do(idx, "example.org", collect_md, found);
+    ck_assert_int_eq(found->nelts, 0);
+}
+END_TEST
+
+/* Not a check of correctness, compares lookup times with and without index.
+ * Only run when MD_UNIT_IDX_BENCH is set. */
+START_TEST(domain_idx_md_core_bench)
+{
+    int count = 30000, lookups = 200, i;
+    apr_array_header_t *mds = make_many(g_pool, count);
+    md_domain_idx_t *idx;
+    const char *name;
+    apr_time_t start, t_build, t_list, t_idx;
+
+    start = apr_time_now();
+    idx = md_domain_idx_make(g_pool, mds);
+    t_build = apr_time_now() - start;
+
+    start = apr_time_now();
+    for (i = 0; i < lookups; ++i) {
+        name = apr_psprintf(g_pool, "x.cdn%d.example.org", (i * 7919) % count);
+        ck_assert(md_get_by_domain(mds, name));
+    }
+    t_list = apr_time_now() - start;
+
+    start = apr_time_now();
+    for (i = 0; i < lookups; ++i) {
+        name = apr_psprintf(g_pool, "x.cdn%d.example.org", (i * 7919) % count);
+        ck_assert(md_domain_idx_get(idx, name));
+    }
+    t_idx = apr_time_now() - start;
+
+    ck_assert_msg(t_idx < t_list, "%d mds, build %ld us, %d lookups: list %ld us, index %ld us",
+                  count, (long)t_build, lookups, (long)t_list, (long)t_idx);
+}
+END_TEST
+
+TCase *md_core_test_case(void)
+{
+    TCase *testcase = tcase_create("md_core");
+
+    tcase_add_checked_fixture(testcase, md_core_setup, md_core_teardown);
+    tcase_set_timeout(testcase, 60);
+
+    tcase_add_test(testcase, domain_idx_md_core_get);
+    tcase_add_test(testcase, domain_idx_md_core_same_as_list);
+    tcase_add_test(testcase, domain_idx_md_core_do);
+    if (getenv("MD_UNIT_IDX_BENCH")) {
+        tcase_add_test(testcase, domain_idx_md_core_bench);
+    }
+
+    return testcase;
+}
@@ -0,0 +1,127 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md_http01.h"
+
+/*
+ * Helpers
+ */
+
+static const char *host_name(int i, apr_pool_t *p)
+{
+    return apr_psprintf(p, "www%d.example.org", i);
+}
+
+static const char *key_authz(int i, apr_pool_t *p)
+{
+    return apr_psprintf(p, "token%d.thumbprint", i);
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static md_http01_slots_t *g_slots;
+
+static void md_http01_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    ck_assert_int_eq(md_http01_slots_create(&g_slots, apr_palloc(g_pool, md_http01_slots_size()),
+                                            g_pool), APR_SUCCESS);
+}
+
+static void md_http01_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+
+START_TEST(slots_md_http01_set_get)
+{
+    const char *data;
+    int i, freed;
+
+    for (i = 0; i < MD_HTTP01_SLOTS; ++i) {
+        ck_assert_int_eq(md_http01_slots_set(g_slots, host_name(i, g_pool),
+                                             key_authz(i, g_pool), g_pool), APR_SUCCESS);
+    }
+    ck_assert_int_eq(md_http01_slots_set(g_slots, "one.too.many", "token.thumbprint", g_pool),
+                     APR_ENOSPC);
+    ck_assert_int_eq(md_http01_slots_count(g_slots, NULL), MD_HTTP01_SLOTS);
+
+    data = md_http01_slots_get(g_slots, "WWW7.example.org", "token7", g_pool);
+    ck_assert_str_eq(data, "token7.thumbprint");
+    ck_assert(md_http01_slots_get(g_slots, "www7.example.org", "token8", g_pool) == NULL);
+    ck_assert(md_http01_slots_get(g_slots, "www7.example.org", "token", g_pool) == NULL);
+    ck_assert(md_http01_slots_get(g_slots, "one.too.many", "token", g_pool) == NULL);
+
+    /* removing all entries leaves no freed slots behind */
+    for (i = 0; i < MD_HTTP01_SLOTS; ++i) {
+        ck_assert_int_eq(md_http01_slots_set(g_slots, host_name(i, g_pool), NULL, g_pool),
+                         APR_SUCCESS);
+    }
+    ck_assert_int_eq(md_http01_slots_count(g_slots, &freed), 0);
+    ck_assert_int_eq(freed, 0);
+    ck_assert(md_http01_slots_get(g_slots, "www7.example.org", "token7", g_pool) == NULL);
+}
+END_TEST
+
+START_TEST(slots_md_http01_churn)
+{
+    const char *data;
+    int i, j, freed, max_freed = 0;
+
+    /* some challenges stay while many others come and go */
+    for (i = 0; i < 100; ++i) {
+        md_http01_slots_set(g_slots, host_name(i, g_pool), key_authz(i, g_pool), g_pool);
+    }
+    for (i = 100; i < 20000; ++i) {
+        ck_assert_int_eq(md_http01_slots_set(g_slots, host_name(i, g_pool),
+                                             key_authz(i, g_pool), g_pool), APR_SUCCESS);
+        ck_assert_int_eq(md_http01_slots_set(g_slots, host_name(i, g_pool), NULL, g_pool),
+                         APR_SUCCESS);
+        ck_assert_int_eq(md_http01_slots_count(g_slots, &freed), 100);
+        if (freed > max_freed) max_freed = freed;
+    }
+    ck_assert(max_freed <= MD_HTTP01_SLOTS / 4);
+    for (j = 0; j < 100; ++j) {
+        data = md_http01_slots_get(g_slots, host_name(j, g_pool),
+                                   apr_psprintf(g_pool, "token%d", j), g_pool);
+        ck_assert_str_eq(data, key_authz(j, g_pool));
+    }
+}
+END_TEST
+
+TCase *md_http01_test_case(void)
+{
+    TCase *testcase = tcase_create("md_http01");
+
+    tcase_add_checked_fixture(testcase, md_http01_setup, md_http01_teardown);
+
+    tcase_add_test(testcase, slots_md_http01_set_get);
+    tcase_add_test(testcase, slots_md_http01_churn);
+
+    return testcase;
+}
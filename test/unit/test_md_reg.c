@@ -0,0 +1,452 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509v3.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_http.h"
+#include "md_http_replay.h"
+#include "md_json.h"
+#include "md_reg.h"
+#include "md_store.h"
+#include "md_store_fs.h"
+#include "md_time.h"
+#include "md_util.h"
+
+/*
+ * Helpers
+ */
+
+static int in_store(md_store_t *store, const char *name, apr_pool_t *p)
+{
+    md_t *md;
+    return APR_SUCCESS == md_load(store, MD_SG_DOMAINS, name, &md, p);
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static md_store_t *g_store;
+static md_reg_t *g_reg;
+
+static void md_reg_setup(void)
+{
+    const char *tmp;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    ck_assert_int_eq(apr_temp_dir_get(&tmp, g_pool), APR_SUCCESS);
+    g_dir = apr_psprintf(g_pool, "%s/md-unit-reg-%" APR_TIME_T_FMT, tmp, apr_time_now());
+    ck_assert_int_eq(md_store_fs_init(&g_store, g_pool, g_dir), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_create(&g_reg, g_pool, g_store, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+}
+
+static void md_reg_teardown(void)
+{
+    md_util_rm_recursive(g_dir, g_pool, 5);
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+START_TEST(sync_md_reg_renames)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 5, sizeof(md_t*));
+
+    md_save(g_store, g_pool, MD_SG_DOMAINS, make_md(g_pool, "a.org", "www.a.org", NULL), 1);
+    md_save(g_store, g_pool, MD_SG_DOMAINS, make_md(g_pool, "b.org", "www.b.org", NULL), 1);
+    md_save(g_store, g_pool, MD_SG_DOMAINS, make_md(g_pool, "c.org", "*.c.org", NULL), 1);
+    md_save(g_store, g_pool, MD_SG_DOMAINS, make_md(g_pool, "old.org", NULL), 1);
+
+    /* unchanged */
+    APR_ARRAY_PUSH(mds, md_t*) = make_md(g_pool, "a.org", "www.a.org", NULL);
+    /* one name in common */
+    APR_ARRAY_PUSH(mds, md_t*) = make_md(g_pool, "x.b.org", "B.org", NULL);
+    /* covered by a wildcard */
+    APR_ARRAY_PUSH(mds, md_t*) = make_md(g_pool, "shop.c.org", NULL);
+    /* nothing in common */
+    APR_ARRAY_PUSH(mds, md_t*) = make_md(g_pool, "d.org", NULL);
+    ck_assert_int_eq(md_reg_sync_start(g_reg, mds, g_pool), APR_SUCCESS);
+
+    ck_assert(in_store(g_store, "a.org", g_pool));
+    ck_assert(in_store(g_store, "x.b.org", g_pool));
+    ck_assert(!in_store(g_store, "b.org", g_pool));
+    ck_assert(in_store(g_store, "shop.c.org", g_pool));
+    ck_assert(!in_store(g_store, "c.org", g_pool));
+    /* new ones are saved later, in md_reg_sync_finish() */
+    ck_assert(!in_store(g_store, "d.org", g_pool));
+    ck_assert(in_store(g_store, "old.org", g_pool));
+}
+END_TEST
+
+START_TEST(sync_md_reg_closest)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 5, sizeof(md_t*));
+    md_domain_idx_t *idx;
+    md_t *md1, *md2, *md3;
+
+    md1 = make_md(g_pool, "a.org", "b.org", NULL);
+    md2 = make_md(g_pool, "x.org", "a.org", "b.org", "c.org", NULL);
+    md3 = make_md(g_pool, "*.d.org", "c.org", NULL);
+    APR_ARRAY_PUSH(mds, md_t*) = md1;
+    APR_ARRAY_PUSH(mds, md_t*) = md2;
+    APR_ARRAY_PUSH(mds, md_t*) = md3;
+    idx = md_domain_idx_make(g_pool, mds);
+
+    /* the first one having all names */
+    ck_assert(md_domain_idx_get_closest(idx, make_md(g_pool, "B.org", NULL), g_pool) == md1);
+    ck_assert(md_domain_idx_get_closest(idx,
+              make_md(g_pool, "a.org", "c.org", NULL), g_pool) == md2);
+    /* most names in common */
+    ck_assert(md_domain_idx_get_closest(idx,
+              make_md(g_pool, "c.org", "e.d.org", "f.org", NULL), g_pool) == md3);
+    ck_assert(md_domain_idx_get_closest(idx, make_md(g_pool, "f.org", NULL), g_pool) == NULL);
+    md_domain_idx_remove(idx, md1);
+    ck_assert(md_domain_idx_get_closest(idx, make_md(g_pool, "B.org", NULL), g_pool) == md2);
+    md_domain_idx_remove(idx, md2);
+    ck_assert(md_domain_idx_get_closest(idx, make_md(g_pool, "b.org", NULL), g_pool) == NULL);
+}
+END_TEST
+
+/* Not a check of correctness, reports the time md_reg_sync_start() takes on a
+ * store of n MDs, of which 5% are renamed and 5% replaced by new ones in the
+ * configuration. Only run when MD_UNIT_SYNC_SIZES gives the sizes, e.g.
+ * "1000,10000,100000", larger ones need a CK_DEFAULT_TIMEOUT to match. */
+START_TEST(sync_md_reg_bench)
+{
+    const char *sizes = getenv("MD_UNIT_SYNC_SIZES");
+    char *list, *s, *last;
+    apr_pool_t *p;
+    md_store_t *store;
+    md_reg_t *reg;
+    apr_array_header_t *mds;
+    const char *dir;
+    apr_time_t start, t_create, t_sync;
+    int n, i;
+
+    list = apr_pstrdup(g_pool, sizes);
+    for (s = apr_strtok(list, ",", &last); s; s = apr_strtok(NULL, ",", &last)) {
+        if ((n = atoi(s)) <= 0) continue;
+        apr_pool_create(&p, g_pool);
+        dir = apr_psprintf(p, "%s/bench-%d", g_dir, n);
+        ck_assert_int_eq(md_store_fs_init(&store, p, dir), APR_SUCCESS);
+        ck_assert_int_eq(md_reg_create(&reg, p, store, NULL, NULL, 0, 0, 0, 0), APR_SUCCESS);
+
+        start = apr_time_now();
+        mds = apr_array_make(p, n, sizeof(md_t*));
+        for (i = 0; i < n; ++i) {
+            md_save(store, p, MD_SG_DOMAINS, make_md(p,
+                    apr_psprintf(p, "site%d.example.org", i),
+                    apr_psprintf(p, "www.site%d.example.org", i),
+                    apr_psprintf(p, "*.cdn%d.example.org", i), NULL), 1);
+            if (i % 20 == 1) {
+                /* renamed */
+                APR_ARRAY_PUSH(mds, md_t*) = make_md(p,
+                    apr_psprintf(p, "www.site%d.example.org", i),
+                    apr_psprintf(p, "site%d.example.org", i), NULL);
+            }
+            else if (i % 20 == 2) {
+                /* new */
+                APR_ARRAY_PUSH(mds, md_t*) = make_md(p,
+                    apr_psprintf(p, "new%d.example.net", i), NULL);
+            }
+            else {
+                APR_ARRAY_PUSH(mds, md_t*) = make_md(p,
+                    apr_psprintf(p, "site%d.example.org", i),
+                    apr_psprintf(p, "www.site%d.example.org", i),
+                    apr_psprintf(p, "*.cdn%d.example.org", i), NULL);
+            }
+        }
+        t_create = apr_time_now() - start;
+
+        start = apr_time_now();
+        ck_assert_int_eq(md_reg_sync_start(reg, mds, p), APR_SUCCESS);
+        t_sync = apr_time_now() - start;
+        ck_assert(n < 2 || in_store(store, "www.site1.example.org", p));
+
+        fprintf(stderr, "# md_reg_sync_start: %d mds, store created in %ld ms, "
+                "synced in %ld ms\n", n, (long)apr_time_as_msec(t_create),
+                (long)apr_time_as_msec(t_sync));
+        md_util_rm_recursive(dir, p, 5);
+        apr_pool_destroy(p);
+    }
+}
+END_TEST
+
+static void add_ext(X509 *x, int nid, const char *value)
+{
+    X509_EXTENSION *ext;
+    X509V3_CTX ctx;
+
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, x, x, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, (char*)value);
+    ck_assert(ext != NULL);
+    ck_assert(X509_add_ext(x, ext, -1));
+    X509_EXTENSION_free(ext);
+}
+
+/* with_ids adds the key identifiers a CA issued certificate has, needed
+ * for ACME renewal information */
+static md_cert_t *make_cert(md_t *md, md_pkey_spec_t *spec, apr_interval_time_t valid_for,
+                            int with_ids, apr_pool_t *p)
+{
+    md_pkey_t *pkey;
+    md_cert_t *cert;
+    X509 *x;
+
+    ck_assert_int_eq(md_pkey_gen(&pkey, p, spec), APR_SUCCESS);
+    ck_assert_int_eq(md_cert_self_sign(&cert, md->name, md->domains, pkey,
+                                       valid_for, p), APR_SUCCESS);
+    if (with_ids) {
+        x = md_cert_get_X509(cert);
+        add_ext(x, NID_subject_key_identifier, "hash");
+        add_ext(x, NID_authority_key_identifier, "keyid:always");
+        ck_assert(X509_sign(x, md_pkey_get_EVP_PKEY(pkey), EVP_sha256()) > 0);
+    }
+    return cert;
+}
+
+START_TEST(snapshot_md_reg_pubcert)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 1, sizeof(md_t*));
+    apr_array_header_t *chain = apr_array_make(g_pool, 1, sizeof(md_cert_t*));
+    const md_pubcert_t *pub1, *pub2;
+    md_pkey_spec_t *spec;
+    md_reg_t *reg;
+    md_t *md;
+
+    md = make_md(g_pool, "snap.org", "www.snap.org", NULL);
+    md->pks = md_pkeys_spec_make(g_pool);
+    md_pkeys_spec_add_rsa(md->pks, 2048);
+    spec = md_pkeys_spec_get(md->pks, 0);
+    APR_ARRAY_PUSH(mds, md_t*) = md;
+    md_save(g_store, g_pool, MD_SG_DOMAINS, md, 1);
+    APR_ARRAY_PUSH(chain, md_cert_t*) = make_cert(md, spec, apr_time_from_sec(3600), 0, g_pool);
+    ck_assert_int_eq(md_pubcert_save(g_store, g_pool, MD_SG_DOMAINS, md->name, spec, chain, 0),
+                     APR_SUCCESS);
+
+    /* parsed and kept in the snapshot */
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, g_reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert(pub1->certs != NULL);
+    ck_assert_int_eq(md_reg_freeze_domains(g_reg, mds), APR_SUCCESS);
+
+    /* the next start needs no parsing */
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, 0, 0, 0, 0), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub2, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert(pub2->certs == NULL);
+    ck_assert_str_eq(pub2->info->serial, pub1->info->serial);
+    ck_assert_str_eq(pub2->info->sha256_fingerprint, pub1->info->sha256_fingerprint);
+    ck_assert_int_eq(pub2->info->not_before, pub1->info->not_before);
+    ck_assert_int_eq(pub2->info->not_after, pub1->info->not_after);
+    ck_assert_int_eq(pub2->info->ocsp_id->len, pub1->info->ocsp_id->len);
+    ck_assert(!memcmp(pub2->info->ocsp_id->data, pub1->info->ocsp_id->data,
+                      pub1->info->ocsp_id->len));
+    ck_assert_int_eq(pub2->alt_names->nelts, 2);
+    ck_assert(md_is_covered_by_alt_names(md, pub2->alt_names));
+
+    /* a changed file is parsed again */
+    APR_ARRAY_IDX(chain, 0, md_cert_t*) = make_cert(md, spec, apr_time_from_sec(3600), 0, g_pool);
+    ck_assert_int_eq(md_pubcert_save(g_store, g_pool, MD_SG_DOMAINS, md->name, spec, chain, 0),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, 0, 0, 0, 0), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub2, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert(pub2->certs != NULL);
+    ck_assert_str_ne(pub2->info->sha256_fingerprint, pub1->info->sha256_fingerprint);
+}
+END_TEST
+
+static md_json_t *ari_window(apr_time_t start, apr_time_t end, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p);
+
+    md_json_sets(rfc3339(start, p), json, "suggestedWindow", "start", NULL);
+    md_json_sets(rfc3339(end, p), json, "suggestedWindow", "end", NULL);
+    return json;
+}
+
+static md_t *make_ari_md(const char *name, const char *ca_url, apr_pool_t *p)
+{
+    apr_array_header_t *chain = apr_array_make(p, 1, sizeof(md_cert_t*));
+    md_pkey_spec_t *spec;
+    md_t *md;
+
+    md = make_md(p, name, NULL);
+    md->pks = md_pkeys_spec_make(p);
+    md_pkeys_spec_add_rsa(md->pks, 2048);
+    md->ca_urls = apr_array_make(p, 1, sizeof(const char*));
+    APR_ARRAY_PUSH(md->ca_urls, const char*) = ca_url;
+    md_timeslice_create(&md->renew_window, p, MD_TIME_LIFE_NORM, MD_TIME_RENEW_WINDOW_DEF);
+    spec = md_pkeys_spec_get(md->pks, 0);
+    md_save(g_store, p, MD_SG_DOMAINS, md, 1);
+    APR_ARRAY_PUSH(chain, md_cert_t*) = make_cert(md, spec,
+                                                   apr_time_from_sec(90 * MD_SECS_PER_DAY), 1, p);
+    ck_assert_int_eq(md_pubcert_save(g_store, p, MD_SG_DOMAINS, md->name, spec, chain, 0),
+                     APR_SUCCESS);
+    return md;
+}
+
+static md_json_t *ari_load(const char *name)
+{
+    md_json_t *json = NULL;
+
+    ck_assert_int_eq(md_store_load_json(g_store, MD_SG_STAGING, name, MD_FN_RENEWAL_INFO,
+                                        &json, g_pool), APR_SUCCESS);
+    return json;
+}
+
+/* Make the renewal info of the certificate due for an update */
+static void ari_expire(const char *name, const char *cert_id)
+{
+    md_json_t *json = ari_load(name);
+
+    md_json_set_time(apr_time_now() - apr_time_from_sec(1), json,
+                     MD_KEY_CERTS, cert_id, MD_KEY_NEXT_UPDATE, NULL);
+    ck_assert_int_eq(md_store_save_json(g_store, g_pool, MD_SG_STAGING, name,
+                                        MD_FN_RENEWAL_INFO, json, 0), APR_SUCCESS);
+}
+
+START_TEST(ari_md_reg_update)
+{
+    apr_array_header_t *mds = apr_array_make(g_pool, 2, sizeof(md_t*));
+    struct md_http_impl_t *impl;
+    const md_pubcert_t *pub;
+    const char *tpath, *cert_id;
+    md_timeperiod_t window;
+    md_json_t *json;
+    apr_file_t *f;
+    apr_time_t now = apr_time_now(), day = apr_time_from_sec(MD_SECS_PER_DAY), t, next;
+    apr_uint32_t loads, requests;
+    md_t *md, *md2;
+
+    md = make_ari_md("ari.org", "https://ca.test/dir", g_pool);
+    md2 = make_ari_md("no-ari.org", "https://ca2.test/dir", g_pool);
+    APR_ARRAY_PUSH(mds, md_t*) = md;
+    APR_ARRAY_PUSH(mds, md_t*) = md2;
+    ck_assert_int_eq(md_reg_get_pubcert(&pub, g_reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert((cert_id = pub->info->ari_cert_id) != NULL);
+
+    /* a CA with renewal info, answering a wide window, a retry and a new window */
+    tpath = apr_psprintf(g_pool, "%s/ari-trace.json", g_dir);
+    ck_assert_int_eq(apr_file_open(&f, tpath, APR_FOPEN_WRITE|APR_FOPEN_CREATE,
+                                   APR_OS_DEFAULT, g_pool), APR_SUCCESS);
+    trace_add(f, "GET", "https://ca.test/dir", 200, NULL,
+              acme_dir("https://ca.test/ari", g_pool), g_pool);
+    trace_add(f, "GET", "https://ca2.test/dir", 200, NULL, acme_dir(NULL, g_pool), g_pool);
+    trace_add(f, "GET", apr_pstrcat(g_pool, "https://ca.test/ari/", cert_id, NULL), 200, NULL,
+              ari_window(now + day, now + 1000 * day, g_pool), g_pool);
+    trace_add(f, "GET", apr_pstrcat(g_pool, "https://ca.test/ari/", cert_id, NULL), 503, "7200",
+              NULL, g_pool);
+    trace_add(f, "GET", apr_pstrcat(g_pool, "https://ca.test/ari/", cert_id, NULL), 200, NULL,
+              ari_window(now + 2 * day, now + 3 * day, g_pool), g_pool);
+    trace_add(f, "GET", apr_pstrcat(g_pool, "https://ca.test/ari/", cert_id, NULL), 200, NULL,
+              ari_window(now + 80 * day, now + 81 * day, g_pool), g_pool);
+    trace_add(f, "GET", apr_pstrcat(g_pool, "https://ca.test/ari/", cert_id, NULL), 200, NULL,
+              ari_window(now + 100 * day, now + 101 * day, g_pool), g_pool);
+    apr_file_close(f);
+    ck_assert_int_eq(md_http_replay_get_impl(&impl, g_pool, tpath, MD_HTTP_REPLAY_PLAY, NULL),
+                     APR_SUCCESS);
+    md_http_use_implementation(impl);
+
+    /* the time picked is anywhere in the window, not only in its first 2^32 microseconds */
+    ck_assert_int_eq(md_reg_ari_update(g_reg, mds, g_pool), APR_SUCCESS);
+    json = ari_load(md->name);
+    ck_assert_int_eq(md_json_get_timeperiod(&window, json, MD_KEY_CERTS, cert_id,
+                                            MD_KEY_WINDOW, NULL), APR_SUCCESS);
+    t = md_json_get_time(json, MD_KEY_CERTS, cert_id, MD_KEY_RENEW_AT, NULL);
+    ck_assert(t >= window.start && t <= window.end);
+    ck_assert(t > window.start + apr_time_from_sec(2 * 3600));
+    /* a CA without renewal info is not asked again soon */
+    json = ari_load(md2->name);
+    pub = NULL;
+    ck_assert_int_eq(md_reg_get_pubcert(&pub, g_reg, md2, 0, g_pool), APR_SUCCESS);
+    next = md_json_get_time(json, MD_KEY_CERTS, pub->info->ari_cert_id, MD_KEY_NEXT_UPDATE, NULL);
+    ck_assert(next > now + day - apr_time_from_sec(60));
+
+    /* unchanged renewal info is not read again */
+    t = md_reg_renew_at(g_reg, md, g_pool);
+    loads = md_counter_get(MD_CNT_STORE_LOADS);
+    ck_assert_int_eq(md_reg_renew_at(g_reg, md, g_pool), t);
+    ck_assert_int_eq(md_counter_get(MD_CNT_STORE_LOADS), loads);
+
+    /* the CA asks to retry later, the window stays. Its directory is not looked up again. */
+    ari_expire(md->name, cert_id);
+    requests = md_counter_get(MD_CNT_ACME_REQUESTS);
+    ck_assert_int_eq(md_reg_ari_update(g_reg, mds, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_counter_get(MD_CNT_ACME_REQUESTS), requests);
+    json = ari_load(md->name);
+    next = md_json_get_time(json, MD_KEY_CERTS, cert_id, MD_KEY_NEXT_UPDATE, NULL);
+    ck_assert(next > now + apr_time_from_sec(7200 - 60));
+    ck_assert(next < apr_time_now() + apr_time_from_sec(7200 + 60));
+    ck_assert_int_eq(md_reg_renew_at(g_reg, md, g_pool), t);
+
+    /* a new window, the registry no longer has the old one */
+    ari_expire(md->name, cert_id);
+    ck_assert_int_eq(md_reg_ari_update(g_reg, mds, g_pool), APR_SUCCESS);
+    t = md_reg_renew_at(g_reg, md, g_pool);
+    ck_assert(t >= now + 2 * day - apr_time_from_sec(1));
+    ck_assert(t <= now + 3 * day);
+
+    /* a window after the renew window is used as well */
+    ari_expire(md->name, cert_id);
+    ck_assert_int_eq(md_reg_ari_update(g_reg, mds, g_pool), APR_SUCCESS);
+    t = md_reg_renew_at(g_reg, md, g_pool);
+    ck_assert(t >= now + 80 * day - apr_time_from_sec(1));
+    ck_assert(t <= now + 81 * day);
+
+    /* but renewal is never later than the certificate's expiry */
+    ari_expire(md->name, cert_id);
+    ck_assert_int_eq(md_reg_ari_update(g_reg, mds, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub, g_reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_renew_at(g_reg, md, g_pool), pub->info->not_after);
+
+    md_http_use_implementation(NULL);
+}
+END_TEST
+
+TCase *md_reg_test_case(void)
+{
+    TCase *testcase = tcase_create("md_reg");
+
+    tcase_add_checked_fixture(testcase, md_reg_setup, md_reg_teardown);
+    tcase_set_timeout(testcase, 60);
+
+    tcase_add_test(testcase, sync_md_reg_renames);
+    tcase_add_test(testcase, sync_md_reg_closest);
+    tcase_add_test(testcase, snapshot_md_reg_pubcert);
+    tcase_add_test(testcase, ari_md_reg_update);
+    if (getenv("MD_UNIT_SYNC_SIZES")) {
+        tcase_add_test(testcase, sync_md_reg_bench);
+    }
+
+    return testcase;
+}
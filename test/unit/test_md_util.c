@@ -14,6 +14,8 @@
 
 #include <stdlib.h>
 
+#include <apr_tables.h>
+
 #include "test_common.h"
 #include "md_util.h"
 
@@ -99,6 +101,24 @@ START_TEST(base64_md_util_largetrip)
 }
 END_TEST
 
+START_TEST(retry_after_md_util_parse)
+{
+    apr_table_t *headers = apr_table_make(g_pool, 5);
+    apr_time_t now = apr_time_from_sec(1000000000);
+    
+    ck_assert(md_util_retry_after(NULL, now) == 0);
+    ck_assert(md_util_retry_after(headers, now) == 0);
+    apr_table_setn(headers, "Retry-After", "120");
+    ck_assert(md_util_retry_after(headers, now) == now + apr_time_from_sec(120));
+    apr_table_setn(headers, "Retry-After", "Sun, 06 Nov 1994 08:49:37 GMT");
+    ck_assert(md_util_retry_after(headers, now) == apr_time_from_sec(784111777));
+    apr_table_setn(headers, "Retry-After", "12abc");
+    ck_assert(md_util_retry_after(headers, now) == 0);
+    apr_table_setn(headers, "Retry-After", "whenever");
+    ck_assert(md_util_retry_after(headers, now) == 0);
+}
+END_TEST
+
 TCase *md_util_test_case(void)
 {
     TCase *testcase = tcase_create("md_util");
@@ -107,6 +127,7 @@ TCase *md_util_test_case(void)
 
     tcase_add_test(testcase, base64_md_util_roundtrip);
     tcase_add_test(testcase, base64_md_util_largetrip);
+    tcase_add_test(testcase, retry_after_md_util_parse);
 
     return testcase;
 }